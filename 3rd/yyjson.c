@@ -5935,6 +5935,9 @@ static_noinline u8 *write_f64_raw(u8 *buf, u64 raw, yyjson_write_flag flg) {
             /* write with scientific notation */
             /* such as 1.234e56 */
             u8 *end = write_u64_len_15_to_17_trim(buf + 1, sig_dec);
+            /* backported from upstream yyjson (not in 0.4.0), a single
+               significant digit was written as "2.e34", which the reader rejects */
+            end -= (end == buf + 2); /* remove '.0', e.g. 2.0e34 -> 2e34 */
             exp_dec += sig_len - 1;
             hdr[0] = hdr[1];
             hdr[1] = '.';
@@ -6014,6 +6017,12 @@ static_noinline u8 *write_f64_raw(u8 *buf, u64 raw, yyjson_write_flag flg) {
 
 #endif /* FP_WRITER */
 
+/* local addition, not in upstream 0.4.0 */
+char *yyjson_write_f64(double num, char *buf) {
+    return (char *)write_f64_raw((u8 *)buf, f64_to_raw(num),
+                                 YYJSON_WRITE_INF_AND_NAN_AS_NULL);
+}
+
 /** Write a JSON number (requires 32 bytes buffer). */
 static_inline u8 *write_number(u8 *cur, yyjson_val *val,
                                yyjson_write_flag flg) {
@@ -932,6 +932,17 @@ yyjson_api bool yyjson_mut_write_file(const char *path,
                                       const yyjson_alc *alc,
                                       yyjson_write_err *err);
 
+/**
+ Write a double number the way the writer does, shortest digits which read
+ back the same, independent of the C locale. Local addition, not in upstream
+ 0.4.0.
+ 
+ @param num The number, inf and nan are written as null.
+ @param buf The output, at least 32 bytes, not null-terminated.
+ @return    The end of the written number.
+ */
+yyjson_api char *yyjson_write_f64(double num, char *buf);
+
 /**
  Write JSON.
  
@@ -23,17 +23,75 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <math.h>
 #include <stdarg.h>
+#include <limits.h>
 #include <signal.h>
 
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#endif
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#ifndef F_SETPIPE_SZ
+#define F_SETPIPE_SZ 1031
+#define F_GETPIPE_SZ 1032
+#endif
+#endif
+
+#ifdef BECO_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
 #include "3rd/yyjson.h"
 #include "3rd/uthash.h"
 
 #define SIZE_1M 0x100000
+#define FRAME_HEADER sizeof(uint32_t)
+#define BUFFER_MIN_SIZE 0x1000
+#define RECV_KEEP_SIZE 0x10000
+#define RECV_SPIKE_SIZE 0x400000
+#define RECV_IDLE_MS 5000
+#define RECV_PADDING YYJSON_PADDING_SIZE
+#define ARENA_BLOCK_SIZE 0x10000
+#define ARENA_ALIGN 16
+#define RING_SIZE 0x10000
+#define SEND_COALESCE_SIZE 0x10000
+#define LOOP_MAX_EVENTS 16
+#define JSON_WRITER_SIZE 0x1000
+#define PARSE_MIN_SIZE 0x40000
+#define INTERN_MAX_KEY 64
+#define MAP_MIN_SIZE 8
+#define MAP_INDEX_MIN 16
+#define INTERN_MAX_COUNT 4096
+#define CHUNK_MIN_SIZE 0x100
+#define BUILDER_MAX_DEPTH 64
+#define ARRAY_PACK_MIN 16
+#define JSON_NUMS_RUN 0x400
+#define CHUNK_PREFIX "{\"chunk\":{\"id\":%llu,\"seq\":%llu,\"total\":%llu},\"data\":\""
+#define CHUNK_SUFFIX "\"}"
+#define URING_ENTRIES 8
+#define URING_SEND_SIZE 0x10000
+#define URING_OP_READ 1
+#define URING_OP_WRITE 2
+#define URING_OP_CANCEL 3
+#define URING_OP_READ_DIRECT 4
 
 #ifdef _WIN32
 #define strdup(x) _strdup(x)
@@ -42,8 +100,184 @@
 #define SIZE_FMT "%zu"
 #endif
 
+// shared maps and arrays may be retained and released from several threads
+#if defined(BECO_ATOMIC_REFS) && defined(_WIN32)
+#define REFS_ADD(refs, n) (InterlockedExchangeAdd((refs), (n)) + (n))
+#define REFS_LOAD(refs) InterlockedCompareExchange((refs), 0, 0)
+#elif defined(BECO_ATOMIC_REFS)
+#define REFS_ADD(refs, n) __atomic_add_fetch((refs), (n), __ATOMIC_ACQ_REL)
+#define REFS_LOAD(refs) __atomic_load_n((refs), __ATOMIC_ACQUIRE)
+#else
+#define REFS_ADD(refs, n) (*(refs) += (n))
+#define REFS_LOAD(refs) (*(refs))
+#endif
+
 struct BecoMapEntry;
 struct BecoRequestHandler;
+struct BecoRing;
+struct BecoTimer;
+struct BecoWatch;
+struct BecoUring;
+struct JsonWriter;
+struct Chunker;
+
+typedef BecoError (*JsonSinkFunc)(struct JsonWriter *w, const char *data, size_t len);
+
+enum BecoParserState {
+  PARSER_VALUE,
+  PARSER_ARRAY_FIRST,
+  PARSER_ARRAY_NEXT,
+  PARSER_MAP_FIRST,
+  PARSER_MAP_KEY,
+  PARSER_MAP_COLON,
+  PARSER_MAP_NEXT,
+  PARSER_DONE,
+  PARSER_ERROR,
+};
+
+/*
+ * Chunk of arena memory, the usable part starts ARENA_HEADER bytes in.
+ */
+struct BecoArenaBlock {
+  struct BecoArenaBlock *next;
+  size_t size;
+  size_t used;
+};
+
+#define ARENA_ROUND(size) (((size) + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1))
+#define ARENA_HEADER ARENA_ROUND(sizeof(struct BecoArenaBlock))
+
+/*
+ * Deep copy being laid out in one block: the arena, the objects, maps and arrays in the
+ * order they're copied, then the strings from strs on.
+ */
+struct BecoPack {
+  struct BecoArena *arena;
+  char *strs;
+};
+
+/*
+ * Bump-pointer allocator, blocks are chained newest first. Nothing is freed one by one,
+ * a reset keeps the first block for the next round and drops the others.
+ */
+struct BecoArena {
+  struct BecoArenaBlock *head;
+  struct BecoArenaBlock *first;
+  struct BecoInterns *interns; // key table of the context, for maps allocated here
+};
+
+/*
+ * Canonical map keys, the hash handle keeps the hash and length for maps to reuse.
+ * Shared by the context and the arenas of its requests.
+ */
+struct BecoInternKey {
+  UT_hash_handle hh;
+  char key[1];
+};
+
+struct BecoInterns {
+  size_t refs;
+  struct BecoInternKey *keys;
+  uint64_t hits;
+  uint64_t misses;
+};
+
+/*
+ * Receive buffer and arena shared by the context and the requests built from them.
+ * data stays NULL while the context owns the buffer, a read which finds the buffer still
+ * referenced hands it over to the lease, together with the arena and the document lazy
+ * views point into, and starts a new one.
+ */
+struct BecoLease {
+  size_t refs;
+  char *data;
+  struct BecoArena arena;
+  yyjson_doc *doc;
+};
+
+/*
+ * A map or array under construction, elements are collected until it is closed.
+ */
+struct BecoParserFrame {
+  struct BecoObject *obj;
+  struct BecoObject **items;
+  size_t count;
+  size_t cap;
+  char *key;
+};
+
+/*
+ * Resumable JSON parser, fed with a growing prefix of the frame. pos is the next byte
+ * to look at, a number or literal cut by the end of the data is looked at again with the
+ * next feed. Strings are decoded in place from str_start on, str_at is where the next
+ * decoded byte goes, so objects reference the frame instead of copies.
+ */
+struct BecoParser {
+  enum BecoParserState state;
+  bool active;
+  size_t pos;
+  bool in_str;
+  bool str_key;
+  size_t str_start;
+  size_t str_at;
+  struct BecoParserFrame *stack;
+  size_t depth;
+  size_t cap;
+  struct BecoObject *root;
+  struct BecoArena *arena;
+};
+
+/*
+ * Streaming JSON serializer, output is staged in buf and handed to the sink piece by piece,
+ * or written straight into out when there is one.
+ */
+struct JsonWriter {
+  JsonSinkFunc sink;
+  void *data;
+  struct BecoBuffer *out;
+  size_t total;
+  size_t len;
+  BecoError err;
+  char *buf;
+};
+
+/*
+ * A serialized response, data is a complete frame and follows the struct in the same block.
+ */
+struct BecoFrozen {
+  size_t len;
+  char *data;
+};
+
+/*
+ * State of BecoRes*, the response is written into buf behind the frame length slot.
+ */
+struct BecoBuilder {
+  struct BecoBuffer buf;
+  size_t depth;
+  // a key was written, its value comes next
+  bool key;
+  char close[BUILDER_MAX_DEPTH];
+  bool more[BUILDER_MAX_DEPTH];
+};
+
+/*
+ * Splits a JSON text into chunk frames. A dry run only counts the frames, both runs cut
+ * at the same places, so the first one tells the total of the second.
+ */
+struct Chunker {
+  struct BecoContext *ctx;
+  bool dry;
+  uint64_t id;
+  uint64_t seq;
+  uint64_t total;
+  size_t limit;
+  size_t frame_len;
+  bool open;
+  unsigned char pending[4];
+  size_t pending_len;
+  size_t pending_need;
+};
 
 struct BecoRequestHandler {
   char *cmd;
@@ -52,26 +286,312 @@ struct BecoRequestHandler {
   UT_hash_handle hh;
 };
 
+/*
+ * Entries in insertion order with their hashes packed alongside. Small maps are searched by
+ * scanning the hashes, from MAP_INDEX_MIN entries on an open addressing index is kept too.
+ */
 struct BecoMap {
   struct BecoMapEntry *entries;
+  uint32_t *hashes;
+  uint32_t count;
+  uint32_t cap;
+  uint32_t *index; // entry position + 1, 0 for a free slot
+  uint32_t index_mask;
+  long refs;
+  struct BecoArena *arena;
+  yyjson_val *view;
 };
 
 struct BecoMapEntry {
   char *key;
-  struct BecoKV *kv;
-  UT_hash_handle hh;
+  struct BecoObject *value;
+  uint32_t len;
+  uint32_t flags; // BecoObjectFlag of the key
+};
+
+/*
+ * Positions are free running counters, masked by cap - 1 when touching data.
+ * [head, scan) holds complete frames waiting for dispatch, [scan, tail) a partial one.
+ */
+struct BecoRing {
+  char *data;
+  size_t cap;
+  size_t head;
+  size_t scan;
+  size_t tail;
+  size_t queued;
+  // a frame larger than the ring, read into recv_buf
+  size_t large;
+  size_t large_have;
+};
+
+struct BecoTimer {
+  int id;
+  uint64_t deadline;
+  uint32_t interval;
+  BecoEventFunc handler;
+  void *user_data;
+};
+
+struct BecoWatch {
+  int fd;
+  BecoFdFunc handler;
+  void *user_data;
+};
+
+struct BecoEventLoop {
+  int epoll_fd;
+  int wake_fd;
+  struct BecoTimer *timers;
+  size_t timer_count;
+  size_t timer_cap;
+  int timer_id;
+  struct BecoWatch *watches;
+  size_t watch_count;
+  size_t watch_cap;
+  BecoEventFunc wakeup_handler;
+  void *wakeup_data;
+};
+
+#ifdef BECO_HAVE_IO_URING
+/*
+ * The input ring and the send area are registered with the kernel once, a read into the
+ * free part of the input ring is kept queued all the time and the send area leaves with
+ * a single write per flush.
+ */
+struct BecoUring {
+  int fd;
+  unsigned sq_entries;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_map;
+  size_t sq_map_len;
+  void *cq_map;
+  size_t cq_map_len;
+  size_t sqes_len;
+  unsigned to_submit;
+  bool fixed;
+  bool reading;
+  bool writing;
+  bool cancelling;
+  bool large;
+  bool eof;
+  int read_err;
+  int write_res;
+  int cancel_res;
+  size_t direct_done;
+  struct iovec read_iov;
+  struct iovec write_iov;
+  struct BecoRing *ring;
+  char *send;
+  size_t send_len;
 };
+#endif
 
 struct BecoRequestHandler *CreateHandler(const char *cmd, BecoRequestHandlerFunc handler, void *user_data);
 BecoError InvokeHandler(struct BecoContext *ctx, struct BecoRequestHandler *entry, struct BecoRequest *req);
 void FreeHandler(struct BecoRequestHandler *handler);
+uint64_t MonotonicMs();
+uint64_t MonotonicUs();
+void WriteBlocked(struct BecoContext *ctx, uint64_t since);
+int StreamFd(int fd, FILE *file);
+uint64_t PipeQueued(int fd);
+uint64_t PipeSize(int fd);
+void RecvBufferTrim(struct BecoContext *ctx);
+void RecvBufferDetach(struct BecoContext *ctx);
+BecoError RecvPrepare(struct BecoContext *ctx);
+bool RecvStarted(struct BecoContext *ctx);
+void LeaseRelease(struct BecoLease *lease);
+BecoError RecvLease(struct BecoContext *ctx);
+struct BecoArenaBlock *ArenaBlockNew(size_t size);
+void ArenaFree(struct BecoArena *arena, void *ptr);
+void ArenaReset(struct BecoArena *arena);
+void ArenaDestroy(struct BecoArena *arena);
+struct BecoObject *ObjectCopy(struct BecoObject *src, struct BecoArena *arena);
+void ObjectClear(struct BecoObject *obj);
+struct BecoObject *ObjectShare(struct BecoObject *src, struct BecoArena *arena);
+void ObjectShareInto(struct BecoObject *src, struct BecoObject *dst, struct BecoArena *arena);
+struct BecoObject *ObjectPack(struct BecoObject *src);
+void PackMeasure(struct BecoObject *obj, size_t *nodes, size_t *strs);
+void PackCopy(struct BecoPack *pack, struct BecoObject *src, struct BecoObject *dst);
+char *PackStr(struct BecoPack *pack, const char *str, size_t len);
+void PackFree(struct BecoObject *obj);
+void ArrayInit(struct BecoArray *array, size_t from, size_t to);
+struct BecoMapEntry *MapInsert(struct BecoMap *map, char *key, uint32_t flags, struct BecoObject *val);
+struct BecoMapEntry *MapAdd(struct BecoMap *map, char *key, size_t len, unsigned hashv, uint32_t flags,
+                            struct BecoObject *val);
+struct BecoInternKey *MapIntern(struct BecoMap *map, const char *key);
+struct BecoInterns *ContextInterns(struct BecoContext *ctx);
+struct BecoInternKey *InternsGet(struct BecoInterns *interns, const char *key, size_t len);
+void InternsRelease(struct BecoInterns *interns);
+struct BecoMapEntry *MapFind(struct BecoMap *map, const char *key);
+struct BecoMapEntry *MapLookup(struct BecoMap *map, const char *key, size_t len, unsigned hashv);
+BecoError MapReserve(struct BecoMap *map, uint32_t size);
+void MapIndexAdd(struct BecoMap *map, uint32_t pos);
+void MapReindex(struct BecoMap *map);
+void MapMaterialize(struct BecoMap *map);
+void ArrayMaterialize(struct BecoArray *array);
+void ArrayUnpack(struct BecoArray *array);
+enum BecoArrayType ArrayNumType(struct BecoArray *array);
+enum BecoArrayType ViewNumType(yyjson_val *arr);
+bool ArrayPack(struct BecoArray *array, enum BecoArrayType type);
+struct BecoArray *ArrayNewNums(struct BecoArena *arena, enum BecoArrayType type, const void *nums, size_t count);
+void *ObjectNums(struct BecoObject *obj, enum BecoArrayType type, size_t *len);
+BecoError ObjectSetNums(struct BecoArena *arena, struct BecoObject *obj, enum BecoArrayType type, const void *nums,
+                        size_t count);
+struct BecoObject *ViewNew(yyjson_val *val, struct BecoArena *arena);
+void LeaseReset(struct BecoLease *lease);
+BecoError WriteFrame(struct BecoContext *ctx, const char *data, size_t dlen);
+BecoError WriteFramed(struct BecoContext *ctx, struct BecoBuffer *frame);
+BecoError WriteFrameBytes(struct BecoContext *ctx, const char *frame, size_t flen);
+BecoError WriteOut(struct BecoContext *ctx, BecoTransportWriteFunc write, const char *data, size_t len,
+                   size_t dlen);
+BecoError WriteObject(struct BecoContext *ctx, struct BecoObject *res, size_t size);
+BecoError WriteRawFile(FILE *out, const char *data, size_t dlen, bool flush);
+void OutputFlushed(struct BecoContext *ctx);
+BecoError WriteChunked(struct BecoContext *ctx, struct BecoObject *res);
+BecoError WriteChunkedJson(struct BecoContext *ctx, const char *json, size_t len);
+BecoError BuilderNext(struct BecoContext *ctx, bool key, struct BecoBuilder **out, size_t *mark);
+BecoError BuilderDone(struct BecoContext *ctx, struct BecoBuilder *b, size_t mark, BecoError err);
+BecoError BuilderBegin(struct BecoContext *ctx, char open, char close);
+BecoError BuilderValue(struct BecoContext *ctx, const char *json, size_t len);
+BecoError BuilderStr(struct BecoBuilder *b, const char *str, size_t len);
+BecoError BuilderCommit(struct BecoContext *ctx, struct BecoBuilder *b);
+void BuilderUndoKey(struct BecoBuilder *b, size_t mark, bool more);
+void BuilderFree(struct BecoBuilder *b);
+
+void JsonWriterInit(struct JsonWriter *w, JsonSinkFunc sink, void *data, char *stage);
+void JsonWriterInitBuffer(struct JsonWriter *w, struct BecoBuffer *out);
+void JsonWriterPut(struct JsonWriter *w, const char *data, size_t len);
+void JsonWriterStr(struct JsonWriter *w, const char *str, size_t len);
+void JsonWriterObj(struct JsonWriter *w, struct BecoObject *obj);
+BecoError JsonWriterFinish(struct JsonWriter *w);
+void JsonWriterStruct(struct JsonWriter *w, struct BecoStruct *desc, const char *base);
+void StructPrepare(struct BecoStruct *desc);
+struct BecoField *StructField(struct BecoStruct *desc, const char *key, size_t len, const uint32_t *hashv,
+                              size_t *next);
+BecoError StructFromObj(struct BecoObject *obj, struct BecoStruct *desc, char *base);
+BecoError StructFromJson(yyjson_val *val, struct BecoStruct *desc, char *base);
+BecoError FieldFromObj(struct BecoObject *obj, struct BecoField *field, char *base);
+size_t JsonEscape(char *out, const char *str, size_t len);
+size_t JsonEscapedLen(const char *str, size_t len);
+size_t JsonIntLen(int64_t val);
+size_t JsonUintLen(uint64_t val);
+size_t ViewSerializedSize(yyjson_val *val);
+int JsonFormatDouble(char *num, double val);
+size_t JsonFormatInt(char *num, int64_t val);
+size_t JsonFormatUint(char *num, uint64_t val);
+void JsonWriterNums(struct JsonWriter *w, struct BecoArray *array);
+
+BecoError ChunkerSink(struct JsonWriter *w, const char *data, size_t len);
+BecoError ChunkerUnit(struct Chunker *c, const unsigned char *unit, size_t len);
+BecoError ChunkerClose(struct Chunker *c);
+BecoError ChunkerFinish(struct Chunker *c);
+
+BecoError ReadRawFile(struct BecoContext *ctx, FILE *in, struct BecoBuffer *buf);
+void ParseProgress(struct BecoContext *ctx, char *data, size_t have, size_t size);
+struct BecoParser *ParserNew();
+void ParserFree(struct BecoParser *p);
+void ParserReset(struct BecoParser *p);
+void ParserFeed(struct BecoParser *p, char *data, size_t len, bool final);
+void ParserEmit(struct BecoParser *p, struct BecoObject *obj);
+void ParserOpen(struct BecoParser *p, enum BecoValueType type);
+void ParserClose(struct BecoParser *p);
+bool ParserString(struct BecoParser *p, char *data, size_t len);
+void ParserKeep(struct BecoParser *p, char *data, size_t from, size_t to);
+bool ParserNumber(struct BecoParser *p, char *data, size_t len, bool final);
+bool NumberValid(const char *num, size_t len, bool *real);
+bool NumberReal(const char *num, size_t len, double *out);
+bool ParserLiteral(struct BecoParser *p, const char *data, size_t len, bool final);
+bool ParseHex4(const unsigned char *s, uint32_t *out);
+int Utf8Check(const unsigned char *s, size_t avail);
+size_t EncodeUtf8(uint32_t cp, unsigned char *out);
+
+BecoError StdioTransportRead(struct BecoContext *ctx, struct BecoBuffer *buf);
+BecoError StdioTransportWrite(struct BecoContext *ctx, const char *data, size_t dlen);
+BecoError StdioTransportWriteFrame(struct BecoContext *ctx, const char *frame, size_t flen);
+BecoError StdioTransportFlush(struct BecoContext *ctx);
+BecoError FdTransportRead(struct BecoContext *ctx, struct BecoBuffer *buf);
+BecoError FdTransportWrite(struct BecoContext *ctx, const char *data, size_t dlen);
+BecoError FdTransportWriteFrame(struct BecoContext *ctx, const char *frame, size_t flen);
+BecoError FdTransportFlush(struct BecoContext *ctx);
+void FdTransportDestroy(struct BecoContext *ctx);
+bool FdTransportReady(struct BecoContext *ctx);
+bool FdTransportPending(struct BecoContext *ctx);
+
+struct BecoRing *RingNew(size_t cap);
+void RingFree(struct BecoRing *ring);
+void RingCopy(struct BecoRing *ring, size_t pos, char *dst, size_t len);
+BecoError RingFill(struct BecoContext *ctx, struct BecoRing *ring);
+void RingScan(struct BecoContext *ctx, struct BecoRing *ring);
+BecoError RingReadLarge(struct BecoContext *ctx, struct BecoRing *ring, struct BecoBuffer *buf);
+BecoError RingLargeStart(struct BecoContext *ctx, struct BecoRing *ring, uint32_t size, struct BecoBuffer *buf);
+BecoError RingLargeStep(struct BecoContext *ctx, struct BecoRing *ring, struct BecoBuffer *buf, bool block);
+
+#ifdef BECO_HAVE_IO_URING
+BecoError UringTransportRead(struct BecoContext *ctx, struct BecoBuffer *buf);
+BecoError UringTransportWrite(struct BecoContext *ctx, const char *data, size_t dlen);
+BecoError UringTransportWriteFrame(struct BecoContext *ctx, const char *frame, size_t flen);
+BecoError UringTransportFlush(struct BecoContext *ctx);
+void UringTransportDestroy(struct BecoContext *ctx);
+bool UringTransportReady(struct BecoContext *ctx);
+
+struct BecoUring *UringNew();
+void UringFree(struct BecoUring *uring);
+struct io_uring_sqe *UringGetSqe(struct BecoUring *uring);
+BecoError UringSubmit(struct BecoUring *uring, unsigned wait);
+void UringReap(struct BecoContext *ctx, struct BecoUring *uring);
+void UringArmRead(struct BecoContext *ctx, struct BecoUring *uring);
+BecoError UringReadLarge(struct BecoContext *ctx, struct BecoUring *uring, uint32_t size, struct BecoBuffer *buf);
+#endif
+
+void EventLoopFree(struct BecoEventLoop *loop);
+BecoError EventLoopRun(struct BecoContext *ctx, const volatile bool *exit, bool exit_on_fail);
+BecoError EventLoopInput(struct BecoContext *ctx);
+int EventLoopTimeout(struct BecoContext *ctx);
+void EventLoopTimers(struct BecoContext *ctx);
+
+static const struct BecoTransport kStdioTransport = {
+    StdioTransportRead,
+    StdioTransportWrite,
+    StdioTransportFlush,
+    NULL,
+    NULL,
+    StdioTransportWriteFrame,
+};
+
+static const struct BecoTransport kFdTransport = {
+    FdTransportRead,
+    FdTransportWrite,
+    FdTransportFlush,
+    FdTransportDestroy,
+    FdTransportReady,
+    FdTransportWriteFrame,
+};
+
+#ifdef BECO_HAVE_IO_URING
+static const struct BecoTransport kUringTransport = {
+    UringTransportRead,
+    UringTransportWrite,
+    UringTransportFlush,
+    UringTransportDestroy,
+    UringTransportReady,
+    UringTransportWriteFrame,
+};
+#endif
 
-BecoError JsonToObj(yyjson_val *root, struct BecoObject *out);
+// strings are borrowed from the document, which is read in-situ, containers come from arena,
+// lazy ones stay views on the document
+BecoError JsonToObj(yyjson_val *root, struct BecoObject *out, struct BecoArena *arena, bool lazy);
 BecoError JsonToMap(yyjson_val *root, struct BecoMap *out);
 BecoError JsonToArr(yyjson_val *root, struct BecoArray *out);
-BecoError ObjToJson(struct BecoObject *obj, yyjson_mut_doc *doc, yyjson_mut_val **out);
-BecoError MapToJson(struct BecoMap *obj, yyjson_mut_doc *doc, yyjson_mut_val **out);
-BecoError ArrToJson(struct BecoArray *obj, yyjson_mut_doc *doc, yyjson_mut_val **out);
 
 void BecoLog(struct BecoContext *ctx, const char *fmt, ...) {
   if (ctx == NULL || ctx->log == NULL) return;
@@ -113,6 +633,15 @@ struct BecoContext *BecoContextNewWithConf(struct BecoConf *conf) {
     ctx->out = conf->out;
   }
 
+  if (BecoSetTransport(ctx, conf->transport) != BECO_ERR_OK) {
+    BecoLog(ctx, "transport %d is not available!", conf->transport);
+    goto error;
+  }
+
+  if (conf->pipe_size > 0 && BecoSetPipeSize(ctx, conf->pipe_size) != BECO_ERR_OK) {
+    BecoLog(ctx, "pipe size " SIZE_FMT " is not available!", conf->pipe_size);
+  }
+
   if (conf->default_cmd_handler != NULL) {
     default_handler = CreateHandler(NULL, conf->default_cmd_handler, conf->default_user_data);
     ctx->default_cmd_handler = default_handler;
@@ -143,6 +672,14 @@ void BecoContextInit(struct BecoContext *ctx) {
   ctx->in = stdin;
   ctx->out = stdout;
   ctx->log = stderr;
+  ctx->transport = &kStdioTransport;
+  ctx->in_fd = -1;
+  ctx->out_fd = -1;
+  ctx->recv_keep_size = RECV_KEEP_SIZE;
+  ctx->recv_spike_size = RECV_SPIKE_SIZE;
+  ctx->recv_idle_ms = RECV_IDLE_MS;
+  ctx->incremental_parse = false;
+  ctx->incremental_min_size = PARSE_MIN_SIZE;
 }
 
 void BecoSetLog(struct BecoContext *ctx, FILE *file) {
@@ -153,15 +690,230 @@ void BecoSetLog(struct BecoContext *ctx, FILE *file) {
 BecoError BecoSetIn(struct BecoContext *ctx, FILE *in) {
   if (ctx == NULL || in == NULL) return BECO_ERR_NULL;
   ctx->in = in;
+#ifndef _WIN32
+  if (ctx->in_fd != -1) ctx->in_fd = fileno(in);
+#endif
   return BECO_ERR_OK;
 }
 
 BecoError BecoSetOut(struct BecoContext *ctx, FILE *out) {
   if (ctx == NULL || out == NULL) return BECO_ERR_NULL;
   ctx->out = out;
+#ifndef _WIN32
+  if (ctx->out_fd != -1) ctx->out_fd = fileno(out);
+#endif
+  return BECO_ERR_OK;
+}
+
+BecoError BecoSetTransport(struct BecoContext *ctx, enum BecoTransportType type) {
+  if (ctx == NULL) return BECO_ERR_NULL;
+
+  switch (type) {
+    case BECO_TRANSPORT_STDIO: {
+      return BecoSetCustomTransport(ctx, &kStdioTransport, NULL);
+    }
+    case BECO_TRANSPORT_FD: {
+#ifdef _WIN32
+      return BECO_ERR_NO_IMPL;
+#else
+      struct BecoRing *ring = NULL;
+      BecoError err;
+
+      if (ctx->in == NULL || ctx->out == NULL) return BECO_ERR_NULL;
+      if ((ring = RingNew(RING_SIZE)) == NULL) return BECO_ERR_OVERFLOW;
+
+      // anything stdio still holds must go out before we bypass it
+      fflush(ctx->out);
+      ctx->in_fd = fileno(ctx->in);
+      ctx->out_fd = fileno(ctx->out);
+      if ((err = BecoSetCustomTransport(ctx, &kFdTransport, ring)) != BECO_ERR_OK) {
+        RingFree(ring);
+      }
+      return err;
+#endif
+    }
+    case BECO_TRANSPORT_URING: {
+#ifdef BECO_HAVE_IO_URING
+      struct BecoUring *uring = NULL;
+      BecoError err;
+
+      if (ctx->in == NULL || ctx->out == NULL) return BECO_ERR_NULL;
+
+      if ((uring = UringNew()) != NULL) {
+        fflush(ctx->out);
+        ctx->in_fd = fileno(ctx->in);
+        ctx->out_fd = fileno(ctx->out);
+        if ((err = BecoSetCustomTransport(ctx, &kUringTransport, uring)) != BECO_ERR_OK) {
+          UringFree(uring);
+          return err;
+        }
+        // from now on a read is always queued
+        UringArmRead(ctx, uring);
+        return UringSubmit(uring, 0);
+      }
+      BecoLog(ctx, "io_uring is not available, fall back to the fd transport");
+#endif
+      return BecoSetTransport(ctx, BECO_TRANSPORT_FD);
+    }
+    case BECO_TRANSPORT_CUSTOM: {
+      break;
+    }
+  }
+  return BECO_ERR_NO_IMPL;
+}
+
+enum BecoTransportType BecoGetTransport(struct BecoContext *ctx) {
+  if (ctx == NULL || ctx->transport == &kStdioTransport) return BECO_TRANSPORT_STDIO;
+  if (ctx->transport == &kFdTransport) return BECO_TRANSPORT_FD;
+#ifdef BECO_HAVE_IO_URING
+  if (ctx->transport == &kUringTransport) return BECO_TRANSPORT_URING;
+#endif
+  return BECO_TRANSPORT_CUSTOM;
+}
+
+BecoError BecoSetCustomTransport(struct BecoContext *ctx, const struct BecoTransport *transport, void *data) {
+  if (ctx == NULL || transport == NULL) return BECO_ERR_NULL;
+  if (transport->read == NULL || transport->write == NULL) return BECO_ERR_NULL;
+
+  BecoError err = BECO_ERR_OK;
+
+  if (ctx->transport != NULL) {
+    // input already read would be lost with the old transport
+    if ((ctx->transport->ready != NULL && ctx->transport->ready(ctx)) || FdTransportPending(ctx)) {
+      return BECO_ERR_GENERIC;
+    }
+    // coalesced output leaves ahead of anything written through the new one
+    if ((err = BecoFlush(ctx)) != BECO_ERR_OK) return err;
+    if (ctx->transport->destroy != NULL) ctx->transport->destroy(ctx);
+  }
+  ctx->transport = transport;
+  ctx->transport_data = data;
+  return BECO_ERR_OK;
+}
+
+BecoError BecoSetFlushPolicy(struct BecoContext *ctx, enum BecoFlushPolicy policy, size_t max_bytes,
+                             uint32_t max_delay_ms) {
+  if (ctx == NULL) return BECO_ERR_NULL;
+
+  BecoError err = BECO_ERR_OK;
+
+  if (policy == BECO_FLUSH_IMMEDIATE) {
+    err = BecoFlush(ctx);
+  }
+  ctx->flush_policy = policy;
+  ctx->flush_bytes = max_bytes;
+  ctx->flush_delay_ms = max_delay_ms;
+  return err;
+}
+
+BecoError BecoFlush(struct BecoContext *ctx) {
+  if (ctx == NULL || ctx->transport == NULL) return BECO_ERR_NULL;
+
+  BecoError err = BECO_ERR_OK;
+  uint64_t since;
+
+  if (ctx->out_frames_pending == 0) return BECO_ERR_OK;
+
+  if (ctx->transport->flush != NULL) {
+    since = MonotonicUs();
+    err = ctx->transport->flush(ctx);
+    WriteBlocked(ctx, since);
+  }
+  if (err == BECO_ERR_OK) {
+    OutputFlushed(ctx);
+  }
+  return err;
+}
+
+BecoError BecoGetStats(struct BecoContext *ctx, struct BecoStats *stats) {
+  if (ctx == NULL || stats == NULL) return BECO_ERR_NULL;
+
+  int in = StreamFd(ctx->in_fd, ctx->in);
+  int out = StreamFd(ctx->out_fd, ctx->out);
+
+  *stats = ctx->stats;
+  stats->in_queued = PipeQueued(in);
+  stats->out_queued = PipeQueued(out);
+  stats->in_pipe_size = PipeSize(in);
+  stats->out_pipe_size = PipeSize(out);
+  if (ctx->interns != NULL) {
+    stats->intern_hits = ctx->interns->hits;
+    stats->intern_misses = ctx->interns->misses;
+    stats->intern_keys = HASH_COUNT(ctx->interns->keys);
+  }
+  return BECO_ERR_OK;
+}
+
+BecoError BecoSetPipeSize(struct BecoContext *ctx, size_t size) {
+  if (ctx == NULL) return BECO_ERR_NULL;
+#ifdef __linux__
+  BecoError err = BECO_ERR_OK;
+  int fds[2];
+  int i;
+
+  if (size > INT32_MAX) return BECO_ERR_OVERFLOW;
+
+  fds[0] = StreamFd(ctx->in_fd, ctx->in);
+  fds[1] = StreamFd(ctx->out_fd, ctx->out);
+  for (i = 0; i < 2; ++i) {
+    if (fds[i] == -1) continue;
+    // EBADF is not a pipe
+    if (fcntl(fds[i], F_SETPIPE_SZ, (int) size) == -1 && errno != EBADF) {
+      err = BECO_ERR_IO;
+    }
+  }
+  return err;
+#else
+  return BECO_ERR_NO_IMPL;
+#endif
+}
+
+BecoError BecoSetChunking(struct BecoContext *ctx, bool enable, size_t frame_size) {
+  if (ctx == NULL) return BECO_ERR_NULL;
+  if (frame_size > SIZE_1M) return BECO_ERR_OVERFLOW;
+
+  if (frame_size == 0) frame_size = SIZE_1M;
+  if (frame_size < CHUNK_MIN_SIZE) frame_size = CHUNK_MIN_SIZE;
+
+  ctx->chunking = enable;
+  ctx->chunk_size = frame_size;
+  if (!enable) BecoBufferDestroy(&ctx->chunk_buf);
+  return BECO_ERR_OK;
+}
+
+BecoError BecoSetIncrementalParse(struct BecoContext *ctx, bool enable, size_t min_size) {
+  if (ctx == NULL) return BECO_ERR_NULL;
+
+  ctx->incremental_parse = enable;
+  ctx->incremental_min_size = min_size == 0 ? PARSE_MIN_SIZE : min_size;
+  if (!enable) {
+    ParserFree(ctx->parser);
+    ctx->parser = NULL;
+  }
+  return BECO_ERR_OK;
+}
+
+BecoError BecoSetLazyView(struct BecoContext *ctx, bool enable) {
+  if (ctx == NULL) return BECO_ERR_NULL;
+  ctx->lazy_view = enable;
   return BECO_ERR_OK;
 }
 
+const char *BecoIntern(struct BecoContext *ctx, const char *key) {
+  struct BecoInternKey *ik = NULL;
+
+  if (ctx == NULL || key == NULL || ContextInterns(ctx) == NULL) return NULL;
+  ik = InternsGet(ctx->interns, key, strlen(key));
+  return ik != NULL ? ik->key : NULL;
+}
+
+void BecoSetRecvBufferPolicy(struct BecoContext *ctx, size_t keep_size, uint32_t idle_ms, size_t spike_size) {
+  if (ctx == NULL) return;
+  if (keep_size != 0) ctx->recv_keep_size = keep_size;
+  if (idle_ms != 0) ctx->recv_idle_ms = idle_ms;
+  if (spike_size != 0) ctx->recv_spike_size = spike_size;
+}
+
 void BecoContextFree(struct BecoContext *ctx) {
   BecoContextDestroy(ctx);
   free(ctx);
@@ -169,6 +921,9 @@ void BecoContextFree(struct BecoContext *ctx) {
 
 void BecoContextDestroy(struct BecoContext *ctx) {
   if (ctx == NULL) return;
+  BecoFlush(ctx);
+  if (ctx->transport != NULL && ctx->transport->destroy != NULL)
+    ctx->transport->destroy(ctx);
   if (ctx->in != NULL)
     fclose(ctx->in);
   if (ctx->out != NULL)
@@ -183,6 +938,22 @@ void BecoContextDestroy(struct BecoContext *ctx) {
   }
   FreeHandler(ctx->null_cmd_handler);
   FreeHandler(ctx->default_cmd_handler);
+  RecvBufferDetach(ctx);
+  LeaseRelease(ctx->recv_lease);
+  ctx->recv_lease = NULL;
+  InternsRelease(ctx->interns);
+  ctx->interns = NULL;
+  ctx->command_key = NULL;
+  BecoBufferDestroy(&ctx->recv_buf);
+  BecoBufferDestroy(&ctx->send_buf);
+  BecoBufferDestroy(&ctx->frame_buf);
+  BecoBufferDestroy(&ctx->chunk_buf);
+  ParserFree(ctx->parser);
+  ctx->parser = NULL;
+  BuilderFree(ctx->builder);
+  ctx->builder = NULL;
+  EventLoopFree(ctx->loop);
+  ctx->loop = NULL;
 }
 
 void BecoSetNullCmdHandler(struct BecoContext *ctx, BecoRequestHandlerFunc handler, void *user_data) {
@@ -205,8 +976,12 @@ BecoError BecoMainLoop(struct BecoContext *ctx, const volatile bool *exit, bool
   if (ctx == NULL) return BECO_ERR_NULL;
 
   BecoError err = BECO_ERR_OK;
+  if (ctx->loop != NULL) {
+    return EventLoopRun(ctx, exit, exit_on_fail);
+  }
   while (!*exit) {
     err = BecoNext(ctx);
+    if (err == BECO_ERR_EOF) break;
     if (err != BECO_ERR_OK && exit_on_fail) break;
   }
   return BECO_ERR_OK;
@@ -242,6 +1017,7 @@ BecoError BecoNext(struct BecoContext *ctx) {
 
   exit:
   BecoRequestDestroy(&req);
+  RecvBufferTrim(ctx);
   return err;
 }
 
@@ -249,119 +1025,442 @@ BecoError BecoSendResponse(struct BecoContext *ctx, struct BecoObject *res) {
   return BecoWrite(ctx, res);
 }
 
-BecoError BecoRead(struct BecoContext *ctx, struct BecoRequest *req) {
-  if (ctx == NULL || req == NULL) return BECO_ERR_NULL;
+BecoError BecoSendJson(struct BecoContext *ctx, const char *json, size_t len) {
+  if (ctx == NULL || json == NULL || ctx->transport == NULL) return BECO_ERR_NULL;
+  BecoLog(ctx, "Write Response: (" SIZE_FMT ") %.*s\n", len, (int) len, json);
+  return WriteFrame(ctx, json, len);
+}
 
-  BecoError err;
-  char *data = NULL;
-  size_t len = 0;
+BecoError BecoObjectFreeze(struct BecoObject *obj, struct BecoFrozen **out) {
+  if (obj == NULL || out == NULL) return BECO_ERR_NULL;
 
-  struct BecoObject *obj = NULL;
-  const char *cmd_name = NULL;
-  char *fmt_json = NULL;
-  size_t fmt_json_len = 0;
-  yyjson_doc *doc = NULL;
-  yyjson_val *root = NULL;
-  yyjson_val *cmd_obj = NULL;
+  struct BecoFrozen *frozen = NULL;
+  struct BecoBuffer buf;
+  struct JsonWriter w;
+  size_t size = BecoObjectSerializedSize(obj);
+  size_t head = sizeof(*frozen) + FRAME_HEADER;
+  uint32_t len;
+  BecoError err;
 
-  if ((err = BecoReadRaw(ctx->in, &data, &len)) != BECO_ERR_OK) {
-    goto error;
+  if (size > SIZE_1M) return BECO_ERR_OVERFLOW;
+  // the frame is written behind the struct in the block which becomes the result,
+  // growing it reallocates the whole block so the struct is placed only afterwards
+  if ((buf.data = malloc(head + size)) == NULL) return BECO_ERR_OVERFLOW;
+  buf.cap = head + size;
+  buf.len = head;
+  JsonWriterInitBuffer(&w, &buf);
+  JsonWriterObj(&w, obj);
+  err = JsonWriterFinish(&w);
+  if (err == BECO_ERR_OK && buf.len - head > SIZE_1M) err = BECO_ERR_OVERFLOW;
+  if (err != BECO_ERR_OK) {
+    BecoBufferDestroy(&buf);
+    return err;
   }
 
-  // parse content
-  doc = yyjson_read(data, len, YYJSON_READ_NOFLAG);
-  if (doc == NULL) {
-    err = BECO_ERR_INVALID_JSON;
-    goto error;
-  }
+  // a lazy map that repeats a key is sized above what gets written
+  BecoBufferShrink(&buf, buf.len);
+  frozen = (struct BecoFrozen *) buf.data;
+  frozen->len = buf.len - sizeof(*frozen);
+  frozen->data = (char *) (frozen + 1);
+  len = (uint32_t) (frozen->len - FRAME_HEADER);
+  memcpy(frozen->data, &len, sizeof(len));
+  *out = frozen;
+  return BECO_ERR_OK;
+}
 
-  root = yyjson_doc_get_root(doc);
-  if (root == NULL) {
-    err = BECO_ERR_INVALID_JSON;
-    goto error;
-  }
+BecoError BecoSendFrozen(struct BecoContext *ctx, const struct BecoFrozen *frozen) {
+  if (ctx == NULL || frozen == NULL || ctx->transport == NULL) return BECO_ERR_NULL;
+  BecoLog(ctx, "Write Response: (" SIZE_FMT ") %.*s\n", frozen->len - FRAME_HEADER,
+          (int) (frozen->len - FRAME_HEADER), frozen->data + FRAME_HEADER);
+  return WriteFrameBytes(ctx, frozen->data, frozen->len);
+}
 
-  fmt_json = yyjson_write(doc, YYJSON_WRITE_PRETTY, &fmt_json_len);
-  BecoLog(ctx, "Received input: %s\n", fmt_json);
+void BecoFrozenFree(struct BecoFrozen *frozen) {
+  free(frozen);
+}
 
-  // optional command tag
-  cmd_obj = yyjson_obj_get(root, "command");
-  if (cmd_obj != NULL) {
-    cmd_name = yyjson_get_str(cmd_obj);
-  }
+BecoError BecoStructDecode(struct BecoStruct *desc, struct BecoObject *obj, void *out) {
+  if (desc == NULL || obj == NULL || out == NULL) return BECO_ERR_NULL;
+  StructPrepare(desc);
+  return StructFromObj(obj, desc, out);
+}
 
-  obj = BecoObjectNew();
-  // read json to key-value obj
-  if (JsonToObj(root, obj) != BECO_ERR_OK) {
-    goto error;
+BecoError BecoStructDumpJson(struct BecoStruct *desc, const void *data, char **out, size_t *olen) {
+  if (desc == NULL || data == NULL || out == NULL || olen == NULL) return BECO_ERR_NULL;
+
+  struct BecoBuffer buf;
+  struct JsonWriter w;
+  BecoError err;
+
+  StructPrepare(desc);
+  BecoBufferInit(&buf);
+  JsonWriterInitBuffer(&w, &buf);
+  JsonWriterStruct(&w, desc, data);
+  // NUL terminated like BecoObjectDumpJson
+  JsonWriterPut(&w, "", 1);
+  err = JsonWriterFinish(&w);
+  if (err != BECO_ERR_OK) {
+    BecoBufferDestroy(&buf);
+    return err;
   }
+  *out = buf.data;
+  *olen = buf.len - 1;
+  return BECO_ERR_OK;
+}
 
-  if (ctx->log)
-    BecoObjectDumpF(obj, 2, ctx->log);
+BecoError BecoSendStruct(struct BecoContext *ctx, struct BecoStruct *desc, const void *data) {
+  if (ctx == NULL || desc == NULL || data == NULL || ctx->transport == NULL) return BECO_ERR_NULL;
 
-  req->data = obj;
-  if (cmd_name != NULL)
-    req->cmd = strdup(cmd_name);
+  struct BecoBuffer *buf = &ctx->frame_buf;
+  struct JsonWriter w;
+  BecoError err;
 
-  error:
-  if (doc != NULL) yyjson_doc_free(doc);
-  if (fmt_json != NULL) free(fmt_json);
-  return err;
+  StructPrepare(desc);
+  buf->len = FRAME_HEADER;
+  JsonWriterInitBuffer(&w, buf);
+  JsonWriterStruct(&w, desc, data);
+  err = JsonWriterFinish(&w);
+  if (err != BECO_ERR_OK) return err;
+
+  BecoLog(ctx, "Write Response: (" SIZE_FMT ") %.*s\n", buf->len - FRAME_HEADER,
+          (int) (buf->len - FRAME_HEADER), buf->data + FRAME_HEADER);
+  return WriteFramed(ctx, buf);
 }
 
-BecoError BecoWrite(struct BecoContext *ctx, struct BecoObject *res) {
-  if (ctx == NULL || res == NULL || ctx->out == NULL) return BECO_ERR_NULL;
+BecoError BecoResBeginObject(struct BecoContext *ctx) {
+  return BuilderBegin(ctx, '{', '}');
+}
 
-  char *out = NULL;
-  size_t len = 0;
-  BecoError err = BECO_ERR_OK;
+BecoError BecoResBeginArray(struct BecoContext *ctx) {
+  return BuilderBegin(ctx, '[', ']');
+}
 
-  if ((err = BecoObjectDumpJson(res, &out, &len)) != BECO_ERR_OK) {
-    goto error;
-  }
+BecoError BecoResEnd(struct BecoContext *ctx) {
+  if (ctx == NULL) return BECO_ERR_NULL;
 
-  BecoLog(ctx, "Write Response: (%d) %s\n", len, out);
+  struct BecoBuilder *b = ctx->builder;
+  BecoError err;
 
-  if ((err = BecoWriteRaw(ctx->out, out, len)) != BECO_ERR_OK) {
-    goto error;
+  if (b == NULL || b->depth == 0 || b->key) return BECO_ERR_INVALID_JSON;
+  if ((err = BecoBufferAppend(&b->buf, &b->close[b->depth - 1], 1)) != BECO_ERR_OK) {
+    return err;
   }
+  b->depth--;
+  if (b->depth > 0) return BECO_ERR_OK;
+  return BuilderCommit(ctx, b);
+}
 
-  error:
-  return err;
+void BecoResAbort(struct BecoContext *ctx) {
+  if (ctx == NULL || ctx->builder == NULL) return;
+  ctx->builder->depth = 0;
+  ctx->builder->key = false;
+  ctx->builder->buf.len = 0;
 }
 
-BecoError BecoReadRaw(FILE *in, char **out, size_t *olen) {
-  if (in == NULL || out == NULL || olen == NULL) return BECO_ERR_NULL;
+BecoError BecoResKey(struct BecoContext *ctx, const char *key, size_t len) {
+  if (key == NULL) return BECO_ERR_NULL;
 
-  BecoError err = BECO_ERR_OK;
+  struct BecoBuilder *b = NULL;
+  size_t mark = 0;
+  BecoError err;
+
+  if ((err = BuilderNext(ctx, true, &b, &mark)) != BECO_ERR_OK) {
+    return err;
+  }
+  if ((err = BuilderStr(b, key, len)) == BECO_ERR_OK) {
+    err = BecoBufferAppend(&b->buf, ":", 1);
+  }
+  if (err != BECO_ERR_OK) {
+    b->buf.len = mark;
+    return err;
+  }
+  b->more[b->depth - 1] = true;
+  b->key = true;
+  return BECO_ERR_OK;
+}
+
+BecoError BecoResKeyStr(struct BecoContext *ctx, const char *key, const char *str) {
+  if (ctx == NULL || key == NULL) return BECO_ERR_NULL;
+
+  struct BecoBuilder *b = ctx->builder;
+  size_t mark;
+  bool more;
+  BecoError err;
+
+  if (b == NULL || b->depth == 0) return BECO_ERR_INVALID_JSON;
+  mark = b->buf.len;
+  more = b->more[b->depth - 1];
+  if ((err = BecoResKey(ctx, key, strlen(key))) != BECO_ERR_OK) return err;
+  if ((err = BecoResStr(ctx, str, str != NULL ? strlen(str) : 0)) != BECO_ERR_OK) {
+    BuilderUndoKey(b, mark, more);
+  }
+  return err;
+}
+
+BecoError BecoResKeyInt(struct BecoContext *ctx, const char *key, int64_t val) {
+  if (ctx == NULL || key == NULL) return BECO_ERR_NULL;
+
+  struct BecoBuilder *b = ctx->builder;
+  size_t mark;
+  bool more;
+  BecoError err;
+
+  if (b == NULL || b->depth == 0) return BECO_ERR_INVALID_JSON;
+  mark = b->buf.len;
+  more = b->more[b->depth - 1];
+  if ((err = BecoResKey(ctx, key, strlen(key))) != BECO_ERR_OK) return err;
+  if ((err = BecoResInt(ctx, val)) != BECO_ERR_OK) {
+    BuilderUndoKey(b, mark, more);
+  }
+  return err;
+}
+
+BecoError BecoResNull(struct BecoContext *ctx) {
+  return BuilderValue(ctx, "null", 4);
+}
+
+BecoError BecoResBool(struct BecoContext *ctx, bool val) {
+  return val ? BuilderValue(ctx, "true", 4) : BuilderValue(ctx, "false", 5);
+}
+
+BecoError BecoResInt(struct BecoContext *ctx, int64_t val) {
+  char num[32];
+  return BuilderValue(ctx, num, JsonFormatInt(num, val));
+}
+
+BecoError BecoResUint(struct BecoContext *ctx, uint64_t val) {
+  char num[32];
+  return BuilderValue(ctx, num, JsonFormatUint(num, val));
+}
+
+BecoError BecoResDouble(struct BecoContext *ctx, double val) {
+  char num[32];
+  int n = JsonFormatDouble(num, val);
+  return BuilderValue(ctx, num, (size_t) n);
+}
+
+BecoError BecoResStr(struct BecoContext *ctx, const char *str, size_t len) {
+  struct BecoBuilder *b = NULL;
+  size_t mark = 0;
+  BecoError err;
+
+  if (str == NULL) return BecoResNull(ctx);
+  if ((err = BuilderNext(ctx, false, &b, &mark)) != BECO_ERR_OK) {
+    return err;
+  }
+  return BuilderDone(ctx, b, mark, BuilderStr(b, str, len));
+}
+
+BecoError BecoResObject(struct BecoContext *ctx, struct BecoObject *obj) {
+  struct BecoBuilder *b = NULL;
+  struct JsonWriter w;
+  size_t mark = 0;
+  BecoError err;
+
+  if ((err = BuilderNext(ctx, false, &b, &mark)) != BECO_ERR_OK) {
+    return err;
+  }
+  JsonWriterInitBuffer(&w, &b->buf);
+  JsonWriterObj(&w, obj);
+  err = JsonWriterFinish(&w);
+  return BuilderDone(ctx, b, mark, err);
+}
+
+BecoError BecoRead(struct BecoContext *ctx, struct BecoRequest *req) {
+  if (ctx == NULL || req == NULL) return BECO_ERR_NULL;
+
+  BecoError err;
+
+  struct BecoObject *obj = NULL;
+  const char *cmd_name = NULL;
+  char *fmt_json = NULL;
+  size_t fmt_json_len = 0;
+  yyjson_doc *doc = NULL;
+  yyjson_val *root = NULL;
+  yyjson_val *cmd_obj = NULL;
+  struct BecoObject *cmd_val = NULL;
+  uint64_t since;
+
+  // about to wait for input, nothing may stay pending
+  if (ctx->transport->ready == NULL || !ctx->transport->ready(ctx)) {
+    if ((err = BecoFlush(ctx)) != BECO_ERR_OK) {
+      goto error;
+    }
+  }
+
+  // the event loop may have started this frame already
+  if (!RecvStarted(ctx) && (err = RecvPrepare(ctx)) != BECO_ERR_OK) {
+    goto error;
+  }
+
+  since = MonotonicUs();
+  err = ctx->transport->read(ctx, &ctx->recv_buf);
+  ctx->stats.read_wait_us += MonotonicUs() - since;
+  if (err != BECO_ERR_OK) {
+    goto error;
+  }
+  if (ctx->recv_buf.len > ctx->recv_keep_size) {
+    ctx->recv_spike_at = MonotonicMs();
+  }
+
+  // parsed while it arrived, the frame is rewritten by then so there is no second try,
+  // the parser accepts what yyjson accepts
+  if (ctx->parser != NULL && ctx->parser->active) {
+    ParserFeed(ctx->parser, ctx->recv_buf.data, ctx->recv_buf.len, true);
+    if (ctx->parser->state == PARSER_DONE) {
+      obj = ctx->parser->root;
+      ctx->parser->root = NULL;
+    }
+    ParserReset(ctx->parser);
+    if (obj == NULL) {
+      err = BECO_ERR_INVALID_JSON;
+      goto error;
+    }
+  }
+  if (obj != NULL) {
+    BecoLog(ctx, "Received input: (" SIZE_FMT ") parsed incrementally\n", ctx->recv_buf.len);
+    if (obj->type == BECO_VALUE_TYPE_MAP) {
+      cmd_val = ctx->command_key != NULL ? BecoMapGetInterned(obj->via.map, ctx->command_key)
+                                         : BecoMapGet(obj->via.map, "command");
+    }
+    if (cmd_val != NULL && cmd_val->type == BECO_VALUE_TYPE_STR) {
+      cmd_name = BecoObjectGetStr(cmd_val);
+    }
+    goto done;
+  }
+
+  // parse content in place, the transports leave room for the padding
+  if ((err = BecoBufferReserve(&ctx->recv_buf, ctx->recv_buf.len + RECV_PADDING)) != BECO_ERR_OK) {
+    goto error;
+  }
+  memset(ctx->recv_buf.data + ctx->recv_buf.len, 0, RECV_PADDING);
+  doc = yyjson_read_opts(ctx->recv_buf.data, ctx->recv_buf.len, YYJSON_READ_INSITU, NULL, NULL);
+  if (doc == NULL) {
+    err = BECO_ERR_INVALID_JSON;
+    goto error;
+  }
+
+  root = yyjson_doc_get_root(doc);
+  if (root == NULL) {
+    err = BECO_ERR_INVALID_JSON;
+    goto error;
+  }
+
+  if (ctx->log != NULL) {
+    fmt_json = yyjson_write(doc, YYJSON_WRITE_PRETTY, &fmt_json_len);
+    BecoLog(ctx, "Received input: %s\n", fmt_json);
+  }
+
+  // optional command tag
+  cmd_obj = yyjson_obj_get(root, "command");
+  if (cmd_obj != NULL) {
+    cmd_name = yyjson_get_str(cmd_obj);
+  }
+
+  obj = BecoObjectNewIn(&ctx->recv_lease->arena);
+  // read json to key-value obj
+  if (JsonToObj(root, obj, &ctx->recv_lease->arena, ctx->lazy_view) != BECO_ERR_OK) {
+    goto error;
+  }
+  if (ctx->lazy_view) {
+    ctx->recv_lease->doc = doc;
+    doc = NULL;
+  }
+
+  done:
+  // dumping would convert a lazy view as a whole
+  if (ctx->log != NULL && !ctx->lazy_view)
+    BecoObjectDumpF(obj, 2, ctx->log);
+
+  req->data = obj;
+  if (cmd_name != NULL)
+    req->cmd = strdup(cmd_name);
+
+  // obj lives in the arena and its strings point into the receive buffer
+  ctx->recv_lease->refs++;
+  req->lease = ctx->recv_lease;
+
+  error:
+  if (doc != NULL) yyjson_doc_free(doc);
+  if (fmt_json != NULL) free(fmt_json);
+  return err;
+}
+
+BecoError BecoWrite(struct BecoContext *ctx, struct BecoObject *res) {
+  if (ctx == NULL || res == NULL || ctx->transport == NULL) return BECO_ERR_NULL;
+
+  // sized up front, an oversized response fails before any serialization work
+  size_t size = BecoObjectSerializedSize(res);
+  if (size <= SIZE_1M) {
+    return WriteObject(ctx, res, size);
+  }
+  if (ctx->chunking) {
+    return WriteChunked(ctx, res);
+  }
+  return BECO_ERR_OVERFLOW;
+}
+
+BecoError BecoReadRaw(FILE *in, char **out, size_t *olen) {
+  if (in == NULL || out == NULL || olen == NULL) return BECO_ERR_NULL;
+
+  BecoError err = BECO_ERR_OK;
+  struct BecoBuffer buf;
+
+  BecoBufferInit(&buf);
+  if ((err = BecoReadRawBuf(in, &buf)) != BECO_ERR_OK) {
+    BecoBufferDestroy(&buf);
+    return err;
+  }
+
+  *out = buf.data;
+  *olen = buf.len;
+  return err;
+}
+
+BecoError BecoReadRawBuf(FILE *in, struct BecoBuffer *buf) {
+  return ReadRawFile(NULL, in, buf);
+}
+
+BecoError ReadRawFile(struct BecoContext *ctx, FILE *in, struct BecoBuffer *buf) {
+  if (in == NULL || buf == NULL) return BECO_ERR_NULL;
+
+  BecoError err = BECO_ERR_OK;
   size_t read = 0;
+  size_t have = 0;
+  size_t step = 0;
   uint32_t size = 0;
-  char *buf = NULL;
 
+  buf->len = 0;
   read = fread(&size, sizeof(size), 1, in);
   if (read != 1) {
-    err = BECO_ERR_IO;
-    goto error;
+    return feof(in) ? BECO_ERR_EOF : BECO_ERR_IO;
   }
 
-  buf = malloc(sizeof(char) * size);
-  read = fread(buf, sizeof(*buf), size, in);
-  if (read != size) {
-    err = BECO_ERR_IO;
-    goto error;
+  if ((err = BecoBufferReserve(buf, (size_t) size + RECV_PADDING)) != BECO_ERR_OK) {
+    return err;
   }
 
-  error:
-  if (err != BECO_ERR_OK) {
-    free(buf);
-  } else {
-    *out = buf;
-    *olen = size;
+  // a context gets to see the frame in slices, one parse step per slice
+  step = ctx != NULL ? RING_SIZE : size;
+  while (have < size) {
+    if (step > size - have) step = size - have;
+    read = fread(buf->data + have, sizeof(*buf->data), step, in);
+    have += read;
+    if (read != step) {
+      return BECO_ERR_IO;
+    }
+    if (ctx != NULL) ParseProgress(ctx, buf->data, have, size);
   }
+
+  buf->len = size;
   return err;
 }
 
 BecoError BecoWriteRaw(FILE *out, const char *data, size_t dlen) {
+  return WriteRawFile(out, data, dlen, true);
+}
+
+BecoError WriteRawFile(FILE *out, const char *data, size_t dlen, bool flush) {
   if (out == NULL || data == NULL) return BECO_ERR_NULL;
 
   BecoError err = BECO_ERR_OK;
@@ -386,7 +1485,7 @@ BecoError BecoWriteRaw(FILE *out, const char *data, size_t dlen) {
     goto error;
   }
 
-  if (fflush(out) != 0) {
+  if (flush && fflush(out) != 0) {
     err = BECO_ERR_IO;
     goto error;
   }
@@ -395,100 +1494,1368 @@ BecoError BecoWriteRaw(FILE *out, const char *data, size_t dlen) {
   return err;
 }
 
-BecoError BecoRegisterCommand(struct BecoContext *ctx,
-                              const char *cmd,
-                              BecoRequestHandlerFunc handler,
-                              void *user_data) {
-  if (ctx == NULL || handler == NULL) return BECO_ERR_NULL;
-
-  struct BecoRequestHandler *entry = NULL;
-
-  entry = CreateHandler(cmd, handler, user_data);
-  HASH_ADD_STR(ctx->handler_entries, cmd, entry);
-
-  return BECO_ERR_OK;
+#ifndef _WIN32
+static BecoError ReadFull(int fd, char *data, size_t len, size_t *olen) {
+  ssize_t n;
+  size_t done = 0;
+  struct pollfd pfd;
+
+  while (done < len) {
+    n = read(fd, data + done, len - done);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        poll(&pfd, 1, -1);
+        continue;
+      }
+      break;
+    }
+    if (n == 0) break;
+    done += (size_t) n;
+  }
+  *olen = done;
+  return done == len ? BECO_ERR_OK : BECO_ERR_IO;
 }
 
-BecoError BecoRemoveCommand(struct BecoContext *ctx, const char *cmd) {
-  if (ctx == NULL) return BECO_ERR_NULL;
-
-  struct BecoRequestHandler *out = NULL;
-  HASH_FIND_STR(ctx->handler_entries, cmd, out);
-  if (out != NULL) {
-    HASH_DEL(ctx->handler_entries, out);
-    free(out->cmd);
-    free(out);
+static BecoError WriteFullv(int fd, struct iovec *iov, int cnt) {
+  ssize_t n;
+  struct pollfd pfd;
+
+  while (cnt > 0) {
+    n = writev(fd, iov, cnt);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        pfd.fd = fd;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        poll(&pfd, 1, -1);
+        continue;
+      }
+      return BECO_ERR_IO;
+    }
+    // skip what has been written, resume in the middle of a partially written vector
+    while (cnt > 0 && (size_t) n >= iov->iov_len) {
+      n -= (ssize_t) iov->iov_len;
+      iov++;
+      cnt--;
+    }
+    if (cnt > 0) {
+      iov->iov_base = (char *) iov->iov_base + n;
+      iov->iov_len -= (size_t) n;
+    }
   }
   return BECO_ERR_OK;
 }
+#endif
 
-struct BecoRequestHandler *BecoFindRequestHandler(struct BecoContext *ctx, const char *cmd) {
-  if (ctx == NULL || cmd == NULL) return NULL;
+BecoError BecoReadRawFd(int fd, struct BecoBuffer *buf) {
+  if (fd < 0 || buf == NULL) return BECO_ERR_NULL;
+#ifdef _WIN32
+  return BECO_ERR_NO_IMPL;
+#else
+  BecoError err = BECO_ERR_OK;
+  uint32_t size = 0;
+  size_t read = 0;
 
-  struct BecoRequestHandler *out = NULL;
-  HASH_FIND_STR(ctx->handler_entries, cmd, out);
-  if (out != NULL) return out;
-  return NULL;
-}
+  buf->len = 0;
+  if (ReadFull(fd, (char *) &size, sizeof(size), &read) != BECO_ERR_OK) {
+    return read == 0 ? BECO_ERR_EOF : BECO_ERR_IO;
+  }
 
-struct BecoRequest *BecoRequestNew() {
-  struct BecoRequest *request = NULL;
-  request = malloc(sizeof(*request));
-  memset(request, 0, sizeof(*request));
-  return request;
-}
+  if ((err = BecoBufferReserve(buf, (size_t) size + RECV_PADDING)) != BECO_ERR_OK) {
+    return err;
+  }
 
-const char *BecoRequestGetCommand(struct BecoRequest *request) {
-  if (request == NULL) return NULL;
-  return request->cmd;
-}
+  if ((err = ReadFull(fd, buf->data, size, &read)) != BECO_ERR_OK) {
+    return err;
+  }
 
-void BecoRequestSetData(struct BecoRequest *request, struct BecoObject *obj) {
-  if (request == NULL) return;
-  request->data = obj;
+  buf->len = size;
+  return err;
+#endif
 }
 
-void BecoRequestSetCommand(struct BecoRequest *request, const char *command) {
-  if (request == NULL) return;
-  request->cmd = strdup(command);
-}
+BecoError BecoWriteRawFd(int fd, const char *data, size_t dlen) {
+  if (fd < 0 || data == NULL) return BECO_ERR_NULL;
+#ifdef _WIN32
+  return BECO_ERR_NO_IMPL;
+#else
+  uint32_t len = 0;
+  struct iovec iov[2];
 
-void BecoRequestInit(struct BecoRequest *req) {
-  if (req == NULL) return;
-  memset(req, 0, sizeof(*req));
-}
+  if (dlen > SIZE_1M) {
+    return BECO_ERR_OVERFLOW;
+  }
 
-void BecoRequestDestroy(struct BecoRequest *req) {
-  if (req == NULL) return;
-  free(req->cmd);
-  BecoObjectFree(req->data);
-}
+  len = (uint32_t) dlen;
+  iov[0].iov_base = &len;
+  iov[0].iov_len = sizeof(len);
+  iov[1].iov_base = (void *) data;
+  iov[1].iov_len = dlen;
 
-void BecoRequestFree(struct BecoRequest *req) {
-  BecoRequestDestroy(req);
-  free(req);
+  return WriteFullv(fd, iov, 2);
+#endif
 }
 
-struct BecoObject *BecoObjectNew() {
-  struct BecoObject *obj = NULL;
-  obj = malloc(sizeof(*obj));
-  memset(obj, 0, sizeof(*obj));
-  return obj;
+BecoError StdioTransportRead(struct BecoContext *ctx, struct BecoBuffer *buf) {
+  BecoError err;
+
+  if ((err = ReadRawFile(ctx, ctx->in, buf)) == BECO_ERR_OK) {
+    ctx->stats.reads++;
+    ctx->stats.frames_read++;
+    if (ctx->stats.max_frames_per_read == 0) ctx->stats.max_frames_per_read = 1;
+  }
+  return err;
 }
 
-enum BecoValueType BecoObjectGetType(struct BecoObject *obj) {
-  if (obj == NULL) return BECO_VALUE_TYPE_NONE;
-  return obj->type;
+BecoError StdioTransportWrite(struct BecoContext *ctx, const char *data, size_t dlen) {
+  return WriteRawFile(ctx->out, data, dlen, false);
 }
 
-int64_t BecoObjectGetInt64(struct BecoObject *obj) {
-  if (obj == NULL) return 0;
-  return obj->via.i64;
+BecoError StdioTransportWriteFrame(struct BecoContext *ctx, const char *frame, size_t flen) {
+  if (ctx->out == NULL) return BECO_ERR_NULL;
+  return fwrite(frame, 1, flen, ctx->out) == flen ? BECO_ERR_OK : BECO_ERR_IO;
 }
 
-uint64_t BecoObjectGetUInt64(struct BecoObject *obj) {
-  if (obj == NULL) return 0;
-  return obj->via.u64;
+BecoError StdioTransportFlush(struct BecoContext *ctx) {
+  if (ctx->out == NULL) return BECO_ERR_NULL;
+  return fflush(ctx->out) == 0 ? BECO_ERR_OK : BECO_ERR_IO;
+}
+
+BecoError FdTransportRead(struct BecoContext *ctx, struct BecoBuffer *buf) {
+  struct BecoRing *ring = ctx->transport_data;
+  BecoError err = BECO_ERR_OK;
+  uint32_t size = 0;
+
+  if (ring == NULL) return BecoReadRawFd(ctx->in_fd, buf);
+
+  if (ring->large != 0) return RingReadLarge(ctx, ring, buf);
+
+  while (ring->queued == 0) {
+    // a frame which never fits into the ring is finished by reading straight into the buffer
+    if (ring->tail - ring->scan >= sizeof(size)) {
+      RingCopy(ring, ring->scan, (char *) &size, sizeof(size));
+      if (size > ring->cap - sizeof(size)) {
+        if ((err = RingLargeStart(ctx, ring, size, buf)) != BECO_ERR_OK) return err;
+        return RingReadLarge(ctx, ring, buf);
+      }
+    }
+    if ((err = RingFill(ctx, ring)) != BECO_ERR_OK) {
+      return err;
+    }
+    RingScan(ctx, ring);
+  }
+
+  RingCopy(ring, ring->head, (char *) &size, sizeof(size));
+  if ((err = BecoBufferReserve(buf, (size_t) size + RECV_PADDING)) != BECO_ERR_OK) {
+    return err;
+  }
+  RingCopy(ring, ring->head + sizeof(size), buf->data, size);
+  buf->len = size;
+
+  ring->head += sizeof(size) + size;
+  ring->queued--;
+  return err;
+}
+
+BecoError FdTransportWrite(struct BecoContext *ctx, const char *data, size_t dlen) {
+#ifdef _WIN32
+  return BECO_ERR_NO_IMPL;
+#else
+  struct BecoBuffer *buf = &ctx->send_buf;
+  BecoError err = BECO_ERR_OK;
+  struct iovec iov[3];
+  uint32_t len = 0;
+
+  if (ctx->flush_policy == BECO_FLUSH_IMMEDIATE) {
+    return BecoWriteRawFd(ctx->out_fd, data, dlen);
+  }
+  if (dlen > SIZE_1M) {
+    return BECO_ERR_OVERFLOW;
+  }
+
+  len = (uint32_t) dlen;
+  if (buf->len + sizeof(len) + dlen <= SEND_COALESCE_SIZE) {
+    if ((err = BecoBufferReserve(buf, buf->len + sizeof(len) + dlen)) != BECO_ERR_OK) {
+      return err;
+    }
+    memcpy(buf->data + buf->len, &len, sizeof(len));
+    memcpy(buf->data + buf->len + sizeof(len), data, dlen);
+    buf->len += sizeof(len) + dlen;
+    return err;
+  }
+
+  // too large to coalesce, pending output, header and payload leave with one writev
+  iov[0].iov_base = buf->data;
+  iov[0].iov_len = buf->len;
+  iov[1].iov_base = &len;
+  iov[1].iov_len = sizeof(len);
+  iov[2].iov_base = (void *) data;
+  iov[2].iov_len = dlen;
+
+  if ((err = WriteFullv(ctx->out_fd, buf->len > 0 ? iov : iov + 1, buf->len > 0 ? 3 : 2)) != BECO_ERR_OK) {
+    return err;
+  }
+  buf->len = 0;
+  OutputFlushed(ctx);
+  return err;
+#endif
+}
+
+BecoError FdTransportWriteFrame(struct BecoContext *ctx, const char *frame, size_t flen) {
+#ifdef _WIN32
+  return BECO_ERR_NO_IMPL;
+#else
+  struct BecoBuffer *buf = &ctx->send_buf;
+  BecoError err = BECO_ERR_OK;
+  struct iovec iov[2];
+
+  if (ctx->flush_policy != BECO_FLUSH_IMMEDIATE && buf->len + flen <= SEND_COALESCE_SIZE) {
+    return BecoBufferAppend(buf, frame, flen);
+  }
+
+  iov[0].iov_base = buf->data;
+  iov[0].iov_len = buf->len;
+  iov[1].iov_base = (void *) frame;
+  iov[1].iov_len = flen;
+
+  if ((err = WriteFullv(ctx->out_fd, buf->len > 0 ? iov : iov + 1, buf->len > 0 ? 2 : 1)) != BECO_ERR_OK) {
+    return err;
+  }
+  buf->len = 0;
+  OutputFlushed(ctx);
+  return err;
+#endif
+}
+
+BecoError FdTransportFlush(struct BecoContext *ctx) {
+#ifdef _WIN32
+  return BECO_ERR_NO_IMPL;
+#else
+  struct BecoBuffer *buf = &ctx->send_buf;
+  BecoError err = BECO_ERR_OK;
+  struct iovec iov;
+
+  if (buf->len == 0) return BECO_ERR_OK;
+
+  iov.iov_base = buf->data;
+  iov.iov_len = buf->len;
+  if ((err = WriteFullv(ctx->out_fd, &iov, 1)) == BECO_ERR_OK) {
+    buf->len = 0;
+  }
+  return err;
+#endif
+}
+
+bool FdTransportReady(struct BecoContext *ctx) {
+  struct BecoRing *ring = ctx->transport_data;
+  return ring != NULL && (ring->queued > 0 || (ring->large != 0 && ring->large_have == ring->large));
+}
+
+// bytes of frames not handed out yet
+bool FdTransportPending(struct BecoContext *ctx) {
+  struct BecoRing *ring = ctx->transport_data;
+  return ctx->transport == &kFdTransport && ring != NULL && (ring->tail != ring->head || ring->large != 0);
+}
+
+void FdTransportDestroy(struct BecoContext *ctx) {
+  RingFree(ctx->transport_data);
+  ctx->transport_data = NULL;
+}
+
+struct BecoRing *RingNew(size_t cap) {
+  struct BecoRing *ring = NULL;
+
+  ring = malloc(sizeof(*ring));
+  if (ring == NULL) return NULL;
+  memset(ring, 0, sizeof(*ring));
+
+  ring->data = malloc(cap);
+  if (ring->data == NULL) {
+    free(ring);
+    return NULL;
+  }
+  ring->cap = cap;
+  return ring;
+}
+
+void RingFree(struct BecoRing *ring) {
+  if (ring == NULL) return;
+  free(ring->data);
+  free(ring);
+}
+
+void RingCopy(struct BecoRing *ring, size_t pos, char *dst, size_t len) {
+  size_t idx = pos & (ring->cap - 1);
+  size_t first = ring->cap - idx;
+
+  if (first >= len) {
+    memcpy(dst, ring->data + idx, len);
+  } else {
+    memcpy(dst, ring->data + idx, first);
+    memcpy(dst + first, ring->data, len - first);
+  }
+}
+
+BecoError RingFill(struct BecoContext *ctx, struct BecoRing *ring) {
+#ifdef _WIN32
+  return BECO_ERR_NO_IMPL;
+#else
+  struct iovec iov[2];
+  size_t idx = ring->tail & (ring->cap - 1);
+  size_t room = ring->cap - (ring->tail - ring->head);
+  size_t first = ring->cap - idx;
+  int cnt = 1;
+  ssize_t n;
+
+  if (first >= room) {
+    first = room;
+  } else {
+    iov[1].iov_base = ring->data;
+    iov[1].iov_len = room - first;
+    cnt = 2;
+  }
+  iov[0].iov_base = ring->data + idx;
+  iov[0].iov_len = first;
+
+  do {
+    n = readv(ctx->in_fd, iov, cnt);
+  } while (n < 0 && errno == EINTR);
+
+  if (n < 0) return BECO_ERR_IO;
+  if (n == 0) return ring->tail == ring->head ? BECO_ERR_EOF : BECO_ERR_IO;
+
+  ring->tail += (size_t) n;
+  ctx->stats.reads++;
+  return BECO_ERR_OK;
+#endif
+}
+
+void RingScan(struct BecoContext *ctx, struct BecoRing *ring) {
+  uint32_t size = 0;
+  uint64_t frames = 0;
+
+  while (ring->tail - ring->scan >= sizeof(size)) {
+    RingCopy(ring, ring->scan, (char *) &size, sizeof(size));
+    if (ring->tail - ring->scan - sizeof(size) < size) break;
+    ring->scan += sizeof(size) + size;
+    frames++;
+  }
+
+  ring->queued += frames;
+  ctx->stats.frames_read += frames;
+  if (frames > ctx->stats.max_frames_per_read) ctx->stats.max_frames_per_read = frames;
+}
+
+BecoError RingLargeStart(struct BecoContext *ctx, struct BecoRing *ring, uint32_t size, struct BecoBuffer *buf) {
+  BecoError err = BECO_ERR_OK;
+  size_t have = ring->tail - ring->scan - sizeof(size);
+
+  if ((err = BecoBufferReserve(buf, (size_t) size + RECV_PADDING)) != BECO_ERR_OK) {
+    return err;
+  }
+
+  RingCopy(ring, ring->scan + sizeof(size), buf->data, have);
+  ring->head = ring->scan = ring->tail;
+  ring->large = size;
+  ring->large_have = have;
+  ParseProgress(ctx, buf->data, have, size);
+  return err;
+}
+
+// ring sized steps, so parsing keeps up with the data, a single read unless blocking
+BecoError RingLargeStep(struct BecoContext *ctx, struct BecoRing *ring, struct BecoBuffer *buf, bool block) {
+#ifdef _WIN32
+  return BECO_ERR_NO_IMPL;
+#else
+  BecoError err = BECO_ERR_OK;
+  size_t step = ring->large - ring->large_have < ring->cap ? ring->large - ring->large_have : ring->cap;
+  size_t got = 0;
+  ssize_t n;
+
+  if (block) {
+    err = ReadFull(ctx->in_fd, buf->data + ring->large_have, step, &got);
+  } else {
+    do {
+      n = read(ctx->in_fd, buf->data + ring->large_have, step);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return BECO_ERR_OK;
+    if (n > 0) got = (size_t) n;
+    else err = BECO_ERR_IO;
+  }
+  ring->large_have += got;
+  ctx->stats.reads++;
+  if (err != BECO_ERR_OK) {
+    // the rest of the frame never comes
+    ring->large = ring->large_have = 0;
+    return err;
+  }
+
+  ParseProgress(ctx, buf->data, ring->large_have, ring->large);
+  if (ring->large_have == ring->large) {
+    buf->len = ring->large;
+    ctx->stats.frames_read++;
+  }
+  return err;
+#endif
+}
+
+BecoError RingReadLarge(struct BecoContext *ctx, struct BecoRing *ring, struct BecoBuffer *buf) {
+  BecoError err = BECO_ERR_OK;
+
+  while (ring->large_have < ring->large) {
+    if ((err = RingLargeStep(ctx, ring, buf, true)) != BECO_ERR_OK) return err;
+  }
+  ring->large = ring->large_have = 0;
+  return err;
+}
+
+#ifdef BECO_HAVE_IO_URING
+BecoError UringTransportRead(struct BecoContext *ctx, struct BecoBuffer *buf) {
+  struct BecoUring *uring = ctx->transport_data;
+  struct BecoRing *ring = uring->ring;
+  BecoError err = BECO_ERR_OK;
+  uint32_t size = 0;
+
+  while (ring->queued == 0) {
+    if (ring->tail - ring->scan >= sizeof(size)) {
+      RingCopy(ring, ring->scan, (char *) &size, sizeof(size));
+      if (size > ring->cap - sizeof(size)) {
+        return UringReadLarge(ctx, uring, size, buf);
+      }
+    }
+    if (uring->read_err != 0) return BECO_ERR_IO;
+    if (uring->eof) return ring->tail == ring->head ? BECO_ERR_EOF : BECO_ERR_IO;
+
+    UringArmRead(ctx, uring);
+    if (!uring->reading) return BECO_ERR_IO;
+    if ((err = UringSubmit(uring, 1)) != BECO_ERR_OK) {
+      return err;
+    }
+    UringReap(ctx, uring);
+  }
+
+  RingCopy(ring, ring->head, (char *) &size, sizeof(size));
+  if ((err = BecoBufferReserve(buf, (size_t) size + RECV_PADDING)) != BECO_ERR_OK) {
+    return err;
+  }
+  RingCopy(ring, ring->head + sizeof(size), buf->data, size);
+  buf->len = size;
+
+  ring->head += sizeof(size) + size;
+  ring->queued--;
+
+  // a full ring had no room for the next read until now, it goes out with the next enter
+  UringArmRead(ctx, uring);
+  return err;
+}
+
+BecoError UringTransportWrite(struct BecoContext *ctx, const char *data, size_t dlen) {
+  struct BecoUring *uring = ctx->transport_data;
+  BecoError err = BECO_ERR_OK;
+  struct iovec iov[2];
+  uint32_t len = 0;
+
+  if (dlen > SIZE_1M) {
+    return BECO_ERR_OVERFLOW;
+  }
+
+  len = (uint32_t) dlen;
+  if (uring->send_len + sizeof(len) + dlen > URING_SEND_SIZE) {
+    if ((err = UringTransportFlush(ctx)) != BECO_ERR_OK) {
+      return err;
+    }
+  }
+
+  if (sizeof(len) + dlen <= URING_SEND_SIZE) {
+    memcpy(uring->send + uring->send_len, &len, sizeof(len));
+    memcpy(uring->send + uring->send_len + sizeof(len), data, dlen);
+    uring->send_len += sizeof(len) + dlen;
+    return err;
+  }
+
+  // never fits into the registered area, the send area is empty by now so order is kept
+  iov[0].iov_base = &len;
+  iov[0].iov_len = sizeof(len);
+  iov[1].iov_base = (void *) data;
+  iov[1].iov_len = dlen;
+  if ((err = WriteFullv(ctx->out_fd, iov, 2)) != BECO_ERR_OK) {
+    return err;
+  }
+  OutputFlushed(ctx);
+  return err;
+}
+
+BecoError UringTransportWriteFrame(struct BecoContext *ctx, const char *frame, size_t flen) {
+  struct BecoUring *uring = ctx->transport_data;
+  BecoError err = BECO_ERR_OK;
+  struct iovec iov;
+
+  if (uring->send_len + flen > URING_SEND_SIZE) {
+    if ((err = UringTransportFlush(ctx)) != BECO_ERR_OK) {
+      return err;
+    }
+  }
+
+  if (flen <= URING_SEND_SIZE) {
+    memcpy(uring->send + uring->send_len, frame, flen);
+    uring->send_len += flen;
+    return err;
+  }
+
+  iov.iov_base = (void *) frame;
+  iov.iov_len = flen;
+  if ((err = WriteFullv(ctx->out_fd, &iov, 1)) != BECO_ERR_OK) {
+    return err;
+  }
+  OutputFlushed(ctx);
+  return err;
+}
+
+BecoError UringTransportFlush(struct BecoContext *ctx) {
+  struct BecoUring *uring = ctx->transport_data;
+  struct io_uring_sqe *sqe = NULL;
+  BecoError err = BECO_ERR_OK;
+  size_t done = 0;
+
+  while (done < uring->send_len) {
+    if ((sqe = UringGetSqe(uring)) == NULL) return BECO_ERR_IO;
+    if (uring->fixed) {
+      sqe->opcode = IORING_OP_WRITE_FIXED;
+      sqe->addr = (uint64_t) (uintptr_t) (uring->send + done);
+      sqe->len = (uint32_t) (uring->send_len - done);
+      sqe->buf_index = 1;
+    } else {
+      uring->write_iov.iov_base = uring->send + done;
+      uring->write_iov.iov_len = uring->send_len - done;
+      sqe->opcode = IORING_OP_WRITEV;
+      sqe->addr = (uint64_t) (uintptr_t) &uring->write_iov;
+      sqe->len = 1;
+    }
+    sqe->fd = ctx->out_fd;
+    sqe->off = (uint64_t) -1;
+    sqe->user_data = URING_OP_WRITE;
+    uring->writing = true;
+
+    // completions of the queued read are picked up while waiting
+    while (uring->writing) {
+      if ((err = UringSubmit(uring, 1)) != BECO_ERR_OK) {
+        return err;
+      }
+      UringReap(ctx, uring);
+    }
+
+    if (uring->write_res == -EINTR || uring->write_res == -EAGAIN) continue;
+    if (uring->write_res <= 0) return BECO_ERR_IO;
+    done += (size_t) uring->write_res;
+  }
+  uring->send_len = 0;
+  return err;
+}
+
+bool UringTransportReady(struct BecoContext *ctx) {
+  struct BecoUring *uring = ctx->transport_data;
+
+  // completions are in shared memory, checking them costs no system call
+  UringReap(ctx, uring);
+  return uring->ring->queued > 0;
+}
+
+void UringTransportDestroy(struct BecoContext *ctx) {
+  struct BecoUring *uring = ctx->transport_data;
+  struct io_uring_sqe *sqe = NULL;
+
+  if (uring == NULL) return;
+
+  UringTransportFlush(ctx);
+  // no more reads are armed
+  uring->eof = true;
+
+  if (uring->reading && (sqe = UringGetSqe(uring)) != NULL) {
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = URING_OP_READ;
+    sqe->user_data = URING_OP_CANCEL;
+    uring->cancelling = true;
+    while (uring->reading) {
+      if (UringSubmit(uring, 1) != BECO_ERR_OK) break;
+      UringReap(ctx, uring);
+      if (!uring->cancelling && uring->cancel_res == -EALREADY) break;
+    }
+  }
+  if (uring->reading) {
+    // the kernel may still fill it, leak the ring rather than handing out memory in use
+    BecoLog(ctx, "io_uring read could not be cancelled");
+    uring->ring = NULL;
+  }
+
+  UringFree(uring);
+  ctx->transport_data = NULL;
+}
+
+struct BecoUring *UringNew() {
+  struct BecoUring *uring = NULL;
+  struct io_uring_params params;
+  struct iovec iov[2];
+  char *sq = NULL;
+  char *cq = NULL;
+  int fd;
+
+  memset(&params, 0, sizeof(params));
+  fd = (int) syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+  if (fd < 0) return NULL;
+
+  uring = malloc(sizeof(*uring));
+  if (uring == NULL) {
+    close(fd);
+    return NULL;
+  }
+  memset(uring, 0, sizeof(*uring));
+  uring->fd = fd;
+  uring->sq_map = MAP_FAILED;
+  uring->cq_map = MAP_FAILED;
+  uring->sqes = MAP_FAILED;
+
+  uring->sq_map_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  uring->cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (uring->cq_map_len > uring->sq_map_len) uring->sq_map_len = uring->cq_map_len;
+    uring->cq_map_len = 0;
+  }
+
+  uring->sq_map = mmap(NULL, uring->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       fd, IORING_OFF_SQ_RING);
+  if (uring->sq_map == MAP_FAILED) goto error;
+
+  if (uring->cq_map_len > 0) {
+    uring->cq_map = mmap(NULL, uring->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         fd, IORING_OFF_CQ_RING);
+    if (uring->cq_map == MAP_FAILED) goto error;
+  }
+
+  uring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+  uring->sqes = mmap(NULL, uring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     fd, IORING_OFF_SQES);
+  if (uring->sqes == MAP_FAILED) goto error;
+
+  sq = uring->sq_map;
+  cq = uring->cq_map_len > 0 ? uring->cq_map : uring->sq_map;
+  uring->sq_entries = params.sq_entries;
+  uring->sq_head = (unsigned *) (sq + params.sq_off.head);
+  uring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+  uring->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+  uring->sq_array = (unsigned *) (sq + params.sq_off.array);
+  uring->cq_head = (unsigned *) (cq + params.cq_off.head);
+  uring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+  uring->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+  uring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+  if ((uring->ring = RingNew(RING_SIZE)) == NULL) goto error;
+  if ((uring->send = malloc(URING_SEND_SIZE)) == NULL) goto error;
+
+  // registration pins memory and may hit RLIMIT_MEMLOCK, plain vectored I/O still works then
+  iov[0].iov_base = uring->ring->data;
+  iov[0].iov_len = uring->ring->cap;
+  iov[1].iov_base = uring->send;
+  iov[1].iov_len = URING_SEND_SIZE;
+  uring->fixed = syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, iov, 2) == 0;
+
+  return uring;
+
+  error:
+  UringFree(uring);
+  return NULL;
+}
+
+void UringFree(struct BecoUring *uring) {
+  if (uring == NULL) return;
+  if (uring->sqes != MAP_FAILED) munmap(uring->sqes, uring->sqes_len);
+  if (uring->cq_map != MAP_FAILED) munmap(uring->cq_map, uring->cq_map_len);
+  if (uring->sq_map != MAP_FAILED) munmap(uring->sq_map, uring->sq_map_len);
+  // closing the ring drops the registered buffers as well
+  close(uring->fd);
+  RingFree(uring->ring);
+  free(uring->send);
+  free(uring);
+}
+
+struct io_uring_sqe *UringGetSqe(struct BecoUring *uring) {
+  struct io_uring_sqe *sqe = NULL;
+  unsigned tail = *uring->sq_tail;
+  unsigned idx;
+
+  if (tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) >= uring->sq_entries) return NULL;
+
+  idx = tail & *uring->sq_mask;
+  sqe = &uring->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  uring->sq_array[idx] = idx;
+  // without SQPOLL the kernel looks at entries only in io_uring_enter, filling it later is fine
+  __atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  uring->to_submit++;
+  return sqe;
+}
+
+BecoError UringSubmit(struct BecoUring *uring, unsigned wait) {
+  int n;
+
+  if (uring->to_submit == 0 && wait == 0) return BECO_ERR_OK;
+
+  do {
+    n = (int) syscall(__NR_io_uring_enter, uring->fd, uring->to_submit, wait,
+                      wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  } while (n < 0 && errno == EINTR);
+
+  if (n < 0) return BECO_ERR_IO;
+  uring->to_submit -= (unsigned) n;
+  return BECO_ERR_OK;
+}
+
+void UringReap(struct BecoContext *ctx, struct BecoUring *uring) {
+  struct BecoRing *ring = uring->ring;
+  struct io_uring_cqe *cqe = NULL;
+  unsigned head = *uring->cq_head;
+
+  while (head != __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE)) {
+    cqe = &uring->cqes[head & *uring->cq_mask];
+    switch (cqe->user_data) {
+      case URING_OP_READ: {
+        uring->reading = false;
+        if (cqe->res > 0) {
+          ring->tail += (size_t) cqe->res;
+          ctx->stats.reads++;
+          // bytes of a frame larger than the ring are not headers
+          if (!uring->large) RingScan(ctx, ring);
+        } else if (cqe->res == 0) {
+          uring->eof = true;
+        } else if (cqe->res != -EINTR && cqe->res != -EAGAIN && cqe->res != -ECANCELED) {
+          uring->read_err = -cqe->res;
+        }
+        break;
+      }
+      case URING_OP_READ_DIRECT: {
+        uring->reading = false;
+        if (cqe->res > 0) {
+          uring->direct_done += (size_t) cqe->res;
+          ctx->stats.reads++;
+        } else if (cqe->res == 0) {
+          uring->eof = true;
+        } else if (cqe->res != -EINTR && cqe->res != -EAGAIN && cqe->res != -ECANCELED) {
+          uring->read_err = -cqe->res;
+        }
+        break;
+      }
+      case URING_OP_WRITE: {
+        uring->writing = false;
+        uring->write_res = cqe->res;
+        break;
+      }
+      case URING_OP_CANCEL: {
+        uring->cancelling = false;
+        uring->cancel_res = cqe->res;
+        break;
+      }
+      default:
+        break;
+    }
+    head++;
+  }
+  __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+
+  if (!uring->large) UringArmRead(ctx, uring);
+}
+
+void UringArmRead(struct BecoContext *ctx, struct BecoUring *uring) {
+  struct BecoRing *ring = uring->ring;
+  struct io_uring_sqe *sqe = NULL;
+  size_t idx = ring->tail & (ring->cap - 1);
+  size_t room = ring->cap - (ring->tail - ring->head);
+
+  if (uring->reading || uring->eof || uring->read_err != 0) return;
+
+  // one contiguous piece, the wrapped part is taken by the next read
+  if (room > ring->cap - idx) room = ring->cap - idx;
+  if (room == 0) return;
+  if ((sqe = UringGetSqe(uring)) == NULL) return;
+
+  if (uring->fixed) {
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->addr = (uint64_t) (uintptr_t) (ring->data + idx);
+    sqe->len = (uint32_t) room;
+    sqe->buf_index = 0;
+  } else {
+    uring->read_iov.iov_base = ring->data + idx;
+    uring->read_iov.iov_len = room;
+    sqe->opcode = IORING_OP_READV;
+    sqe->addr = (uint64_t) (uintptr_t) &uring->read_iov;
+    sqe->len = 1;
+  }
+  sqe->fd = ctx->in_fd;
+  sqe->off = (uint64_t) -1;
+  sqe->user_data = URING_OP_READ;
+  uring->reading = true;
+}
+
+BecoError UringReadLarge(struct BecoContext *ctx, struct BecoUring *uring, uint32_t size, struct BecoBuffer *buf) {
+  struct BecoRing *ring = uring->ring;
+  struct io_uring_sqe *sqe = NULL;
+  BecoError err = BECO_ERR_OK;
+  size_t have = 0;
+  size_t n;
+
+  if ((err = BecoBufferReserve(buf, (size_t) size + RECV_PADDING)) != BECO_ERR_OK) {
+    return err;
+  }
+
+  // whatever the queued read brings in is copied out of the ring, the rest is read
+  // straight into the buffer once the ring is drained
+  ring->head = ring->scan = ring->scan + sizeof(size);
+  uring->large = true;
+  uring->direct_done = 0;
+  for (;;) {
+    n = ring->tail - ring->head;
+    if (n > size - have) n = size - have;
+    RingCopy(ring, ring->head, buf->data + have, n);
+    ring->head = ring->scan = ring->head + n;
+    have += n + uring->direct_done;
+    uring->direct_done = 0;
+    ParseProgress(ctx, buf->data, have, size);
+    if (have == size) break;
+
+    if (uring->read_err != 0 || uring->eof) {
+      err = BECO_ERR_IO;
+      break;
+    }
+    if (!uring->reading) {
+      if ((sqe = UringGetSqe(uring)) == NULL) {
+        err = BECO_ERR_IO;
+        break;
+      }
+      uring->read_iov.iov_base = buf->data + have;
+      uring->read_iov.iov_len = size - have;
+      sqe->opcode = IORING_OP_READV;
+      sqe->fd = ctx->in_fd;
+      sqe->addr = (uint64_t) (uintptr_t) &uring->read_iov;
+      sqe->len = 1;
+      sqe->off = (uint64_t) -1;
+      sqe->user_data = URING_OP_READ_DIRECT;
+      uring->reading = true;
+    }
+    if ((err = UringSubmit(uring, 1)) != BECO_ERR_OK) {
+      break;
+    }
+    UringReap(ctx, uring);
+  }
+  uring->large = false;
+  if (err != BECO_ERR_OK) return err;
+
+  buf->len = size;
+  ctx->stats.frames_read++;
+  RingScan(ctx, ring);
+
+  UringArmRead(ctx, uring);
+  return err;
+}
+#endif
+
+BecoError BecoEnableEventLoop(struct BecoContext *ctx) {
+  if (ctx == NULL) return BECO_ERR_NULL;
+#ifndef __linux__
+  return BECO_ERR_NO_IMPL;
+#else
+  struct BecoEventLoop *loop = NULL;
+  struct epoll_event ev;
+  BecoError err = BECO_ERR_OK;
+
+  if (ctx->loop != NULL) return BECO_ERR_OK;
+
+  if (ctx->transport == &kStdioTransport) {
+    if ((err = BecoSetTransport(ctx, BECO_TRANSPORT_FD)) != BECO_ERR_OK) {
+      return err;
+    }
+  }
+  if (ctx->transport != &kFdTransport) {
+    return BECO_ERR_NO_IMPL;
+  }
+
+  loop = malloc(sizeof(*loop));
+  if (loop == NULL) return BECO_ERR_OVERFLOW;
+  memset(loop, 0, sizeof(*loop));
+  loop->wake_fd = -1;
+
+  loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (loop->epoll_fd < 0) {
+    err = BECO_ERR_IO;
+    goto error;
+  }
+
+  loop->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (loop->wake_fd < 0) {
+    err = BECO_ERR_IO;
+    goto error;
+  }
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = loop->wake_fd;
+  if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &ev) != 0) {
+    err = BECO_ERR_IO;
+    goto error;
+  }
+
+  ev.data.fd = ctx->in_fd;
+  if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, ctx->in_fd, &ev) != 0) {
+    err = BECO_ERR_IO;
+    goto error;
+  }
+
+  ctx->loop = loop;
+  return BECO_ERR_OK;
+
+  error:
+  EventLoopFree(loop);
+  return err;
+#endif
+}
+
+BecoError BecoWakeup(struct BecoContext *ctx) {
+  if (ctx == NULL || ctx->loop == NULL) return BECO_ERR_NULL;
+#ifndef __linux__
+  return BECO_ERR_NO_IMPL;
+#else
+  uint64_t one = 1;
+  ssize_t n;
+
+  do {
+    n = write(ctx->loop->wake_fd, &one, sizeof(one));
+  } while (n < 0 && errno == EINTR);
+
+  // a full counter is already a pending wakeup
+  if (n < 0 && errno != EAGAIN) return BECO_ERR_IO;
+  return BECO_ERR_OK;
+#endif
+}
+
+BecoError BecoSetWakeupHandler(struct BecoContext *ctx, BecoEventFunc handler, void *user_data) {
+  if (ctx == NULL || ctx->loop == NULL) return BECO_ERR_NULL;
+  ctx->loop->wakeup_handler = handler;
+  ctx->loop->wakeup_data = user_data;
+  return BECO_ERR_OK;
+}
+
+BecoError BecoAddTimer(struct BecoContext *ctx,
+                       uint32_t delay_ms,
+                       uint32_t interval_ms,
+                       BecoEventFunc handler,
+                       void *user_data,
+                       int *id) {
+  if (ctx == NULL || ctx->loop == NULL || handler == NULL) return BECO_ERR_NULL;
+
+  struct BecoEventLoop *loop = ctx->loop;
+  struct BecoTimer *timer = NULL;
+  struct BecoTimer *timers = NULL;
+  size_t cap;
+
+  if (loop->timer_count == loop->timer_cap) {
+    cap = loop->timer_cap == 0 ? 8 : loop->timer_cap * 2;
+    timers = realloc(loop->timers, sizeof(*timers) * cap);
+    if (timers == NULL) return BECO_ERR_OVERFLOW;
+    loop->timers = timers;
+    loop->timer_cap = cap;
+  }
+
+  timer = &loop->timers[loop->timer_count++];
+  timer->id = ++loop->timer_id;
+  timer->deadline = MonotonicMs() + delay_ms;
+  timer->interval = interval_ms;
+  timer->handler = handler;
+  timer->user_data = user_data;
+
+  if (id != NULL) *id = timer->id;
+  return BECO_ERR_OK;
+}
+
+BecoError BecoRemoveTimer(struct BecoContext *ctx, int id) {
+  if (ctx == NULL || ctx->loop == NULL) return BECO_ERR_NULL;
+
+  struct BecoEventLoop *loop = ctx->loop;
+  size_t i;
+
+  for (i = 0; i < loop->timer_count; ++i) {
+    if (loop->timers[i].id == id) {
+      // keep slots in place while timers fire, EventLoopTimers() compacts them
+      loop->timers[i].handler = NULL;
+      return BECO_ERR_OK;
+    }
+  }
+  return BECO_ERR_OK;
+}
+
+BecoError BecoAddFd(struct BecoContext *ctx, int fd, uint32_t events, BecoFdFunc handler, void *user_data) {
+  if (ctx == NULL || ctx->loop == NULL || handler == NULL) return BECO_ERR_NULL;
+#ifndef __linux__
+  return BECO_ERR_NO_IMPL;
+#else
+  struct BecoEventLoop *loop = ctx->loop;
+  struct BecoWatch *watches = NULL;
+  struct epoll_event ev;
+  size_t cap;
+
+  if (loop->watch_count == loop->watch_cap) {
+    cap = loop->watch_cap == 0 ? 8 : loop->watch_cap * 2;
+    watches = realloc(loop->watches, sizeof(*watches) * cap);
+    if (watches == NULL) return BECO_ERR_OVERFLOW;
+    loop->watches = watches;
+    loop->watch_cap = cap;
+  }
+
+  memset(&ev, 0, sizeof(ev));
+  if (events & BECO_EVENT_READ) ev.events |= EPOLLIN;
+  if (events & BECO_EVENT_WRITE) ev.events |= EPOLLOUT;
+  ev.data.fd = fd;
+  if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+    return BECO_ERR_IO;
+  }
+
+  loop->watches[loop->watch_count].fd = fd;
+  loop->watches[loop->watch_count].handler = handler;
+  loop->watches[loop->watch_count].user_data = user_data;
+  loop->watch_count++;
+  return BECO_ERR_OK;
+#endif
+}
+
+BecoError BecoRemoveFd(struct BecoContext *ctx, int fd) {
+  if (ctx == NULL || ctx->loop == NULL) return BECO_ERR_NULL;
+#ifndef __linux__
+  return BECO_ERR_NO_IMPL;
+#else
+  struct BecoEventLoop *loop = ctx->loop;
+  size_t i;
+
+  for (i = 0; i < loop->watch_count; ++i) {
+    if (loop->watches[i].fd == fd) {
+      epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+      loop->watches[i] = loop->watches[--loop->watch_count];
+      return BECO_ERR_OK;
+    }
+  }
+  return BECO_ERR_OK;
+#endif
+}
+
+void EventLoopFree(struct BecoEventLoop *loop) {
+  if (loop == NULL) return;
+#ifndef _WIN32
+  if (loop->epoll_fd >= 0) close(loop->epoll_fd);
+  if (loop->wake_fd >= 0) close(loop->wake_fd);
+#endif
+  free(loop->timers);
+  free(loop->watches);
+  free(loop);
+}
+
+BecoError EventLoopRun(struct BecoContext *ctx, const volatile bool *exit, bool exit_on_fail) {
+#ifndef __linux__
+  return BECO_ERR_NO_IMPL;
+#else
+  struct BecoEventLoop *loop = ctx->loop;
+  struct epoll_event events[LOOP_MAX_EVENTS];
+  struct BecoWatch *watch = NULL;
+  BecoError err = BECO_ERR_OK;
+  uint64_t count;
+  uint32_t ready;
+  size_t j;
+  int i, n;
+
+  while (!*exit) {
+    // frames left from the last read are served before waiting again
+    while (!*exit && FdTransportReady(ctx)) {
+      err = BecoNext(ctx);
+      if (err != BECO_ERR_OK && exit_on_fail) return err;
+    }
+    if (*exit) break;
+
+    if ((err = BecoFlush(ctx)) != BECO_ERR_OK && exit_on_fail) return err;
+
+    n = epoll_wait(loop->epoll_fd, events, LOOP_MAX_EVENTS, EventLoopTimeout(ctx));
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return BECO_ERR_IO;
+    }
+
+    for (i = 0; i < n; ++i) {
+      if (events[i].data.fd == loop->wake_fd) {
+        while (read(loop->wake_fd, &count, sizeof(count)) > 0) {}
+        if (loop->wakeup_handler != NULL) {
+          loop->wakeup_handler(ctx, loop->wakeup_data);
+        }
+      } else if (events[i].data.fd == ctx->in_fd) {
+        // a hang up mid frame would be reported forever, the input is gone either way
+        err = EventLoopInput(ctx);
+        if (err == BECO_ERR_EOF) return BECO_ERR_OK;
+        if (err != BECO_ERR_OK) return err;
+      } else {
+        ready = 0;
+        if (events[i].events & EPOLLIN) ready |= BECO_EVENT_READ;
+        if (events[i].events & EPOLLOUT) ready |= BECO_EVENT_WRITE;
+        if (events[i].events & (EPOLLERR | EPOLLHUP)) ready |= BECO_EVENT_ERROR;
+        // handlers may remove watches, look it up for every event
+        for (j = 0, watch = NULL; j < loop->watch_count; ++j) {
+          if (loop->watches[j].fd == events[i].data.fd) {
+            watch = &loop->watches[j];
+            break;
+          }
+        }
+        if (watch != NULL) {
+          watch->handler(ctx, watch->fd, ready, watch->user_data);
+        }
+      }
+    }
+
+    EventLoopTimers(ctx);
+    RecvBufferTrim(ctx);
+  }
+  return BECO_ERR_OK;
+#endif
+}
+
+BecoError EventLoopInput(struct BecoContext *ctx) {
+  struct BecoRing *ring = ctx->transport_data;
+  BecoError err = BECO_ERR_OK;
+  uint32_t size = 0;
+
+  // a frame larger than the ring goes on into recv_buf, one read per wakeup
+  if (ring->large == 0 && ring->queued == 0 && ring->tail - ring->scan >= sizeof(size)) {
+    RingCopy(ring, ring->scan, (char *) &size, sizeof(size));
+    if (size > ring->cap - sizeof(size)) {
+      if ((err = RecvPrepare(ctx)) != BECO_ERR_OK) return err;
+      if ((err = RingLargeStart(ctx, ring, size, &ctx->recv_buf)) != BECO_ERR_OK) return err;
+    }
+  }
+
+  if (ring->large != 0) {
+    err = RingLargeStep(ctx, ring, &ctx->recv_buf, false);
+  } else if ((err = RingFill(ctx, ring)) == BECO_ERR_OK) {
+    RingScan(ctx, ring);
+  }
+  return err;
+}
+
+int EventLoopTimeout(struct BecoContext *ctx) {
+  struct BecoEventLoop *loop = ctx->loop;
+  uint64_t now = MonotonicMs();
+  uint64_t deadline = UINT64_MAX;
+  size_t i;
+
+  for (i = 0; i < loop->timer_count; ++i) {
+    if (loop->timers[i].handler != NULL && loop->timers[i].deadline < deadline) {
+      deadline = loop->timers[i].deadline;
+    }
+  }
+  // an oversized receive buffer is released once idle, even if nothing arrives
+  if (ctx->recv_buf.cap > ctx->recv_keep_size && ctx->recv_spike_at + ctx->recv_idle_ms < deadline) {
+    deadline = ctx->recv_spike_at + ctx->recv_idle_ms;
+  }
+
+  if (deadline == UINT64_MAX) return -1;
+  if (deadline <= now) return 0;
+  return deadline - now > INT32_MAX ? INT32_MAX : (int) (deadline - now);
+}
+
+void EventLoopTimers(struct BecoContext *ctx) {
+  struct BecoEventLoop *loop = ctx->loop;
+  struct BecoTimer timer;
+  uint64_t now = MonotonicMs();
+  size_t count = loop->timer_count;
+  size_t i, j;
+
+  // timers added by handlers wait for the next round, slots may move when they are added
+  for (i = 0; i < count; ++i) {
+    timer = loop->timers[i];
+    if (timer.handler == NULL || timer.deadline > now) continue;
+    if (timer.interval == 0) {
+      loop->timers[i].handler = NULL;
+    } else {
+      loop->timers[i].deadline = now + timer.interval;
+    }
+    timer.handler(ctx, timer.user_data);
+  }
+
+  for (i = 0, j = 0; i < loop->timer_count; ++i) {
+    if (loop->timers[i].handler != NULL) loop->timers[j++] = loop->timers[i];
+  }
+  loop->timer_count = j;
+}
+
+BecoError BecoRegisterCommand(struct BecoContext *ctx,
+                              const char *cmd,
+                              BecoRequestHandlerFunc handler,
+                              void *user_data) {
+  if (ctx == NULL || handler == NULL) return BECO_ERR_NULL;
+
+  struct BecoRequestHandler *entry = NULL;
+
+  entry = CreateHandler(cmd, handler, user_data);
+  HASH_ADD_STR(ctx->handler_entries, cmd, entry);
+
+  return BECO_ERR_OK;
+}
+
+BecoError BecoRemoveCommand(struct BecoContext *ctx, const char *cmd) {
+  if (ctx == NULL) return BECO_ERR_NULL;
+
+  struct BecoRequestHandler *out = NULL;
+  HASH_FIND_STR(ctx->handler_entries, cmd, out);
+  if (out != NULL) {
+    HASH_DEL(ctx->handler_entries, out);
+    free(out->cmd);
+    free(out);
+  }
+  return BECO_ERR_OK;
+}
+
+struct BecoRequestHandler *BecoFindRequestHandler(struct BecoContext *ctx, const char *cmd) {
+  if (ctx == NULL || cmd == NULL) return NULL;
+
+  struct BecoRequestHandler *out = NULL;
+  HASH_FIND_STR(ctx->handler_entries, cmd, out);
+  if (out != NULL) return out;
+  return NULL;
+}
+
+struct BecoRequest *BecoRequestNew() {
+  struct BecoRequest *request = NULL;
+  request = malloc(sizeof(*request));
+  memset(request, 0, sizeof(*request));
+  return request;
+}
+
+struct BecoObject *BecoRequestGetData(struct BecoRequest *request) {
+  if (request == NULL) return NULL;
+  return request->data;
+}
+
+struct BecoArena *BecoRequestGetArena(struct BecoRequest *request) {
+  if (request == NULL || request->lease == NULL) return NULL;
+  return &request->lease->arena;
+}
+
+const char *BecoRequestGetCommand(struct BecoRequest *request) {
+  if (request == NULL) return NULL;
+  return request->cmd;
+}
+
+void BecoRequestSetData(struct BecoRequest *request, struct BecoObject *obj) {
+  if (request == NULL) return;
+  request->data = obj;
+}
+
+void BecoRequestSetCommand(struct BecoRequest *request, const char *command) {
+  if (request == NULL) return;
+  request->cmd = strdup(command);
+}
+
+void BecoRequestInit(struct BecoRequest *req) {
+  if (req == NULL) return;
+  memset(req, 0, sizeof(*req));
+}
+
+void BecoRequestDestroy(struct BecoRequest *req) {
+  if (req == NULL) return;
+  free(req->cmd);
+  BecoObjectFree(req->data);
+  LeaseRelease(req->lease);
+  req->lease = NULL;
+}
+
+void BecoRequestFree(struct BecoRequest *req) {
+  BecoRequestDestroy(req);
+  free(req);
+}
+
+struct BecoObject *BecoObjectNew() {
+  return BecoObjectNewIn(NULL);
+}
+
+struct BecoObject *BecoObjectNewIn(struct BecoArena *arena) {
+  struct BecoObject *obj = NULL;
+  obj = BecoArenaAlloc(arena, sizeof(*obj));
+  if (obj == NULL) return NULL;
+  memset(obj, 0, sizeof(*obj));
+  if (arena != NULL) obj->flags = BECO_OBJECT_ARENA;
+  return obj;
+}
+
+struct BecoObject *BecoObjectPromote(struct BecoObject *obj) {
+  return ObjectCopy(obj, NULL);
+}
+
+struct BecoObject *ObjectCopy(struct BecoObject *src, struct BecoArena *arena) {
+  if (src == NULL) return NULL;
+
+  struct BecoObject *dst = NULL;
+  struct BecoMapEntry *entry = NULL;
+  size_t i;
+
+  if ((dst = BecoObjectNewIn(arena)) == NULL) return NULL;
+  dst->type = src->type;
+  switch (src->type) {
+    case BECO_VALUE_TYPE_STR: {
+      if (BecoObjectGetStr(src) != NULL) {
+        BecoObjectSetStrIn(arena, dst, BecoObjectGetStr(src), BecoObjectGetStrLen(src));
+      }
+      break;
+    }
+    case BECO_VALUE_TYPE_MAP: {
+      dst->via.map = BecoMapNewIn(arena);
+      if (src->via.map == NULL || dst->via.map == NULL) break;
+      MapMaterialize(src->via.map);
+      MapReserve(dst->via.map, src->via.map->count);
+      for (i = 0; i < src->via.map->count; ++i) {
+        entry = &src->via.map->entries[i];
+        BecoMapPut(dst->via.map, entry->key, ObjectCopy(entry->value, arena));
+      }
+      break;
+    }
+    case BECO_VALUE_TYPE_ARRAY: {
+      if (src->via.array == NULL) break;
+      if (src->via.array->num_type != BECO_ARRAY_OBJECTS) {
+        dst->via.array = ArrayNewNums(arena, src->via.array->num_type, src->via.array->nums, src->via.array->size);
+        break;
+      }
+      ArrayMaterialize(src->via.array);
+      dst->via.array = BecoArrayNewIn(arena, src->via.array->size);
+      if (dst->via.array == NULL) break;
+      for (i = 0; i < src->via.array->size; ++i) {
+        BecoArrayAdd(dst->via.array, i, ObjectCopy(&src->via.array->items[i], arena));
+      }
+      break;
+    }
+    default: {
+      dst->via = src->via;
+    }
+  }
+  return dst;
+}
+
+enum BecoValueType BecoObjectGetType(struct BecoObject *obj) {
+  if (obj == NULL) return BECO_VALUE_TYPE_NONE;
+  return obj->type;
+}
+
+int64_t BecoObjectGetInt64(struct BecoObject *obj) {
+  if (obj == NULL) return 0;
+  return obj->via.i64;
+}
+
+uint64_t BecoObjectGetUInt64(struct BecoObject *obj) {
+  if (obj == NULL) return 0;
+  return obj->via.u64;
 }
 
 bool BecoObjectGetBool(struct BecoObject *obj) {
@@ -496,553 +2863,3245 @@ bool BecoObjectGetBool(struct BecoObject *obj) {
   return obj->via.bool_;
 }
 
-double BecoObjectGetFloat64(struct BecoObject *obj) {
-  if (obj == NULL) return NAN;
-  return obj->via.f64;
+double BecoObjectGetFloat64(struct BecoObject *obj) {
+  if (obj == NULL) return NAN;
+  return obj->via.f64;
+}
+
+const char *BecoObjectGetStr(struct BecoObject *obj) {
+  if (obj == NULL) return NULL;
+  if (obj->flags & BECO_OBJECT_INLINE) return obj->via.inline_str;
+  return obj->via.str;
+}
+
+size_t BecoObjectGetStrLen(struct BecoObject *obj) {
+  if (obj == NULL || obj->type != BECO_VALUE_TYPE_STR) return 0;
+  if (obj->flags & BECO_OBJECT_INLINE) return (unsigned char) obj->via.inline_str[sizeof(obj->via.inline_str) - 1];
+  if (obj->flags & BECO_OBJECT_SIZED) return obj->via.text.len;
+  // set through via.str directly
+  return obj->via.str != NULL ? strlen(obj->via.str) : 0;
+}
+
+BecoError BecoObjectSetStr(struct BecoObject *obj, const char *str, size_t len) {
+  return BecoObjectSetStrIn(NULL, obj, str, len);
+}
+
+BecoError BecoObjectSetStrIn(struct BecoArena *arena, struct BecoObject *obj, const char *str, size_t len) {
+  char short_str[sizeof(obj->via.inline_str)];
+  char *copy = NULL;
+
+  if (obj == NULL || (str == NULL && len > 0)) return BECO_ERR_NULL;
+
+  // str may point into the previous value, copy it before that is released
+  if (len > BECO_INLINE_STR_MAX) {
+    if ((copy = BecoArenaAlloc(arena, len + 1)) == NULL) return BECO_ERR_GENERIC;
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+  } else if (len > 0) {
+    memcpy(short_str, str, len);
+  }
+  ObjectClear(obj);
+
+  obj->type = BECO_VALUE_TYPE_STR;
+  obj->flags &= ~(uint32_t) (BECO_OBJECT_BORROWED | BECO_OBJECT_INLINE | BECO_OBJECT_SIZED);
+  if (copy != NULL) {
+    obj->via.text.str = copy;
+    obj->via.text.len = len;
+    obj->flags |= BECO_OBJECT_SIZED | (arena != NULL ? BECO_OBJECT_BORROWED : 0);
+    return BECO_ERR_OK;
+  }
+  if (len > 0) memcpy(obj->via.inline_str, short_str, len);
+  obj->via.inline_str[len] = '\0';
+  obj->via.inline_str[sizeof(obj->via.inline_str) - 1] = (char) len;
+  obj->flags |= BECO_OBJECT_INLINE;
+  return BECO_ERR_OK;
+}
+
+struct BecoMap *BecoObjectGetMap(struct BecoObject *obj) {
+  if (obj == NULL) return NULL;
+  return obj->via.map;
+}
+
+struct BecoArray *BecoObjectGetArray(struct BecoObject *obj) {
+  if (obj == NULL) return NULL;
+  if (obj->type == BECO_VALUE_TYPE_ARRAY && obj->via.array != NULL) ArrayMaterialize(obj->via.array);
+  return obj->via.array;
+}
+
+void BecoObjectDumpF(struct BecoObject *obj, int indent, FILE *out) {
+  if (obj == NULL || out == NULL) return;
+  switch (obj->type) {
+    case BECO_VALUE_TYPE_NONE: {
+      fprintf(out, "(none)\n");
+      break;
+    }
+    case BECO_VALUE_TYPE_BOOL: {
+      fprintf(out, "%d (none)\n", obj->via.bool_);
+      break;
+    }
+    case BECO_VALUE_TYPE_INTEGER: {
+      fprintf(out, "%lld (integer)\n", obj->via.i64);
+      break;
+    }
+    case BECO_VALUE_TYPE_POSITIVE_INTEGER: {
+      fprintf(out, "%lld (+integer)\n", obj->via.u64);
+      break;
+    }
+    case BECO_VALUE_TYPE_DOUBLE: {
+      fprintf(out, "%f (double)\n", obj->via.f64);
+      break;
+    }
+    case BECO_VALUE_TYPE_STR: {
+      fprintf(out, "\"%s\" (string)\n", BecoObjectGetStr(obj));
+      break;
+    }
+    case BECO_VALUE_TYPE_MAP: {
+      fprintf(out, "(map) {\n");
+      uint32_t i;
+      MapMaterialize(obj->via.map);
+      for (i = 0; i < obj->via.map->count; ++i) {
+        fprintf(out, "%*s\"%s\": ", indent + 2, " ", obj->via.map->entries[i].key);
+        BecoObjectDumpF(obj->via.map->entries[i].value, indent + 2, out);
+      }
+      fprintf(out, "%*s}\n", indent, " ");
+      break;
+    }
+    case BECO_VALUE_TYPE_ARRAY: {
+      fprintf(out, "(array["SIZE_FMT"]) {\n", obj->via.array->size);
+      size_t i;
+      ArrayMaterialize(obj->via.array);
+      for (i = 0; i < obj->via.array->size; ++i) {
+        fprintf(out, "%*s["SIZE_FMT"]: ", indent + 2, " ", i);
+        BecoObjectDumpF(&obj->via.array->items[i], indent + 2, out);
+      }
+      fprintf(out, "%*s}\n", indent, " ");
+      break;
+    }
+  }
+}
+
+BecoError BecoObjectDumpJson(struct BecoObject *obj, char **out, size_t *olen) {
+  if (obj == NULL || out == NULL || olen == NULL) return BECO_ERR_NULL;
+
+  struct BecoBuffer buf;
+  struct JsonWriter w;
+  BecoError err;
+
+  BecoBufferInit(&buf);
+  if ((err = BecoBufferReserve(&buf, BecoObjectSerializedSize(obj) + 1)) != BECO_ERR_OK) {
+    return err;
+  }
+  JsonWriterInitBuffer(&w, &buf);
+  JsonWriterObj(&w, obj);
+  JsonWriterPut(&w, "", 1);
+  err = JsonWriterFinish(&w);
+  if (err != BECO_ERR_OK) {
+    BecoBufferDestroy(&buf);
+    return err;
+  }
+  *out = buf.data;
+  *olen = buf.len - 1;
+  return BECO_ERR_OK;
+}
+
+void BecoObjectDump(struct BecoObject *obj) {
+  if (obj == NULL) return;
+  BecoObjectDumpF(obj, 0, stdout);
+}
+
+struct BecoObject *BecoObjectDup(struct BecoObject *src, bool recursive) {
+  if (src == NULL) return NULL;
+  if (recursive) return ObjectCopy(src, NULL);
+  return ObjectShare(src, NULL);
+}
+
+struct BecoObject *BecoObjectPack(struct BecoObject *src) {
+  if (src == NULL) return NULL;
+  return ObjectPack(src);
+}
+
+struct BecoObject *ObjectShare(struct BecoObject *src, struct BecoArena *arena) {
+  struct BecoObject *dst = NULL;
+
+  if ((dst = BecoObjectNewIn(arena)) == NULL) return NULL;
+  ObjectShareInto(src, dst, arena);
+  return dst;
+}
+
+// maps and arrays are retained, the rest is copied
+void ObjectShareInto(struct BecoObject *src, struct BecoObject *dst, struct BecoArena *arena) {
+  dst->type = src->type;
+  switch (src->type) {
+    case BECO_VALUE_TYPE_STR: {
+      if (BecoObjectGetStr(src) != NULL) {
+        BecoObjectSetStrIn(arena, dst, BecoObjectGetStr(src), BecoObjectGetStrLen(src));
+      }
+      break;
+    }
+    case BECO_VALUE_TYPE_MAP: {
+      dst->via.map = BecoMapRetain(src->via.map);
+      break;
+    }
+    case BECO_VALUE_TYPE_ARRAY: {
+      dst->via.array = BecoArrayRetain(src->via.array);
+      break;
+    }
+    default: {
+      dst->via = src->via;
+    }
+  }
+}
+
+struct BecoMap *BecoObjectGetMutMap(struct BecoObject *obj) {
+  struct BecoMap *src = NULL;
+  struct BecoMap *map = NULL;
+  struct BecoMapEntry *from = NULL;
+  struct BecoMapEntry *to = NULL;
+  uint32_t i, size;
+
+  if (obj == NULL || obj->type != BECO_VALUE_TYPE_MAP) return NULL;
+  src = obj->via.map;
+  if (src == NULL || REFS_LOAD(&src->refs) <= 1) return src;
+
+  MapMaterialize(src);
+  if ((map = BecoMapNewIn(src->arena)) == NULL) return NULL;
+  if (src->count > 0 && MapReserve(map, src->count) != BECO_ERR_OK) goto error;
+  if (src->index != NULL) {
+    size = src->index_mask + 1;
+    if ((map->index = BecoArenaAlloc(map->arena, size * sizeof(*map->index))) == NULL) goto error;
+    memcpy(map->index, src->index, size * sizeof(*map->index));
+    map->index_mask = src->index_mask;
+  }
+  // same keys in the same order, so the hashes and the index stay valid
+  if (src->count > 0) memcpy(map->hashes, src->hashes, src->count * sizeof(*map->hashes));
+  for (i = 0; i < src->count; ++i) {
+    from = &src->entries[i];
+    to = &map->entries[i];
+    *to = *from;
+    if (!(from->flags & BECO_OBJECT_BORROWED)) to->key = strdup(from->key);
+    to->value = from->value != NULL ? ObjectShare(from->value, map->arena) : NULL;
+    map->count++;
+  }
+
+  BecoMapFree(src);
+  obj->via.map = map;
+  return map;
+
+  error:
+  BecoMapFree(map);
+  return NULL;
+}
+
+struct BecoArray *BecoObjectGetMutArray(struct BecoObject *obj) {
+  struct BecoArray *src = NULL;
+  struct BecoArray *array = NULL;
+  size_t i;
+
+  if (obj == NULL || obj->type != BECO_VALUE_TYPE_ARRAY) return NULL;
+  src = obj->via.array;
+  if (src == NULL || REFS_LOAD(&src->refs) <= 1) return src;
+
+  // the other owners may hold the numbers from BecoObjectGetDoubles, leave them packed
+  if (src->num_type != BECO_ARRAY_OBJECTS) {
+    if ((array = ArrayNewNums(src->arena, src->num_type, src->nums, src->size)) == NULL) return NULL;
+  } else {
+    ArrayMaterialize(src);
+    if ((array = BecoArrayNewIn(src->arena, src->size)) == NULL) return NULL;
+    for (i = 0; i < src->size; ++i) {
+      ObjectShareInto(&src->items[i], &array->items[i], array->arena);
+    }
+  }
+
+  BecoArrayFree(src);
+  obj->via.array = array;
+  return array;
+}
+
+void BecoObjectFree(struct BecoObject *obj) {
+  if (obj == NULL || (obj->flags & BECO_OBJECT_ARENA)) return;
+  if (obj->flags & BECO_OBJECT_PACKED) {
+    PackFree(obj);
+    return;
+  }
+  ObjectClear(obj);
+  free(obj);
+}
+
+// releases what the object owns, not the object itself
+void ObjectClear(struct BecoObject *obj) {
+  if (obj == NULL || (obj->flags & (BECO_OBJECT_ARENA | BECO_OBJECT_PACKED))) return;
+  switch (obj->type) {
+    case BECO_VALUE_TYPE_NONE:
+    case BECO_VALUE_TYPE_BOOL:
+    case BECO_VALUE_TYPE_INTEGER:
+    case BECO_VALUE_TYPE_POSITIVE_INTEGER:
+    case BECO_VALUE_TYPE_DOUBLE:break;
+    case BECO_VALUE_TYPE_STR: {
+      if (!(obj->flags & (BECO_OBJECT_BORROWED | BECO_OBJECT_INLINE))) free(obj->via.str);
+      obj->via.str = NULL;
+      break;
+    }
+    case BECO_VALUE_TYPE_MAP: {
+      BecoMapFree(obj->via.map);
+      obj->via.map = NULL;
+      break;
+    }
+    case BECO_VALUE_TYPE_ARRAY: {
+      BecoArrayFree(obj->via.array);
+      obj->via.array = NULL;
+      break;
+    }
+  }
+}
+
+struct BecoObject *ObjectPack(struct BecoObject *src) {
+  struct BecoArenaBlock *block = NULL;
+  struct BecoObject *dst = NULL;
+  struct BecoPack pack;
+  size_t nodes = ARENA_ROUND(sizeof(*pack.arena)) + ARENA_ROUND(sizeof(*dst));
+  size_t strs = 0;
+
+  PackMeasure(src, &nodes, &strs);
+  if ((block = ArenaBlockNew(nodes + strs)) == NULL) return NULL;
+  // the arena hands out the nodes, the strings follow them
+  block->size = nodes;
+  pack.arena = (struct BecoArena *) ((char *) block + ARENA_HEADER);
+  memset(pack.arena, 0, sizeof(*pack.arena));
+  pack.arena->head = block;
+  pack.arena->first = block;
+  block->used = ARENA_ROUND(sizeof(*pack.arena));
+  pack.strs = (char *) block + ARENA_HEADER + nodes;
+
+  dst = BecoObjectNewIn(pack.arena);
+  PackCopy(&pack, src, dst);
+  dst->flags = (dst->flags & ~(uint32_t) BECO_OBJECT_ARENA) | BECO_OBJECT_PACKED;
+  return dst;
+}
+
+// what PackCopy takes from the arena, and the bytes of the strings
+void PackMeasure(struct BecoObject *obj, size_t *nodes, size_t *strs) {
+  struct BecoMap *map = NULL;
+  struct BecoArray *array = NULL;
+  size_t i;
+
+  if (obj == NULL) return;
+  switch (obj->type) {
+    case BECO_VALUE_TYPE_STR: {
+      if (!(obj->flags & BECO_OBJECT_INLINE) && BecoObjectGetStr(obj) != NULL) {
+        *strs += BecoObjectGetStrLen(obj) + 1;
+      }
+      break;
+    }
+    case BECO_VALUE_TYPE_MAP: {
+      if ((map = obj->via.map) == NULL) break;
+      MapMaterialize(map);
+      *nodes += ARENA_ROUND(sizeof(*map));
+      if (map->count > 0) *nodes += ARENA_ROUND(map->count * (sizeof(*map->entries) + sizeof(*map->hashes)));
+      if (map->index != NULL) *nodes += ARENA_ROUND((map->index_mask + 1) * sizeof(*map->index));
+      for (i = 0; i < map->count; ++i) {
+        *strs += map->entries[i].len + 1;
+        if (map->entries[i].value == NULL) continue;
+        *nodes += ARENA_ROUND(sizeof(*map->entries[i].value));
+        PackMeasure(map->entries[i].value, nodes, strs);
+      }
+      break;
+    }
+    case BECO_VALUE_TYPE_ARRAY: {
+      if ((array = obj->via.array) == NULL) break;
+      *nodes += ARENA_ROUND(sizeof(*array));
+      if (array->num_type != BECO_ARRAY_OBJECTS) {
+        *nodes += ARENA_ROUND(array->size * sizeof(double));
+        break;
+      }
+      ArrayMaterialize(array);
+      if (array->size > 0) *nodes += ARENA_ROUND(array->size * sizeof(*array->items));
+      for (i = 0; i < array->size; ++i) {
+        PackMeasure(&array->items[i], nodes, strs);
+      }
+      break;
+    }
+    default: {
+      break;
+    }
+  }
+}
+
+void PackCopy(struct BecoPack *pack, struct BecoObject *src, struct BecoObject *dst) {
+  struct BecoMap *map = NULL;
+  struct BecoMapEntry *from = NULL;
+  struct BecoMapEntry *to = NULL;
+  uint32_t size;
+  size_t i, len;
+
+  if (src == NULL) return;
+  dst->type = src->type;
+  switch (src->type) {
+    case BECO_VALUE_TYPE_STR: {
+      if (src->flags & BECO_OBJECT_INLINE) {
+        dst->via = src->via;
+        dst->flags |= BECO_OBJECT_INLINE;
+        break;
+      }
+      if (BecoObjectGetStr(src) == NULL) break;
+      len = BecoObjectGetStrLen(src);
+      dst->via.text.str = PackStr(pack, BecoObjectGetStr(src), len);
+      dst->via.text.len = len;
+      dst->flags |= BECO_OBJECT_BORROWED | BECO_OBJECT_SIZED;
+      break;
+    }
+    case BECO_VALUE_TYPE_MAP: {
+      if (src->via.map == NULL) break;
+      if ((dst->via.map = map = BecoMapNewIn(pack->arena)) == NULL) break;
+      if (src->via.map->count > 0 && MapReserve(map, src->via.map->count) != BECO_ERR_OK) break;
+      // same keys in the same order, the hashes and the index carry over as they are
+      if (src->via.map->count > 0) memcpy(map->hashes, src->via.map->hashes, src->via.map->count * sizeof(*map->hashes));
+      for (i = 0; i < src->via.map->count; ++i) {
+        from = &src->via.map->entries[i];
+        to = &map->entries[i];
+        to->key = PackStr(pack, from->key, from->len);
+        to->len = from->len;
+        to->flags = BECO_OBJECT_BORROWED;
+        to->value = NULL;
+        if (from->value != NULL && (to->value = BecoObjectNewIn(pack->arena)) != NULL) {
+          PackCopy(pack, from->value, to->value);
+        }
+      }
+      map->count = src->via.map->count;
+      if (src->via.map->index != NULL) {
+        size = src->via.map->index_mask + 1;
+        if ((map->index = BecoArenaAlloc(pack->arena, size * sizeof(*map->index))) == NULL) break;
+        memcpy(map->index, src->via.map->index, size * sizeof(*map->index));
+        map->index_mask = src->via.map->index_mask;
+      }
+      break;
+    }
+    case BECO_VALUE_TYPE_ARRAY: {
+      if (src->via.array == NULL) break;
+      if (src->via.array->num_type != BECO_ARRAY_OBJECTS) {
+        dst->via.array = ArrayNewNums(pack->arena, src->via.array->num_type, src->via.array->nums,
+                                      src->via.array->size);
+        break;
+      }
+      dst->via.array = BecoArrayNewIn(pack->arena, src->via.array->size);
+      if (dst->via.array == NULL) break;
+      for (i = 0; i < src->via.array->size; ++i) {
+        PackCopy(pack, &src->via.array->items[i], &dst->via.array->items[i]);
+      }
+      break;
+    }
+    default: {
+      dst->via = src->via;
+    }
+  }
+}
+
+char *PackStr(struct BecoPack *pack, const char *str, size_t len) {
+  char *out = pack->strs;
+
+  memcpy(out, str, len);
+  out[len] = '\0';
+  pack->strs += len + 1;
+  return out;
+}
+
+// the arena lives in the first block of the copy, which is the last one in the chain
+void PackFree(struct BecoObject *obj) {
+  struct BecoArena *arena = (struct BecoArena *) ((char *) obj - ARENA_ROUND(sizeof(*arena)));
+  struct BecoArenaBlock *block = arena->head;
+  struct BecoArenaBlock *next = NULL;
+
+  while (block != NULL) {
+    next = block->next;
+    free(block);
+    block = next;
+  }
+}
+
+struct BecoMap *BecoMapNew() {
+  return BecoMapNewIn(NULL);
+}
+
+struct BecoMap *BecoMapNewIn(struct BecoArena *arena) {
+  struct BecoMap *map = NULL;
+  map = BecoArenaAlloc(arena, sizeof(*map));
+  if (map == NULL) return NULL;
+  memset(map, 0, sizeof(*map));
+  map->refs = 1;
+  map->arena = arena;
+  return map;
+}
+
+void BecoMapPut(struct BecoMap *map, const char *key, struct BecoObject *val) {
+  struct BecoInternKey *ik = NULL;
+  char *copy = NULL;
+  size_t len;
+  unsigned hashv;
+
+  MapMaterialize(map);
+  if ((ik = MapIntern(map, key)) != NULL) {
+    MapAdd(map, ik->key, ik->hh.keylen, ik->hh.hashv, BECO_OBJECT_BORROWED, val);
+    return;
+  }
+  copy = BecoArenaStrdup(map->arena, key);
+  len = strlen(copy);
+  HASH_VALUE(copy, len, hashv);
+  MapAdd(map, copy, len, hashv, map->arena != NULL ? BECO_OBJECT_BORROWED : 0, val);
+}
+
+// keys of arena maps come from the key table of the context where possible
+struct BecoInternKey *MapIntern(struct BecoMap *map, const char *key) {
+  if (map->arena == NULL || map->arena->interns == NULL) return NULL;
+  return InternsGet(map->arena->interns, key, strlen(key));
+}
+
+struct BecoMapEntry *MapInsert(struct BecoMap *map, char *key, uint32_t flags, struct BecoObject *val) {
+  struct BecoInternKey *ik = MapIntern(map, key);
+  size_t len;
+  unsigned hashv;
+
+  if (ik != NULL) return MapAdd(map, ik->key, ik->hh.keylen, ik->hh.hashv, flags | BECO_OBJECT_BORROWED, val);
+  len = strlen(key);
+  HASH_VALUE(key, len, hashv);
+  return MapAdd(map, key, len, hashv, flags, val);
+}
+
+// a key put again replaces the value and keeps its place
+struct BecoMapEntry *MapAdd(struct BecoMap *map, char *key, size_t len, unsigned hashv, uint32_t flags,
+                            struct BecoObject *val) {
+  struct BecoMapEntry *entry = MapLookup(map, key, len, hashv);
+
+  if (entry != NULL) {
+    if (entry->value != val) BecoObjectFree(entry->value);
+    entry->value = val;
+    if (!(flags & BECO_OBJECT_BORROWED)) free(key);
+    return entry;
+  }
+  if (map->count == map->cap && MapReserve(map, map->cap > 0 ? map->cap * 2 : MAP_MIN_SIZE) != BECO_ERR_OK) {
+    return NULL;
+  }
+
+  entry = &map->entries[map->count];
+  entry->key = key;
+  entry->value = val;
+  entry->len = (uint32_t) len;
+  entry->flags = flags;
+  map->hashes[map->count++] = hashv;
+  if (map->index != NULL || map->count >= MAP_INDEX_MIN) MapIndexAdd(map, map->count - 1);
+  return entry;
+}
+
+BecoError MapReserve(struct BecoMap *map, uint32_t size) {
+  struct BecoMapEntry *entries = NULL;
+  uint32_t *hashes = NULL;
+
+  if (size <= map->cap) return BECO_ERR_OK;
+
+  // entries and hashes share one allocation
+  entries = BecoArenaAlloc(map->arena, size * (sizeof(*entries) + sizeof(*hashes)));
+  if (entries == NULL) return BECO_ERR_OVERFLOW;
+  hashes = (uint32_t *) (entries + size);
+  if (map->count > 0) {
+    memcpy(entries, map->entries, map->count * sizeof(*entries));
+    memcpy(hashes, map->hashes, map->count * sizeof(*hashes));
+  }
+  ArenaFree(map->arena, map->entries);
+  map->entries = entries;
+  map->hashes = hashes;
+  map->cap = size;
+  return BECO_ERR_OK;
+}
+
+void MapIndexAdd(struct BecoMap *map, uint32_t pos) {
+  uint32_t slot;
+
+  // kept at most half full
+  if (map->index == NULL || map->count * 2 > map->index_mask + 1) {
+    MapReindex(map);
+    return;
+  }
+  slot = map->hashes[pos] & map->index_mask;
+  while (map->index[slot] != 0) slot = (slot + 1) & map->index_mask;
+  map->index[slot] = pos + 1;
+}
+
+void MapReindex(struct BecoMap *map) {
+  uint32_t size = MAP_INDEX_MIN * 2;
+  uint32_t *index = NULL;
+  uint32_t i, slot;
+
+  while (size < map->count * 4) size *= 2;
+  ArenaFree(map->arena, map->index);
+  map->index = NULL;
+  map->index_mask = 0;
+  // without an index lookups fall back to scanning
+  if ((index = BecoArenaAlloc(map->arena, size * sizeof(*index))) == NULL) return;
+  memset(index, 0, size * sizeof(*index));
+  for (i = 0; i < map->count; ++i) {
+    slot = map->hashes[i] & (size - 1);
+    while (index[slot] != 0) slot = (slot + 1) & (size - 1);
+    index[slot] = i + 1;
+  }
+  map->index = index;
+  map->index_mask = size - 1;
+}
+
+struct BecoMapEntry *MapLookup(struct BecoMap *map, const char *key, size_t len, unsigned hashv) {
+  struct BecoMapEntry *entry = NULL;
+  uint32_t i, pos;
+
+  if (map->index == NULL) {
+    // small maps scan the packed hashes
+    for (i = 0; i < map->count; ++i) {
+      if (map->hashes[i] != hashv) continue;
+      entry = &map->entries[i];
+      if (entry->len == len && (entry->key == key || memcmp(entry->key, key, len) == 0)) return entry;
+    }
+    return NULL;
+  }
+  for (i = hashv & map->index_mask; (pos = map->index[i]) != 0; i = (i + 1) & map->index_mask) {
+    if (map->hashes[pos - 1] != hashv) continue;
+    entry = &map->entries[pos - 1];
+    if (entry->len == len && (entry->key == key || memcmp(entry->key, key, len) == 0)) return entry;
+  }
+  return NULL;
+}
+
+// looks into the document of a lazy map when the key wasn't converted yet
+struct BecoMapEntry *MapFind(struct BecoMap *map, const char *key) {
+  struct BecoMapEntry *out = NULL;
+  size_t len = strlen(key);
+  unsigned hashv;
+  yyjson_obj_iter iter;
+  yyjson_val *k;
+
+  HASH_VALUE(key, len, hashv);
+  out = MapLookup(map, key, len, hashv);
+  if (out != NULL || map->view == NULL) return out;
+
+  yyjson_obj_iter_init(map->view, &iter);
+  while ((k = yyjson_obj_iter_next(&iter))) {
+    if (strcmp(yyjson_get_str(k), key) != 0) continue;
+    return MapInsert(map, (char *) yyjson_get_str(k), BECO_OBJECT_BORROWED,
+                     ViewNew(yyjson_obj_iter_get_val(k), map->arena));
+  }
+  return NULL;
+}
+
+// converts the remaining keys, the ones looked up before take their place in document order
+void MapMaterialize(struct BecoMap *map) {
+  struct BecoMap cached;
+  struct BecoMapEntry *entry = NULL;
+  yyjson_val *view = map->view;
+  yyjson_obj_iter iter;
+  yyjson_val *k;
+  const char *key;
+  size_t len;
+  unsigned hashv;
+
+  if (view == NULL) return;
+  cached = *map;
+  map->entries = NULL;
+  map->hashes = NULL;
+  map->count = 0;
+  map->cap = 0;
+  map->index = NULL;
+  map->index_mask = 0;
+  map->view = NULL;
+  MapReserve(map, (uint32_t) yyjson_obj_size(view));
+
+  yyjson_obj_iter_init(view, &iter);
+  while ((k = yyjson_obj_iter_next(&iter))) {
+    key = yyjson_get_str(k);
+    len = strlen(key);
+    HASH_VALUE(key, len, hashv);
+    entry = MapLookup(&cached, key, len, hashv);
+    MapInsert(map, (char *) key, BECO_OBJECT_BORROWED,
+              entry != NULL ? entry->value : ViewNew(yyjson_obj_iter_get_val(k), map->arena));
+  }
+}
+
+void ArrayMaterialize(struct BecoArray *array) {
+  yyjson_val *view = array->view;
+  yyjson_arr_iter iter;
+  yyjson_val *val;
+  size_t pos = 0;
+
+  if (array->num_type != BECO_ARRAY_OBJECTS) ArrayUnpack(array);
+  if (view == NULL) return;
+  array->view = NULL;
+
+  if (array->size == 0) return;
+  array->items = BecoArenaAlloc(array->arena, sizeof(*array->items) * array->size);
+  if (array->items == NULL) {
+    array->size = 0;
+    return;
+  }
+  array->cap = array->size;
+  ArrayInit(array, 0, array->size);
+  yyjson_arr_iter_init(view, &iter);
+  while ((val = yyjson_arr_iter_next(&iter)) && pos < array->size) {
+    JsonToObj(val, &array->items[pos++], array->arena, true);
+  }
+}
+
+// plain numbers back to objects, integers get the types a parsed document gives them
+void ArrayUnpack(struct BecoArray *array) {
+  enum BecoArrayType type = array->num_type;
+  void *nums = array->nums;
+  struct BecoObject *item = NULL;
+  int64_t val;
+  size_t i;
+
+  array->num_type = BECO_ARRAY_OBJECTS;
+  array->nums = NULL;
+  array->items = BecoArenaAlloc(array->arena, sizeof(*array->items) * array->size);
+  if (array->items == NULL) {
+    array->size = 0;
+    ArenaFree(array->arena, nums);
+    return;
+  }
+  array->cap = array->size;
+  ArrayInit(array, 0, array->size);
+  for (i = 0; i < array->size; ++i) {
+    item = &array->items[i];
+    if (type == BECO_ARRAY_DOUBLE) {
+      item->type = BECO_VALUE_TYPE_DOUBLE;
+      item->via.f64 = ((double *) nums)[i];
+      continue;
+    }
+    val = ((int64_t *) nums)[i];
+    item->type = val < 0 ? BECO_VALUE_TYPE_INTEGER : BECO_VALUE_TYPE_POSITIVE_INTEGER;
+    item->via.i64 = val;
+  }
+  ArenaFree(array->arena, nums);
+}
+
+enum BecoArrayType ViewNumType(yyjson_val *arr) {
+  enum BecoArrayType type = BECO_ARRAY_OBJECTS;
+  yyjson_arr_iter iter;
+  yyjson_val *val;
+  uint8_t tag;
+
+  yyjson_arr_iter_init(arr, &iter);
+  while ((val = yyjson_arr_iter_next(&iter))) {
+    tag = unsafe_yyjson_get_tag(val);
+    if (tag == (YYJSON_TYPE_NUM | YYJSON_SUBTYPE_REAL)) {
+      if (type == BECO_ARRAY_INT64) return BECO_ARRAY_OBJECTS;
+      type = BECO_ARRAY_DOUBLE;
+    } else if (tag == (YYJSON_TYPE_NUM | YYJSON_SUBTYPE_SINT)
+               || (tag == (YYJSON_TYPE_NUM | YYJSON_SUBTYPE_UINT) && unsafe_yyjson_get_uint(val) <= INT64_MAX)) {
+      if (type == BECO_ARRAY_DOUBLE) return BECO_ARRAY_OBJECTS;
+      type = BECO_ARRAY_INT64;
+    } else {
+      return BECO_ARRAY_OBJECTS;
+    }
+  }
+  return type;
+}
+
+// the type shared by every element, BECO_ARRAY_OBJECTS for anything else
+enum BecoArrayType ArrayNumType(struct BecoArray *array) {
+  enum BecoArrayType type = BECO_ARRAY_OBJECTS;
+  struct BecoObject *item = NULL;
+  size_t i;
+
+  if (array->num_type != BECO_ARRAY_OBJECTS || array->size == 0) return array->num_type;
+  if (array->view != NULL) return ViewNumType(array->view);
+  for (i = 0; i < array->size; ++i) {
+    item = &array->items[i];
+    if (item->type == BECO_VALUE_TYPE_DOUBLE) {
+      if (type == BECO_ARRAY_INT64) return BECO_ARRAY_OBJECTS;
+      type = BECO_ARRAY_DOUBLE;
+    } else if (item->type == BECO_VALUE_TYPE_INTEGER
+               || (item->type == BECO_VALUE_TYPE_POSITIVE_INTEGER && item->via.u64 <= INT64_MAX)) {
+      if (type == BECO_ARRAY_DOUBLE) return BECO_ARRAY_OBJECTS;
+      type = BECO_ARRAY_INT64;
+    } else {
+      return BECO_ARRAY_OBJECTS;
+    }
+  }
+  return type;
+}
+
+// every element is of type already, see ArrayNumType
+bool ArrayPack(struct BecoArray *array, enum BecoArrayType type) {
+  yyjson_arr_iter iter;
+  yyjson_val *val;
+  int64_t *ints = NULL;
+  double *reals = NULL;
+  void *nums = NULL;
+  size_t i = 0;
+
+  if (array->num_type == type) return true;
+  nums = BecoArenaAlloc(array->arena, array->size * (type == BECO_ARRAY_DOUBLE ? sizeof(*reals) : sizeof(*ints)));
+  if (nums == NULL) return false;
+  ints = nums;
+  reals = nums;
+
+  // the integer and real members of a value share their storage
+  if (array->view != NULL) {
+    yyjson_arr_iter_init(array->view, &iter);
+    while ((val = yyjson_arr_iter_next(&iter)) && i < array->size) {
+      if (type == BECO_ARRAY_DOUBLE) reals[i++] = unsafe_yyjson_get_real(val);
+      else ints[i++] = unsafe_yyjson_get_sint(val);
+    }
+    array->view = NULL;
+  } else {
+    for (i = 0; i < array->size; ++i) {
+      if (type == BECO_ARRAY_DOUBLE) reals[i] = array->items[i].via.f64;
+      else ints[i] = array->items[i].via.i64;
+    }
+    ArenaFree(array->arena, array->items);
+    array->items = NULL;
+    array->cap = 0;
+  }
+  array->nums = nums;
+  array->num_type = type;
+  return true;
+}
+
+struct BecoArray *ArrayNewNums(struct BecoArena *arena, enum BecoArrayType type, const void *nums, size_t count) {
+  struct BecoArray *array = BecoArrayNewIn(arena, 0);
+  size_t size = count * (type == BECO_ARRAY_DOUBLE ? sizeof(double) : sizeof(int64_t));
+
+  if (array == NULL) return NULL;
+  if (count == 0) return array;
+  if (count > SIZE_MAX / sizeof(double) || (array->nums = BecoArenaAlloc(arena, size)) == NULL) {
+    BecoArrayFree(array);
+    return NULL;
+  }
+  if (nums != NULL) memcpy(array->nums, nums, size);
+  else memset(array->nums, 0, size);
+  array->num_type = type;
+  array->size = count;
+  return array;
+}
+
+void *ObjectNums(struct BecoObject *obj, enum BecoArrayType type, size_t *len) {
+  struct BecoArray *array = NULL;
+
+  if (len != NULL) *len = 0;
+  if (obj == NULL || obj->type != BECO_VALUE_TYPE_ARRAY || (array = obj->via.array) == NULL) return NULL;
+  if (ArrayNumType(array) != type || !ArrayPack(array, type)) return NULL;
+  if (len != NULL) *len = array->size;
+  return array->nums;
+}
+
+int64_t *BecoObjectGetInt64s(struct BecoObject *obj, size_t *len) {
+  return ObjectNums(obj, BECO_ARRAY_INT64, len);
+}
+
+double *BecoObjectGetDoubles(struct BecoObject *obj, size_t *len) {
+  return ObjectNums(obj, BECO_ARRAY_DOUBLE, len);
+}
+
+BecoError ObjectSetNums(struct BecoArena *arena, struct BecoObject *obj, enum BecoArrayType type, const void *nums,
+                        size_t count) {
+  struct BecoArray *array = NULL;
+
+  if (obj == NULL) return BECO_ERR_NULL;
+  if ((array = ArrayNewNums(arena, type, nums, count)) == NULL) return BECO_ERR_OVERFLOW;
+  ObjectClear(obj);
+  obj->type = BECO_VALUE_TYPE_ARRAY;
+  obj->flags &= ~(uint32_t) (BECO_OBJECT_BORROWED | BECO_OBJECT_INLINE | BECO_OBJECT_SIZED);
+  obj->via.array = array;
+  return BECO_ERR_OK;
+}
+
+BecoError BecoObjectSetInt64sIn(struct BecoArena *arena, struct BecoObject *obj, const int64_t *nums, size_t count) {
+  return ObjectSetNums(arena, obj, BECO_ARRAY_INT64, nums, count);
+}
+
+BecoError BecoObjectSetDoublesIn(struct BecoArena *arena, struct BecoObject *obj, const double *nums, size_t count) {
+  return ObjectSetNums(arena, obj, BECO_ARRAY_DOUBLE, nums, count);
+}
+
+struct BecoObject *ViewNew(yyjson_val *val, struct BecoArena *arena) {
+  struct BecoObject *obj = BecoObjectNewIn(arena);
+  if (obj == NULL) return NULL;
+  JsonToObj(val, obj, arena, true);
+  return obj;
+}
+
+struct BecoObject *BecoMapGet(struct BecoMap *map, const char *key) {
+  if (map == NULL || key == NULL) return NULL;
+
+  struct BecoMapEntry *out = MapFind(map, key);
+  if (out == NULL) return NULL;
+  return out->value;
+}
+
+struct BecoObject *BecoMapGetInterned(struct BecoMap *map, const char *key) {
+  if (map == NULL || key == NULL) return NULL;
+
+  struct BecoMapEntry *out = NULL;
+  // only valid for keys from BecoIntern, see beco.h
+  const struct BecoInternKey *ik = (const struct BecoInternKey *) (key - offsetof(struct BecoInternKey, key));
+
+  if (map->view != NULL) out = MapFind(map, key);
+  else out = MapLookup(map, key, ik->hh.keylen, ik->hh.hashv);
+  if (out == NULL) return NULL;
+  return out->value;
+}
+
+bool BecoMapContainsKey(struct BecoMap *map, const char *key) {
+  if (map == NULL || key == NULL) return false;
+  return MapFind(map, key) != NULL;
+}
+
+bool BecoMapNext(struct BecoMap *map, size_t *pos, const char **key, size_t *len, struct BecoObject **value) {
+  struct BecoMapEntry *entry = NULL;
+
+  if (map == NULL || pos == NULL) return false;
+  MapMaterialize(map);
+  if (*pos >= map->count) return false;
+  entry = &map->entries[(*pos)++];
+  if (key != NULL) *key = entry->key;
+  if (len != NULL) *len = entry->len;
+  if (value != NULL) *value = entry->value;
+  return true;
+}
+
+struct BecoMap *BecoMapRetain(struct BecoMap *map) {
+  if (map != NULL) REFS_ADD(&map->refs, 1);
+  return map;
+}
+
+void BecoMapFree(struct BecoMap *map) {
+  if (map == NULL || REFS_ADD(&map->refs, -1) > 0 || map->arena != NULL) return;
+  uint32_t i;
+
+  for (i = 0; i < map->count; ++i) {
+    if (!(map->entries[i].flags & BECO_OBJECT_BORROWED)) free(map->entries[i].key);
+    BecoObjectFree(map->entries[i].value);
+  }
+  free(map->entries);
+  free(map->index);
+  free(map);
+}
+
+struct BecoArray *BecoArrayNew(size_t size) {
+  return BecoArrayNewIn(NULL, size);
+}
+
+struct BecoArray *BecoArrayNewIn(struct BecoArena *arena, size_t size) {
+  struct BecoArray *arr = NULL;
+  arr = BecoArenaAlloc(arena, sizeof(*arr));
+  if (arr == NULL) return NULL;
+  memset(arr, 0, sizeof(*arr));
+  arr->refs = 1;
+  arr->arena = arena;
+  if (size > 0 && BecoArrayReserve(arr, size) != BECO_ERR_OK) {
+    ArenaFree(arena, arr);
+    return NULL;
+  }
+  ArrayInit(arr, 0, size);
+  arr->size = size;
+  return arr;
+}
+
+// empty values, owned by the arena for arena arrays
+void ArrayInit(struct BecoArray *array, size_t from, size_t to) {
+  size_t i;
+  if (to <= from) return;
+  memset(array->items + from, 0, (to - from) * sizeof(*array->items));
+  if (array->arena == NULL) return;
+  for (i = from; i < to; ++i) {
+    array->items[i].flags = BECO_OBJECT_ARENA;
+  }
+}
+
+BecoError BecoArrayReserve(struct BecoArray *array, size_t cap) {
+  struct BecoObject *items = NULL;
+
+  if (array == NULL) return BECO_ERR_NULL;
+  ArrayMaterialize(array);
+  if (cap <= array->cap) return BECO_ERR_OK;
+  if (cap > SIZE_MAX / sizeof(*items)) return BECO_ERR_OVERFLOW;
+
+  items = BecoArenaAlloc(array->arena, cap * sizeof(*items));
+  if (items == NULL) return BECO_ERR_OVERFLOW;
+  if (array->size > 0) memcpy(items, array->items, array->size * sizeof(*items));
+  ArenaFree(array->arena, array->items);
+  array->items = items;
+  array->cap = cap;
+  return BECO_ERR_OK;
+}
+
+struct BecoObject *BecoArrayPush(struct BecoArray *array) {
+  if (array == NULL) return NULL;
+  ArrayMaterialize(array);
+  if (array->size == array->cap &&
+      BecoArrayReserve(array, array->cap < 4 ? 8 : array->cap * 2) != BECO_ERR_OK) {
+    return NULL;
+  }
+  ArrayInit(array, array->size, array->size + 1);
+  return &array->items[array->size++];
+}
+
+struct BecoObject *BecoArrayPop(struct BecoArray *array) {
+  struct BecoObject *obj = NULL;
+
+  if (array == NULL) return NULL;
+  ArrayMaterialize(array);
+  if (array->size == 0) return NULL;
+  obj = BecoArenaAlloc(array->arena, sizeof(*obj));
+  if (obj == NULL) return NULL;
+  *obj = array->items[--array->size];
+  return obj;
+}
+
+BecoError BecoArrayAppend(struct BecoArray *array, const struct BecoObject *items, size_t count) {
+  size_t cap;
+
+  if (array == NULL || (items == NULL && count > 0)) return BECO_ERR_NULL;
+  ArrayMaterialize(array);
+  if (count > SIZE_MAX - array->size) return BECO_ERR_OVERFLOW;
+  if (array->size + count > array->cap) {
+    cap = array->cap * 2 > array->size + count ? array->cap * 2 : array->size + count;
+    if (BecoArrayReserve(array, cap) != BECO_ERR_OK) return BECO_ERR_OVERFLOW;
+  }
+  if (count > 0) memcpy(array->items + array->size, items, count * sizeof(*items));
+  array->size += count;
+  return BECO_ERR_OK;
+}
+
+size_t BecoArrayLen(struct BecoArray *array) {
+  if (array == NULL) return 0;
+  return array->size;
+}
+
+void BecoArrayAdd(struct BecoArray *array, size_t pos, struct BecoObject *obj) {
+  struct BecoObject *slot = NULL;
+
+  if (array != NULL) ArrayMaterialize(array);
+  if (array == NULL || obj == NULL || pos > array->size) return;
+  if (obj->flags & BECO_OBJECT_PACKED) {
+    // the contents can't be moved out of the block they're packed in
+    slot = ObjectCopy(obj, array->arena);
+    BecoObjectFree(obj);
+    if ((obj = slot) == NULL) return;
+  }
+  if (pos == array->size) {
+    if ((slot = BecoArrayPush(array)) == NULL) return;
+  } else {
+    slot = &array->items[pos];
+    ObjectClear(slot);
+  }
+  *slot = *obj;
+  if (!(obj->flags & BECO_OBJECT_ARENA)) free(obj);
+}
+
+struct BecoObject *BecoArrayGet(struct BecoArray *array, size_t pos) {
+  if (array != NULL) ArrayMaterialize(array);
+  if (array == NULL || pos >= array->size) return NULL;
+  return &array->items[pos];
+}
+
+struct BecoArray *BecoArrayRetain(struct BecoArray *array) {
+  if (array != NULL) REFS_ADD(&array->refs, 1);
+  return array;
+}
+
+void BecoArrayFree(struct BecoArray *array) {
+  if (array == NULL || REFS_ADD(&array->refs, -1) > 0 || array->arena != NULL) return;
+  size_t i;
+
+  for (i = 0; i < array->size && array->items != NULL; ++i) {
+    ObjectClear(&array->items[i]);
+  }
+  free(array->items);
+  free(array->nums);
+  free(array);
+}
+
+struct BecoKV *BecoKVNew() {
+  struct BecoKV *obj = NULL;
+  obj = malloc(sizeof(*obj));
+  memset(obj, 0, sizeof(*obj));
+  return obj;
+}
+
+void BecoKVFree(struct BecoKV *kv) {
+  if (kv == NULL) return;
+  if (!(kv->flags & BECO_OBJECT_BORROWED)) free(kv->key);
+  BecoObjectFree(kv->value);
+  free(kv);
+}
+
+void BecoKVSetKey(struct BecoKV *kv, const char *key) {
+  if (kv == NULL) return;
+  kv->key = strdup(key);
+}
+
+void BecoKVSetValue(struct BecoKV *kv, struct BecoObject *obj) {
+  if (kv == NULL) return;
+  kv->value = obj;
+}
+
+void BecoBufferInit(struct BecoBuffer *buf) {
+  if (buf == NULL) return;
+  memset(buf, 0, sizeof(*buf));
+}
+
+BecoError BecoBufferReserve(struct BecoBuffer *buf, size_t size) {
+  if (buf == NULL) return BECO_ERR_NULL;
+  if (size <= buf->cap) return BECO_ERR_OK;
+
+  char *data = NULL;
+  size_t cap = buf->cap < BUFFER_MIN_SIZE ? BUFFER_MIN_SIZE : buf->cap;
+
+  while (cap < size) {
+    if (cap > SIZE_MAX / 2) {
+      cap = size;
+      break;
+    }
+    cap *= 2;
+  }
+
+  data = realloc(buf->data, cap);
+  if (data == NULL) return BECO_ERR_OVERFLOW;
+
+  buf->data = data;
+  buf->cap = cap;
+  return BECO_ERR_OK;
+}
+
+void BecoBufferShrink(struct BecoBuffer *buf, size_t size) {
+  if (buf == NULL || size >= buf->cap) return;
+
+  char *data = NULL;
+
+  if (size == 0) {
+    BecoBufferDestroy(buf);
+    return;
+  }
+
+  data = realloc(buf->data, size);
+  if (data == NULL) return;
+
+  buf->data = data;
+  buf->cap = size;
+  if (buf->len > size) buf->len = size;
+}
+
+void BecoBufferDestroy(struct BecoBuffer *buf) {
+  if (buf == NULL) return;
+  free(buf->data);
+  memset(buf, 0, sizeof(*buf));
+}
+
+BecoError WriteFrame(struct BecoContext *ctx, const char *data, size_t dlen) {
+  if (dlen > SIZE_1M) {
+    return BECO_ERR_OVERFLOW;
+  }
+  return WriteOut(ctx, ctx->transport->write, data, dlen, dlen);
+}
+
+// frame starts with FRAME_HEADER bytes of room for the length, the payload follows
+BecoError WriteFramed(struct BecoContext *ctx, struct BecoBuffer *frame) {
+  uint32_t len = (uint32_t) (frame->len - FRAME_HEADER);
+
+  if (frame->len - FRAME_HEADER > SIZE_1M) {
+    return BECO_ERR_OVERFLOW;
+  }
+  memcpy(frame->data, &len, sizeof(len));
+  return WriteFrameBytes(ctx, frame->data, frame->len);
+}
+
+// a complete frame, its length header is filled in already
+BecoError WriteFrameBytes(struct BecoContext *ctx, const char *frame, size_t flen) {
+  size_t dlen = flen - FRAME_HEADER;
+
+  if (ctx->transport->write_frame == NULL) {
+    return WriteOut(ctx, ctx->transport->write, frame + FRAME_HEADER, dlen, dlen);
+  }
+  return WriteOut(ctx, ctx->transport->write_frame, frame, flen, dlen);
+}
+
+BecoError WriteOut(struct BecoContext *ctx, BecoTransportWriteFunc write, const char *data, size_t len,
+                   size_t dlen) {
+  BecoError err = BECO_ERR_OK;
+  uint64_t since;
+
+  if (ctx->out_frames_pending == 0) ctx->out_pending_since = MonotonicMs();
+  ctx->out_frames_pending++;
+  ctx->out_bytes_pending += FRAME_HEADER + dlen;
+  ctx->stats.frames_written++;
+
+  since = MonotonicUs();
+  err = write(ctx, data, len);
+  WriteBlocked(ctx, since);
+  if (err != BECO_ERR_OK) {
+    return err;
+  }
+
+  switch (ctx->flush_policy) {
+    case BECO_FLUSH_IMMEDIATE: {
+      err = BecoFlush(ctx);
+      break;
+    }
+    case BECO_FLUSH_IDLE: {
+      break;
+    }
+    case BECO_FLUSH_THRESHOLD: {
+      if (ctx->out_bytes_pending >= ctx->flush_bytes
+          || MonotonicMs() - ctx->out_pending_since >= ctx->flush_delay_ms) {
+        err = BecoFlush(ctx);
+      }
+      break;
+    }
+  }
+  return err;
+}
+
+void WriteBlocked(struct BecoContext *ctx, uint64_t since) {
+  uint64_t spent = MonotonicUs() - since;
+
+  ctx->stats.write_blocked_us += spent;
+  if (spent > ctx->stats.max_write_blocked_us) ctx->stats.max_write_blocked_us = spent;
+}
+
+void OutputFlushed(struct BecoContext *ctx) {
+  if (ctx->out_frames_pending == 0) return;
+
+  ctx->stats.flushes++;
+  ctx->stats.frames_flushed += ctx->out_frames_pending;
+  if (ctx->out_frames_pending > ctx->stats.max_frames_per_flush)
+    ctx->stats.max_frames_per_flush = ctx->out_frames_pending;
+  ctx->out_frames_pending = 0;
+  ctx->out_bytes_pending = 0;
+}
+
+void RecvBufferTrim(struct BecoContext *ctx) {
+  struct BecoBuffer *buf = &ctx->recv_buf;
+
+  // a frame is still arriving
+  if (RecvStarted(ctx)) return;
+  // a request still points into it
+  if (ctx->recv_lease != NULL && ctx->recv_lease->refs > 1) return;
+  if (ctx->recv_lease != NULL) LeaseReset(ctx->recv_lease);
+
+  if (buf->cap <= ctx->recv_keep_size) return;
+
+  if (buf->cap > ctx->recv_spike_size || MonotonicMs() - ctx->recv_spike_at >= ctx->recv_idle_ms) {
+    BecoBufferShrink(buf, ctx->recv_keep_size);
+  }
+}
+
+void RecvBufferDetach(struct BecoContext *ctx) {
+  struct BecoLease *lease = ctx->recv_lease;
+
+  if (lease == NULL || lease->refs == 1) return;
+
+  lease->data = ctx->recv_buf.data;
+  BecoBufferInit(&ctx->recv_buf);
+  ctx->recv_lease = NULL;
+  LeaseRelease(lease);
+}
+
+// leftovers of a frame which failed half way
+BecoError RecvPrepare(struct BecoContext *ctx) {
+  BecoError err = BECO_ERR_OK;
+
+  if (ctx->parser != NULL) ParserReset(ctx->parser);
+  RecvBufferDetach(ctx);
+  if ((err = RecvLease(ctx)) != BECO_ERR_OK) {
+    return err;
+  }
+  LeaseReset(ctx->recv_lease);
+  return err;
+}
+
+bool RecvStarted(struct BecoContext *ctx) {
+  struct BecoRing *ring = ctx->transport_data;
+  return ctx->transport == &kFdTransport && ring != NULL && ring->large != 0;
+}
+
+void LeaseRelease(struct BecoLease *lease) {
+  if (lease == NULL || --lease->refs > 0) return;
+  ArenaDestroy(&lease->arena);
+  InternsRelease(lease->arena.interns);
+  if (lease->doc != NULL) yyjson_doc_free(lease->doc);
+  free(lease->data);
+  free(lease);
+}
+
+void LeaseReset(struct BecoLease *lease) {
+  ArenaReset(&lease->arena);
+  if (lease->doc != NULL) yyjson_doc_free(lease->doc);
+  lease->doc = NULL;
+}
+
+BecoError RecvLease(struct BecoContext *ctx) {
+  if (ctx->recv_lease != NULL) return BECO_ERR_OK;
+
+  ctx->recv_lease = malloc(sizeof(*ctx->recv_lease));
+  if (ctx->recv_lease == NULL) return BECO_ERR_OVERFLOW;
+  memset(ctx->recv_lease, 0, sizeof(*ctx->recv_lease));
+  ctx->recv_lease->refs = 1;
+  if ((ctx->recv_lease->arena.interns = ContextInterns(ctx)) != NULL) ctx->interns->refs++;
+  return BECO_ERR_OK;
+}
+
+struct BecoInterns *ContextInterns(struct BecoContext *ctx) {
+  struct BecoInternKey *ik = NULL;
+
+  if (ctx->interns != NULL) return ctx->interns;
+  if ((ctx->interns = malloc(sizeof(*ctx->interns))) == NULL) return NULL;
+  memset(ctx->interns, 0, sizeof(*ctx->interns));
+  ctx->interns->refs = 1;
+  if ((ik = InternsGet(ctx->interns, "command", 7)) != NULL) ctx->command_key = ik->key;
+  return ctx->interns;
+}
+
+struct BecoInternKey *InternsGet(struct BecoInterns *interns, const char *key, size_t len) {
+  struct BecoInternKey *ik = NULL;
+  unsigned hashv;
+
+  if (len > INTERN_MAX_KEY) {
+    interns->misses++;
+    return NULL;
+  }
+  HASH_VALUE(key, len, hashv);
+  HASH_FIND_BYHASHVALUE(hh, interns->keys, key, len, hashv, ik);
+  if (ik != NULL) {
+    interns->hits++;
+    return ik;
+  }
+  interns->misses++;
+
+  // requests decide what ends up here, the table stops growing at some point
+  if (HASH_COUNT(interns->keys) >= INTERN_MAX_COUNT) return NULL;
+  if ((ik = malloc(sizeof(*ik) + len)) == NULL) return NULL;
+  memcpy(ik->key, key, len);
+  ik->key[len] = '\0';
+  HASH_ADD_KEYPTR_BYHASHVALUE(hh, interns->keys, ik->key, len, hashv, ik);
+  return ik;
+}
+
+void InternsRelease(struct BecoInterns *interns) {
+  struct BecoInternKey *ik, *temp;
+
+  if (interns == NULL || --interns->refs > 0) return;
+  HASH_ITER(hh, interns->keys, ik, temp) {
+    HASH_DEL(interns->keys, ik);
+    free(ik);
+  }
+  free(interns);
+}
+
+void *BecoArenaAlloc(struct BecoArena *arena, size_t size) {
+  struct BecoArenaBlock *block = NULL;
+
+  if (arena == NULL) return malloc(size);
+
+  size = (size + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1);
+  block = arena->head;
+  if (block != NULL && block->size - block->used >= size) {
+    block->used += size;
+    return (char *) block + ARENA_HEADER + block->used - size;
+  }
+
+  // large ones get a block of their own, the current block keeps serving the small ones
+  if (block != NULL && size > ARENA_BLOCK_SIZE / 4) {
+    if ((block = ArenaBlockNew(size)) == NULL) return NULL;
+    block->next = arena->head->next;
+    arena->head->next = block;
+  } else {
+    if ((block = ArenaBlockNew(size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE)) == NULL) return NULL;
+    block->next = arena->head;
+    arena->head = block;
+    if (arena->first == NULL) arena->first = block;
+  }
+  block->used = size;
+  return (char *) block + ARENA_HEADER;
+}
+
+char *BecoArenaStrdup(struct BecoArena *arena, const char *str) {
+  if (str == NULL) return NULL;
+
+  size_t len = strlen(str) + 1;
+  char *out = BecoArenaAlloc(arena, len);
+
+  if (out != NULL) memcpy(out, str, len);
+  return out;
+}
+
+struct BecoArenaBlock *ArenaBlockNew(size_t size) {
+  struct BecoArenaBlock *block = NULL;
+
+  block = malloc(ARENA_HEADER + size);
+  if (block == NULL) return NULL;
+  block->next = NULL;
+  block->size = size;
+  block->used = 0;
+  return block;
+}
+
+void ArenaFree(struct BecoArena *arena, void *ptr) {
+  if (arena == NULL) free(ptr);
+}
+
+void ArenaReset(struct BecoArena *arena) {
+  struct BecoArenaBlock *block = arena->head;
+  struct BecoArenaBlock *next = NULL;
+
+  // a first block grown for one large allocation isn't worth keeping
+  if (arena->first != NULL && arena->first->size > ARENA_BLOCK_SIZE) {
+    arena->first = NULL;
+  }
+  while (block != NULL) {
+    next = block->next;
+    if (block != arena->first) free(block);
+    block = next;
+  }
+  arena->head = arena->first;
+  if (arena->first != NULL) {
+    arena->first->next = NULL;
+    arena->first->used = 0;
+  }
+}
+
+void ArenaDestroy(struct BecoArena *arena) {
+  struct BecoArenaBlock *block = arena->head;
+  struct BecoArenaBlock *next = NULL;
+
+  while (block != NULL) {
+    next = block->next;
+    free(block);
+    block = next;
+  }
+  arena->head = NULL;
+  arena->first = NULL;
+}
+
+uint64_t MonotonicMs() {
+#ifdef _WIN32
+  return GetTickCount64();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+#endif
+}
+
+uint64_t MonotonicUs() {
+#ifdef _WIN32
+  return GetTickCount64() * 1000;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+#endif
+}
+
+int StreamFd(int fd, FILE *file) {
+#ifdef _WIN32
+  return -1;
+#else
+  if (fd != -1) return fd;
+  return file != NULL ? fileno(file) : -1;
+#endif
+}
+
+uint64_t PipeQueued(int fd) {
+#ifdef _WIN32
+  return 0;
+#else
+  int n = 0;
+
+  // a pipe reports what is in it from either end
+  if (fd == -1 || ioctl(fd, FIONREAD, &n) != 0 || n < 0) return 0;
+  return (uint64_t) n;
+#endif
+}
+
+uint64_t PipeSize(int fd) {
+#ifdef __linux__
+  int n;
+
+  if (fd == -1 || (n = fcntl(fd, F_GETPIPE_SZ)) < 0) return 0;
+  return (uint64_t) n;
+#else
+  return 0;
+#endif
+}
+
+struct BecoRequestHandler *CreateHandler(const char *cmd, BecoRequestHandlerFunc handler, void *user_data) {
+  struct BecoRequestHandler *entry = NULL;
+  entry = malloc(sizeof(*entry));
+  memset(entry, 0, sizeof(*entry));
+
+  if (cmd != NULL)
+    entry->cmd = strdup(cmd);
+
+  entry->handler = handler;
+  entry->user_data = user_data;
+  return entry;
+}
+
+BecoError InvokeHandler(struct BecoContext *ctx, struct BecoRequestHandler *entry, struct BecoRequest *req) {
+  if (ctx == NULL || entry == NULL || req == NULL) return BECO_ERR_NULL;
+  if (entry->handler == NULL) return BECO_ERR_NULL;
+
+  BecoError err;
+  uint64_t since = MonotonicUs();
+
+  err = entry->handler(ctx, req, entry->user_data);
+  ctx->stats.handler_us += MonotonicUs() - since;
+  return err;
+}
+
+BecoError JsonToArr(yyjson_val *root, struct BecoArray *out) {
+  if (root == NULL || out == NULL) return BECO_ERR_NULL;
+
+  if (!yyjson_is_arr(root)) {
+    return BECO_ERR_INVALID_JSON;
+  }
+
+  yyjson_val *val;
+  yyjson_arr_iter iter;
+  enum BecoArrayType type;
+  size_t len = 0;
+  size_t pos = 0;
+
+  len = yyjson_arr_size(root);
+  if (out->size != 0) {
+    return BECO_ERR_OVERFLOW;
+  }
+
+  // long runs of numbers of one type are kept as plain numbers, not an object each
+  if (len >= ARRAY_PACK_MIN && (type = ViewNumType(root)) != BECO_ARRAY_OBJECTS) {
+    out->view = root;
+    out->size = len;
+    if (ArrayPack(out, type)) return BECO_ERR_OK;
+    out->view = NULL;
+    out->size = 0;
+    return BECO_ERR_OVERFLOW;
+  }
+  if (BecoArrayReserve(out, len) != BECO_ERR_OK) {
+    return BECO_ERR_OVERFLOW;
+  }
+  ArrayInit(out, 0, len);
+  out->size = len;
+
+  // elements are converted in place
+  yyjson_arr_iter_init(root, &iter);
+  while ((val = yyjson_arr_iter_next(&iter))) {
+    if (JsonToObj(val, &out->items[pos++], out->arena, false) != BECO_ERR_OK) {
+      goto error;
+    }
+  }
+  error:
+  return BECO_ERR_OK;
+}
+
+BecoError JsonToObj(yyjson_val *root, struct BecoObject *out, struct BecoArena *arena, bool lazy) {
+  if (root == NULL || out == NULL) return BECO_ERR_NULL;
+
+  bool val_bool = false;
+  const char *val_str = NULL;
+  size_t str_len = 0;
+  uint64_t val_u64 = 0;
+  int64_t val_i64 = 0;
+  double val_f64 = 0;
+  struct BecoMap *val_map = NULL;
+  struct BecoArray *val_array = NULL;
+  enum BecoValueType val_type = BECO_VALUE_TYPE_NONE;
+  size_t arr_len = 0;
+
+  yyjson_type type;
+  yyjson_type main_type;
+  yyjson_type sub_type;
+
+  type = yyjson_get_type(root);
+  main_type = type & YYJSON_TYPE_MASK;
+  sub_type = yyjson_get_subtype(root);
+  switch (main_type) {
+    case YYJSON_TYPE_BOOL: {
+      val_bool = yyjson_get_bool(root);
+      val_type = BECO_VALUE_TYPE_BOOL;
+      break;
+    }
+    case YYJSON_TYPE_NUM : {
+      switch (sub_type) {
+        case YYJSON_SUBTYPE_UINT: {
+          val_u64 = yyjson_get_uint(root);
+          val_type = BECO_VALUE_TYPE_POSITIVE_INTEGER;
+          break;
+        }
+        case YYJSON_SUBTYPE_SINT: {
+          val_i64 = yyjson_get_sint(root);
+          val_type = BECO_VALUE_TYPE_INTEGER;
+          break;
+        }
+        case YYJSON_SUBTYPE_REAL: {
+          val_f64 = yyjson_get_real(root);
+          val_type = BECO_VALUE_TYPE_DOUBLE;
+          break;
+        }
+        default: {
+          // unknown sub type
+        }
+      }
+      break;
+    }
+    case YYJSON_TYPE_STR : {
+      val_str = yyjson_get_str(root);
+      str_len = yyjson_get_len(root);
+      val_type = BECO_VALUE_TYPE_STR;
+      break;
+    }
+    case YYJSON_TYPE_ARR : {
+      arr_len = yyjson_arr_size(root);
+      if (lazy) {
+        val_array = BecoArenaAlloc(arena, sizeof(*val_array));
+        memset(val_array, 0, sizeof(*val_array));
+        val_array->refs = 1;
+        val_array->size = arr_len;
+        val_array->arena = arena;
+        val_array->view = root;
+      } else {
+        val_array = BecoArrayNewIn(arena, 0);
+        JsonToArr(root, val_array);
+      }
+      val_type = BECO_VALUE_TYPE_ARRAY;
+      break;
+    }
+    case YYJSON_TYPE_OBJ : {
+      val_map = BecoMapNewIn(arena);
+      if (lazy) val_map->view = root;
+      else JsonToMap(root, val_map);
+      val_type = BECO_VALUE_TYPE_MAP;
+      break;
+    }
+    case YYJSON_TYPE_NULL:
+    case YYJSON_TYPE_NONE:
+    default: {
+      val_type = BECO_VALUE_TYPE_NONE;
+      // unknown type
+    }
+  }
+
+  out->type = val_type;
+  switch (val_type) {
+    case BECO_VALUE_TYPE_NONE:break;
+    case BECO_VALUE_TYPE_BOOL: {
+      out->via.bool_ = val_bool;
+      break;
+    }
+    case BECO_VALUE_TYPE_INTEGER: {
+      out->via.i64 = val_i64;
+      break;
+    }
+    case BECO_VALUE_TYPE_POSITIVE_INTEGER: {
+      out->via.u64 = val_u64;
+      break;
+    }
+    case BECO_VALUE_TYPE_DOUBLE: {
+      out->via.f64 = val_f64;
+      break;
+    }
+    case BECO_VALUE_TYPE_STR: {
+      out->via.text.str = (char *) val_str;
+      out->via.text.len = str_len;
+      out->flags |= BECO_OBJECT_BORROWED | BECO_OBJECT_SIZED;
+      break;
+    }
+    case BECO_VALUE_TYPE_MAP: {
+      out->via.map = val_map;
+      break;
+    }
+    case BECO_VALUE_TYPE_ARRAY: {
+      out->via.array = val_array;
+      break;
+    }
+  }
+
+  return BECO_ERR_OK;
+}
+
+BecoError JsonToMap(yyjson_val *root, struct BecoMap *out) {
+  if (root == NULL || out == NULL) return BECO_ERR_NULL;
+
+  struct BecoObject *obj = NULL;
+
+  const char *key_str = NULL;
+
+  yyjson_val *key, *val;
+  yyjson_obj_iter iter;
+  MapReserve(out, (uint32_t) yyjson_obj_size(root));
+  yyjson_obj_iter_init(root, &iter);
+  while ((key = yyjson_obj_iter_next(&iter))) {
+
+    val = yyjson_obj_iter_get_val(key);
+    key_str = yyjson_get_str(key);
+
+    obj = BecoObjectNewIn(out->arena);
+    if (JsonToObj(val, obj, out->arena, false) != BECO_ERR_OK) {
+      goto error;
+    }
+
+    MapInsert(out, (char *) key_str, BECO_OBJECT_BORROWED, obj);
+  }
+
+  error:
+  return BECO_ERR_OK;
+}
+
+BecoError WriteChunked(struct BecoContext *ctx, struct BecoObject *res) {
+  struct JsonWriter w;
+  char stage[JSON_WRITER_SIZE];
+  struct Chunker c;
+  size_t total;
+  BecoError err = BECO_ERR_OK;
+
+  // dry run, counts bytes and frames without keeping any output
+  memset(&c, 0, sizeof(c));
+  c.ctx = ctx;
+  c.dry = true;
+  c.limit = ctx->chunk_size;
+  JsonWriterInit(&w, ChunkerSink, &c, stage);
+  JsonWriterObj(&w, res);
+  if ((err = JsonWriterFinish(&w)) != BECO_ERR_OK || (err = ChunkerFinish(&c)) != BECO_ERR_OK) {
+    return err;
+  }
+
+  // a lazy map that repeats a key is sized above what gets written
+  if ((total = w.total) <= SIZE_1M) {
+    return WriteObject(ctx, res, total);
+  }
+
+  BecoLog(ctx, "Write Response: (" SIZE_FMT ") in %llu chunks\n", w.total, (unsigned long long) c.seq);
+
+  c.total = c.seq;
+  c.seq = 0;
+  c.dry = false;
+  c.id = ctx->chunk_id++;
+  JsonWriterInit(&w, ChunkerSink, &c, stage);
+  JsonWriterObj(&w, res);
+  if ((err = JsonWriterFinish(&w)) != BECO_ERR_OK) {
+    return err;
+  }
+  return ChunkerFinish(&c);
+}
+
+// serialized into the frame buffer behind the length slot, which goes to the transport as it is
+// size is the payload length from BecoObjectSerializedSize, the frame is allocated once
+BecoError WriteObject(struct BecoContext *ctx, struct BecoObject *res, size_t size) {
+  struct BecoBuffer *buf = &ctx->frame_buf;
+  struct JsonWriter w;
+  BecoError err;
+
+  buf->len = 0;
+  if ((err = BecoBufferReserve(buf, FRAME_HEADER + size)) != BECO_ERR_OK) return err;
+  buf->len = FRAME_HEADER;
+  JsonWriterInitBuffer(&w, buf);
+  JsonWriterObj(&w, res);
+  err = JsonWriterFinish(&w);
+  if (err == BECO_ERR_OK) {
+    BecoLog(ctx, "Write Response: (" SIZE_FMT ") %.*s\n", buf->len - FRAME_HEADER,
+            (int) (buf->len - FRAME_HEADER), buf->data + FRAME_HEADER);
+    err = WriteFramed(ctx, buf);
+  }
+  // an oversized response is not worth keeping the memory for
+  if (buf->cap > FRAME_HEADER + SIZE_1M) BecoBufferDestroy(buf);
+  return err;
+}
+
+// the same as WriteChunked for JSON text which is serialized already
+BecoError WriteChunkedJson(struct BecoContext *ctx, const char *json, size_t len) {
+  struct JsonWriter w;
+  char stage[JSON_WRITER_SIZE];
+  struct Chunker c;
+  BecoError err = BECO_ERR_OK;
+
+  memset(&c, 0, sizeof(c));
+  c.ctx = ctx;
+  c.dry = true;
+  c.limit = ctx->chunk_size;
+  JsonWriterInit(&w, ChunkerSink, &c, stage);
+  JsonWriterPut(&w, json, len);
+  if ((err = JsonWriterFinish(&w)) != BECO_ERR_OK || (err = ChunkerFinish(&c)) != BECO_ERR_OK) {
+    return err;
+  }
+
+  c.total = c.seq;
+  c.seq = 0;
+  c.dry = false;
+  c.id = ctx->chunk_id++;
+  JsonWriterInit(&w, ChunkerSink, &c, stage);
+  JsonWriterPut(&w, json, len);
+  if ((err = JsonWriterFinish(&w)) != BECO_ERR_OK) {
+    return err;
+  }
+  return ChunkerFinish(&c);
+}
+
+// checks that a key or a value may come next and writes the separator in front of it,
+// mark is where the response is cut back to if writing fails
+BecoError BuilderNext(struct BecoContext *ctx, bool key, struct BecoBuilder **out, size_t *mark) {
+  if (ctx == NULL) return BECO_ERR_NULL;
+
+  struct BecoBuilder *b = ctx->builder;
+  bool comma = false;
+
+  if (b == NULL) {
+    if ((b = calloc(1, sizeof(*b))) == NULL) return BECO_ERR_OVERFLOW;
+    ctx->builder = b;
+  }
+
+  if (b->depth == 0) {
+    if (key) return BECO_ERR_INVALID_JSON;
+    if (BecoBufferReserve(&b->buf, FRAME_HEADER) != BECO_ERR_OK) return BECO_ERR_OVERFLOW;
+    b->buf.len = FRAME_HEADER;
+  } else if (b->close[b->depth - 1] == '}') {
+    if (key == b->key) return BECO_ERR_INVALID_JSON;
+    comma = key && b->more[b->depth - 1];
+  } else {
+    if (key) return BECO_ERR_INVALID_JSON;
+    comma = b->more[b->depth - 1];
+  }
+
+  *out = b;
+  *mark = b->buf.len;
+  return comma ? BecoBufferAppend(&b->buf, ",", 1) : BECO_ERR_OK;
+}
+
+// a failed value leaves nothing behind, a complete outermost one is sent
+BecoError BuilderDone(struct BecoContext *ctx, struct BecoBuilder *b, size_t mark, BecoError err) {
+  if (err != BECO_ERR_OK) {
+    b->buf.len = mark;
+    return err;
+  }
+  if (b->depth == 0) return BuilderCommit(ctx, b);
+  b->more[b->depth - 1] = true;
+  b->key = false;
+  return BECO_ERR_OK;
+}
+
+BecoError BuilderBegin(struct BecoContext *ctx, char open, char close) {
+  struct BecoBuilder *b = NULL;
+  size_t mark = 0;
+  BecoError err;
+
+  if ((err = BuilderNext(ctx, false, &b, &mark)) != BECO_ERR_OK) {
+    return err;
+  }
+  if (b->depth == BUILDER_MAX_DEPTH) {
+    err = BECO_ERR_OVERFLOW;
+  } else {
+    err = BecoBufferAppend(&b->buf, &open, 1);
+  }
+  if (err != BECO_ERR_OK) {
+    b->buf.len = mark;
+    return err;
+  }
+  if (b->depth > 0) b->more[b->depth - 1] = true;
+  b->key = false;
+  b->close[b->depth] = close;
+  b->more[b->depth] = false;
+  b->depth++;
+  return BECO_ERR_OK;
+}
+
+BecoError BuilderValue(struct BecoContext *ctx, const char *json, size_t len) {
+  struct BecoBuilder *b = NULL;
+  size_t mark = 0;
+  BecoError err;
+
+  if ((err = BuilderNext(ctx, false, &b, &mark)) != BECO_ERR_OK) {
+    return err;
+  }
+  return BuilderDone(ctx, b, mark, BecoBufferAppend(&b->buf, json, len));
+}
+
+BecoError BuilderStr(struct BecoBuilder *b, const char *str, size_t len) {
+  BecoError err;
+
+  if ((err = BecoBufferReserve(&b->buf, b->buf.len + len * 6 + 2)) != BECO_ERR_OK) {
+    return err;
+  }
+  b->buf.data[b->buf.len++] = '"';
+  b->buf.len += JsonEscape(b->buf.data + b->buf.len, str, len);
+  b->buf.data[b->buf.len++] = '"';
+  return BECO_ERR_OK;
 }
 
-const char *BecoObjectGetStr(struct BecoObject *obj) {
-  if (obj == NULL) return NULL;
-  return obj->via.str;
+void BuilderUndoKey(struct BecoBuilder *b, size_t mark, bool more) {
+  b->buf.len = mark;
+  b->more[b->depth - 1] = more;
+  b->key = false;
 }
 
-struct BecoMap *BecoObjectGetMap(struct BecoObject *obj) {
-  if (obj == NULL) return NULL;
-  return obj->via.map;
+BecoError BuilderCommit(struct BecoContext *ctx, struct BecoBuilder *b) {
+  struct BecoBuffer *buf = &b->buf;
+  size_t dlen = buf->len - FRAME_HEADER;
+  BecoError err;
+
+  if (ctx->transport == NULL) {
+    err = BECO_ERR_NULL;
+  } else if (dlen > SIZE_1M && ctx->chunking) {
+    BecoLog(ctx, "Write Response: (" SIZE_FMT ") chunked\n", dlen);
+    err = WriteChunkedJson(ctx, buf->data + FRAME_HEADER, dlen);
+  } else {
+    BecoLog(ctx, "Write Response: (" SIZE_FMT ") %.*s\n", dlen, (int) dlen, buf->data + FRAME_HEADER);
+    err = WriteFramed(ctx, buf);
+  }
+  buf->len = 0;
+  if (buf->cap > FRAME_HEADER + SIZE_1M) BecoBufferDestroy(buf);
+  return err;
 }
 
-struct BecoArray *BecoObjectGetArray(struct BecoObject *obj) {
-  if (obj == NULL) return NULL;
-  return obj->via.array;
+void BuilderFree(struct BecoBuilder *b) {
+  if (b == NULL) return;
+  BecoBufferDestroy(&b->buf);
+  free(b);
 }
 
-void BecoObjectDumpF(struct BecoObject *obj, int indent, FILE *out) {
-  if (obj == NULL || out == NULL) return;
-  switch (obj->type) {
-    case BECO_VALUE_TYPE_NONE: {
-      fprintf(out, "(none)\n");
-      break;
-    }
-    case BECO_VALUE_TYPE_BOOL: {
-      fprintf(out, "%d (none)\n", obj->via.bool_);
-      break;
-    }
-    case BECO_VALUE_TYPE_INTEGER: {
-      fprintf(out, "%lld (integer)\n", obj->via.i64);
-      break;
+// stage holds JSON_WRITER_SIZE bytes for a sink, a writer into a buffer needs none
+void JsonWriterInit(struct JsonWriter *w, JsonSinkFunc sink, void *data, char *stage) {
+  w->sink = sink;
+  w->data = data;
+  w->buf = stage;
+  w->out = NULL;
+  w->total = 0;
+  w->len = 0;
+  w->err = BECO_ERR_OK;
+}
+
+// appends to out, skipping the staging buffer
+void JsonWriterInitBuffer(struct JsonWriter *w, struct BecoBuffer *out) {
+  JsonWriterInit(w, NULL, NULL, NULL);
+  w->out = out;
+}
+
+void JsonWriterPut(struct JsonWriter *w, const char *data, size_t len) {
+  if (w->err != BECO_ERR_OK) return;
+
+  if (w->out != NULL) {
+    if ((w->err = BecoBufferAppend(w->out, data, len)) == BECO_ERR_OK) w->total += len;
+    return;
+  }
+
+  if (w->len + len > JSON_WRITER_SIZE) {
+    if (w->len > 0 && (w->err = w->sink(w, w->buf, w->len)) != BECO_ERR_OK) return;
+    w->len = 0;
+    if (len > JSON_WRITER_SIZE) {
+      w->err = w->sink(w, data, len);
+      w->total += len;
+      return;
     }
-    case BECO_VALUE_TYPE_POSITIVE_INTEGER: {
-      fprintf(out, "%lld (+integer)\n", obj->via.u64);
-      break;
+  }
+  memcpy(w->buf + w->len, data, len);
+  w->len += len;
+  w->total += len;
+}
+
+void JsonWriterStr(struct JsonWriter *w, const char *str, size_t len) {
+  size_t step, n;
+
+  JsonWriterPut(w, "\"", 1);
+  // escaped straight into the output, a slice fits even if every byte needs \u00XX
+  while (len > 0 && w->err == BECO_ERR_OK) {
+    step = len < JSON_WRITER_SIZE / 6 ? len : JSON_WRITER_SIZE / 6;
+    if (w->out != NULL) {
+      // near the end of a buffer sized up front, reserve what the slice really needs
+      n = w->out->cap - w->out->len >= step * 6 ? step * 6 : JsonEscapedLen(str, step);
+      if ((w->err = BecoBufferReserve(w->out, w->out->len + n)) != BECO_ERR_OK) return;
+      n = JsonEscape(w->out->data + w->out->len, str, step);
+      w->out->len += n;
+    } else {
+      if (w->len + step * 6 > JSON_WRITER_SIZE) {
+        if ((w->err = w->sink(w, w->buf, w->len)) != BECO_ERR_OK) return;
+        w->len = 0;
+      }
+      n = JsonEscape(w->buf + w->len, str, step);
+      w->len += n;
     }
-    case BECO_VALUE_TYPE_DOUBLE: {
-      fprintf(out, "%f (double)\n", obj->via.f64);
-      break;
+    w->total += n;
+    str += step;
+    len -= step;
+  }
+  JsonWriterPut(w, "\"", 1);
+}
+
+// out has room for 6 bytes per input byte
+size_t JsonEscape(char *out, const char *str, size_t len) {
+  static const char hex[] = "0123456789abcdef";
+  const char *end = str + len;
+  char *o = out;
+  unsigned char ch;
+
+  for (; str < end; ++str) {
+    ch = (unsigned char) *str;
+    if (ch >= 0x20 && ch != '"' && ch != '\\') {
+      *o++ = (char) ch;
+      continue;
     }
-    case BECO_VALUE_TYPE_STR: {
-      fprintf(out, "\"%s\" (string)\n", obj->via.str);
-      break;
+    *o++ = '\\';
+    switch (ch) {
+      case '"':
+      case '\\':
+        *o++ = (char) ch;
+        break;
+      case '\b':
+        *o++ = 'b';
+        break;
+      case '\f':
+        *o++ = 'f';
+        break;
+      case '\n':
+        *o++ = 'n';
+        break;
+      case '\r':
+        *o++ = 'r';
+        break;
+      case '\t':
+        *o++ = 't';
+        break;
+      default:
+        *o++ = 'u';
+        *o++ = '0';
+        *o++ = '0';
+        *o++ = hex[ch >> 4];
+        *o++ = hex[ch & 0xf];
+        break;
     }
-    case BECO_VALUE_TYPE_MAP: {
-      fprintf(out, "(map) {\n");
-      struct BecoMapEntry *s, *tmp;
-      HASH_ITER(hh, obj->via.map->entries, s, tmp) {
-        fprintf(out, "%*s\"%s\": ", indent + 2, " ", s->key);
-        BecoObjectDumpF(s->kv->value, indent + 2, out);
-      }
-      fprintf(out, "%*s}\n", indent, " ");
-      break;
+  }
+  return (size_t) (o - out);
+}
+
+// the length JsonEscape writes
+size_t JsonEscapedLen(const char *str, size_t len) {
+  const unsigned char *s = (const unsigned char *) str;
+  const unsigned char *end = s + len;
+  size_t n = len;
+
+  for (; s < end; ++s) {
+    if (*s >= 0x20) {
+      if (*s == '"' || *s == '\\') n += 1;
+      continue;
     }
-    case BECO_VALUE_TYPE_ARRAY: {
-      fprintf(out, "(array["SIZE_FMT"]) {\n", obj->via.array->size);
-      size_t i;
-      for (i = 0; i < obj->via.array->size; ++i) {
-        fprintf(out, "%*s["SIZE_FMT"]: ", indent + 2, " ", i);
-        BecoObjectDumpF(obj->via.array->ptr[i], indent + 2, out);
-      }
-      fprintf(out, "%*s}\n", indent, " ");
-      break;
+    switch (*s) {
+      case '\b':
+      case '\f':
+      case '\n':
+      case '\r':
+      case '\t':
+        n += 1;
+        break;
+      default:
+        n += 5;
+        break;
     }
   }
+  return n;
 }
 
-BecoError BecoObjectDumpJson(struct BecoObject *obj, char **out, size_t *olen) {
-  if (obj == NULL || out == NULL || olen == NULL) return BECO_ERR_NULL;
+size_t JsonUintLen(uint64_t val) {
+  size_t n = 1;
 
-  yyjson_mut_doc *doc = NULL;
-  yyjson_mut_val *root = NULL;
-  char *json_str = NULL;
-  BecoError err = BECO_ERR_OK;
+  while (val >= 10) {
+    val /= 10;
+    ++n;
+  }
+  return n;
+}
 
-  doc = yyjson_mut_doc_new(NULL);
+size_t JsonIntLen(int64_t val) {
+  if (val >= 0) return JsonUintLen((uint64_t) val);
+  return 1 + JsonUintLen(0 - (uint64_t) val);
+}
 
-  if ((err = ObjToJson(obj, doc, &root)) != BECO_ERR_OK) {
-    goto error;
-  }
-  yyjson_mut_doc_set_root(doc, root);
+// num has room for 32 bytes, not NUL terminated, printf would follow LC_NUMERIC
+int JsonFormatDouble(char *num, double val) {
+  return (int) (yyjson_write_f64(val, num) - num);
+}
 
-  json_str = yyjson_mut_write(doc, YYJSON_WRITE_NOFLAG, olen);
-  *out = json_str;
+// num has room for 20 bytes, not NUL terminated
+size_t JsonFormatUint(char *num, uint64_t val) {
+  static const char pairs[] = "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+                              "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+                              "8081828384858687888990919293949596979899";
+  char tmp[20];
+  char *p = tmp + sizeof(tmp);
+  size_t n;
+
+  // two digits per division
+  while (val >= 100) {
+    p -= 2;
+    memcpy(p, pairs + (val % 100) * 2, 2);
+    val /= 100;
+  }
+  if (val >= 10) {
+    p -= 2;
+    memcpy(p, pairs + val * 2, 2);
+  } else {
+    *--p = (char) ('0' + val);
+  }
+  n = (size_t) (tmp + sizeof(tmp) - p);
+  memcpy(num, p, n);
+  return n;
+}
 
-  error:
-  yyjson_mut_doc_free(doc);
-  return err;
+size_t JsonFormatInt(char *num, int64_t val) {
+  if (val >= 0) return JsonFormatUint(num, (uint64_t) val);
+  *num = '-';
+  return 1 + JsonFormatUint(num + 1, 0 - (uint64_t) val);
 }
 
-void BecoObjectDump(struct BecoObject *obj) {
-  if (obj == NULL) return;
-  BecoObjectDumpF(obj, 0, stdout);
+// numbers are formatted into runs, one write per run
+void JsonWriterNums(struct JsonWriter *w, struct BecoArray *array) {
+  char run[JSON_NUMS_RUN];
+  size_t len = 0, i;
+
+  for (i = 0; i < array->size; ++i) {
+    if (len > sizeof(run) - 40) {
+      JsonWriterPut(w, run, len);
+      len = 0;
+    }
+    if (i > 0) run[len++] = ',';
+    if (array->num_type == BECO_ARRAY_DOUBLE) len += (size_t) JsonFormatDouble(run + len, ((double *) array->nums)[i]);
+    else len += JsonFormatInt(run + len, ((int64_t *) array->nums)[i]);
+  }
+  JsonWriterPut(w, run, len);
 }
 
-struct BecoObject *BecoObjectDup(struct BecoObject *src, bool recursive) {
-  if (src == NULL) return NULL;
-  struct BecoObject *dst = NULL;
+void JsonWriterObj(struct JsonWriter *w, struct BecoObject *obj) {
+  struct BecoMapEntry *entry = NULL;
+  char num[32];
+  int n;
+  size_t i;
 
-  dst = BecoObjectNew();
-  dst->type = src->type;
-  switch (src->type) {
+  if (obj == NULL) {
+    JsonWriterPut(w, "null", 4);
+    return;
+  }
+
+  switch (obj->type) {
     case BECO_VALUE_TYPE_NONE: {
+      JsonWriterPut(w, "null", 4);
       break;
     }
     case BECO_VALUE_TYPE_BOOL: {
-      dst->via.bool_ = src->via.bool_;
+      if (obj->via.bool_) JsonWriterPut(w, "true", 4);
+      else JsonWriterPut(w, "false", 5);
       break;
     }
     case BECO_VALUE_TYPE_INTEGER: {
-      dst->via.i64 = src->via.i64;
+      JsonWriterPut(w, num, JsonFormatInt(num, obj->via.i64));
       break;
     }
     case BECO_VALUE_TYPE_POSITIVE_INTEGER: {
-      dst->via.u64 = src->via.u64;
+      JsonWriterPut(w, num, JsonFormatUint(num, obj->via.u64));
       break;
     }
     case BECO_VALUE_TYPE_DOUBLE: {
-      dst->via.f64 = src->via.f64;
+      n = JsonFormatDouble(num, obj->via.f64);
+      JsonWriterPut(w, num, (size_t) n);
       break;
     }
     case BECO_VALUE_TYPE_STR: {
-      dst->via.str = strdup(src->via.str);
+      if (BecoObjectGetStr(obj) == NULL) JsonWriterPut(w, "null", 4);
+      else JsonWriterStr(w, BecoObjectGetStr(obj), BecoObjectGetStrLen(obj));
       break;
     }
     case BECO_VALUE_TYPE_MAP: {
-      dst->via.map = src->via.map; // todo impl recursive
+      JsonWriterPut(w, "{", 1);
+      if (obj->via.map != NULL) {
+        MapMaterialize(obj->via.map);
+        for (i = 0; i < obj->via.map->count; ++i) {
+          entry = &obj->via.map->entries[i];
+          if (i > 0) JsonWriterPut(w, ",", 1);
+          JsonWriterStr(w, entry->key, entry->len);
+          JsonWriterPut(w, ":", 1);
+          JsonWriterObj(w, entry->value);
+        }
+      }
+      JsonWriterPut(w, "}", 1);
       break;
     }
     case BECO_VALUE_TYPE_ARRAY: {
-      dst->via.array = src->via.array; // todo impl recursive
+      JsonWriterPut(w, "[", 1);
+      if (obj->via.array != NULL && obj->via.array->num_type != BECO_ARRAY_OBJECTS) {
+        JsonWriterNums(w, obj->via.array);
+        JsonWriterPut(w, "]", 1);
+        break;
+      }
+      if (obj->via.array != NULL) ArrayMaterialize(obj->via.array);
+      if (obj->via.array != NULL && obj->via.array->items != NULL) {
+        for (i = 0; i < obj->via.array->size; ++i) {
+          if (i > 0) JsonWriterPut(w, ",", 1);
+          JsonWriterObj(w, &obj->via.array->items[i]);
+        }
+      }
+      JsonWriterPut(w, "]", 1);
       break;
     }
   }
-  return dst;
 }
 
-void BecoObjectFree(struct BecoObject *obj) {
-  if (obj == NULL) return;
+// mirrors JsonToObj, so a view counts the same as its materialized form
+size_t ViewSerializedSize(yyjson_val *val) {
+  char num[32];
+  yyjson_obj_iter iter;
+  yyjson_arr_iter items;
+  yyjson_val *k;
+  size_t size, i = 0;
+
+  switch (yyjson_get_type(val)) {
+    case YYJSON_TYPE_BOOL:
+      return yyjson_get_bool(val) ? 4 : 5;
+    case YYJSON_TYPE_NUM: {
+      switch (yyjson_get_subtype(val)) {
+        case YYJSON_SUBTYPE_UINT:
+          return JsonUintLen(yyjson_get_uint(val));
+        case YYJSON_SUBTYPE_SINT:
+          return JsonIntLen(yyjson_get_sint(val));
+        case YYJSON_SUBTYPE_REAL:
+          return (size_t) JsonFormatDouble(num, yyjson_get_real(val));
+        default:
+          return 4;
+      }
+    }
+    case YYJSON_TYPE_STR:
+      return 2 + JsonEscapedLen(yyjson_get_str(val), yyjson_get_len(val));
+    case YYJSON_TYPE_ARR: {
+      size = 2;
+      yyjson_arr_iter_init(val, &items);
+      while ((k = yyjson_arr_iter_next(&items))) {
+        size += (i++ > 0) + ViewSerializedSize(k);
+      }
+      return size;
+    }
+    case YYJSON_TYPE_OBJ: {
+      size = 2;
+      yyjson_obj_iter_init(val, &iter);
+      while ((k = yyjson_obj_iter_next(&iter))) {
+        // keys are cut at a NUL, like MapMaterialize does
+        size += (i++ > 0) + 3 + JsonEscapedLen(yyjson_get_str(k), strlen(yyjson_get_str(k)));
+        size += ViewSerializedSize(yyjson_obj_iter_get_val(k));
+      }
+      return size;
+    }
+    default:
+      return 4;
+  }
+}
+
+size_t BecoObjectSerializedSize(struct BecoObject *obj) {
+  struct BecoMap *map = NULL;
+  struct BecoArray *array = NULL;
+  struct BecoMapEntry *entry = NULL;
+  yyjson_obj_iter iter;
+  yyjson_val *k;
+  const char *key;
+  char num[32];
+  size_t size, len, i;
+  unsigned hashv;
+
+  if (obj == NULL) return 4;
+
   switch (obj->type) {
-    case BECO_VALUE_TYPE_NONE:
     case BECO_VALUE_TYPE_BOOL:
+      return obj->via.bool_ ? 4 : 5;
     case BECO_VALUE_TYPE_INTEGER:
+      return JsonIntLen(obj->via.i64);
     case BECO_VALUE_TYPE_POSITIVE_INTEGER:
-    case BECO_VALUE_TYPE_DOUBLE:break;
+      return JsonUintLen(obj->via.u64);
+    case BECO_VALUE_TYPE_DOUBLE:
+      return (size_t) JsonFormatDouble(num, obj->via.f64);
     case BECO_VALUE_TYPE_STR: {
-      free(obj->via.str);
-      obj->via.str = NULL;
-      break;
+      if (BecoObjectGetStr(obj) == NULL) return 4;
+      return 2 + JsonEscapedLen(BecoObjectGetStr(obj), BecoObjectGetStrLen(obj));
     }
     case BECO_VALUE_TYPE_MAP: {
-      BecoMapFree(obj->via.map);
-      obj->via.map = NULL;
-      break;
+      size = 2;
+      if ((map = obj->via.map) == NULL) return size;
+      if (map->view == NULL) {
+        for (i = 0; i < map->count; ++i) {
+          entry = &map->entries[i];
+          size += (i > 0) + 3 + JsonEscapedLen(entry->key, entry->len) + BecoObjectSerializedSize(entry->value);
+        }
+        return size;
+      }
+      // values looked up before may have been changed, they count instead of the document
+      i = 0;
+      yyjson_obj_iter_init(map->view, &iter);
+      while ((k = yyjson_obj_iter_next(&iter))) {
+        key = yyjson_get_str(k);
+        len = strlen(key);
+        entry = NULL;
+        if (map->count > 0) {
+          HASH_VALUE(key, len, hashv);
+          entry = MapLookup(map, key, len, hashv);
+        }
+        size += (i++ > 0) + 3 + JsonEscapedLen(key, len);
+        size += entry != NULL ? BecoObjectSerializedSize(entry->value) : ViewSerializedSize(yyjson_obj_iter_get_val(k));
+      }
+      return size;
     }
     case BECO_VALUE_TYPE_ARRAY: {
-      BecoArrayFree(obj->via.array);
-      obj->via.array = NULL;
-      break;
+      size = 2;
+      if ((array = obj->via.array) == NULL) return size;
+      if (array->view != NULL) return ViewSerializedSize(array->view);
+      if (array->num_type == BECO_ARRAY_INT64) {
+        for (i = 0; i < array->size; ++i) size += (i > 0) + JsonIntLen(((int64_t *) array->nums)[i]);
+        return size;
+      }
+      if (array->num_type == BECO_ARRAY_DOUBLE) {
+        for (i = 0; i < array->size; ++i) size += (i > 0) + (size_t) JsonFormatDouble(num, ((double *) array->nums)[i]);
+        return size;
+      }
+      if (array->items == NULL) return size;
+      for (i = 0; i < array->size; ++i) {
+        size += (i > 0) + BecoObjectSerializedSize(&array->items[i]);
+      }
+      return size;
     }
+    default:
+      return 4;
   }
-  free(obj);
 }
 
-struct BecoMap *BecoMapNew() {
-  struct BecoMap *map = NULL;
-  map = malloc(sizeof(*map));
-  memset(map, 0, sizeof(*map));
-  return map;
+BecoError JsonWriterFinish(struct JsonWriter *w) {
+  if (w->err == BECO_ERR_OK && w->len > 0) {
+    w->err = w->sink(w, w->buf, w->len);
+    w->len = 0;
+  }
+  return w->err;
 }
 
-void BecoMapPut(struct BecoMap *map, const char *key, struct BecoObject *val) {
-  struct BecoMapEntry *entry = NULL;
-  struct BecoKV *kv = NULL;
+BecoError BecoBufferAppend(struct BecoBuffer *buf, const char *data, size_t len) {
+  BecoError err;
 
-  kv = BecoKVNew();
-  kv->key = strdup(key);
-  kv->value = val;
+  if (buf == NULL || (data == NULL && len > 0)) return BECO_ERR_NULL;
+  if (len == 0) return BECO_ERR_OK;
+  if ((err = BecoBufferReserve(buf, buf->len + len)) != BECO_ERR_OK) {
+    return err;
+  }
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+  return BECO_ERR_OK;
+}
 
-  entry = malloc(sizeof(*entry));
-  entry->key = kv->key;
-  entry->kv = kv;
+void JsonWriterStruct(struct JsonWriter *w, struct BecoStruct *desc, const char *base) {
+  struct BecoField *field = NULL;
+  struct BecoObject tmp;
+  const char *str = NULL;
+  size_t i;
 
-  HASH_ADD_STR(map->entries, key, entry);
+  JsonWriterPut(w, "{", 1);
+  for (i = 0; i < desc->count; ++i) {
+    field = &desc->fields[i];
+    if (i > 0) JsonWriterPut(w, ",", 1);
+    JsonWriterStr(w, field->name, field->len);
+    JsonWriterPut(w, ":", 1);
+
+    if (field->type == BECO_FIELD_STRUCT) {
+      if (field->nested != NULL) JsonWriterStruct(w, field->nested, base + field->offset);
+      else JsonWriterPut(w, "null", 4);
+      continue;
+    }
+    if (field->type == BECO_FIELD_STR) {
+      str = *(const char *const *) (base + field->offset);
+      if (str != NULL) JsonWriterStr(w, str, strlen(str));
+      else JsonWriterPut(w, "null", 4);
+      continue;
+    }
+
+    // numbers are written the same way as for objects
+    memset(&tmp, 0, sizeof(tmp));
+    switch (field->type) {
+      case BECO_FIELD_BOOL: {
+        tmp.type = BECO_VALUE_TYPE_BOOL;
+        tmp.via.bool_ = *(const bool *) (base + field->offset);
+        break;
+      }
+      case BECO_FIELD_INT: {
+        tmp.type = BECO_VALUE_TYPE_INTEGER;
+        tmp.via.i64 = *(const int *) (base + field->offset);
+        break;
+      }
+      case BECO_FIELD_INT64: {
+        tmp.type = BECO_VALUE_TYPE_INTEGER;
+        tmp.via.i64 = *(const int64_t *) (base + field->offset);
+        break;
+      }
+      case BECO_FIELD_UINT64: {
+        tmp.type = BECO_VALUE_TYPE_POSITIVE_INTEGER;
+        tmp.via.u64 = *(const uint64_t *) (base + field->offset);
+        break;
+      }
+      case BECO_FIELD_DOUBLE: {
+        tmp.type = BECO_VALUE_TYPE_DOUBLE;
+        tmp.via.f64 = *(const double *) (base + field->offset);
+        break;
+      }
+      default: {
+        break;
+      }
+    }
+    JsonWriterObj(w, &tmp);
+  }
+  JsonWriterPut(w, "}", 1);
 }
 
-struct BecoObject *BecoMapGet(struct BecoMap *map, const char *key) {
-  if (map == NULL) return NULL;
+// hashes and lengths of the names, once per descriptor
+void StructPrepare(struct BecoStruct *desc) {
+  struct BecoField *field = NULL;
+  unsigned hashv;
+  size_t i;
 
-  struct BecoMapEntry *out = NULL;
-  HASH_FIND_STR(map->entries, key, out);
-  if (out == NULL || out->key == NULL) return NULL;
-  return out->kv->value;
+  if (desc->ready) return;
+  desc->ready = true;
+  for (i = 0; i < desc->count; ++i) {
+    field = &desc->fields[i];
+    field->len = (uint32_t) strlen(field->name);
+    HASH_VALUE(field->name, field->len, hashv);
+    field->hash = hashv;
+    if (field->type == BECO_FIELD_STRUCT && field->nested != NULL) StructPrepare(field->nested);
+  }
 }
 
-bool BecoMapContainsKey(struct BecoMap *map, const char *key) {
-  if (map == NULL) return false;
+// keys tend to come in declaration order, the field after the last match is tried first
+struct BecoField *StructField(struct BecoStruct *desc, const char *key, size_t len, const uint32_t *hashv,
+                              size_t *next) {
+  struct BecoField *field = NULL;
+  unsigned hash;
+  size_t i;
 
-  struct BecoMapEntry *out = NULL;
-  HASH_FIND_STR(map->entries, key, out);
-  if (out == NULL || out->key == NULL) return false;
-  return true;
+  if (*next < desc->count) {
+    field = &desc->fields[*next];
+    if (field->len == len && memcmp(field->name, key, len) == 0) {
+      ++*next;
+      return field;
+    }
+  }
+
+  if (hashv != NULL) {
+    hash = *hashv;
+  } else {
+    HASH_VALUE(key, len, hash);
+  }
+  for (i = 0; i < desc->count; ++i) {
+    field = &desc->fields[i];
+    if (field->hash == (uint32_t) hash && field->len == len && memcmp(field->name, key, len) == 0) {
+      *next = i + 1;
+      return field;
+    }
+  }
+  return NULL;
 }
 
-void BecoMapFree(struct BecoMap *map) {
-  if (map == NULL) return;
-  struct BecoMapEntry *entry, *temp;
-  HASH_ITER(hh, map->entries, entry, temp) {
-    BecoKVFree(entry->kv);
-    free(entry);
+BecoError StructFromObj(struct BecoObject *obj, struct BecoStruct *desc, char *base) {
+  struct BecoMap *map = NULL;
+  struct BecoMapEntry *entry = NULL;
+  struct BecoField *field = NULL;
+  BecoError err;
+  size_t next = 0;
+  uint32_t i;
+
+  if (obj->type != BECO_VALUE_TYPE_MAP || obj->via.map == NULL) return BECO_ERR_INVALID_JSON;
+  map = obj->via.map;
+  // a lazy view hasn't been touched as a whole, the document has it all
+  if (map->view != NULL) return StructFromJson(map->view, desc, base);
+
+  for (i = 0; i < map->count; ++i) {
+    entry = &map->entries[i];
+    field = StructField(desc, entry->key, entry->len, &map->hashes[i], &next);
+    if (field == NULL || entry->value == NULL) continue;
+    if ((err = FieldFromObj(entry->value, field, base)) != BECO_ERR_OK) return err;
   }
-  free(map);
+  return BECO_ERR_OK;
 }
 
-struct BecoArray *BecoArrayNew(size_t size) {
-  struct BecoArray *arr = NULL;
-  arr = malloc(sizeof(*arr));
-  memset(arr, 0, sizeof(*arr));
-  arr->ptr = malloc(sizeof(*arr->ptr) * size);
-  arr->size = size;
-  return arr;
+BecoError StructFromJson(yyjson_val *val, struct BecoStruct *desc, char *base) {
+  struct BecoField *field = NULL;
+  struct BecoObject tmp;
+  yyjson_obj_iter iter;
+  yyjson_val *k, *v;
+  BecoError err;
+  size_t next = 0;
+
+  if (!yyjson_is_obj(val)) return BECO_ERR_INVALID_JSON;
+
+  yyjson_obj_iter_init(val, &iter);
+  while ((k = yyjson_obj_iter_next(&iter))) {
+    field = StructField(desc, yyjson_get_str(k), yyjson_get_len(k), NULL, &next);
+    if (field == NULL) continue;
+    v = yyjson_obj_iter_get_val(k);
+    if (field->type == BECO_FIELD_STRUCT && yyjson_is_obj(v)) {
+      if (field->nested == NULL) continue;
+      err = StructFromJson(v, field->nested, base + field->offset);
+    } else if (yyjson_is_obj(v) || yyjson_is_arr(v)) {
+      err = BECO_ERR_INVALID_JSON;
+    } else {
+      // scalars convert without allocating, strings stay in the document
+      memset(&tmp, 0, sizeof(tmp));
+      JsonToObj(v, &tmp, NULL, false);
+      err = FieldFromObj(&tmp, field, base);
+    }
+    if (err != BECO_ERR_OK) return err;
+  }
+  return BECO_ERR_OK;
 }
 
-size_t BecoArrayLen(struct BecoArray *array) {
-  if (array == NULL) return 0;
-  return array->size;
+BecoError FieldFromObj(struct BecoObject *obj, struct BecoField *field, char *base) {
+  char *dst = base + field->offset;
+
+  if (obj->type == BECO_VALUE_TYPE_NONE) {
+    if (field->type == BECO_FIELD_STR) *(const char **) dst = NULL;
+    return BECO_ERR_OK;
+  }
+
+  switch (field->type) {
+    case BECO_FIELD_BOOL: {
+      if (obj->type != BECO_VALUE_TYPE_BOOL) return BECO_ERR_INVALID_JSON;
+      *(bool *) dst = obj->via.bool_;
+      break;
+    }
+    case BECO_FIELD_INT: {
+      if (obj->type == BECO_VALUE_TYPE_INTEGER && obj->via.i64 >= INT_MIN && obj->via.i64 <= INT_MAX) {
+        *(int *) dst = (int) obj->via.i64;
+      } else if (obj->type == BECO_VALUE_TYPE_POSITIVE_INTEGER && obj->via.u64 <= INT_MAX) {
+        *(int *) dst = (int) obj->via.u64;
+      } else {
+        return BECO_ERR_INVALID_JSON;
+      }
+      break;
+    }
+    case BECO_FIELD_INT64: {
+      if (obj->type == BECO_VALUE_TYPE_INTEGER) {
+        *(int64_t *) dst = obj->via.i64;
+      } else if (obj->type == BECO_VALUE_TYPE_POSITIVE_INTEGER && obj->via.u64 <= INT64_MAX) {
+        *(int64_t *) dst = (int64_t) obj->via.u64;
+      } else {
+        return BECO_ERR_INVALID_JSON;
+      }
+      break;
+    }
+    case BECO_FIELD_UINT64: {
+      if (obj->type == BECO_VALUE_TYPE_POSITIVE_INTEGER) {
+        *(uint64_t *) dst = obj->via.u64;
+      } else if (obj->type == BECO_VALUE_TYPE_INTEGER && obj->via.i64 >= 0) {
+        *(uint64_t *) dst = (uint64_t) obj->via.i64;
+      } else {
+        return BECO_ERR_INVALID_JSON;
+      }
+      break;
+    }
+    case BECO_FIELD_DOUBLE: {
+      if (obj->type == BECO_VALUE_TYPE_DOUBLE) *(double *) dst = obj->via.f64;
+      else if (obj->type == BECO_VALUE_TYPE_INTEGER) *(double *) dst = (double) obj->via.i64;
+      else if (obj->type == BECO_VALUE_TYPE_POSITIVE_INTEGER) *(double *) dst = (double) obj->via.u64;
+      else return BECO_ERR_INVALID_JSON;
+      break;
+    }
+    case BECO_FIELD_STR: {
+      if (obj->type != BECO_VALUE_TYPE_STR) return BECO_ERR_INVALID_JSON;
+      *(const char **) dst = BecoObjectGetStr(obj);
+      break;
+    }
+    case BECO_FIELD_STRUCT: {
+      if (field->nested == NULL) break;
+      return StructFromObj(obj, field->nested, dst);
+    }
+  }
+  return BECO_ERR_OK;
 }
 
-void BecoArrayAdd(struct BecoArray *array, size_t pos, struct BecoObject *obj) {
-  if (array == NULL || array->ptr == NULL || pos >= array->size) return;
-  *(array->ptr + pos) = obj;
+BecoError BecoBufferAppendJsonStr(struct BecoBuffer *buf, const char *str, size_t len) {
+  BecoError err;
+
+  if (buf == NULL || (str == NULL && len > 0)) return BECO_ERR_NULL;
+  if (len > (SIZE_MAX - buf->len - 2) / 6) return BECO_ERR_OVERFLOW;
+  if ((err = BecoBufferReserve(buf, buf->len + len * 6 + 2)) != BECO_ERR_OK) return err;
+  buf->data[buf->len++] = '"';
+  buf->len += JsonEscape(buf->data + buf->len, str, len);
+  buf->data[buf->len++] = '"';
+  return BECO_ERR_OK;
 }
 
-struct BecoObject *BecoArrayGet(struct BecoArray *array, size_t pos) {
-  if (array == NULL || array->ptr == NULL || pos >= array->size) return NULL;
-  return array->ptr[pos];
+BecoError BecoBufferAppendJsonInt(struct BecoBuffer *buf, int64_t val) {
+  char num[32];
+  return BecoBufferAppend(buf, num, JsonFormatInt(num, val));
 }
 
-void BecoArrayFree(struct BecoArray *array) {
-  if (array == NULL) return;
-  size_t i;
+BecoError BecoBufferAppendJsonUint(struct BecoBuffer *buf, uint64_t val) {
+  char num[32];
+  return BecoBufferAppend(buf, num, JsonFormatUint(num, val));
+}
 
-  if (array->ptr != NULL) {
-    for (i = 0; i < array->size; ++i) {
-      BecoObjectFree(array->ptr[i]);
-      array->ptr[i] = NULL;
+BecoError BecoBufferAppendJsonDouble(struct BecoBuffer *buf, double val) {
+  char num[32];
+  int n = JsonFormatDouble(num, val);
+  return BecoBufferAppend(buf, num, (size_t) n);
+}
+
+BecoError ChunkerSink(struct JsonWriter *w, const char *data, size_t len) {
+  struct Chunker *c = w->data;
+  const unsigned char *p = (const unsigned char *) data;
+  const unsigned char *end = p + len;
+  BecoError err = BECO_ERR_OK;
+  unsigned char ch;
+
+  for (; p < end; ++p) {
+    ch = *p;
+    // a UTF-8 sequence may straddle two pieces, collect it before it is placed
+    if (c->pending_len > 0) {
+      c->pending[c->pending_len++] = ch;
+      if (c->pending_len < c->pending_need) continue;
+      err = ChunkerUnit(c, c->pending, c->pending_len);
+      c->pending_len = 0;
+    } else if (ch >= 0xc0) {
+      c->pending[0] = ch;
+      c->pending_len = 1;
+      c->pending_need = ch >= 0xf0 ? 4 : ch >= 0xe0 ? 3 : 2;
+    } else {
+      err = ChunkerUnit(c, p, 1);
     }
+    if (err != BECO_ERR_OK) return err;
   }
-  free(array);
+  return err;
 }
 
-struct BecoKV *BecoKVNew() {
-  struct BecoKV *obj = NULL;
-  obj = malloc(sizeof(*obj));
-  memset(obj, 0, sizeof(*obj));
-  return obj;
-}
+BecoError ChunkerUnit(struct Chunker *c, const unsigned char *unit, size_t len) {
+  static const char hex[] = "0123456789abcdef";
+  struct BecoBuffer *buf = &c->ctx->chunk_buf;
+  char head[128];
+  char esc[6];
+  size_t elen = len;
+  BecoError err;
+  int n;
+
+  if (len == 1 && (unit[0] == '"' || unit[0] == '\\')) {
+    esc[0] = '\\';
+    esc[1] = (char) unit[0];
+    elen = 2;
+  } else if (len == 1 && unit[0] < 0x20) {
+    memcpy(esc, "\\u00", 4);
+    esc[4] = hex[unit[0] >> 4];
+    esc[5] = hex[unit[0] & 0xf];
+    elen = 6;
+  } else {
+    memcpy(esc, unit, len);
+  }
+
+  if (c->open && c->frame_len + elen + sizeof(CHUNK_SUFFIX) - 1 > c->limit) {
+    if ((err = ChunkerClose(c)) != BECO_ERR_OK) {
+      return err;
+    }
+  }
 
-void BecoKVFree(struct BecoKV *kv) {
-  if (kv == NULL) return;
-  free(kv->key);
-  BecoObjectFree(kv->value);
-}
+  if (!c->open) {
+    // the budget is computed with the widest total, so both runs cut at the same places
+    n = snprintf(head, sizeof(head), CHUNK_PREFIX, (unsigned long long) c->id,
+                 (unsigned long long) c->seq, (unsigned long long) c->total);
+    c->frame_len = (size_t) snprintf(NULL, 0, CHUNK_PREFIX, (unsigned long long) c->id,
+                                     (unsigned long long) c->seq, (unsigned long long) UINT64_MAX);
+    if (!c->dry) {
+      if ((err = BecoBufferReserve(buf, FRAME_HEADER + c->limit)) != BECO_ERR_OK) {
+        return err;
+      }
+      memcpy(buf->data + FRAME_HEADER, head, (size_t) n);
+      buf->len = FRAME_HEADER + (size_t) n;
+    }
+    c->open = true;
+  }
 
-void BecoKVSetKey(struct BecoKV *kv, const char *key) {
-  if (kv == NULL) return;
-  kv->key = strdup(key);
+  if (!c->dry) {
+    memcpy(buf->data + buf->len, esc, elen);
+    buf->len += elen;
+  }
+  c->frame_len += elen;
+  return BECO_ERR_OK;
 }
 
-void BecoKVSetValue(struct BecoKV *kv, struct BecoObject *obj) {
-  if (kv == NULL) return;
-  kv->value = obj;
-}
+BecoError ChunkerClose(struct Chunker *c) {
+  struct BecoBuffer *buf = &c->ctx->chunk_buf;
+  BecoError err = BECO_ERR_OK;
 
-struct BecoRequestHandler *CreateHandler(const char *cmd, BecoRequestHandlerFunc handler, void *user_data) {
-  struct BecoRequestHandler *entry = NULL;
-  entry = malloc(sizeof(*entry));
-  memset(entry, 0, sizeof(*entry));
+  if (!c->open) return BECO_ERR_OK;
 
-  if (cmd != NULL)
-    entry->cmd = strdup(cmd);
+  c->open = false;
+  c->seq++;
+  if (c->dry) return BECO_ERR_OK;
 
-  entry->handler = handler;
-  entry->user_data = user_data;
-  return entry;
+  memcpy(buf->data + buf->len, CHUNK_SUFFIX, sizeof(CHUNK_SUFFIX) - 1);
+  buf->len += sizeof(CHUNK_SUFFIX) - 1;
+  err = WriteFramed(c->ctx, buf);
+  buf->len = 0;
+  return err;
 }
 
-BecoError InvokeHandler(struct BecoContext *ctx, struct BecoRequestHandler *entry, struct BecoRequest *req) {
-  if (ctx == NULL || entry == NULL || req == NULL) return BECO_ERR_NULL;
-  if (entry->handler == NULL) return BECO_ERR_NULL;
-  return entry->handler(ctx, req, entry->user_data);
+BecoError ChunkerFinish(struct Chunker *c) {
+  BecoError err = BECO_ERR_OK;
+
+  // a truncated UTF-8 sequence at the very end goes out as it is
+  if (c->pending_len > 0) {
+    err = ChunkerUnit(c, c->pending, c->pending_len);
+    c->pending_len = 0;
+  }
+  if (err != BECO_ERR_OK) return err;
+  return ChunkerClose(c);
 }
 
-BecoError JsonToArr(yyjson_val *root, struct BecoArray *out) {
-  if (root == NULL || out == NULL) return BECO_ERR_NULL;
+void ParseProgress(struct BecoContext *ctx, char *data, size_t have, size_t size) {
+  struct BecoParser *p = ctx->parser;
 
-  if (!yyjson_is_arr(root)) {
-    return BECO_ERR_INVALID_JSON;
+  if (!ctx->incremental_parse || ctx->lazy_view || size < ctx->incremental_min_size) return;
+
+  if (p == NULL) {
+    if ((p = ctx->parser = ParserNew()) == NULL) return;
   }
+  if (!p->active) {
+    ParserReset(p);
+    p->active = true;
+    p->arena = ctx->recv_lease != NULL ? &ctx->recv_lease->arena : NULL;
+  }
+  ParserFeed(p, data, have, have == size);
+}
 
-  struct BecoObject *obj = NULL;
-  yyjson_val *val;
-  yyjson_arr_iter iter;
-  size_t len = 0;
-  size_t pos = 0;
+struct BecoParser *ParserNew() {
+  struct BecoParser *p = NULL;
 
-  len = yyjson_arr_size(root);
-  if (len != out->size) {
-    return BECO_ERR_OVERFLOW;
-  }
+  p = malloc(sizeof(*p));
+  if (p == NULL) return NULL;
+  memset(p, 0, sizeof(*p));
+  return p;
+}
 
-  yyjson_arr_iter_init(root, &iter);
-  while ((val = yyjson_arr_iter_next(&iter))) {
-    obj = malloc(sizeof(*obj));
-    if (JsonToObj(val, obj) != BECO_ERR_OK) {
-      goto error;
+void ParserFree(struct BecoParser *p) {
+  if (p == NULL) return;
+  ParserReset(p);
+  free(p->stack);
+  free(p);
+}
+
+void ParserReset(struct BecoParser *p) {
+  struct BecoParserFrame *frame = NULL;
+  size_t i;
+
+  while (p->depth > 0) {
+    frame = &p->stack[--p->depth];
+    for (i = 0; i < frame->count; ++i) {
+      BecoObjectFree(frame->items[i]);
     }
-    BecoArrayAdd(out, pos++, obj);
+    free(frame->items);
+    BecoObjectFree(frame->obj);
   }
-  error:
-  return BECO_ERR_OK;
+  BecoObjectFree(p->root);
+  p->root = NULL;
+  p->state = PARSER_VALUE;
+  p->active = false;
+  p->pos = 0;
+  p->in_str = false;
 }
 
-BecoError JsonToObj(yyjson_val *root, struct BecoObject *out) {
-  if (root == NULL || out == NULL) return BECO_ERR_NULL;
-
-  bool val_bool = false;
-  const char *val_str = NULL;
-  uint64_t val_u64 = 0;
-  int64_t val_i64 = 0;
-  double val_f64 = 0;
-  struct BecoMap *val_map = NULL;
-  struct BecoArray *val_array = NULL;
-  enum BecoValueType val_type = BECO_VALUE_TYPE_NONE;
-  size_t arr_len = 0;
+void ParserFeed(struct BecoParser *p, char *data, size_t len, bool final) {
+  char c;
 
-  yyjson_type type;
-  yyjson_type main_type;
-  yyjson_type sub_type;
+  while (p->pos < len && p->state != PARSER_ERROR) {
+    if (p->in_str) {
+      if (!ParserString(p, data, len)) break;
+      continue;
+    }
 
-  type = yyjson_get_type(root);
-  main_type = type & YYJSON_TYPE_MASK;
-  sub_type = type & YYJSON_SUBTYPE_MASK;
-  switch (main_type) {
-    case YYJSON_TYPE_BOOL: {
-      val_bool = yyjson_get_bool(root);
-      val_type = BECO_VALUE_TYPE_BOOL;
-      break;
+    c = data[p->pos];
+    if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+      p->pos++;
+      continue;
     }
-    case YYJSON_TYPE_NUM : {
-      switch (sub_type) {
-        case YYJSON_SUBTYPE_UINT: {
-          val_u64 = yyjson_get_uint(root);
-          val_type = BECO_VALUE_TYPE_POSITIVE_INTEGER;
-          break;
-        }
-        case YYJSON_SUBTYPE_SINT: {
-          val_i64 = yyjson_get_sint(root);
-          val_type = BECO_VALUE_TYPE_INTEGER;
+
+    switch (p->state) {
+      case PARSER_ARRAY_FIRST:
+        if (c == ']') {
+          p->pos++;
+          ParserClose(p);
           break;
         }
-        case YYJSON_SUBTYPE_REAL: {
-          val_f64 = yyjson_get_real(root);
-          val_type = BECO_VALUE_TYPE_DOUBLE;
-          break;
+        // fall through
+      case PARSER_VALUE: {
+        if (c == '{') {
+          p->pos++;
+          ParserOpen(p, BECO_VALUE_TYPE_MAP);
+        } else if (c == '[') {
+          p->pos++;
+          ParserOpen(p, BECO_VALUE_TYPE_ARRAY);
+        } else if (c == '"') {
+          p->pos++;
+          p->in_str = true;
+          p->str_key = false;
+          p->str_start = p->str_at = p->pos;
+        } else if (c == '-' || (c >= '0' && c <= '9')) {
+          if (!ParserNumber(p, data, len, final)) return;
+        } else {
+          if (!ParserLiteral(p, data, len, final)) return;
         }
-        default: {
-          // unknown sub type
+        break;
+      }
+      case PARSER_ARRAY_NEXT: {
+        p->pos++;
+        if (c == ',') p->state = PARSER_VALUE;
+        else if (c == ']') ParserClose(p);
+        else p->state = PARSER_ERROR;
+        break;
+      }
+      case PARSER_MAP_FIRST:
+      case PARSER_MAP_KEY: {
+        p->pos++;
+        if (c == '"') {
+          p->in_str = true;
+          p->str_key = true;
+          p->str_start = p->str_at = p->pos;
+        } else if (c == '}' && p->state == PARSER_MAP_FIRST) {
+          ParserClose(p);
+        } else {
+          p->state = PARSER_ERROR;
         }
+        break;
+      }
+      case PARSER_MAP_COLON: {
+        p->pos++;
+        p->state = c == ':' ? PARSER_VALUE : PARSER_ERROR;
+        break;
+      }
+      case PARSER_MAP_NEXT: {
+        p->pos++;
+        if (c == ',') p->state = PARSER_MAP_KEY;
+        else if (c == '}') ParserClose(p);
+        else p->state = PARSER_ERROR;
+        break;
+      }
+      case PARSER_DONE:
+      case PARSER_ERROR: {
+        p->state = PARSER_ERROR;
+        break;
       }
-      break;
-    }
-    case YYJSON_TYPE_STR : {
-      val_str = yyjson_get_str(root);
-      val_type = BECO_VALUE_TYPE_STR;
-      break;
-    }
-    case YYJSON_TYPE_ARR : {
-      arr_len = yyjson_arr_size(root);
-      val_array = BecoArrayNew(arr_len);
-      JsonToArr(root, val_array);
-      val_type = BECO_VALUE_TYPE_ARRAY;
-      break;
     }
-    case YYJSON_TYPE_OBJ : {
-      val_map = BecoMapNew();
-      JsonToMap(root, val_map);
-      val_type = BECO_VALUE_TYPE_MAP;
-      break;
+  }
+
+  if (final && p->state != PARSER_DONE) {
+    p->state = PARSER_ERROR;
+  }
+}
+
+void ParserEmit(struct BecoParser *p, struct BecoObject *obj) {
+  struct BecoParserFrame *frame = NULL;
+  struct BecoObject **items = NULL;
+  size_t cap;
+
+  if (p->depth == 0) {
+    p->root = obj;
+    p->state = PARSER_DONE;
+    return;
+  }
+
+  frame = &p->stack[p->depth - 1];
+  if (frame->obj->type == BECO_VALUE_TYPE_MAP) {
+    MapInsert(frame->obj->via.map, frame->key, BECO_OBJECT_BORROWED, obj);
+    frame->key = NULL;
+    p->state = PARSER_MAP_NEXT;
+    return;
+  }
+
+  if (frame->count == frame->cap) {
+    cap = frame->cap == 0 ? 8 : frame->cap * 2;
+    items = realloc(frame->items, cap * sizeof(*items));
+    if (items == NULL) {
+      BecoObjectFree(obj);
+      p->state = PARSER_ERROR;
+      return;
     }
-    case YYJSON_TYPE_NULL:
-    case YYJSON_TYPE_NONE:
-    default: {
-      val_type = BECO_VALUE_TYPE_NONE;
-      // unknown type
+    frame->items = items;
+    frame->cap = cap;
+  }
+  frame->items[frame->count++] = obj;
+  p->state = PARSER_ARRAY_NEXT;
+}
+
+void ParserOpen(struct BecoParser *p, enum BecoValueType type) {
+  struct BecoParserFrame *stack = NULL;
+  struct BecoParserFrame *frame = NULL;
+  size_t cap;
+
+  if (p->depth == p->cap) {
+    cap = p->cap == 0 ? 16 : p->cap * 2;
+    stack = realloc(p->stack, cap * sizeof(*stack));
+    if (stack == NULL) {
+      p->state = PARSER_ERROR;
+      return;
     }
+    p->stack = stack;
+    p->cap = cap;
   }
 
-  out->type = val_type;
-  switch (val_type) {
-    case BECO_VALUE_TYPE_NONE:break;
-    case BECO_VALUE_TYPE_BOOL: {
-      out->via.bool_ = val_bool;
-      break;
+  frame = &p->stack[p->depth++];
+  memset(frame, 0, sizeof(*frame));
+  frame->obj = BecoObjectNewIn(p->arena);
+  frame->obj->type = type;
+  if (type == BECO_VALUE_TYPE_MAP) {
+    frame->obj->via.map = BecoMapNewIn(p->arena);
+    p->state = PARSER_MAP_FIRST;
+  } else {
+    p->state = PARSER_ARRAY_FIRST;
+  }
+}
+
+void ParserClose(struct BecoParser *p) {
+  struct BecoParserFrame *frame = &p->stack[--p->depth];
+  struct BecoObject *obj = frame->obj;
+  struct BecoArray *array = NULL;
+  enum BecoArrayType type;
+  size_t i;
+
+  if (obj->type == BECO_VALUE_TYPE_ARRAY) {
+    array = BecoArrayNewIn(p->arena, frame->count);
+    if (array == NULL) {
+      p->depth++;
+      p->state = PARSER_ERROR;
+      return;
     }
-    case BECO_VALUE_TYPE_INTEGER: {
-      out->via.i64 = val_i64;
-      break;
+    for (i = 0; i < frame->count; ++i) {
+      array->items[i] = *frame->items[i];
+      if (!(frame->items[i]->flags & BECO_OBJECT_ARENA)) free(frame->items[i]);
     }
-    case BECO_VALUE_TYPE_POSITIVE_INTEGER: {
-      out->via.u64 = val_u64;
-      break;
+    free(frame->items);
+    obj->via.array = array;
+    // packed like the arrays yyjson reads, see JsonToArr
+    if (array->size >= ARRAY_PACK_MIN && (type = ArrayNumType(array)) != BECO_ARRAY_OBJECTS) {
+      ArrayPack(array, type);
     }
-    case BECO_VALUE_TYPE_DOUBLE: {
-      out->via.f64 = val_f64;
-      break;
+  }
+  ParserEmit(p, obj);
+}
+
+bool ParserString(struct BecoParser *p, char *data, size_t len) {
+  const unsigned char *s = (const unsigned char *) data;
+  struct BecoObject *obj = NULL;
+  size_t i = p->pos;
+  size_t start = i;
+  uint32_t cp, lo;
+  unsigned char utf8[4];
+  size_t ulen;
+  int n;
+
+  while (i < len) {
+    if (s[i] == '"') break;
+    if (s[i] < 0x20) {
+      p->state = PARSER_ERROR;
+      return false;
     }
-    case BECO_VALUE_TYPE_STR: {
-      out->via.str = strdup(val_str);
-      break;
+    if (s[i] >= 0x80) {
+      // a sequence cut by the end of the data is checked with the next feed
+      if ((n = Utf8Check(s + i, len - i)) < 0) break;
+      if (n == 0) goto error;
+      i += (size_t) n;
+      continue;
     }
-    case BECO_VALUE_TYPE_MAP: {
-      out->via.map = val_map;
-      break;
+    if (s[i] != '\\') {
+      i++;
+      continue;
     }
-    case BECO_VALUE_TYPE_ARRAY: {
-      out->via.array = val_array;
-      break;
+
+    ParserKeep(p, data, start, i);
+    start = i;
+    // an escape cut by the end of the data is decoded with the next feed
+    if (i + 1 >= len) break;
+    switch (s[i + 1]) {
+      case '"':
+      case '\\':
+      case '/':
+        utf8[0] = s[i + 1];
+        ulen = 1;
+        break;
+      case 'b':
+        utf8[0] = '\b';
+        ulen = 1;
+        break;
+      case 'f':
+        utf8[0] = '\f';
+        ulen = 1;
+        break;
+      case 'n':
+        utf8[0] = '\n';
+        ulen = 1;
+        break;
+      case 'r':
+        utf8[0] = '\r';
+        ulen = 1;
+        break;
+      case 't':
+        utf8[0] = '\t';
+        ulen = 1;
+        break;
+      case 'u': {
+        if (i + 6 > len) goto more;
+        if (!ParseHex4(s + i + 2, &cp)) goto error;
+        if (cp >= 0xd800 && cp < 0xdc00) {
+          if (i + 12 > len) goto more;
+          if (s[i + 6] != '\\' || s[i + 7] != 'u' || !ParseHex4(s + i + 8, &lo) || lo < 0xdc00 || lo > 0xdfff) {
+            goto error;
+          }
+          cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+          i += 6;
+        } else if (cp >= 0xdc00 && cp <= 0xdfff) {
+          goto error;
+        }
+        ulen = EncodeUtf8(cp, utf8);
+        i += 4;
+        break;
+      }
+      default:
+        goto error;
     }
+    // a decoded escape is never longer than the escape itself
+    memcpy(data + p->str_at, utf8, ulen);
+    p->str_at += ulen;
+    i += 2;
+    start = i;
   }
 
-  return BECO_ERR_OK;
-}
+  ParserKeep(p, data, start, i);
+  if (i >= len || s[i] != '"') {
+    p->pos = i;
+    return false;
+  }
+  data[p->str_at] = '\0';
+  p->pos = i + 1;
+  p->in_str = false;
 
-BecoError JsonToMap(yyjson_val *root, struct BecoMap *out) {
-  if (root == NULL || out == NULL) return BECO_ERR_NULL;
+  if (p->str_key) {
+    p->stack[p->depth - 1].key = data + p->str_start;
+    p->state = PARSER_MAP_COLON;
+  } else {
+    obj = BecoObjectNewIn(p->arena);
+    obj->type = BECO_VALUE_TYPE_STR;
+    obj->flags |= BECO_OBJECT_BORROWED | BECO_OBJECT_SIZED;
+    obj->via.text.str = data + p->str_start;
+    obj->via.text.len = p->str_at - p->str_start;
+    ParserEmit(p, obj);
+  }
+  return true;
 
-  struct BecoObject *obj = NULL;
+  more:
+  p->pos = start;
+  return false;
 
-  const char *key_str = NULL;
+  error:
+  p->state = PARSER_ERROR;
+  return false;
+}
 
-  yyjson_val *key, *val;
-  yyjson_obj_iter iter;
-  yyjson_obj_iter_init(root, &iter);
-  while ((key = yyjson_obj_iter_next(&iter))) {
+void ParserKeep(struct BecoParser *p, char *data, size_t from, size_t to) {
+  if (p->str_at != from) memmove(data + p->str_at, data + from, to - from);
+  p->str_at += to - from;
+}
 
-    val = yyjson_obj_iter_get_val(key);
-    key_str = yyjson_get_str(key);
+// number types as yyjson gives them, integers out of the 64-bit range become reals
+bool ParserNumber(struct BecoParser *p, char *data, size_t len, bool final) {
+  struct BecoObject *obj = NULL;
+  const char *num = data + p->pos;
+  size_t i = p->pos;
+  size_t n, k;
+  uint64_t u = 0;
+  unsigned d;
+  bool real = false;
+  bool neg = num[0] == '-';
+
+  for (; i < len; ++i) {
+    if (data[i] != '-' && data[i] != '+' && data[i] != '.' && data[i] != 'e' && data[i] != 'E'
+        && (data[i] < '0' || data[i] > '9')) {
+      break;
+    }
+  }
+  if (i == len && !final) return false;
 
-    obj = BecoObjectNew();
-    if (JsonToObj(val, obj) != BECO_ERR_OK) {
-      goto error;
+  n = i - p->pos;
+  if (!NumberValid(num, n, &real)) {
+    p->state = PARSER_ERROR;
+    return false;
+  }
+  for (k = neg; !real && k < n; ++k) {
+    d = (unsigned) (num[k] - '0');
+    if (u > (UINT64_MAX - d) / 10) real = true;
+    else u = u * 10 + d;
+  }
+  if (neg && u > (uint64_t) INT64_MAX + 1) real = true;
+
+  obj = BecoObjectNewIn(p->arena);
+  if (real) {
+    obj->type = BECO_VALUE_TYPE_DOUBLE;
+    if (!NumberReal(num, n, &obj->via.f64)) {
+      BecoObjectFree(obj);
+      p->state = PARSER_ERROR;
+      return false;
     }
+  } else if (neg) {
+    obj->type = BECO_VALUE_TYPE_INTEGER;
+    obj->via.i64 = (int64_t) (0 - u);
+  } else {
+    obj->type = BECO_VALUE_TYPE_POSITIVE_INTEGER;
+    obj->via.u64 = u;
+  }
 
-    BecoMapPut(out, key_str, obj);
+  p->pos = i;
+  ParserEmit(p, obj);
+  return true;
+}
+
+// -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)? and nothing else
+bool NumberValid(const char *num, size_t len, bool *real) {
+  size_t i = 0, from;
+
+  *real = false;
+  if (i < len && num[i] == '-') i++;
+  if (i < len && num[i] == '0') {
+    i++;
+  } else {
+    from = i;
+    while (i < len && num[i] >= '0' && num[i] <= '9') i++;
+    if (i == from) return false;
+  }
+  if (i < len && num[i] == '.') {
+    from = ++i;
+    while (i < len && num[i] >= '0' && num[i] <= '9') i++;
+    if (i == from) return false;
+    *real = true;
   }
+  if (i < len && (num[i] == 'e' || num[i] == 'E')) {
+    if (++i < len && (num[i] == '+' || num[i] == '-')) i++;
+    from = i;
+    while (i < len && num[i] >= '0' && num[i] <= '9') i++;
+    if (i == from) return false;
+    *real = true;
+  }
+  return i == len;
+}
 
-  error:
-  return BECO_ERR_OK;
+// converted by yyjson, the same rounding as the rest of the requests and no locale involved
+bool NumberReal(const char *num, size_t len, double *out) {
+  char pool[512];
+  yyjson_alc alc;
+  yyjson_doc *doc = NULL;
+  yyjson_val *val = NULL;
+  bool ok;
+
+  // a short number fits the pool on the stack, a long one goes to the heap
+  doc = yyjson_read_opts((char *) num, len, YYJSON_READ_NOFLAG,
+                         len < sizeof(pool) / 4 && yyjson_alc_pool_init(&alc, pool, sizeof(pool)) ? &alc : NULL,
+                         NULL);
+  val = yyjson_doc_get_root(doc);
+  // only called for reals and for integers too large for 64 bits, which yyjson reads as reals
+  if ((ok = yyjson_is_real(val))) *out = yyjson_get_real(val);
+  yyjson_doc_free(doc);
+  return ok;
 }
 
-BecoError ObjToJson(struct BecoObject *obj, yyjson_mut_doc *doc, yyjson_mut_val **out) {
-  if (obj == NULL || out == NULL) return BECO_ERR_NULL;
+bool ParserLiteral(struct BecoParser *p, const char *data, size_t len, bool final) {
+  struct BecoObject *obj = NULL;
+  const char *word = NULL;
+  size_t wlen;
 
-  yyjson_mut_val *val = NULL;
-  switch (obj->type) {
-    case BECO_VALUE_TYPE_NONE: {
-      val = yyjson_mut_null(doc);
-      break;
-    }
-    case BECO_VALUE_TYPE_BOOL: {
-      val = yyjson_mut_bool(doc, obj->via.bool_);
-      break;
-    }
-    case BECO_VALUE_TYPE_INTEGER: {
-      val = yyjson_mut_int(doc, obj->via.i64);
-      break;
-    }
-    case BECO_VALUE_TYPE_POSITIVE_INTEGER: {
-      val = yyjson_mut_uint(doc, obj->via.u64);
+  switch (data[p->pos]) {
+    case 't':
+      word = "true";
       break;
-    }
-    case BECO_VALUE_TYPE_DOUBLE: {
-      val = yyjson_mut_real(doc, obj->via.f64);
-      break;
-    }
-    case BECO_VALUE_TYPE_STR: {
-      val = yyjson_mut_str(doc, obj->via.str);
-      break;
-    }
-    case BECO_VALUE_TYPE_MAP: {
-      MapToJson(obj->via.map, doc, &val);
+    case 'f':
+      word = "false";
       break;
-    }
-    case BECO_VALUE_TYPE_ARRAY: {
-      ArrToJson(obj->via.array, doc, &val);
+    case 'n':
+      word = "null";
       break;
-    }
+    default:
+      p->state = PARSER_ERROR;
+      return false;
   }
-  *out = val;
-  return BECO_ERR_OK;
-}
-
-BecoError MapToJson(struct BecoMap *obj, yyjson_mut_doc *doc, yyjson_mut_val **out) {
-  if (obj == NULL) return BECO_ERR_NULL;
 
-  struct BecoMapEntry *entry, *temp;
-  struct BecoKV *kv = NULL;
-  yyjson_mut_val *val;
-  yyjson_mut_val *vk;
-  yyjson_mut_val *vv;
+  wlen = strlen(word);
+  if (len - p->pos < wlen) {
+    if (final) p->state = PARSER_ERROR;
+    return false;
+  }
+  if (memcmp(data + p->pos, word, wlen) != 0) {
+    p->state = PARSER_ERROR;
+    return false;
+  }
+  p->pos += wlen;
 
-  val = yyjson_mut_obj(doc);
-  HASH_ITER(hh, obj->entries, entry, temp) {
-    kv = entry->kv;
-    if (kv != NULL) {
-      vk = yyjson_mut_str(doc, kv->key);
-      ObjToJson(kv->value, doc, &vv);
-      yyjson_mut_obj_add(val, vk, vv);
-    }
+  obj = BecoObjectNewIn(p->arena);
+  if (word[0] != 'n') {
+    obj->type = BECO_VALUE_TYPE_BOOL;
+    obj->via.bool_ = word[0] == 't';
   }
-  *out = val;
-  return BECO_ERR_OK;
+  ParserEmit(p, obj);
+  return true;
 }
 
-BecoError ArrToJson(struct BecoArray *obj, yyjson_mut_doc *doc, yyjson_mut_val **out) {
-  if (obj == NULL) return BECO_ERR_NULL;
-
-  struct BecoObject *element = NULL;
-  yyjson_mut_val *val = NULL;
-  yyjson_mut_val *ve = NULL;
+bool ParseHex4(const unsigned char *s, uint32_t *out) {
+  uint32_t v = 0;
   int i;
 
-  val = yyjson_mut_arr(doc);
-  if (obj->ptr != NULL) {
-    for (i = 0; i < obj->size; ++i) {
-      element = obj->ptr[i];
-      ObjToJson(element, doc, &ve);
-      yyjson_mut_arr_add_val(val, ve);
-    }
+  for (i = 0; i < 4; ++i) {
+    v <<= 4;
+    if (s[i] >= '0' && s[i] <= '9') v |= s[i] - '0';
+    else if (s[i] >= 'a' && s[i] <= 'f') v |= s[i] - 'a' + 10;
+    else if (s[i] >= 'A' && s[i] <= 'F') v |= s[i] - 'A' + 10;
+    else return false;
+  }
+  *out = v;
+  return true;
+}
+
+// length of a well-formed UTF-8 sequence, 0 if it is not one, -1 if it needs more bytes
+int Utf8Check(const unsigned char *s, size_t avail) {
+  unsigned char lo = 0x80, hi = 0xbf;
+  int need, i;
+
+  if (s[0] >= 0xc2 && s[0] <= 0xdf) need = 2;
+  else if (s[0] >= 0xe0 && s[0] <= 0xef) need = 3;
+  else if (s[0] >= 0xf0 && s[0] <= 0xf4) need = 4;
+  else return 0;
+
+  // no overlong forms, surrogates or code points past U+10FFFF
+  if (s[0] == 0xe0) lo = 0xa0;
+  else if (s[0] == 0xed) hi = 0x9f;
+  else if (s[0] == 0xf0) lo = 0x90;
+  else if (s[0] == 0xf4) hi = 0x8f;
+
+  for (i = 1; i < need; ++i) {
+    if ((size_t) i >= avail) return -1;
+    if (s[i] < lo || s[i] > hi) return 0;
+    lo = 0x80;
+    hi = 0xbf;
   }
+  return need;
+}
 
-  *out = val;
-  return BECO_ERR_OK;
+size_t EncodeUtf8(uint32_t cp, unsigned char *out) {
+  if (cp < 0x80) {
+    out[0] = (unsigned char) cp;
+    return 1;
+  }
+  if (cp < 0x800) {
+    out[0] = (unsigned char) (0xc0 | (cp >> 6));
+    out[1] = (unsigned char) (0x80 | (cp & 0x3f));
+    return 2;
+  }
+  if (cp < 0x10000) {
+    out[0] = (unsigned char) (0xe0 | (cp >> 12));
+    out[1] = (unsigned char) (0x80 | ((cp >> 6) & 0x3f));
+    out[2] = (unsigned char) (0x80 | (cp & 0x3f));
+    return 3;
+  }
+  out[0] = (unsigned char) (0xf0 | (cp >> 18));
+  out[1] = (unsigned char) (0x80 | ((cp >> 12) & 0x3f));
+  out[2] = (unsigned char) (0x80 | ((cp >> 6) & 0x3f));
+  out[3] = (unsigned char) (0x80 | (cp & 0x3f));
+  return 4;
 }
 
 void FreeHandler(struct BecoRequestHandler *handler) {
@@ -23,6 +23,7 @@
 #define BECO_H
 
 #include <stdio.h>
+#include <stddef.h>
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -33,6 +34,7 @@ typedef enum BecoError {
   BECO_ERR_NULL = 3,
   BECO_ERR_INVALID_JSON = 4,
   BECO_ERR_NO_IMPL = 5,
+  BECO_ERR_EOF = 6,
   BECO_ERR_GENERIC = 9,
 } BecoError;
 
@@ -47,6 +49,53 @@ typedef enum BecoValueType {
   BECO_VALUE_TYPE_ARRAY,
 } BecoValueType;
 
+typedef enum BecoObjectFlag {
+  BECO_OBJECT_BORROWED = 1,
+  BECO_OBJECT_ARENA = 2,
+  BECO_OBJECT_INLINE = 4,
+  BECO_OBJECT_SIZED = 8,
+  BECO_OBJECT_PACKED = 16,
+} BecoObjectFlag;
+
+// longest string kept inside the object itself
+#define BECO_INLINE_STR_MAX 14
+
+// element storage of an array, numbers of a single type can be kept as a plain C array
+typedef enum BecoArrayType {
+  BECO_ARRAY_OBJECTS,
+  BECO_ARRAY_INT64,
+  BECO_ARRAY_DOUBLE,
+} BecoArrayType;
+
+typedef enum BecoFieldType {
+  BECO_FIELD_BOOL, // bool
+  BECO_FIELD_INT, // int
+  BECO_FIELD_INT64, // int64_t
+  BECO_FIELD_UINT64, // uint64_t
+  BECO_FIELD_DOUBLE, // double
+  BECO_FIELD_STR, // const char *, points into the request when decoded
+  BECO_FIELD_STRUCT, // struct described by nested
+} BecoFieldType;
+
+typedef enum BecoTransportType {
+  BECO_TRANSPORT_STDIO,
+  BECO_TRANSPORT_FD,
+  BECO_TRANSPORT_URING,
+  BECO_TRANSPORT_CUSTOM,
+} BecoTransportType;
+
+typedef enum BecoEventType {
+  BECO_EVENT_READ = 1,
+  BECO_EVENT_WRITE = 2,
+  BECO_EVENT_ERROR = 4,
+} BecoEventType;
+
+typedef enum BecoFlushPolicy {
+  BECO_FLUSH_IMMEDIATE,
+  BECO_FLUSH_IDLE,
+  BECO_FLUSH_THRESHOLD,
+} BecoFlushPolicy;
+
 struct BecoRequest;
 struct BecoContext;
 struct BecoMap;
@@ -54,36 +103,122 @@ struct BecoKV;
 struct BecoArray;
 struct BecoObject;
 struct BecoRequestHandler;
+struct BecoTransport;
+struct BecoBuffer;
+struct BecoEventLoop;
+struct BecoParser;
+struct BecoBuilder;
+struct BecoFrozen;
+struct BecoLease;
+struct BecoArena;
+struct BecoInterns;
 
 typedef BecoError (*BecoRequestHandlerFunc)(struct BecoContext *, struct BecoRequest *, void *);
+typedef BecoError (*BecoTransportReadFunc)(struct BecoContext *, struct BecoBuffer *);
+typedef BecoError (*BecoTransportWriteFunc)(struct BecoContext *, const char *, size_t);
+typedef BecoError (*BecoTransportFlushFunc)(struct BecoContext *);
+typedef bool (*BecoTransportReadyFunc)(struct BecoContext *);
+typedef void (*BecoTransportDestroyFunc)(struct BecoContext *);
+typedef void (*BecoEventFunc)(struct BecoContext *, void *);
+typedef void (*BecoFdFunc)(struct BecoContext *, int, uint32_t, void *);
 
 struct BecoObject {
   enum BecoValueType type;
+  uint32_t flags; // BecoObjectFlag, a borrowed string isn't freed with the object, an arena one not at all
   union {
     bool bool_;
     uint64_t u64;
     int64_t i64;
     double f64;
-    char *str;
+    char *str; // not valid to read or set directly, use BecoObjectGetStr and BecoObjectSetStr
     struct BecoMap *map;
     struct BecoArray *array;
+    struct {
+      char *str;
+      size_t len;
+    } text; // str with its length when BECO_OBJECT_SIZED is set
+    char inline_str[16]; // BECO_OBJECT_INLINE, NUL terminated, the length is in the last byte
   } via;
 };
 
 struct BecoKV {
   enum BecoValueType type;
+  uint32_t flags;
   char *key;
   struct BecoObject *value;
 };
 
 struct BecoArray {
   size_t size;
-  struct BecoObject **ptr;
+  size_t cap;
+  struct BecoObject *items; // elements by value, contiguous
+  long refs; // owners sharing the array, see BecoArrayRetain
+  struct BecoArena *arena;
+  void *view; // document node while the elements aren't converted yet, see BecoSetLazyView
+  enum BecoArrayType num_type; // elements are in nums instead of items unless BECO_ARRAY_OBJECTS
+  void *nums; // int64_t or double values, see BecoObjectGetDoubles
+};
+
+struct BecoField {
+  const char *name;
+  size_t offset;
+  enum BecoFieldType type;
+  struct BecoStruct *nested;
+  uint32_t hash; // name hash and length, filled in on first use
+  uint32_t len;
+};
+
+struct BecoStruct {
+  struct BecoField *fields;
+  size_t count;
+  bool ready;
+};
+
+#define BECO_FIELD(type, member, field_type) {#member, offsetof(type, member), field_type, NULL, 0, 0}
+#define BECO_FIELD_NESTED(type, member, desc) {#member, offsetof(type, member), BECO_FIELD_STRUCT, desc, 0, 0}
+#define BECO_STRUCT(fields) {fields, sizeof(fields) / sizeof((fields)[0]), false}
+
+struct BecoBuffer {
+  char *data;
+  size_t len;
+  size_t cap;
+};
+
+struct BecoStats {
+  uint64_t reads;
+  uint64_t frames_read;
+  uint64_t max_frames_per_read;
+  uint64_t frames_written;
+  uint64_t flushes;
+  uint64_t frames_flushed;
+  uint64_t max_frames_per_flush;
+  uint64_t read_wait_us;
+  uint64_t write_blocked_us;
+  uint64_t max_write_blocked_us;
+  uint64_t handler_us;
+  uint64_t in_queued;
+  uint64_t out_queued;
+  uint64_t in_pipe_size;
+  uint64_t out_pipe_size;
+  uint64_t intern_hits;
+  uint64_t intern_misses;
+  uint64_t intern_keys;
+};
+
+struct BecoTransport {
+  BecoTransportReadFunc read;
+  BecoTransportWriteFunc write;
+  BecoTransportFlushFunc flush;
+  BecoTransportDestroyFunc destroy;
+  BecoTransportReadyFunc ready;
+  // optional, writes a frame whose length header is already in place
+  BecoTransportWriteFunc write_frame;
 };
 
 struct BecoRequest {
   char *cmd;
   struct BecoObject *data;
+  struct BecoLease *lease; // frame buffer the strings of data point into
 };
 
 struct BecoConf {
@@ -97,6 +232,8 @@ struct BecoConf {
   BecoRequestHandlerFunc null_cmd_handler;
   void *null_user_data;
   bool *exit_flag;
+  enum BecoTransportType transport;
+  size_t pipe_size;
 };
 
 struct BecoContext {
@@ -106,6 +243,37 @@ struct BecoContext {
   struct BecoRequestHandler *handler_entries;
   struct BecoRequestHandler *null_cmd_handler;
   struct BecoRequestHandler *default_cmd_handler;
+  const struct BecoTransport *transport;
+  void *transport_data;
+  struct BecoEventLoop *loop;
+  int in_fd;
+  int out_fd;
+  struct BecoStats stats;
+  enum BecoFlushPolicy flush_policy;
+  size_t flush_bytes;
+  uint32_t flush_delay_ms;
+  uint64_t out_frames_pending;
+  size_t out_bytes_pending;
+  uint64_t out_pending_since;
+  struct BecoBuffer send_buf;
+  struct BecoBuffer frame_buf;
+  struct BecoBuffer recv_buf;
+  size_t recv_keep_size;
+  size_t recv_spike_size;
+  uint32_t recv_idle_ms;
+  uint64_t recv_spike_at;
+  bool chunking;
+  size_t chunk_size;
+  uint64_t chunk_id;
+  struct BecoBuffer chunk_buf;
+  bool incremental_parse;
+  size_t incremental_min_size;
+  struct BecoParser *parser;
+  struct BecoBuilder *builder;
+  struct BecoLease *recv_lease;
+  bool lazy_view;
+  struct BecoInterns *interns;
+  const char *command_key;
 };
 
 /******************************************
@@ -158,6 +326,172 @@ BecoError BecoSetIn(struct BecoContext *ctx, FILE *in);
  */
 BecoError BecoSetOut(struct BecoContext *ctx, FILE *out);
 
+/**
+ * Select a builtin transport, BECO_TRANSPORT_STDIO by default.
+ *
+ * BECO_TRANSPORT_FD works on the file descriptors behind the input and output channels,
+ * it reads with read(2) and writes every frame with a single writev(2). Reads are greedy,
+ * every read takes as many bytes as available into a ring buffer and all complete frames
+ * in it are served without another system call. Select it before the first read, data
+ * already buffered by stdio won't be seen by the fd transport.
+ *
+ * BECO_TRANSPORT_URING drives the same descriptors through io_uring, Linux only. A read
+ * into the input ring stays queued all the time, responses are collected in a registered
+ * send area and leave with one write per flush, so batching follows the flush policy.
+ * It is detected at runtime, when the kernel or the build lacks io_uring the context
+ * falls back to BECO_TRANSPORT_FD. Not supported by the event loop mode.
+ * @param ctx context
+ * @param type transport type
+ * @return error, BECO_ERR_NO_IMPL if the transport is not available on this platform,
+ *         BECO_ERR_GENERIC while the current transport holds input not read yet
+ */
+BecoError BecoSetTransport(struct BecoContext *ctx, enum BecoTransportType type);
+
+/**
+ * Get the transport in use, BECO_TRANSPORT_CUSTOM for user defined ones
+ * @param ctx context
+ * @return transport type
+ */
+enum BecoTransportType BecoGetTransport(struct BecoContext *ctx);
+
+/**
+ * Install a user defined transport. Pending output of the previous transport is flushed first.
+ * @param ctx context
+ * @param transport transport, must outlive the context
+ * @param data transport private data, available as ctx->transport_data
+ * @return error, BECO_ERR_GENERIC while the previous transport holds input not read yet
+ */
+BecoError BecoSetCustomTransport(struct BecoContext *ctx, const struct BecoTransport *transport, void *data);
+
+/**
+ * Set output flush policy, BECO_FLUSH_IMMEDIATE by default.
+ *
+ *  - BECO_FLUSH_IMMEDIATE  every response is flushed right after it is written
+ *  - BECO_FLUSH_IDLE       responses are coalesced until the context is about to wait for input
+ *  - BECO_FLUSH_THRESHOLD  like BECO_FLUSH_IDLE, but flushes as well once max_bytes are pending
+ *                          or the oldest pending response is older than max_delay_ms
+ *
+ * Pending output is always flushed before the context blocks on input, so a quiet channel
+ * gets every response without delay.
+ * @param ctx context
+ * @param policy flush policy
+ * @param max_bytes pending bytes threshold, only used by BECO_FLUSH_THRESHOLD
+ * @param max_delay_ms pending time threshold, only used by BECO_FLUSH_THRESHOLD
+ * @return error
+ */
+BecoError BecoSetFlushPolicy(struct BecoContext *ctx, enum BecoFlushPolicy policy, size_t max_bytes,
+                             uint32_t max_delay_ms);
+
+/**
+ * Flush pending output
+ * @param ctx context
+ * @return error
+ */
+BecoError BecoFlush(struct BecoContext *ctx);
+
+/**
+ * Get transport statistics.
+ *
+ * reads counts read system calls (or frames for stdio), frames_read / reads tells how many
+ * frames a single read delivered on average, frames_flushed / flushes tells the same for writes.
+ *
+ * read_wait_us is the time spent waiting for input frames, frames parsed while they arrive
+ * included. write_blocked_us is the time spent handing output to the transport, which grows
+ * when the extension stops draining its end, handler_us is the time spent in handlers, the
+ * responses they write included.
+ * in_queued and out_queued are the bytes sitting in the input and output pipes and
+ * in_pipe_size and out_pipe_size their capacity, sampled by this call (0 where unknown).
+ * intern_hits and intern_misses count the map keys looked up in the key table, intern_keys
+ * is its size.
+ * @param ctx context
+ * @param stats output statistics
+ * @return error
+ */
+BecoError BecoGetStats(struct BecoContext *ctx, struct BecoStats *stats);
+
+/**
+ * Resize the input and output pipes, Linux only.
+ *
+ * A pipe holds 64 KiB by default, a larger one absorbs bursts from the browser and lets
+ * responses queue up while the extension is busy. Unprivileged processes are limited to
+ * /proc/sys/fs/pipe-max-size, descriptors which aren't pipes are left as they are.
+ * @param ctx context
+ * @param size capacity in bytes, the kernel rounds it up to a power of two pages
+ * @return error, BECO_ERR_NO_IMPL on other platforms, BECO_ERR_IO if the kernel refused
+ */
+BecoError BecoSetPipeSize(struct BecoContext *ctx, size_t size);
+
+/**
+ * Enable or disable chunked responses, disabled by default.
+ *
+ * A response which serializes to more than 1 MiB is split into frames of at most
+ * frame_size bytes, every frame is a chunk envelope carrying a slice of the JSON text:
+ *
+ *   {"chunk":{"id":7,"seq":0,"total":3},"data":"{\"files\":[..."}
+ *
+ * id is the same for all chunks of a response, seq counts from 0 to total - 1 and the
+ * concatenated data strings are the JSON of the response. Slices never split a UTF-8
+ * sequence. Serialization is streamed, only one frame exists in memory at a time.
+ * Smaller responses are written as usual.
+ * @param ctx context
+ * @param enable enable chunking
+ * @param frame_size max frame size, 0 for 1 MiB
+ * @return error, BECO_ERR_OVERFLOW if frame_size is larger than 1 MiB
+ */
+BecoError BecoSetChunking(struct BecoContext *ctx, bool enable, size_t frame_size);
+
+/**
+ * Parse large requests while they arrive, disabled by default. The default min_size is 256 KiB.
+ *
+ * The frame is tokenized after every read, so the request is ready right after its last
+ * byte instead of after a full parse of the complete frame. Strings are decoded in place,
+ * so there is no second try with yyjson: a frame the incremental parser does not accept is
+ * rejected as invalid JSON. The parser follows the same grammar as yyjson, strings must be
+ * valid UTF-8.
+ * @param ctx context
+ * @param enable enable incremental parsing
+ * @param min_size smallest frame parsed incrementally, 0 for the default
+ * @return error
+ */
+BecoError BecoSetIncrementalParse(struct BecoContext *ctx, bool enable, size_t min_size);
+
+/**
+ * Convert request data on access instead of up front, disabled by default.
+ *
+ * The request keeps the parsed document, a map or array is a view on it until it is used:
+ * BecoMapGet and BecoMapContainsKey convert just the value they look at, BecoObjectGetArray
+ * and BecoArrayGet convert one level of the array, iterating, serializing or modifying a
+ * container converts it as a whole. Requests read this way are not parsed while they arrive.
+ * @param ctx context
+ * @param enable enable lazy conversion
+ * @return error
+ */
+BecoError BecoSetLazyView(struct BecoContext *ctx, bool enable);
+
+/**
+ * Get the canonical copy of a map key from the key table of the context.
+ *
+ * Keys of received requests and of maps built in a request arena are taken from the table,
+ * so they are stored once and hashed once. Long keys and keys beyond the capacity of the
+ * table are not interned.
+ * @param ctx context
+ * @param key key
+ * @return interned key, valid as long as the context, NULL if it can't be interned
+ */
+const char *BecoIntern(struct BecoContext *ctx, const char *key);
+
+/**
+ * Set receive buffer policy. The receive buffer is reused across requests and grows geometrically,
+ * it shrinks back to keep_size once no frame larger than keep_size arrived for idle_ms milliseconds,
+ * or right after a frame larger than spike_size has been handled.
+ * Pass 0 to keep the default value of a field.
+ * @param ctx context
+ * @param keep_size capacity retained while idle, 64KiB by default
+ * @param idle_ms idle period before shrinking, 5000ms by default
+ * @param spike_size capacity released immediately after use, 4MiB by default
+ */
+void BecoSetRecvBufferPolicy(struct BecoContext *ctx, size_t keep_size, uint32_t idle_ms, size_t spike_size);
+
 /**
  * Free a context allocated on heap
  * @param ctx context
@@ -194,11 +528,42 @@ void BecoSetDefaultCmdHandler(struct BecoContext *ctx, BecoRequestHandlerFunc ha
  */
 BecoError BecoSendResponse(struct BecoContext *ctx, struct BecoObject *res);
 
+/**
+ * Send JSON text serialized by the caller as a response, in a single frame
+ * @param ctx context
+ * @param json JSON text
+ * @param len length
+ * @return error, BECO_ERR_OVERFLOW if it's larger than a frame
+ */
+BecoError BecoSendJson(struct BecoContext *ctx, const char *json, size_t len);
+
+/**
+ * Serialize a response once to send it any number of times, the frame is kept as it goes out
+ * @param obj response
+ * @param out frozen response, immutable, release with BecoFrozenFree
+ * @return error, BECO_ERR_OVERFLOW if it's larger than a frame
+ */
+BecoError BecoObjectFreeze(struct BecoObject *obj, struct BecoFrozen **out);
+
+/**
+ * Send a frozen response, no serialization takes place
+ * @param ctx context
+ * @param frozen frozen response
+ * @return error
+ */
+BecoError BecoSendFrozen(struct BecoContext *ctx, const struct BecoFrozen *frozen);
+
+/**
+ * Free a frozen response
+ * @param frozen frozen response
+ */
+void BecoFrozenFree(struct BecoFrozen *frozen);
+
 /**
  * Beco main loop, it will handle incoming requests continuously unless `exit` state changed
  * @param ctx context
  * @param exit loop exit when exit turns to be true
- * @param exit_on_fail if true, loop will exit when error occurs
+ * @param exit_on_fail if true, loop will exit when error occurs, the event loop exits on a broken input anyway
  * @return last error
  */
 BecoError BecoMainLoop(struct BecoContext *ctx, const volatile bool *exit, bool exit_on_fail);
@@ -210,6 +575,78 @@ BecoError BecoMainLoop(struct BecoContext *ctx, const volatile bool *exit, bool
  */
 BecoError BecoNext(struct BecoContext *ctx);
 
+/**
+ * Switch BecoMainLoop() to the event loop mode, Linux only.
+ *
+ * The loop waits on epoll for input, timers, extra file descriptors and a wakeup eventfd,
+ * so it reacts to BecoWakeup() immediately instead of after the next browser message.
+ * The context is switched to BECO_TRANSPORT_FD if it still uses stdio.
+ * @param ctx context
+ * @return error, BECO_ERR_NO_IMPL if not supported on this platform or by the transport
+ */
+BecoError BecoEnableEventLoop(struct BecoContext *ctx);
+
+/**
+ * Wake up the event loop, safe to call from other threads and signal handlers.
+ * The loop checks its exit flag and calls the wakeup handler.
+ * @param ctx context
+ * @return error
+ */
+BecoError BecoWakeup(struct BecoContext *ctx);
+
+/**
+ * Set handler called by the event loop thread after BecoWakeup()
+ * @param ctx context
+ * @param handler handler, NULL to remove
+ * @param user_data user data
+ * @return error
+ */
+BecoError BecoSetWakeupHandler(struct BecoContext *ctx, BecoEventFunc handler, void *user_data);
+
+/**
+ * Add a timer to the event loop
+ * @param ctx context
+ * @param delay_ms first expiration, relative to now
+ * @param interval_ms repeat interval, 0 for a one-shot timer
+ * @param handler handler
+ * @param user_data user data
+ * @param id output timer id, optional
+ * @return error
+ */
+BecoError BecoAddTimer(struct BecoContext *ctx,
+                       uint32_t delay_ms,
+                       uint32_t interval_ms,
+                       BecoEventFunc handler,
+                       void *user_data,
+                       int *id);
+
+/**
+ * Remove a timer, it's safe to remove a timer from its own handler
+ * @param ctx context
+ * @param id timer id
+ * @return error
+ */
+BecoError BecoRemoveTimer(struct BecoContext *ctx, int id);
+
+/**
+ * Watch an extra file descriptor in the event loop
+ * @param ctx context
+ * @param fd file descriptor
+ * @param events BECO_EVENT_READ and/or BECO_EVENT_WRITE
+ * @param handler handler, called with the ready events
+ * @param user_data user data
+ * @return error
+ */
+BecoError BecoAddFd(struct BecoContext *ctx, int fd, uint32_t events, BecoFdFunc handler, void *user_data);
+
+/**
+ * Stop watching a file descriptor, it won't be closed
+ * @param ctx context
+ * @param fd file descriptor
+ * @return error
+ */
+BecoError BecoRemoveFd(struct BecoContext *ctx, int fd);
+
 /**
  * Read request from input channel
  * @param ctx context
@@ -229,12 +666,20 @@ BecoError BecoWrite(struct BecoContext *ctx, struct BecoObject *res);
 /**
  * Read raw request content from channel
  * @param in input channel
- * @param out raw request content
+ * @param out raw request content, caller takes the ownership
  * @param olen raw request content length
  * @return error
  */
 BecoError BecoReadRaw(FILE *in, char **out, size_t *olen);
 
+/**
+ * Read raw request content from channel into a reusable buffer
+ * @param in input channel
+ * @param buf buffer, grows if needed, buf->len is set to the content length
+ * @return error, BECO_ERR_EOF if the channel is closed
+ */
+BecoError BecoReadRawBuf(FILE *in, struct BecoBuffer *buf);
+
 /**
  * Write raw response content to channel
  * @param out output channel
@@ -244,6 +689,23 @@ BecoError BecoReadRaw(FILE *in, char **out, size_t *olen);
  */
 BecoError BecoWriteRaw(FILE *out, const char *data, size_t dlen);
 
+/**
+ * Read raw request content from file descriptor into a reusable buffer
+ * @param fd input file descriptor
+ * @param buf buffer, grows if needed, buf->len is set to the content length
+ * @return error, BECO_ERR_EOF if the channel is closed
+ */
+BecoError BecoReadRawFd(int fd, struct BecoBuffer *buf);
+
+/**
+ * Write raw response content to file descriptor, header and content are written by one writev(2)
+ * @param fd output file descriptor
+ * @param data raw response content
+ * @param dlen raw response content length
+ * @return error
+ */
+BecoError BecoWriteRawFd(int fd, const char *data, size_t dlen);
+
 /**
  * Register command handler function to context
  * @param ctx context
@@ -276,9 +738,11 @@ struct BecoRequestHandler *BecoFindRequestHandler(struct BecoContext *ctx, const
 /******************************************
  * Common Data Structures
  *   - BecoMap          HashMap
- *   - BecoArray        Fixed-size Array
+ *   - BecoArray        Growable Array
  *   - BecoObject       Generic Object
  *   - BecoKV           Key-Value
+ *   - BecoBuffer       Growable Buffer
+ *   - BecoArena        Bump-pointer Allocator
  *****************************************/
 
 /**
@@ -287,6 +751,23 @@ struct BecoRequestHandler *BecoFindRequestHandler(struct BecoContext *ctx, const
  */
 struct BecoObject *BecoObjectNew();
 
+/**
+ * Create an object in an arena, it is released with the arena and BecoObjectFree leaves it alone.
+ *
+ * Everything put into an arena object must come from the same arena or outlive it.
+ * @param arena arena, NULL for the heap
+ * @return object
+ */
+struct BecoObject *BecoObjectNewIn(struct BecoArena *arena);
+
+/**
+ * Copy an object and everything under it to the heap, strings included,
+ * so it can outlive the request or arena it came from
+ * @param obj object
+ * @return heap object, release with BecoObjectFree()
+ */
+struct BecoObject *BecoObjectPromote(struct BecoObject *obj);
+
 /**
  * Get value type.
  * @param obj object
@@ -323,12 +804,40 @@ bool BecoObjectGetBool(struct BecoObject *obj);
 double BecoObjectGetFloat64(struct BecoObject *obj);
 
 /**
- * Get null-terminated string value
+ * Get null-terminated string value. Strings may be kept inline or with their length, so
+ * via.str is not the string any more, read it only through this function.
  * @param obj  object
  * @return  string
  */
 const char *BecoObjectGetStr(struct BecoObject *obj);
 
+/**
+ * Get string length, strings may contain NUL bytes
+ * @param obj object
+ * @return length in bytes, 0 for other types
+ */
+size_t BecoObjectGetStrLen(struct BecoObject *obj);
+
+/**
+ * Set a copy of a string as value. Strings of up to BECO_INLINE_STR_MAX bytes are kept inside
+ * the object, longer ones are allocated. A previous string value is released.
+ * @param obj object
+ * @param str string, may contain NUL bytes
+ * @param len length in bytes
+ * @return error
+ */
+BecoError BecoObjectSetStr(struct BecoObject *obj, const char *str, size_t len);
+
+/**
+ * Set a copy of a string as value, a long string is allocated from an arena.
+ * @param arena arena, NULL for the heap
+ * @param obj object
+ * @param str string, may contain NUL bytes
+ * @param len length in bytes
+ * @return error
+ */
+BecoError BecoObjectSetStrIn(struct BecoArena *arena, struct BecoObject *obj, const char *str, size_t len);
+
 /**
  * Get hash map value
  * @param obj  object
@@ -337,12 +846,72 @@ const char *BecoObjectGetStr(struct BecoObject *obj);
 struct BecoMap *BecoObjectGetMap(struct BecoObject *obj);
 
 /**
- * Get fixed-size array value
+ * Get array value, the array grows when BecoArrayAdd appends at its length.
+ *
+ * An array received as plain numbers is converted back to objects on this call, use
+ * BecoObjectGetInt64s or BecoObjectGetDoubles to read such arrays without the conversion.
  * @param obj  object
  * @return array
  */
 struct BecoArray *BecoObjectGetArray(struct BecoObject *obj);
 
+/**
+ * Get hash map value to modify it. A map shared with other owners is copied first and the copy
+ * replaces it in obj, the values in the copy still share their maps and arrays.
+ * @param obj object
+ * @return hash map owned by obj alone, NULL if out of memory
+ */
+struct BecoMap *BecoObjectGetMutMap(struct BecoObject *obj);
+
+/**
+ * Get array value to modify it, an array shared with other owners is copied first,
+ * see BecoObjectGetMutMap
+ * @param obj object
+ * @return array owned by obj alone, NULL if out of memory
+ */
+struct BecoArray *BecoObjectGetMutArray(struct BecoObject *obj);
+
+/**
+ * Get the elements of an array of integers as plain numbers, to read or change them in place.
+ *
+ * Long arrays of numbers of one type are received this way, other arrays are converted on the
+ * first call. The numbers are valid until the array is accessed through the BecoArray functions
+ * or BecoObjectGetArray, which turn them back into objects.
+ * @param obj array object
+ * @param len element count output, may be NULL
+ * @return numbers, NULL if obj is empty or not an array of integers in the int64 range
+ */
+int64_t *BecoObjectGetInt64s(struct BecoObject *obj, size_t *len);
+
+/**
+ * Get the elements of an array of real numbers as plain numbers, see BecoObjectGetInt64s.
+ * Integers are not converted, an array holding any is not returned.
+ * @param obj array object
+ * @param len element count output, may be NULL
+ * @return numbers, NULL if obj is empty or not an array of real numbers
+ */
+double *BecoObjectGetDoubles(struct BecoObject *obj, size_t *len);
+
+/**
+ * Set an array of integers as value, kept as plain numbers. A previous value is released.
+ * @param arena arena, NULL for the heap
+ * @param obj object
+ * @param nums numbers to copy, NULL for zeros to fill in through BecoObjectGetInt64s
+ * @param count element count
+ * @return error
+ */
+BecoError BecoObjectSetInt64sIn(struct BecoArena *arena, struct BecoObject *obj, const int64_t *nums, size_t count);
+
+/**
+ * Set an array of real numbers as value, see BecoObjectSetInt64sIn.
+ * @param arena arena, NULL for the heap
+ * @param obj object
+ * @param nums numbers to copy, NULL for zeros to fill in through BecoObjectGetDoubles
+ * @param count element count
+ * @return error
+ */
+BecoError BecoObjectSetDoublesIn(struct BecoArena *arena, struct BecoObject *obj, const double *nums, size_t count);
+
 /**
  * Dump object content to stdout.
  * @param obj object
@@ -360,20 +929,45 @@ void BecoObjectDumpF(struct BecoObject *obj, int indent, FILE *out);
 /**
  * Dump object content as json
  * @param obj object
- * @param out output buf
+ * @param out output buf, NUL terminated, to be released with free
  * @param olen output buf length
  * @return error code
  */
 BecoError BecoObjectDumpJson(struct BecoObject *obj, char **out, size_t *olen);
 
 /**
- * Duplicate an object
+ * Get the compact json length of an object, as written in a response, without building it.
+ * Lazily parsed values are walked in place and stay unmaterialized.
+ * A lazily parsed map that repeats a key is counted once per occurrence, an upper bound then
+ * @param obj object
+ * @return byte count, string escaping included
+ */
+size_t BecoObjectSerializedSize(struct BecoObject *obj);
+
+/**
+ * Duplicate an object.
+ *
+ * A deep copy is built on the heap and owns what is put into it later, like a new object.
+ * A shallow copy shares the map or array of src instead, each holding a reference. Changes made
+ * with BecoMapPut or BecoArrayAdd are seen by every owner, get the map or array through
+ * BecoObjectGetMutMap or BecoObjectGetMutArray to change a copy of your own. Arena maps and
+ * arrays are counted as well, sharing them doesn't make them outlive the arena.
  * @param src source object
- * @param recursive deep copy
- * @return new object
+ * @param recursive deep copy, otherwise maps and arrays are shared
+ * @return new object, release with BecoObjectFree()
  */
 struct BecoObject *BecoObjectDup(struct BecoObject *src, bool recursive);
 
+/**
+ * Deep copy an object into one block, strings last, which BecoObjectFree releases in one go.
+ *
+ * Meant for copies that are kept and read. The copy is arena memory: whatever is added to it
+ * later is allocated with it, and values put into it are not taken over, they must outlive it.
+ * @param src source object
+ * @return new object, release with BecoObjectFree()
+ */
+struct BecoObject *BecoObjectPack(struct BecoObject *src);
+
 /**
  * Free an object, it'll free the object recursively
  * @param obj
@@ -388,6 +982,13 @@ void BecoObjectFree(struct BecoObject *obj);
  */
 struct BecoMap *BecoMapNew();
 
+/**
+ * Create a hash map in an arena, keys put into it are copied into the arena as well
+ * @param arena arena, NULL for the heap
+ * @return hash map
+ */
+struct BecoMap *BecoMapNewIn(struct BecoArena *arena);
+
 /**
  * Add a kv entry into the hash map
  * @param map map
@@ -404,6 +1005,19 @@ void BecoMapPut(struct BecoMap *map, const char *key, struct BecoObject *val);
  */
 struct BecoObject *BecoMapGet(struct BecoMap *map, const char *key);
 
+/**
+ * Get value by a key returned from BecoIntern, which skips hashing the key and
+ * compares it by address against the interned keys of the map.
+ *
+ * The key must be a non-NULL result of BecoIntern of a context which is still alive, its
+ * hash is read from the key table entry in front of it. Passing any other string is
+ * undefined behavior, use BecoMapGet for those.
+ * @param map map
+ * @param key interned key
+ * @return value
+ */
+struct BecoObject *BecoMapGetInterned(struct BecoMap *map, const char *key);
+
 /**
  * test if map contains key
  * @param map map
@@ -413,18 +1027,78 @@ struct BecoObject *BecoMapGet(struct BecoMap *map, const char *key);
 bool BecoMapContainsKey(struct BecoMap *map, const char *key);
 
 /**
- * Release a map
+ * Iterate a map in insertion order
+ * @param map map
+ * @param pos iteration state, start with 0
+ * @param key output key, NUL terminated
+ * @param len output key length
+ * @param value output value
+ * @return false when there are no more entries
+ */
+bool BecoMapNext(struct BecoMap *map, size_t *pos, const char **key, size_t *len, struct BecoObject **value);
+
+/**
+ * Take another reference to a map
+ * @param map map
+ * @return map
+ */
+struct BecoMap *BecoMapRetain(struct BecoMap *map);
+
+/**
+ * Release a map, it's freed with the last reference
  * @param map map
  */
 void BecoMapFree(struct BecoMap *map);
 
 /**
- * Create a fixed-size array with given size
+ * Create an array with given size, the elements are empty values
  * @param size size
  * @return array
  */
 struct BecoArray *BecoArrayNew(size_t size);
 
+/**
+ * Create an array in an arena, it also grows from the arena
+ * @param arena arena, NULL for the heap
+ * @param size size
+ * @return array
+ */
+struct BecoArray *BecoArrayNewIn(struct BecoArena *arena, size_t size);
+
+/**
+ * Make room for cap elements without changing the length.
+ *
+ * Elements are stored by value in one buffer, growing it moves them: pointers returned by
+ * BecoArrayGet and BecoArrayPush are invalid after the array grows.
+ * @param array array
+ * @param cap capacity
+ * @return error, BECO_ERR_OVERFLOW if out of memory
+ */
+BecoError BecoArrayReserve(struct BecoArray *array, size_t cap);
+
+/**
+ * Append an empty element
+ * @param array array
+ * @return the new element, to be filled in place, NULL if out of memory
+ */
+struct BecoObject *BecoArrayPush(struct BecoArray *array);
+
+/**
+ * Remove the last element
+ * @param array array
+ * @return the element, owned by the caller, release it with BecoObjectFree, NULL if empty
+ */
+struct BecoObject *BecoArrayPop(struct BecoArray *array);
+
+/**
+ * Append count elements in one go, the array takes over their contents
+ * @param array array
+ * @param items elements
+ * @param count number of elements
+ * @return error, BECO_ERR_OVERFLOW if out of memory
+ */
+BecoError BecoArrayAppend(struct BecoArray *array, const struct BecoObject *items, size_t count);
+
 /**
  * Get array's length
  * @param array array
@@ -433,15 +1107,15 @@ struct BecoArray *BecoArrayNew(size_t size);
 size_t BecoArrayLen(struct BecoArray *array);
 
 /**
- * Insert an element
+ * Set an element, the array takes over the contents of obj and releases it
  * @param array array
- * @param pos index
+ * @param pos index, the length appends
  * @param obj value
  */
 void BecoArrayAdd(struct BecoArray *array, size_t pos, struct BecoObject *obj);
 
 /**
- * Get an element by index
+ * Get an element by index, it lives in the array until the array grows
  * @param array array
  * @param pos index
  * @return value
@@ -449,7 +1123,14 @@ void BecoArrayAdd(struct BecoArray *array, size_t pos, struct BecoObject *obj);
 struct BecoObject *BecoArrayGet(struct BecoArray *array, size_t pos);
 
 /**
- * Free an array
+ * Take another reference to an array
+ * @param array array
+ * @return array
+ */
+struct BecoArray *BecoArrayRetain(struct BecoArray *array);
+
+/**
+ * Release an array, it's freed with the last reference
  * @param array array
  */
 void BecoArrayFree(struct BecoArray *array);
@@ -466,6 +1147,22 @@ struct BecoKV *BecoKVNew();
  */
 void BecoKVFree(struct BecoKV *kv);
 
+/**
+ * Allocate memory from an arena, it stays valid until the arena is reset
+ * @param arena arena, NULL for the heap
+ * @param size size in bytes
+ * @return memory, NULL if out of memory
+ */
+void *BecoArenaAlloc(struct BecoArena *arena, size_t size);
+
+/**
+ * Copy a string into an arena
+ * @param arena arena, NULL for the heap
+ * @param str string
+ * @return copy, NULL if out of memory
+ */
+char *BecoArenaStrdup(struct BecoArena *arena, const char *str);
+
 /**
  * Key-value pair set key
  * @param kv kv
@@ -480,6 +1177,75 @@ void BecoKVSetKey(struct BecoKV *kv, const char *key);
  */
 void BecoKVSetValue(struct BecoKV *kv, struct BecoObject *obj);
 
+/**
+ * Initialize an empty buffer
+ * @param buf buffer
+ */
+void BecoBufferInit(struct BecoBuffer *buf);
+
+/**
+ * Make sure the buffer can hold at least size bytes, capacity grows geometrically
+ * @param buf buffer
+ * @param size required capacity
+ * @return error
+ */
+BecoError BecoBufferReserve(struct BecoBuffer *buf, size_t size);
+
+/**
+ * Shrink buffer capacity, content beyond the new capacity is dropped
+ * @param buf buffer
+ * @param size new capacity
+ */
+void BecoBufferShrink(struct BecoBuffer *buf, size_t size);
+
+/**
+ * Release buffer memory, it won't free buffer itself
+ * @param buf buffer
+ */
+void BecoBufferDestroy(struct BecoBuffer *buf);
+
+/**
+ * Append bytes to a buffer
+ * @param buf buffer
+ * @param data data
+ * @param len length
+ * @return error
+ */
+BecoError BecoBufferAppend(struct BecoBuffer *buf, const char *data, size_t len);
+
+/**
+ * Append a string as JSON, quoted and escaped
+ * @param buf buffer
+ * @param str string
+ * @param len length in bytes
+ * @return error
+ */
+BecoError BecoBufferAppendJsonStr(struct BecoBuffer *buf, const char *str, size_t len);
+
+/**
+ * Append a signed integer as JSON
+ * @param buf buffer
+ * @param val value
+ * @return error
+ */
+BecoError BecoBufferAppendJsonInt(struct BecoBuffer *buf, int64_t val);
+
+/**
+ * Append an unsigned integer as JSON
+ * @param buf buffer
+ * @param val value
+ * @return error
+ */
+BecoError BecoBufferAppendJsonUint(struct BecoBuffer *buf, uint64_t val);
+
+/**
+ * Append a double as JSON, formatted like object values, null for inf and nan
+ * @param buf buffer
+ * @param val value
+ * @return error
+ */
+BecoError BecoBufferAppendJsonDouble(struct BecoBuffer *buf, double val);
+
 /**
  * Create request
  * @return request
@@ -493,7 +1259,9 @@ struct BecoRequest *BecoRequestNew();
 void BecoRequestInit(struct BecoRequest *req);
 
 /**
- * Destroy a request, it won't free request itself
+ * Destroy a request, it won't free request itself.
+ * The request data lives in the request arena and its strings point into the received frame,
+ * both stay valid until then, use BecoObjectPromote to keep something longer
  * @param req request
  */
 void BecoRequestDestroy(struct BecoRequest *req);
@@ -505,6 +1273,14 @@ void BecoRequestDestroy(struct BecoRequest *req);
  */
 struct BecoObject *BecoRequestGetData(struct BecoRequest *request);
 
+/**
+ * Get the request arena, handlers may build their responses in it.
+ * Its memory is released at once after the request is destroyed.
+ * @param request request
+ * @return arena, NULL if the request hasn't been read
+ */
+struct BecoArena *BecoRequestGetArena(struct BecoRequest *request);
+
 /**
  * Get request command
  * @param request request
@@ -532,6 +1308,174 @@ void BecoRequestSetCommand(struct BecoRequest *request, const char *command);
  */
 void BecoRequestFree(struct BecoRequest *request);
 
+/******************************************
+ * Struct Binding
+ *   - BecoStruct       Fields of a C struct
+ *
+ * struct Tab { int id; const char *url; };
+ * struct BecoField tab_fields[] = {BECO_FIELD(struct Tab, id, BECO_FIELD_INT),
+ *                                  BECO_FIELD(struct Tab, url, BECO_FIELD_STR)};
+ * struct BecoStruct tab_struct = BECO_STRUCT(tab_fields);
+ *****************************************/
+
+/**
+ * Decode a JSON object into a struct.
+ *
+ * Keys without a field are skipped, fields without a key or with null are left as they are.
+ * With BecoSetLazyView the request is read straight from the parsed document, no objects
+ * are created. Strings point into the request and stay valid as long as it does.
+ * @param desc struct descriptor
+ * @param obj object, a map
+ * @param out struct
+ * @return error, BECO_ERR_INVALID_JSON if a value doesn't fit its field
+ */
+BecoError BecoStructDecode(struct BecoStruct *desc, struct BecoObject *obj, void *out);
+
+/**
+ * Encode a struct as JSON, fields in declaration order
+ * @param desc struct descriptor
+ * @param data struct
+ * @param out output buf, release with free()
+ * @param olen output length
+ * @return error
+ */
+BecoError BecoStructDumpJson(struct BecoStruct *desc, const void *data, char **out, size_t *olen);
+
+/**
+ * Send a struct as response, it is encoded into a single frame
+ * @param ctx context
+ * @param desc struct descriptor
+ * @param data struct
+ * @return error, BECO_ERR_OVERFLOW if it's larger than a frame
+ */
+BecoError BecoSendStruct(struct BecoContext *ctx, struct BecoStruct *desc, const void *data);
+
+/******************************************
+ * Response Builder
+ *   - Writes a response token by token, no objects are created
+ *
+ * BecoResBeginObject(ctx);
+ * BecoResKeyStr(ctx, "url", "https://example.com");
+ * BecoResKey(ctx, "ids", 3);
+ * BecoResBeginArray(ctx);
+ * for (i = 0; i < n; ++i) BecoResInt(ctx, ids[i]);
+ * BecoResEnd(ctx);
+ * BecoResEnd(ctx);
+ *
+ * The response is sent as soon as its outermost value is complete. A call that fails or is
+ * out of place returns an error and leaves the response as it was.
+ *****************************************/
+
+/**
+ * Open an object
+ * @param ctx context
+ * @return error, BECO_ERR_INVALID_JSON if a key is expected, BECO_ERR_OVERFLOW if nested too deep
+ */
+BecoError BecoResBeginObject(struct BecoContext *ctx);
+
+/**
+ * Open an array
+ * @param ctx context
+ * @return error, BECO_ERR_INVALID_JSON if a key is expected, BECO_ERR_OVERFLOW if nested too deep
+ */
+BecoError BecoResBeginArray(struct BecoContext *ctx);
+
+/**
+ * Close the innermost object or array, the outermost one sends the response
+ * @param ctx context
+ * @return error, BECO_ERR_INVALID_JSON if nothing is open or a key misses its value
+ */
+BecoError BecoResEnd(struct BecoContext *ctx);
+
+/**
+ * Drop the response being built
+ * @param ctx context
+ */
+void BecoResAbort(struct BecoContext *ctx);
+
+/**
+ * Write an object key, the next call writes its value
+ * @param ctx context
+ * @param key key
+ * @param len key length
+ * @return error, BECO_ERR_INVALID_JSON outside of an object or if a value is expected
+ */
+BecoError BecoResKey(struct BecoContext *ctx, const char *key, size_t len);
+
+/**
+ * Write a key with a string value
+ * @param ctx context
+ * @param key key, NUL terminated
+ * @param str value, NUL terminated, NULL for null
+ * @return error
+ */
+BecoError BecoResKeyStr(struct BecoContext *ctx, const char *key, const char *str);
+
+/**
+ * Write a key with an integer value
+ * @param ctx context
+ * @param key key, NUL terminated
+ * @param val value
+ * @return error
+ */
+BecoError BecoResKeyInt(struct BecoContext *ctx, const char *key, int64_t val);
+
+/**
+ * Write null
+ * @param ctx context
+ * @return error, BECO_ERR_INVALID_JSON if a key is expected
+ */
+BecoError BecoResNull(struct BecoContext *ctx);
+
+/**
+ * Write a bool
+ * @param ctx context
+ * @param val value
+ * @return error, BECO_ERR_INVALID_JSON if a key is expected
+ */
+BecoError BecoResBool(struct BecoContext *ctx, bool val);
+
+/**
+ * Write a signed integer
+ * @param ctx context
+ * @param val value
+ * @return error, BECO_ERR_INVALID_JSON if a key is expected
+ */
+BecoError BecoResInt(struct BecoContext *ctx, int64_t val);
+
+/**
+ * Write an unsigned integer
+ * @param ctx context
+ * @param val value
+ * @return error, BECO_ERR_INVALID_JSON if a key is expected
+ */
+BecoError BecoResUint(struct BecoContext *ctx, uint64_t val);
+
+/**
+ * Write a double, inf and nan are written as null
+ * @param ctx context
+ * @param val value
+ * @return error, BECO_ERR_INVALID_JSON if a key is expected
+ */
+BecoError BecoResDouble(struct BecoContext *ctx, double val);
+
+/**
+ * Write a string
+ * @param ctx context
+ * @param str string, NULL for null
+ * @param len length
+ * @return error, BECO_ERR_INVALID_JSON if a key is expected
+ */
+BecoError BecoResStr(struct BecoContext *ctx, const char *str, size_t len);
+
+/**
+ * Write an object tree as a value
+ * @param ctx context
+ * @param obj object
+ * @return error, BECO_ERR_INVALID_JSON if a key is expected
+ */
+BecoError BecoResObject(struct BecoContext *ctx, struct BecoObject *obj);
+
 /******************************************
  * Utilities
  *   - Log
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2022 Rieon Ke <i@ry.ke>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Tail latency of large requests arriving over a throttled pipe.
+ *
+ *   bench_parse [incremental|whole] [frames] [frame KiB] [rate MiB/s]
+ *
+ * A writer process trickles every frame in slices at the given rate and reports when
+ * the last byte left, the reader measures from there until BecoRead() returned the request.
+ * A reader slower than the writer falls behind and the latency piles up, pick the rate
+ * accordingly and measure a release build.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "beco.h"
+
+#define SLICE_SIZE 0x4000
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static char *make_frame(size_t size, size_t *olen) {
+  const char *entry = "{\"name\":\"bookmark \\\"%d\\\" \\u00e9\",\"id\":%d,\"score\":%d.25,\"tags\":[\"a\",\"b\"],\"ok\":true},";
+  char *json = malloc(size + 256);
+  size_t len = 0;
+  int i = 0;
+
+  json[len++] = '[';
+  while (len < size) {
+    len += (size_t) snprintf(json + len, 256, entry, i, i, i);
+    i++;
+  }
+  json[len - 1] = ']';
+  *olen = len;
+  return json;
+}
+
+static void run_writer(int fd, int stamp_fd, long frames, size_t size, double rate) {
+  struct timespec pause;
+  size_t len = 0, off, step;
+  uint32_t header;
+  uint64_t stamp;
+  char *json = make_frame(size, &len);
+  double slice_ns = (double) SLICE_SIZE / (rate * 1024 * 1024) * 1e9;
+  long i;
+
+  pause.tv_sec = (time_t) (slice_ns / 1e9);
+  pause.tv_nsec = (long) (slice_ns - (double) pause.tv_sec * 1e9);
+
+  header = (uint32_t) len;
+  for (i = 0; i < frames; ++i) {
+    if (write(fd, &header, sizeof(header)) != sizeof(header)) break;
+    for (off = 0; off < len; off += step) {
+      step = len - off < SLICE_SIZE ? len - off : SLICE_SIZE;
+      if (write(fd, json + off, step) != (ssize_t) step) break;
+      if (off + step < len) nanosleep(&pause, NULL);
+    }
+    stamp = now_ns();
+    if (write(stamp_fd, &stamp, sizeof(stamp)) != sizeof(stamp)) break;
+  }
+  free(json);
+}
+
+int main(int argc, char **argv) {
+  struct BecoContext ctx;
+  struct BecoRequest req;
+  bool incremental = true;
+  long frames = 20;
+  size_t size = 4096 * 1024;
+  double rate = 200;
+  int data[2], stamps[2];
+  uint64_t stamp, done, total = 0, worst = 0;
+  pid_t writer;
+  long i;
+
+  if (argc > 1) incremental = strcmp(argv[1], "whole") != 0;
+  if (argc > 2) frames = atol(argv[2]);
+  if (argc > 3) size = (size_t) atol(argv[3]) * 1024;
+  if (argc > 4) rate = atof(argv[4]);
+
+  if (pipe(data) != 0 || pipe(stamps) != 0) {
+    perror("pipe");
+    return 1;
+  }
+
+  writer = fork();
+  if (writer == 0) {
+    close(data[0]);
+    close(stamps[0]);
+    run_writer(data[1], stamps[1], frames, size, rate);
+    _exit(0);
+  }
+  close(data[1]);
+  close(stamps[1]);
+
+  BecoContextInit(&ctx);
+  ctx.log = NULL;
+  BecoSetIn(&ctx, fdopen(data[0], "r"));
+  BecoSetTransport(&ctx, BECO_TRANSPORT_FD);
+  BecoSetIncrementalParse(&ctx, incremental, 0);
+
+  for (i = 0; i < frames; ++i) {
+    BecoRequestInit(&req);
+    if (BecoRead(&ctx, &req) != BECO_ERR_OK) break;
+    done = now_ns();
+    BecoRequestDestroy(&req);
+    if (read(stamps[0], &stamp, sizeof(stamp)) != sizeof(stamp)) break;
+    total += done - stamp;
+    if (done - stamp > worst) worst = done - stamp;
+  }
+
+  waitpid(writer, NULL, 0);
+  close(stamps[0]);
+
+  printf("%s: %ld/%ld frames of %zu KiB at %.0f MiB/s, last byte to request %.3f ms avg, %.3f ms max\n",
+         incremental ? "incremental" : "whole", i, frames, size / 1024, rate,
+         (double) total / 1e6 / (double) (i ? i : 1), (double) worst / 1e6);
+  ctx.out = NULL;
+  BecoContextDestroy(&ctx);
+  return i == frames ? 0 : 1;
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2022 Rieon Ke <i@ry.ke>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Echo round trip benchmark of the transports.
+ *
+ *   bench_transport [stdio|fd|uring] [frames] [payload size] [immediate|idle]
+ *
+ * A writer process feeds request frames into the host process, which echoes every
+ * request back, the parent reads the responses and measures the whole run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "beco.h"
+
+volatile bool g_con_exit = false;
+
+static const char *transport_name(enum BecoTransportType type) {
+  switch (type) {
+    case BECO_TRANSPORT_STDIO:
+      return "stdio";
+    case BECO_TRANSPORT_FD:
+      return "fd";
+    case BECO_TRANSPORT_URING:
+      return "uring";
+    default:
+      return "custom";
+  }
+}
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+BecoError echo_command(struct BecoContext *ctx, struct BecoRequest *req, void *data) {
+  return BecoSendResponse(ctx, BecoRequestGetData(req));
+}
+
+static void run_writer(int fd, long frames, size_t size) {
+  const char *prefix = "{\"command\":\"echo\",\"payload\":\"";
+  const char *suffix = "\"}";
+  size_t len = strlen(prefix) + size + strlen(suffix);
+  char *frame = malloc(len);
+  long i;
+
+  memcpy(frame, prefix, strlen(prefix));
+  memset(frame + strlen(prefix), 'x', size);
+  memcpy(frame + strlen(prefix) + size, suffix, strlen(suffix));
+
+  for (i = 0; i < frames; ++i) {
+    if (BecoWriteRawFd(fd, frame, len) != BECO_ERR_OK) break;
+  }
+  free(frame);
+}
+
+static void run_host(enum BecoTransportType type, enum BecoFlushPolicy policy) {
+  struct BecoContext ctx;
+  struct BecoStats stats;
+
+  BecoContextInit(&ctx);
+  ctx.log = NULL;
+  BecoRegisterCommand(&ctx, "echo", echo_command, NULL);
+  BecoSetTransport(&ctx, type);
+  BecoSetFlushPolicy(&ctx, policy, 0, 0);
+
+  BecoMainLoop(&ctx, &g_con_exit, false);
+
+  BecoFlush(&ctx);
+  BecoGetStats(&ctx, &stats);
+  fprintf(stderr, "host: transport %s, %llu reads, %llu flushes, %llu frames per read max\n",
+          transport_name(BecoGetTransport(&ctx)),
+          (unsigned long long) stats.reads,
+          (unsigned long long) stats.flushes,
+          (unsigned long long) stats.max_frames_per_read);
+  fprintf(stderr, "host: %.1f ms waiting for input, %.1f ms blocked on output (%.1f ms max), %.1f ms in handlers\n",
+          stats.read_wait_us / 1000.0,
+          stats.write_blocked_us / 1000.0,
+          stats.max_write_blocked_us / 1000.0,
+          stats.handler_us / 1000.0);
+  BecoContextDestroy(&ctx);
+}
+
+int main(int argc, char **argv) {
+  enum BecoTransportType type = BECO_TRANSPORT_FD;
+  enum BecoFlushPolicy policy = BECO_FLUSH_IDLE;
+  long frames = 100000;
+  size_t size = 64;
+  struct BecoBuffer buf;
+  int in[2], out[2];
+  pid_t writer, host;
+  uint64_t start, elapsed;
+  long i;
+
+  if (argc > 1) {
+    if (strcmp(argv[1], "stdio") == 0) type = BECO_TRANSPORT_STDIO;
+    else if (strcmp(argv[1], "fd") == 0) type = BECO_TRANSPORT_FD;
+    else if (strcmp(argv[1], "uring") == 0) type = BECO_TRANSPORT_URING;
+    else {
+      fprintf(stderr, "usage: %s [stdio|fd|uring] [frames] [payload size] [immediate|idle]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (argc > 2) frames = atol(argv[2]);
+  if (argc > 3) size = (size_t) atol(argv[3]);
+  if (argc > 4 && strcmp(argv[4], "immediate") == 0) policy = BECO_FLUSH_IMMEDIATE;
+
+  if (pipe(in) != 0 || pipe(out) != 0) {
+    perror("pipe");
+    return 1;
+  }
+
+  start = now_ns();
+
+  host = fork();
+  if (host == 0) {
+    dup2(in[0], STDIN_FILENO);
+    dup2(out[1], STDOUT_FILENO);
+    close(in[0]);
+    close(in[1]);
+    close(out[0]);
+    close(out[1]);
+    run_host(type, policy);
+    _exit(0);
+  }
+
+  writer = fork();
+  if (writer == 0) {
+    close(in[0]);
+    close(out[0]);
+    close(out[1]);
+    run_writer(in[1], frames, size);
+    close(in[1]);
+    _exit(0);
+  }
+
+  close(in[0]);
+  close(in[1]);
+  close(out[1]);
+
+  BecoBufferInit(&buf);
+  for (i = 0; i < frames; ++i) {
+    if (BecoReadRawFd(out[0], &buf) != BECO_ERR_OK) break;
+  }
+  elapsed = now_ns() - start;
+  BecoBufferDestroy(&buf);
+  close(out[0]);
+
+  waitpid(writer, NULL, 0);
+  waitpid(host, NULL, 0);
+
+  printf("%s: %ld/%ld frames of %zu bytes in %.3f ms, %.0f frames/s\n",
+         transport_name(type), i, frames, size, (double) elapsed / 1e6,
+         (double) i * 1e9 / (double) (elapsed ? elapsed : 1));
+  return i == frames ? 0 : 1;
+}
@@ -0,0 +1,52 @@
+#
+# Copyright (c) 2022 Rieon Ke <i@ry.ke>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy of
+# this software and associated documentation files (the "Software"), to deal in
+# the Software without restriction, including without limitation the rights to
+# use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+# the Software, and to permit persons to whom the Software is furnished to do so,
+# subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+# FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+# COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+# IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+# CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#
+
+# beco_generate_codecs(<var> SCHEMA <schema.json> [PREFIX <prefix>] [NAME <name>])
+#
+# Runs beco-codegen on the schema at build time and writes <name>.h and
+# <name>.c into the current binary directory. The generated files are stored
+# in <var>, add them to a target linking beco and put
+# ${CMAKE_CURRENT_BINARY_DIR} on its include path.
+
+include(CMakeParseArguments)
+
+function(beco_generate_codecs var)
+    cmake_parse_arguments(CODECS "" "SCHEMA;PREFIX;NAME" "" ${ARGN})
+    if (NOT CODECS_SCHEMA)
+        message(FATAL_ERROR "beco_generate_codecs: SCHEMA is required")
+    endif ()
+    get_filename_component(schema "${CODECS_SCHEMA}" ABSOLUTE)
+    if (NOT CODECS_NAME)
+        get_filename_component(CODECS_NAME "${schema}" NAME_WE)
+    endif ()
+
+    set(output "${CMAKE_CURRENT_BINARY_DIR}/${CODECS_NAME}")
+    set(args -o "${output}")
+    if (CODECS_PREFIX)
+        list(APPEND args -p "${CODECS_PREFIX}")
+    endif ()
+    add_custom_command(OUTPUT "${output}.h" "${output}.c"
+                       COMMAND beco-codegen ${args} "${schema}"
+                       DEPENDS beco-codegen "${schema}"
+                       COMMENT "Generating codecs from ${CODECS_SCHEMA}"
+                       VERBATIM)
+    set(${var} "${output}.h" "${output}.c" PARENT_SCOPE)
+endfunction()
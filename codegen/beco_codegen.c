@@ -0,0 +1,994 @@
+/*
+ * Copyright (c) 2022 Rieon Ke <i@ry.ke>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// beco-codegen reads a JSON Schema subset describing commands and writes a
+// header and source with C structs, parse and dump functions specialized to
+// the schema, and typed BecoRegisterCommand bindings.
+//
+//   {"commands": {"<name>": {"request": <schema>, "response": <schema>}}}
+//
+// Both schemas are objects. Properties keep their declaration order, which is
+// also the order the dump functions write them in. Supported types are
+// boolean, integer (format int32 / uint64), number, string, object and array.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#include "yyjson.h"
+
+enum CodegenKind {
+  KIND_BOOL,
+  KIND_INT,
+  KIND_INT64,
+  KIND_UINT64,
+  KIND_DOUBLE,
+  KIND_STR,
+  KIND_OBJECT,
+  KIND_ARRAY,
+  KIND_MAX
+};
+
+struct CodegenField;
+
+struct CodegenType {
+  enum CodegenKind kind;
+  char *name;
+  struct CodegenField *fields;
+  size_t count;
+  struct CodegenType *items;
+  // objects in dependency order, nested structs first
+  struct CodegenType *next;
+  // every type, for cleanup
+  struct CodegenType *all;
+};
+
+struct CodegenField {
+  const char *key;
+  size_t len;
+  char *member;
+  bool required;
+  struct CodegenType *type;
+};
+
+struct CodegenCommand {
+  const char *name;
+  char *camel;
+  struct CodegenType *request;
+  struct CodegenType *response;
+};
+
+struct Codegen {
+  const char *prefix;
+  const char *source;
+  struct CodegenCommand *commands;
+  size_t count;
+  struct CodegenType *objects;
+  struct CodegenType **tail;
+  struct CodegenType *all;
+  // helpers the generated source needs, by kind
+  bool uses[KIND_MAX];
+  FILE *h;
+  FILE *c;
+};
+
+static const char *c_keywords[] = {
+    "auto", "bool", "break", "case", "char", "const", "continue", "default", "do", "double", "else", "enum",
+    "extern", "false", "float", "for", "goto", "if", "inline", "int", "long", "register", "restrict", "return",
+    "short", "signed", "sizeof", "static", "struct", "switch", "true", "typedef", "union", "unsigned", "void",
+    "volatile", "while", NULL
+};
+
+static char *StrConcat(const char *a, const char *b) {
+  size_t a_len = strlen(a);
+  size_t b_len = strlen(b);
+  char *out = malloc(a_len + b_len + 1);
+
+  if (out == NULL) return NULL;
+  memcpy(out, a, a_len);
+  memcpy(out + a_len, b, b_len + 1);
+  return out;
+}
+
+// open_tab -> OpenTab
+static char *CamelCase(const char *name) {
+  char *out = malloc(strlen(name) + 1);
+  char *p = out;
+  bool upper = true;
+
+  if (out == NULL) return NULL;
+  for (; *name; ++name) {
+    if (!isalnum((unsigned char) *name)) {
+      upper = true;
+      continue;
+    }
+    *p++ = (char) (upper ? toupper((unsigned char) *name) : *name);
+    upper = false;
+  }
+  *p = '\0';
+  return out;
+}
+
+// a valid C identifier for a property key
+static char *MemberName(const char *key) {
+  char *out = malloc(strlen(key) + 3);
+  char *p = out;
+  int i;
+
+  if (out == NULL) return NULL;
+  if (!isalpha((unsigned char) *key) && *key != '_') *p++ = '_';
+  for (; *key; ++key) *p++ = (char) (isalnum((unsigned char) *key) ? *key : '_');
+  *p = '\0';
+  for (i = 0; c_keywords[i] != NULL; ++i) {
+    if (strcmp(out, c_keywords[i]) == 0) {
+      *p++ = '_';
+      *p = '\0';
+      break;
+    }
+  }
+  return out;
+}
+
+// writes bytes as the inside of a C string literal
+static void EmitCString(FILE *f, const char *str, size_t len) {
+  size_t i;
+  unsigned char ch;
+
+  for (i = 0; i < len; ++i) {
+    ch = (unsigned char) str[i];
+    if (ch == '"' || ch == '\\' || ch == '?') {
+      fprintf(f, "\\%c", ch);
+    } else if (ch >= 0x20 && ch < 0x7f) {
+      fputc(ch, f);
+    } else {
+      fprintf(f, "\\%03o", ch);
+    }
+  }
+}
+
+// ",\"key\":" as it appears in the output, escaped for JSON
+static char *KeyLiteral(const char *key, size_t len, bool first, size_t *out_len) {
+  char *out = malloc(len * 6 + 5);
+  char *p = out;
+  size_t i;
+  unsigned char ch;
+
+  if (out == NULL) return NULL;
+  *p++ = first ? '{' : ',';
+  *p++ = '"';
+  for (i = 0; i < len; ++i) {
+    ch = (unsigned char) key[i];
+    if (ch == '"' || ch == '\\') {
+      *p++ = '\\';
+      *p++ = (char) ch;
+    } else if (ch < 0x20) {
+      p += sprintf(p, "\\u%04x", ch);
+    } else {
+      *p++ = (char) ch;
+    }
+  }
+  *p++ = '"';
+  *p++ = ':';
+  *out_len = (size_t) (p - out);
+  return out;
+}
+
+static struct CodegenType *TypeNew(struct Codegen *gen, enum CodegenKind kind) {
+  struct CodegenType *type = calloc(1, sizeof(struct CodegenType));
+
+  if (type == NULL) return NULL;
+  type->kind = kind;
+  type->all = gen->all;
+  gen->all = type;
+  return type;
+}
+
+static struct CodegenType *TypeParse(struct Codegen *gen, yyjson_val *schema, const char *name);
+
+static struct CodegenType *ObjectParse(struct Codegen *gen, yyjson_val *schema, const char *name) {
+  yyjson_val *props = yyjson_obj_get(schema, "properties");
+  yyjson_val *required = yyjson_obj_get(schema, "required");
+  yyjson_val *key, *val;
+  yyjson_obj_iter iter;
+  yyjson_arr_iter arr_iter;
+  struct CodegenType *type = TypeNew(gen, KIND_OBJECT);
+  struct CodegenField *field;
+  char *camel, *nested;
+  size_t i, j;
+
+  if (type == NULL) return NULL;
+  type->name = StrConcat(gen->prefix, name);
+  if (type->name == NULL) return NULL;
+  if (props != NULL && !yyjson_is_obj(props)) {
+    fprintf(stderr, "%s: properties must be an object\n", name);
+    return NULL;
+  }
+
+  type->count = yyjson_obj_size(props);
+  if (type->count > 0) {
+    type->fields = calloc(type->count, sizeof(struct CodegenField));
+    if (type->fields == NULL) return NULL;
+  }
+
+  i = 0;
+  yyjson_obj_iter_init(props, &iter);
+  while ((key = yyjson_obj_iter_next(&iter)) != NULL) {
+    val = yyjson_obj_iter_get_val(key);
+    field = &type->fields[i++];
+    field->key = yyjson_get_str(key);
+    field->len = yyjson_get_len(key);
+    if (strlen(field->key) != field->len) {
+      fprintf(stderr, "%s: property names must not contain NUL\n", name);
+      return NULL;
+    }
+    field->member = MemberName(field->key);
+    camel = CamelCase(field->key);
+    if (field->member == NULL || camel == NULL) {
+      free(camel);
+      return NULL;
+    }
+    for (j = 0; j + 1 < i; ++j) {
+      if (strcmp(type->fields[j].member, field->member) == 0) {
+        fprintf(stderr, "%s: properties \"%s\" and \"%s\" map to the same member\n",
+                name, type->fields[j].key, field->key);
+        free(camel);
+        return NULL;
+      }
+    }
+    nested = StrConcat(name, camel);
+    free(camel);
+    if (nested == NULL) return NULL;
+    field->type = TypeParse(gen, val, nested);
+    free(nested);
+    if (field->type == NULL) return NULL;
+  }
+
+  yyjson_arr_iter_init(required, &arr_iter);
+  while ((val = yyjson_arr_iter_next(&arr_iter)) != NULL) {
+    for (i = 0; i < type->count; ++i) {
+      if (yyjson_equals_strn(val, type->fields[i].key, type->fields[i].len)) break;
+    }
+    if (i == type->count) {
+      fprintf(stderr, "%s: required property \"%s\" is not declared\n", name, yyjson_get_str(val));
+      return NULL;
+    }
+    if (i >= 64) {
+      fprintf(stderr, "%s: only the first 64 properties can be required\n", name);
+      return NULL;
+    }
+    type->fields[i].required = true;
+  }
+
+  // nested objects were appended while parsing the fields
+  *gen->tail = type;
+  gen->tail = &type->next;
+  return type;
+}
+
+static struct CodegenType *TypeParse(struct Codegen *gen, yyjson_val *schema, const char *name) {
+  const char *type = yyjson_get_str(yyjson_obj_get(schema, "type"));
+  const char *format = yyjson_get_str(yyjson_obj_get(schema, "format"));
+  struct CodegenType *out = NULL;
+  char *item_name;
+
+  if (type == NULL) {
+    fprintf(stderr, "%s: missing type\n", name);
+    return NULL;
+  }
+
+  if (strcmp(type, "object") == 0) return ObjectParse(gen, schema, name);
+
+  if (strcmp(type, "boolean") == 0) {
+    out = TypeNew(gen, KIND_BOOL);
+  } else if (strcmp(type, "integer") == 0) {
+    if (format != NULL && strcmp(format, "int32") == 0) {
+      out = TypeNew(gen, KIND_INT);
+    } else if (format != NULL && strcmp(format, "uint64") == 0) {
+      out = TypeNew(gen, KIND_UINT64);
+    } else {
+      out = TypeNew(gen, KIND_INT64);
+    }
+  } else if (strcmp(type, "number") == 0) {
+    out = TypeNew(gen, KIND_DOUBLE);
+  } else if (strcmp(type, "string") == 0) {
+    out = TypeNew(gen, KIND_STR);
+  } else if (strcmp(type, "array") == 0) {
+    out = TypeNew(gen, KIND_ARRAY);
+    if (out == NULL) return NULL;
+    item_name = StrConcat(name, "Item");
+    if (item_name == NULL) return NULL;
+    out->items = TypeParse(gen, yyjson_obj_get(schema, "items"), item_name);
+    free(item_name);
+    if (out->items == NULL) return NULL;
+    if (out->items->kind == KIND_ARRAY) {
+      fprintf(stderr, "%s: arrays of arrays are not supported\n", name);
+      return NULL;
+    }
+  } else {
+    fprintf(stderr, "%s: unsupported type \"%s\"\n", name, type);
+    return NULL;
+  }
+  if (out != NULL) gen->uses[out->kind] = true;
+  return out;
+}
+
+static const char *CType(struct CodegenType *type) {
+  switch (type->kind) {
+    case KIND_BOOL:
+      return "bool";
+    case KIND_INT:
+      return "int";
+    case KIND_INT64:
+      return "int64_t";
+    case KIND_UINT64:
+      return "uint64_t";
+    case KIND_DOUBLE:
+      return "double";
+    case KIND_STR:
+      return "const char *";
+    default:
+      return NULL;
+  }
+}
+
+static void EmitStruct(struct Codegen *gen, struct CodegenType *type) {
+  struct CodegenField *field;
+  struct CodegenType *item;
+  size_t i;
+
+  fprintf(gen->h, "struct %s {\n", type->name);
+  for (i = 0; i < type->count; ++i) {
+    field = &type->fields[i];
+    if (field->type->kind == KIND_OBJECT) {
+      fprintf(gen->h, "  struct %s %s;\n", field->type->name, field->member);
+    } else if (field->type->kind == KIND_ARRAY) {
+      item = field->type->items;
+      if (item->kind == KIND_OBJECT) {
+        fprintf(gen->h, "  struct %s *%s;\n", item->name, field->member);
+      } else if (item->kind == KIND_STR) {
+        fprintf(gen->h, "  const char **%s;\n", field->member);
+      } else {
+        fprintf(gen->h, "  %s *%s;\n", CType(item), field->member);
+      }
+      fprintf(gen->h, "  size_t %s_count;\n", field->member);
+    } else if (field->type->kind == KIND_STR) {
+      fprintf(gen->h, "  const char *%s;\n", field->member);
+    } else {
+      fprintf(gen->h, "  %s %s;\n", CType(field->type), field->member);
+    }
+  }
+  // empty structs are not valid C
+  if (type->count == 0) fprintf(gen->h, "  char unused;\n");
+  fprintf(gen->h, "};\n\n");
+}
+
+static const char *ParseHelper(enum CodegenKind kind) {
+  switch (kind) {
+    case KIND_BOOL:
+      return "ParseBool";
+    case KIND_INT:
+      return "ParseInt";
+    case KIND_INT64:
+      return "ParseInt64";
+    case KIND_UINT64:
+      return "ParseUint64";
+    case KIND_DOUBLE:
+      return "ParseDouble";
+    case KIND_STR:
+      return "ParseStr";
+    default:
+      return NULL;
+  }
+}
+
+// one value into target, err holds the result
+static void EmitParseValue(struct Codegen *gen, struct CodegenType *type, const char *val, const char *target,
+                           const char *indent) {
+  if (type->kind == KIND_OBJECT) {
+    fprintf(gen->c, "%sif (BecoObjectGetType(%s) != BECO_VALUE_TYPE_NONE) err = %sParse(%s, arena, &%s);\n",
+            indent, val, type->name, val, target);
+  } else {
+    fprintf(gen->c, "%serr = %s(%s, &%s);\n", indent, ParseHelper(type->kind), val, target);
+  }
+}
+
+static void EmitParseField(struct Codegen *gen, struct CodegenField *field, size_t index, const char *indent) {
+  char target[512];
+  char inner[64];
+
+  if (field->type->kind == KIND_ARRAY) {
+    fprintf(gen->c, "%sout->%s = ParseArray(val, arena, sizeof(*out->%s), &out->%s_count, &err);\n",
+            indent, field->member, field->member, field->member);
+    fprintf(gen->c, "%sfor (i = 0; err == BECO_ERR_OK && i < out->%s_count; ++i) {\n", indent, field->member);
+    snprintf(target, sizeof(target), "out->%s[i]", field->member);
+    snprintf(inner, sizeof(inner), "%s  ", indent);
+    fprintf(gen->c, "%s  item = BecoArrayGet(BecoObjectGetArray(val), i);\n", indent);
+    EmitParseValue(gen, field->type->items, "item", target, inner);
+    fprintf(gen->c, "%s}\n", indent);
+  } else {
+    snprintf(target, sizeof(target), "out->%s", field->member);
+    EmitParseValue(gen, field->type, "val", target, indent);
+  }
+  if (field->required) fprintf(gen->c, "%sseen |= (uint64_t) 1 << %lu;\n", indent, (unsigned long) index);
+}
+
+static const struct CodegenType *sort_type;
+
+// by key length, then first byte, then declaration order
+static int FieldCompare(const void *a, const void *b) {
+  const struct CodegenField *fa = &sort_type->fields[*(const size_t *) a];
+  const struct CodegenField *fb = &sort_type->fields[*(const size_t *) b];
+  unsigned char ca, cb;
+
+  if (fa->len != fb->len) return fa->len < fb->len ? -1 : 1;
+  ca = fa->len > 0 ? (unsigned char) fa->key[0] : 0;
+  cb = fb->len > 0 ? (unsigned char) fb->key[0] : 0;
+  if (ca != cb) return ca < cb ? -1 : 1;
+  return *(const size_t *) a < *(const size_t *) b ? -1 : 1;
+}
+
+static void EmitCharCase(FILE *f, unsigned char ch) {
+  if (ch >= 0x20 && ch < 0x7f && ch != '\'' && ch != '\\') {
+    fprintf(f, "'%c'", ch);
+  } else {
+    fprintf(f, "0x%02x", ch);
+  }
+}
+
+// matches key against the properties without hashing, the length and first
+// byte select a small group and memcmp settles the rest
+static void EmitKeySwitch(struct Codegen *gen, struct CodegenType *type, size_t *order) {
+  struct CodegenField *field, *prev;
+  size_t i, j;
+
+  fprintf(gen->c, "    switch (len) {\n");
+  for (i = 0; i < type->count;) {
+    field = &type->fields[order[i]];
+    fprintf(gen->c, "      case %lu:\n", (unsigned long) field->len);
+    if (field->len == 0) {
+      EmitParseField(gen, field, order[i], "        ");
+      fprintf(gen->c, "        break;\n");
+      ++i;
+      continue;
+    }
+    fprintf(gen->c, "        switch ((unsigned char) key[0]) {\n");
+    while (i < type->count && type->fields[order[i]].len == field->len) {
+      prev = &type->fields[order[i]];
+      fprintf(gen->c, "          case ");
+      EmitCharCase(gen->c, (unsigned char) prev->key[0]);
+      fprintf(gen->c, ":\n");
+      for (j = i; j < type->count && type->fields[order[j]].len == field->len &&
+          type->fields[order[j]].key[0] == prev->key[0]; ++j) {
+        if (field->len == 1) {
+          EmitParseField(gen, &type->fields[order[j]], order[j], "            ");
+          continue;
+        }
+        fprintf(gen->c, "            %sif (memcmp(key + 1, \"", j == i ? "" : "} else ");
+        EmitCString(gen->c, type->fields[order[j]].key + 1, field->len - 1);
+        fprintf(gen->c, "\", %lu) == 0) {\n", (unsigned long) field->len - 1);
+        EmitParseField(gen, &type->fields[order[j]], order[j], "              ");
+      }
+      if (field->len > 1) fprintf(gen->c, "            }\n");
+      fprintf(gen->c, "            break;\n");
+      i = j;
+    }
+    fprintf(gen->c, "        }\n");
+    fprintf(gen->c, "        break;\n");
+  }
+  fprintf(gen->c, "    }\n");
+}
+
+static bool EmitParse(struct Codegen *gen, struct CodegenType *type) {
+  size_t *order = NULL;
+  uint64_t mask = 0;
+  bool arrays = false;
+  bool arena = false;
+  size_t i;
+
+  if (type->count > 0) {
+    order = malloc(type->count * sizeof(size_t));
+    if (order == NULL) return false;
+  }
+  for (i = 0; i < type->count; ++i) {
+    order[i] = i;
+    if (type->fields[i].required) mask |= (uint64_t) 1 << i;
+    if (type->fields[i].type->kind == KIND_ARRAY) arrays = true;
+    if (type->fields[i].type->kind == KIND_ARRAY || type->fields[i].type->kind == KIND_OBJECT) arena = true;
+  }
+  sort_type = type;
+  if (type->count > 1) qsort(order, type->count, sizeof(size_t), FieldCompare);
+
+  fprintf(gen->c, "BecoError %sParse(struct BecoObject *obj, struct BecoArena *arena, struct %s *out) {\n",
+          type->name, type->name);
+  fprintf(gen->c, "  struct BecoMap *map = NULL;\n");
+  fprintf(gen->c, "  struct BecoObject *val = NULL;\n");
+  if (arrays) fprintf(gen->c, "  struct BecoObject *item = NULL;\n");
+  fprintf(gen->c, "  const char *key = NULL;\n");
+  fprintf(gen->c, "  size_t len = 0;\n");
+  fprintf(gen->c, "  size_t pos = 0;\n");
+  if (arrays) fprintf(gen->c, "  size_t i;\n");
+  if (mask != 0) fprintf(gen->c, "  uint64_t seen = 0;\n");
+  fprintf(gen->c, "  BecoError err = BECO_ERR_OK;\n\n");
+  if (!arena) fprintf(gen->c, "  (void) arena;\n");
+  if (type->count == 0) fprintf(gen->c, "  (void) out;\n");
+  fprintf(gen->c, "  if (BecoObjectGetType(obj) != BECO_VALUE_TYPE_MAP) return BECO_ERR_INVALID_JSON;\n");
+  fprintf(gen->c, "  map = BecoObjectGetMap(obj);\n");
+  fprintf(gen->c, "  while (err == BECO_ERR_OK && BecoMapNext(map, &pos, &key, &len, &val)) {\n");
+  if (type->count > 0) EmitKeySwitch(gen, type, order);
+  fprintf(gen->c, "  }\n");
+  if (mask != 0) {
+    fprintf(gen->c, "  if (err == BECO_ERR_OK && (seen & 0x%llxu) != 0x%llxu) err = BECO_ERR_INVALID_JSON;\n",
+            (unsigned long long) mask, (unsigned long long) mask);
+  }
+  fprintf(gen->c, "  return err;\n");
+  fprintf(gen->c, "}\n\n");
+  free(order);
+  return true;
+}
+
+static void EmitDumpValue(struct Codegen *gen, struct CodegenType *type, const char *expr, const char *indent) {
+  switch (type->kind) {
+    case KIND_BOOL:
+      fprintf(gen->c, "%sCODEC_TRY(BecoBufferAppend(buf, %s ? \"true\" : \"false\", %s ? 4 : 5));\n",
+              indent, expr, expr);
+      break;
+    case KIND_INT:
+    case KIND_INT64:
+      fprintf(gen->c, "%sCODEC_TRY(BecoBufferAppendJsonInt(buf, %s));\n", indent, expr);
+      break;
+    case KIND_UINT64:
+      fprintf(gen->c, "%sCODEC_TRY(BecoBufferAppendJsonUint(buf, %s));\n", indent, expr);
+      break;
+    case KIND_DOUBLE:
+      fprintf(gen->c, "%sCODEC_TRY(BecoBufferAppendJsonDouble(buf, %s));\n", indent, expr);
+      break;
+    case KIND_STR:
+      fprintf(gen->c, "%sCODEC_TRY(DumpStr(buf, %s));\n", indent, expr);
+      break;
+    case KIND_OBJECT:
+      fprintf(gen->c, "%sCODEC_TRY(%sDump(&%s, buf));\n", indent, type->name, expr);
+      break;
+    default:
+      break;
+  }
+}
+
+static bool EmitDump(struct Codegen *gen, struct CodegenType *type) {
+  struct CodegenField *field;
+  char expr[512];
+  char *literal;
+  size_t literal_len;
+  bool arrays = false;
+  size_t i;
+
+  for (i = 0; i < type->count; ++i) {
+    if (type->fields[i].type->kind == KIND_ARRAY) arrays = true;
+  }
+
+  fprintf(gen->c, "BecoError %sDump(const struct %s *in, struct BecoBuffer *buf) {\n", type->name, type->name);
+  if (arrays) fprintf(gen->c, "  size_t i;\n");
+  fprintf(gen->c, "  BecoError err;\n\n");
+  if (type->count == 0) {
+    fprintf(gen->c, "  (void) in;\n");
+    fprintf(gen->c, "  CODEC_TRY(BecoBufferAppend(buf, \"{}\", 2));\n");
+    fprintf(gen->c, "  return BECO_ERR_OK;\n");
+    fprintf(gen->c, "}\n\n");
+    return true;
+  }
+
+  for (i = 0; i < type->count; ++i) {
+    field = &type->fields[i];
+    literal = KeyLiteral(field->key, field->len, i == 0, &literal_len);
+    if (literal == NULL) return false;
+    fprintf(gen->c, "  CODEC_TRY(BecoBufferAppend(buf, \"");
+    EmitCString(gen->c, literal, literal_len);
+    fprintf(gen->c, "\", %lu));\n", (unsigned long) literal_len);
+    free(literal);
+
+    if (field->type->kind == KIND_ARRAY) {
+      fprintf(gen->c, "  CODEC_TRY(BecoBufferAppend(buf, \"[\", 1));\n");
+      fprintf(gen->c, "  for (i = 0; i < in->%s_count; ++i) {\n", field->member);
+      fprintf(gen->c, "    if (i > 0) CODEC_TRY(BecoBufferAppend(buf, \",\", 1));\n");
+      snprintf(expr, sizeof(expr), "in->%s[i]", field->member);
+      EmitDumpValue(gen, field->type->items, expr, "    ");
+      fprintf(gen->c, "  }\n");
+      fprintf(gen->c, "  CODEC_TRY(BecoBufferAppend(buf, \"]\", 1));\n");
+    } else {
+      snprintf(expr, sizeof(expr), "in->%s", field->member);
+      EmitDumpValue(gen, field->type, expr, "  ");
+    }
+  }
+  fprintf(gen->c, "  CODEC_TRY(BecoBufferAppend(buf, \"}\", 1));\n");
+  fprintf(gen->c, "  return BECO_ERR_OK;\n");
+  fprintf(gen->c, "}\n\n");
+  return true;
+}
+
+// static helpers shared by every generated parse and dump function
+static void EmitHelpers(struct Codegen *gen) {
+  FILE *c = gen->c;
+
+  fprintf(c, "#define CODEC_TRY(expr) do { if ((err = (expr)) != BECO_ERR_OK) return err; } while (0)\n\n");
+
+  if (gen->uses[KIND_BOOL]) {
+    fprintf(c, "static BecoError ParseBool(struct BecoObject *val, bool *out) {\n"
+               "  if (BecoObjectGetType(val) == BECO_VALUE_TYPE_NONE) return BECO_ERR_OK;\n"
+               "  if (val->type != BECO_VALUE_TYPE_BOOL) return BECO_ERR_INVALID_JSON;\n"
+               "  *out = val->via.bool_;\n"
+               "  return BECO_ERR_OK;\n"
+               "}\n\n");
+  }
+  if (gen->uses[KIND_INT]) {
+    fprintf(c, "static BecoError ParseInt(struct BecoObject *val, int *out) {\n"
+               "  if (BecoObjectGetType(val) == BECO_VALUE_TYPE_NONE) return BECO_ERR_OK;\n"
+               "  if (val->type == BECO_VALUE_TYPE_INTEGER && val->via.i64 >= INT_MIN && val->via.i64 <= INT_MAX) {\n"
+               "    *out = (int) val->via.i64;\n"
+               "  } else if (val->type == BECO_VALUE_TYPE_POSITIVE_INTEGER && val->via.u64 <= INT_MAX) {\n"
+               "    *out = (int) val->via.u64;\n"
+               "  } else {\n"
+               "    return BECO_ERR_INVALID_JSON;\n"
+               "  }\n"
+               "  return BECO_ERR_OK;\n"
+               "}\n\n");
+  }
+  if (gen->uses[KIND_INT64]) {
+    fprintf(c, "static BecoError ParseInt64(struct BecoObject *val, int64_t *out) {\n"
+               "  if (BecoObjectGetType(val) == BECO_VALUE_TYPE_NONE) return BECO_ERR_OK;\n"
+               "  if (val->type == BECO_VALUE_TYPE_INTEGER) {\n"
+               "    *out = val->via.i64;\n"
+               "  } else if (val->type == BECO_VALUE_TYPE_POSITIVE_INTEGER && val->via.u64 <= INT64_MAX) {\n"
+               "    *out = (int64_t) val->via.u64;\n"
+               "  } else {\n"
+               "    return BECO_ERR_INVALID_JSON;\n"
+               "  }\n"
+               "  return BECO_ERR_OK;\n"
+               "}\n\n");
+  }
+  if (gen->uses[KIND_UINT64]) {
+    fprintf(c, "static BecoError ParseUint64(struct BecoObject *val, uint64_t *out) {\n"
+               "  if (BecoObjectGetType(val) == BECO_VALUE_TYPE_NONE) return BECO_ERR_OK;\n"
+               "  if (val->type == BECO_VALUE_TYPE_POSITIVE_INTEGER) {\n"
+               "    *out = val->via.u64;\n"
+               "  } else if (val->type == BECO_VALUE_TYPE_INTEGER && val->via.i64 >= 0) {\n"
+               "    *out = (uint64_t) val->via.i64;\n"
+               "  } else {\n"
+               "    return BECO_ERR_INVALID_JSON;\n"
+               "  }\n"
+               "  return BECO_ERR_OK;\n"
+               "}\n\n");
+  }
+  if (gen->uses[KIND_DOUBLE]) {
+    fprintf(c, "static BecoError ParseDouble(struct BecoObject *val, double *out) {\n"
+               "  switch (BecoObjectGetType(val)) {\n"
+               "    case BECO_VALUE_TYPE_NONE:\n"
+               "      return BECO_ERR_OK;\n"
+               "    case BECO_VALUE_TYPE_DOUBLE:\n"
+               "      *out = val->via.f64;\n"
+               "      return BECO_ERR_OK;\n"
+               "    case BECO_VALUE_TYPE_INTEGER:\n"
+               "      *out = (double) val->via.i64;\n"
+               "      return BECO_ERR_OK;\n"
+               "    case BECO_VALUE_TYPE_POSITIVE_INTEGER:\n"
+               "      *out = (double) val->via.u64;\n"
+               "      return BECO_ERR_OK;\n"
+               "    default:\n"
+               "      return BECO_ERR_INVALID_JSON;\n"
+               "  }\n"
+               "}\n\n");
+  }
+  if (gen->uses[KIND_STR]) {
+    fprintf(c, "static BecoError ParseStr(struct BecoObject *val, const char **out) {\n"
+               "  if (BecoObjectGetType(val) == BECO_VALUE_TYPE_NONE) return BECO_ERR_OK;\n"
+               "  if (val->type != BECO_VALUE_TYPE_STR) return BECO_ERR_INVALID_JSON;\n"
+               "  *out = BecoObjectGetStr(val);\n"
+               "  return BECO_ERR_OK;\n"
+               "}\n\n");
+    fprintf(c, "static BecoError DumpStr(struct BecoBuffer *buf, const char *str) {\n"
+               "  if (str == NULL) return BecoBufferAppend(buf, \"null\", 4);\n"
+               "  return BecoBufferAppendJsonStr(buf, str, strlen(str));\n"
+               "}\n\n");
+  }
+  if (gen->uses[KIND_ARRAY]) {
+    fprintf(c, "// zeroed items in the request arena, a missing array is empty\n"
+               "static void *ParseArray(struct BecoObject *val, struct BecoArena *arena, size_t size,\n"
+               "                        size_t *count, BecoError *err) {\n"
+               "  void *items = NULL;\n\n"
+               "  *count = 0;\n"
+               "  if (BecoObjectGetType(val) == BECO_VALUE_TYPE_NONE) return NULL;\n"
+               "  if (val->type != BECO_VALUE_TYPE_ARRAY) {\n"
+               "    *err = BECO_ERR_INVALID_JSON;\n"
+               "    return NULL;\n"
+               "  }\n"
+               "  *count = BecoArrayLen(BecoObjectGetArray(val));\n"
+               "  if (*count == 0) return NULL;\n"
+               "  items = BecoArenaAlloc(arena, *count * size);\n"
+               "  if (items == NULL) {\n"
+               "    *count = 0;\n"
+               "    *err = BECO_ERR_OVERFLOW;\n"
+               "    return NULL;\n"
+               "  }\n"
+               "  memset(items, 0, *count * size);\n"
+               "  return items;\n"
+               "}\n\n");
+  }
+}
+
+static void EmitCommand(struct Codegen *gen, struct CodegenCommand *cmd) {
+  const char *p = gen->prefix;
+  const char *n = cmd->camel;
+
+  fprintf(gen->c, "static struct {\n");
+  fprintf(gen->c, "  %s%sHandler handler;\n", p, n);
+  fprintf(gen->c, "  void *user_data;\n");
+  fprintf(gen->c, "} %s%sBinding;\n\n", p, n);
+
+  fprintf(gen->c, "static BecoError %s%sDispatch(struct BecoContext *ctx, struct BecoRequest *req, void *data) {\n",
+          p, n);
+  if (cmd->request != NULL) {
+    fprintf(gen->c, "  struct %s in;\n", cmd->request->name);
+    fprintf(gen->c, "  BecoError err;\n\n");
+    fprintf(gen->c, "  (void) data;\n");
+    fprintf(gen->c, "  memset(&in, 0, sizeof(in));\n");
+    fprintf(gen->c, "  err = %sParse(BecoRequestGetData(req), BecoRequestGetArena(req), &in);\n",
+            cmd->request->name);
+    fprintf(gen->c, "  if (err != BECO_ERR_OK) return err;\n");
+    fprintf(gen->c, "  return %s%sBinding.handler(ctx, req, &in, %s%sBinding.user_data);\n", p, n, p, n);
+  } else {
+    fprintf(gen->c, "  (void) data;\n");
+    fprintf(gen->c, "  return %s%sBinding.handler(ctx, req, %s%sBinding.user_data);\n", p, n, p, n);
+  }
+  fprintf(gen->c, "}\n\n");
+
+  fprintf(gen->c, "BecoError %sRegister%s(struct BecoContext *ctx, %s%sHandler handler, void *user_data) {\n",
+          p, n, p, n);
+  fprintf(gen->c, "  if (handler == NULL) return BECO_ERR_NULL;\n");
+  fprintf(gen->c, "  %s%sBinding.handler = handler;\n", p, n);
+  fprintf(gen->c, "  %s%sBinding.user_data = user_data;\n", p, n);
+  fprintf(gen->c, "  return BecoRegisterCommand(ctx, \"");
+  EmitCString(gen->c, cmd->name, strlen(cmd->name));
+  fprintf(gen->c, "\", %s%sDispatch, NULL);\n", p, n);
+  fprintf(gen->c, "}\n\n");
+
+  if (cmd->response != NULL) {
+    fprintf(gen->c, "BecoError %sSend%s(struct BecoContext *ctx, const struct %s *res) {\n",
+            p, n, cmd->response->name);
+    fprintf(gen->c, "  struct BecoBuffer buf = {0};\n");
+    fprintf(gen->c, "  BecoError err;\n\n");
+    fprintf(gen->c, "  err = %sDump(res, &buf);\n", cmd->response->name);
+    fprintf(gen->c, "  if (err == BECO_ERR_OK) err = BecoSendJson(ctx, buf.data, buf.len);\n");
+    fprintf(gen->c, "  free(buf.data);\n");
+    fprintf(gen->c, "  return err;\n");
+    fprintf(gen->c, "}\n\n");
+  }
+}
+
+static void EmitHeader(struct Codegen *gen, const char *guard) {
+  struct CodegenCommand *cmd;
+  struct CodegenType *type;
+  size_t i;
+
+  fprintf(gen->h, "// Generated by beco-codegen from %s, do not edit.\n\n", gen->source);
+  fprintf(gen->h, "#ifndef %s\n#define %s\n\n", guard, guard);
+  fprintf(gen->h, "#include \"beco.h\"\n\n");
+
+  for (type = gen->objects; type != NULL; type = type->next) EmitStruct(gen, type);
+
+  fprintf(gen->h, "// Parse fills out from obj and leaves absent properties untouched, arrays are\n"
+                  "// allocated in arena. Dump appends the JSON of in to buf.\n\n");
+  for (type = gen->objects; type != NULL; type = type->next) {
+    fprintf(gen->h, "BecoError %sParse(struct BecoObject *obj, struct BecoArena *arena, struct %s *out);\n",
+            type->name, type->name);
+    fprintf(gen->h, "BecoError %sDump(const struct %s *in, struct BecoBuffer *buf);\n\n", type->name, type->name);
+  }
+
+  for (i = 0; i < gen->count; ++i) {
+    cmd = &gen->commands[i];
+    if (cmd->request != NULL) {
+      fprintf(gen->h, "typedef BecoError (*%s%sHandler)(struct BecoContext *, struct BecoRequest *, "
+                      "struct %s *, void *);\n",
+              gen->prefix, cmd->camel, cmd->request->name);
+    } else {
+      fprintf(gen->h, "typedef BecoError (*%s%sHandler)(struct BecoContext *, struct BecoRequest *, void *);\n",
+              gen->prefix, cmd->camel);
+    }
+    fprintf(gen->h, "BecoError %sRegister%s(struct BecoContext *ctx, %s%sHandler handler, void *user_data);\n",
+            gen->prefix, cmd->camel, gen->prefix, cmd->camel);
+    if (cmd->response != NULL) {
+      fprintf(gen->h, "BecoError %sSend%s(struct BecoContext *ctx, const struct %s *res);\n",
+              gen->prefix, cmd->camel, cmd->response->name);
+    }
+    fprintf(gen->h, "\n");
+  }
+
+  fprintf(gen->h, "#endif //%s\n", guard);
+}
+
+static bool EmitSource(struct Codegen *gen, const char *header) {
+  struct CodegenType *type;
+  size_t i;
+
+  fprintf(gen->c, "// Generated by beco-codegen from %s, do not edit.\n\n", gen->source);
+  fprintf(gen->c, "#include \"%s\"\n\n", header);
+  fprintf(gen->c, "#include <stdlib.h>\n#include <string.h>\n#include <limits.h>\n\n");
+
+  EmitHelpers(gen);
+  for (type = gen->objects; type != NULL; type = type->next) {
+    if (!EmitParse(gen, type) || !EmitDump(gen, type)) return false;
+  }
+  for (i = 0; i < gen->count; ++i) EmitCommand(gen, &gen->commands[i]);
+  return true;
+}
+
+static bool CommandsParse(struct Codegen *gen, yyjson_val *root) {
+  yyjson_val *commands = yyjson_obj_get(root, "commands");
+  yyjson_val *key, *val, *schema;
+  yyjson_obj_iter iter;
+  struct CodegenCommand *cmd;
+  char *name;
+
+  if (!yyjson_is_obj(commands) || yyjson_obj_size(commands) == 0) {
+    fprintf(stderr, "%s: expected a non-empty \"commands\" object\n", gen->source);
+    return false;
+  }
+  gen->commands = calloc(yyjson_obj_size(commands), sizeof(struct CodegenCommand));
+  if (gen->commands == NULL) return false;
+
+  yyjson_obj_iter_init(commands, &iter);
+  while ((key = yyjson_obj_iter_next(&iter)) != NULL) {
+    val = yyjson_obj_iter_get_val(key);
+    cmd = &gen->commands[gen->count++];
+    cmd->name = yyjson_get_str(key);
+    cmd->camel = CamelCase(cmd->name);
+    if (cmd->camel == NULL) return false;
+    if (cmd->camel[0] == '\0' || isdigit((unsigned char) cmd->camel[0])) {
+      fprintf(stderr, "%s: command \"%s\" has no usable name\n", gen->source, cmd->name);
+      return false;
+    }
+
+    schema = yyjson_obj_get(val, "request");
+    if (schema != NULL) {
+      name = StrConcat(cmd->camel, "Request");
+      if (name == NULL) return false;
+      cmd->request = TypeParse(gen, schema, name);
+      free(name);
+      if (cmd->request == NULL) return false;
+      if (cmd->request->kind != KIND_OBJECT) {
+        fprintf(stderr, "%s: the request of \"%s\" must be an object\n", gen->source, cmd->name);
+        return false;
+      }
+    }
+
+    schema = yyjson_obj_get(val, "response");
+    if (schema != NULL) {
+      name = StrConcat(cmd->camel, "Response");
+      if (name == NULL) return false;
+      cmd->response = TypeParse(gen, schema, name);
+      free(name);
+      if (cmd->response == NULL) return false;
+      if (cmd->response->kind != KIND_OBJECT) {
+        fprintf(stderr, "%s: the response of \"%s\" must be an object\n", gen->source, cmd->name);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static void CodegenFree(struct Codegen *gen) {
+  struct CodegenType *type, *next;
+  size_t i;
+
+  for (type = gen->all; type != NULL; type = next) {
+    next = type->all;
+    for (i = 0; i < type->count; ++i) free(type->fields[i].member);
+    free(type->fields);
+    free(type->name);
+    free(type);
+  }
+  for (i = 0; i < gen->count; ++i) free(gen->commands[i].camel);
+  free(gen->commands);
+}
+
+static void Usage(void) {
+  fprintf(stderr, "usage: beco-codegen [-p prefix] -o output schema.json\n"
+                  "  writes output.h and output.c\n");
+}
+
+int main(int argc, char **argv) {
+  struct Codegen gen;
+  yyjson_read_err read_err;
+  yyjson_doc *doc = NULL;
+  const char *output = NULL;
+  const char *input = NULL;
+  const char *base;
+  char *h_path = NULL, *c_path = NULL, *guard = NULL;
+  char *p;
+  int i;
+  int ret = 1;
+
+  memset(&gen, 0, sizeof(gen));
+  gen.prefix = "";
+  gen.tail = &gen.objects;
+
+  for (i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+      gen.prefix = argv[++i];
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    } else if (argv[i][0] != '-' && input == NULL) {
+      input = argv[i];
+    } else {
+      Usage();
+      return 1;
+    }
+  }
+  if (input == NULL || output == NULL) {
+    Usage();
+    return 1;
+  }
+
+  base = strrchr(input, '/');
+  gen.source = base != NULL ? base + 1 : input;
+
+  doc = yyjson_read_file(input, 0, NULL, &read_err);
+  if (doc == NULL) {
+    fprintf(stderr, "%s:%lu: %s\n", input, (unsigned long) read_err.pos, read_err.msg);
+    return 1;
+  }
+  if (!CommandsParse(&gen, yyjson_doc_get_root(doc))) goto done;
+
+  h_path = StrConcat(output, ".h");
+  c_path = StrConcat(output, ".c");
+  base = strrchr(output, '/');
+  base = base != NULL ? base + 1 : output;
+  guard = StrConcat(base, "_H");
+  if (h_path == NULL || c_path == NULL || guard == NULL) goto done;
+  for (p = guard; *p; ++p) *p = (char) (isalnum((unsigned char) *p) ? toupper((unsigned char) *p) : '_');
+
+  gen.h = fopen(h_path, "w");
+  gen.c = fopen(c_path, "w");
+  if (gen.h == NULL || gen.c == NULL) {
+    fprintf(stderr, "cannot write %s\n", gen.h == NULL ? h_path : c_path);
+    goto done;
+  }
+
+  base = strrchr(h_path, '/');
+  EmitHeader(&gen, guard);
+  if (!EmitSource(&gen, base != NULL ? base + 1 : h_path)) goto done;
+  ret = ferror(gen.h) || ferror(gen.c) ? 1 : 0;
+
+done:
+  if (gen.h != NULL) fclose(gen.h);
+  if (gen.c != NULL) fclose(gen.c);
+  if (ret != 0) {
+    if (h_path != NULL) remove(h_path);
+    if (c_path != NULL) remove(c_path);
+  }
+  free(h_path);
+  free(c_path);
+  free(guard);
+  CodegenFree(&gen);
+  yyjson_doc_free(doc);
+  return ret;
+}
@@ -20,6 +20,7 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include "yyjson.h"
 #include "beco.h"
 
@@ -27,8 +28,7 @@ volatile bool g_con_exit = false;
 
 struct BecoObject *STR(char *str) {
   struct BecoObject *obj = BecoObjectNew();
-  obj->type = BECO_VALUE_TYPE_STR;
-  obj->via.str = strdup(str);
+  BecoObjectSetStr(obj, str, strlen(str));
   return obj;
 }
 
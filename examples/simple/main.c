@@ -27,8 +27,7 @@
 
 struct BecoObject *STR(char *str) {
   struct BecoObject *obj = BecoObjectNew();
-  obj->type = BECO_VALUE_TYPE_STR;
-  obj->via.str = strdup(str);
+  BecoObjectSetStr(obj, str, strlen(str));
   return obj;
 }
 
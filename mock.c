@@ -31,6 +31,7 @@ typedef HANDLE IO;
 #include <unistd.h>
 #include <spawn.h>
 typedef int IO;
+extern char **environ;
 #endif
 
 bool MockCreateProcess(char *exec, IO in, IO out, IO err);
@@ -173,25 +174,24 @@ bool MockCreateProcess(char *exec, IO in, IO out, IO err) {
 #else
   pid_t pid;
   int ret = 0;
+  char *argv[2];
   posix_spawn_file_actions_t file_actions;
 
+  argv[0] = exec;
+  argv[1] = NULL;
+
   posix_spawn_file_actions_init(&file_actions);
   posix_spawn_file_actions_adddup2(&file_actions, in, STDIN_FILENO);
   posix_spawn_file_actions_adddup2(&file_actions, out, STDOUT_FILENO);
   posix_spawn_file_actions_adddup2(&file_actions, err, STDERR_FILENO);
 
-  ret = posix_spawn(&pid, exec, &file_actions, NULL, NULL, NULL);
+  ret = posix_spawn(&pid, exec, &file_actions, NULL, argv, environ);
   if (ret != 0) {
     goto error;
   }
 
-  if (file_actions != NULL) {
-//    ret = posix_spawn_file_actions_destroy(file_actions);
-//    if (ret != 0)
-//      goto error;
-  }
-
   error:
+  posix_spawn_file_actions_destroy(&file_actions);
   if (ret != 0) {
     fprintf(stderr, "Failed to create sub process\n");
     return false;
@@ -20,17 +20,22 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
 #include <signal.h>
+#ifdef __linux__
+#include <unistd.h>
+#endif
 #include "yyjson.h"
 #include "beco.h"
+#include "test_codecs.h"
 
 volatile bool g_con_exit = false;
 
 struct BecoObject *STR(char *str) {
   struct BecoObject *obj = BecoObjectNew();
-  obj->type = BECO_VALUE_TYPE_STR;
-  obj->via.str = strdup(str);
+  BecoObjectSetStr(obj, str, strlen(str));
   return obj;
 }
 
@@ -108,6 +113,254 @@ BecoError print_command(struct BecoContext *ctx, struct BecoRequest *req, void *
   return BECO_ERR_OK;
 }
 
+BecoError echo_command(struct BecoContext *ctx, struct BecoRequest *req, void *data) {
+  return BecoSendResponse(ctx, BecoRequestGetData(req));
+}
+
+// quotes, backslashes and multibyte sequences exercise escaping and chunk boundaries
+char *big_payload(size_t size) {
+  const char *pattern = "h\xc3\xa9llo \"w\xc3\xb6rld\" \\ \xe6\x97\xa5\xe6\x9c\xac \xf0\x9f\x98\x80 ";
+  size_t plen = strlen(pattern);
+  char *str = malloc(size + 1);
+  size_t len = 0;
+
+  while (len + plen <= size) {
+    memcpy(str + len, pattern, plen);
+    len += plen;
+  }
+  str[len] = '\0';
+  return str;
+}
+
+BecoError big_command(struct BecoContext *ctx, struct BecoRequest *req, void *data) {
+  struct BecoObject *obj;
+  struct BecoMap *map = NULL;
+  char *str = NULL;
+  BecoError err;
+
+  str = big_payload(BecoObjectGetUInt64(BecoMapGet(BecoObjectGetMap(BecoRequestGetData(req)), "size")));
+  map = BecoMapNew();
+  BecoMapPut(map, "payload", STR(str));
+  free(str);
+
+  obj = MAP(map);
+  err = BecoSendResponse(ctx, obj);
+  BecoObjectFree(obj);
+  return err;
+}
+
+// the response is written token by token, calls out of place are refused and change nothing
+BecoError list_command(struct BecoContext *ctx, struct BecoRequest *req, void *data) {
+  struct BecoMap *map = BecoObjectGetMap(BecoRequestGetData(req));
+  uint64_t count = BecoObjectGetUInt64(BecoMapGet(map, "count"));
+  char name[32];
+  bool checked;
+  uint64_t i;
+
+  checked = BecoResKey(ctx, "x", 1) == BECO_ERR_INVALID_JSON && BecoResEnd(ctx) == BECO_ERR_INVALID_JSON;
+  BecoResBeginObject(ctx);
+  checked = checked && BecoResInt(ctx, 1) == BECO_ERR_INVALID_JSON;
+  BecoResKey(ctx, "items", 5);
+  checked = checked && BecoResEnd(ctx) == BECO_ERR_INVALID_JSON && BecoResKey(ctx, "y", 1) == BECO_ERR_INVALID_JSON;
+  BecoResBeginArray(ctx);
+  checked = checked && BecoResKey(ctx, "z", 1) == BECO_ERR_INVALID_JSON;
+  for (i = 0; i < count; ++i) {
+    BecoResBeginObject(ctx);
+    BecoResKeyInt(ctx, "id", (int64_t) i);
+    snprintf(name, sizeof(name), "item %llu", (unsigned long long) i);
+    BecoResKeyStr(ctx, "name", name);
+    BecoResEnd(ctx);
+  }
+  BecoResEnd(ctx);
+  BecoResKey(ctx, "count", 5);
+  BecoResUint(ctx, count);
+  BecoResKey(ctx, "echo", 4);
+  BecoResObject(ctx, BecoMapGet(map, "echo"));
+  BecoResKey(ctx, "checked", 7);
+  BecoResBool(ctx, checked);
+  BecoResKey(ctx, "ratio", 5);
+  BecoResDouble(ctx, 0.5);
+  BecoResKey(ctx, "limits", 6);
+  BecoResBeginArray(ctx);
+  BecoResInt(ctx, INT64_MIN);
+  BecoResUint(ctx, UINT64_MAX);
+  BecoResEnd(ctx);
+  BecoResKeyStr(ctx, "none", NULL);
+  return BecoResEnd(ctx);
+}
+
+struct BecoFrozen *g_caps = NULL;
+
+// the same bytes every time, serialized once at startup
+BecoError caps_command(struct BecoContext *ctx, struct BecoRequest *req, void *data) {
+  return BecoSendFrozen(ctx, g_caps);
+}
+
+void freeze_caps(void) {
+  struct BecoObject *obj;
+  struct BecoObject *val;
+  struct BecoArray *caps = NULL;
+  struct BecoMap *map = NULL;
+
+  caps = BecoArrayNew(0);
+  BecoArrayAdd(caps, 0, STR("tab"));
+  BecoArrayAdd(caps, 1, STR("window"));
+  val = BecoObjectNew();
+  val->type = BECO_VALUE_TYPE_ARRAY;
+  val->via.array = caps;
+  map = BecoMapNew();
+  BecoMapPut(map, "caps", val);
+  BecoMapPut(map, "version", STR("1.0"));
+
+  obj = MAP(map);
+  BecoObjectFreeze(obj, &g_caps);
+  BecoObjectFree(obj);
+}
+
+struct BecoObject *g_previous = NULL;
+
+// the response is built in the request arena, the payload is promoted to answer the next call
+BecoError arena_command(struct BecoContext *ctx, struct BecoRequest *req, void *data) {
+  struct BecoArena *arena = BecoRequestGetArena(req);
+  struct BecoObject *obj;
+  struct BecoObject *val;
+  struct BecoMap *map = NULL;
+  BecoError err;
+
+  map = BecoMapNewIn(arena);
+  val = BecoObjectNewIn(arena);
+  BecoObjectSetStrIn(arena, val, "arena", 5);
+  BecoMapPut(map, "from", val);
+  BecoMapPut(map, "previous", g_previous != NULL ? g_previous : BecoObjectNewIn(arena));
+
+  obj = BecoObjectNewIn(arena);
+  obj->type = BECO_VALUE_TYPE_MAP;
+  obj->via.map = map;
+  err = BecoSendResponse(ctx, obj);
+
+  BecoObjectFree(g_previous);
+  g_previous = BecoObjectPromote(BecoMapGet(BecoObjectGetMap(BecoRequestGetData(req)), "payload"));
+  return err;
+}
+
+struct Pos {
+  int64_t x;
+  uint64_t y;
+};
+
+struct Tab {
+  int id;
+  const char *url;
+  bool active;
+  double zoom;
+  struct Pos pos;
+};
+
+struct BecoField pos_fields[] = {
+    BECO_FIELD(struct Pos, x, BECO_FIELD_INT64),
+    BECO_FIELD(struct Pos, y, BECO_FIELD_UINT64),
+};
+struct BecoStruct pos_struct = BECO_STRUCT(pos_fields);
+
+struct BecoField tab_fields[] = {
+    BECO_FIELD(struct Tab, id, BECO_FIELD_INT),
+    BECO_FIELD(struct Tab, url, BECO_FIELD_STR),
+    BECO_FIELD(struct Tab, active, BECO_FIELD_BOOL),
+    BECO_FIELD(struct Tab, zoom, BECO_FIELD_DOUBLE),
+    BECO_FIELD_NESTED(struct Tab, pos, &pos_struct),
+};
+struct BecoStruct tab_struct = BECO_STRUCT(tab_fields);
+
+// the payload goes through a struct both ways, with the next id
+BecoError tab_command(struct BecoContext *ctx, struct BecoRequest *req, void *data) {
+  struct Tab tab;
+  BecoError err;
+
+  memset(&tab, 0, sizeof(tab));
+  err = BecoStructDecode(&tab_struct, BecoMapGet(BecoObjectGetMap(BecoRequestGetData(req)), "payload"), &tab);
+  if (err != BECO_ERR_OK) return err;
+  tab.id++;
+  return BecoSendStruct(ctx, &tab_struct, &tab);
+}
+
+// answers from the struct the generated codec parsed, tags follow the tab urls
+BecoError window_command(struct BecoContext *ctx, struct BecoRequest *req, struct TestWindowRequest *in, void *data) {
+  struct TestWindowResponse res;
+  struct BecoArena *arena = BecoRequestGetArena(req);
+  size_t i;
+
+  memset(&res, 0, sizeof(res));
+  res.id = in->id;
+  res.title = in->title;
+  res.urls_count = in->tabs_count + in->tags_count;
+  res.urls = BecoArenaAlloc(arena, res.urls_count * sizeof(*res.urls));
+  res.pinned_count = in->tabs_count;
+  res.pinned = BecoArenaAlloc(arena, res.pinned_count * sizeof(*res.pinned));
+  if (res.urls == NULL || res.pinned == NULL) return BECO_ERR_OVERFLOW;
+  for (i = 0; i < in->tabs_count; ++i) {
+    res.urls[i] = in->tabs[i].url;
+    res.pinned[i] = in->tabs[i].pinned;
+    res.zoom += in->tabs[i].zoom;
+  }
+  for (i = 0; i < in->tags_count; ++i) res.urls[in->tabs_count + i] = in->tags[i];
+  res.area = in->bounds.width * in->bounds.height;
+  res.origin.x = in->bounds.left;
+  res.origin.y = in->bounds.top;
+  return TestSendWindow(ctx, &res);
+}
+
+void send_event(struct BecoContext *ctx, const char *event) {
+  struct BecoObject *obj;
+  struct BecoMap *map = NULL;
+
+  map = BecoMapNew();
+  BecoMapPut(map, "event", STR((char *) event));
+
+  obj = MAP(map);
+
+  BecoSendResponse(ctx, obj);
+  BecoObjectFree(obj);
+}
+
+void timer_fired(struct BecoContext *ctx, void *data) {
+  send_event(ctx, "timer");
+}
+
+void woke_up(struct BecoContext *ctx, void *data) {
+  send_event(ctx, "wakeup");
+}
+
+BecoError timer_command(struct BecoContext *ctx, struct BecoRequest *req, void *data) {
+  return BecoAddTimer(ctx, 10, 0, timer_fired, NULL, NULL);
+}
+
+BecoError wake_command(struct BecoContext *ctx, struct BecoRequest *req, void *data) {
+  BecoSetWakeupHandler(ctx, woke_up, NULL);
+  return BecoWakeup(ctx);
+}
+
+#ifdef __linux__
+void pipe_readable(struct BecoContext *ctx, int fd, uint32_t events, void *data) {
+  char c;
+  if (read(fd, &c, 1) == 1 && c == 'x') {
+    send_event(ctx, "fd");
+  }
+  BecoRemoveFd(ctx, fd);
+  close(fd);
+}
+
+BecoError pipe_command(struct BecoContext *ctx, struct BecoRequest *req, void *data) {
+  int fds[2];
+  BecoError err;
+
+  if (pipe(fds) != 0) return BECO_ERR_IO;
+  err = BecoAddFd(ctx, fds[0], BECO_EVENT_READ, pipe_readable, NULL);
+  if (write(fds[1], "x", 1) != 1) err = BECO_ERR_IO;
+  close(fds[1]);
+  return err;
+}
+#endif
+
 int main(int argc, char **argv) {
 
   struct BecoContext *context;
@@ -121,13 +374,31 @@ int main(int argc, char **argv) {
       .null_cmd_handler = default_handler,
       .default_cmd_handler = default_handler,
       .use_stdio = true,
-      .log_file = log_file
+      .log_file = log_file,
+      .transport = BECO_TRANSPORT_FD
   };
 
   context = BecoContextNewWithConf(&conf);
+  freeze_caps();
   BecoRegisterCommand(context, "hello", hello_handler, NULL);
   BecoRegisterCommand(context, "close", close_command, NULL);
   BecoRegisterCommand(context, "print", print_command, NULL);
+  BecoRegisterCommand(context, "echo", echo_command, NULL);
+  BecoRegisterCommand(context, "big", big_command, NULL);
+  BecoRegisterCommand(context, "arena", arena_command, NULL);
+  BecoRegisterCommand(context, "list", list_command, NULL);
+  BecoRegisterCommand(context, "caps", caps_command, NULL);
+  BecoRegisterCommand(context, "tab", tab_command, NULL);
+  TestRegisterWindow(context, window_command, NULL);
+  BecoSetChunking(context, true, 0);
+  BecoSetIncrementalParse(context, true, 0);
+  BecoSetFlushPolicy(context, BECO_FLUSH_IDLE, 0, 0);
+#ifdef __linux__
+  BecoEnableEventLoop(context);
+  BecoRegisterCommand(context, "timer", timer_command, NULL);
+  BecoRegisterCommand(context, "wake", wake_command, NULL);
+  BecoRegisterCommand(context, "pipe", pipe_command, NULL);
+#endif
 
   char *arg = NULL;
   int i;
@@ -146,5 +417,6 @@ int main(int argc, char **argv) {
   fclose(log_file);
 
   BecoContextFree(context);
+  BecoFrozenFree(g_caps);
   return 0;
 }
@@ -21,15 +21,22 @@
 
 #include "../beco.h"
 #include "../mock.h"
+#include "test_codecs.h"
+#include "yyjson.h"
 #include <string.h>
+#include <stdlib.h>
 #include <assert.h>
+#include <locale.h>
+#include <math.h>
+#ifdef __linux__
+#include <unistd.h>
+#endif
 
 volatile bool g_con_exit = false;
 
 struct BecoObject *STR(char *str) {
   struct BecoObject *obj = BecoObjectNew();
-  obj->type = BECO_VALUE_TYPE_STR;
-  obj->via.str = strdup(str);
+  BecoObjectSetStr(obj, str, strlen(str));
   return obj;
 }
 
@@ -94,6 +101,1358 @@ void test_print(struct BecoContext *ctx) {
   BecoRequestDestroy(&req);
 }
 
+// a request for the echo command of the child, the caller adds the members to send back
+struct BecoMap *echo_map(void) {
+  struct BecoMap *map = BecoMapNew();
+  BecoMapPut(map, "command", STR("echo"));
+  return map;
+}
+
+// sends a map from echo_map and reads the reply, the map stays with the caller
+void echo_round_trip(struct BecoContext *ctx, struct BecoMap *map, struct BecoRequest *req) {
+  struct BecoObject obj;
+
+  obj.type = BECO_VALUE_TYPE_MAP;
+  obj.via.map = map;
+  assert(BecoWrite(ctx, &obj) == BECO_ERR_OK);
+  assert(BecoRead(ctx, req) == BECO_ERR_OK);
+}
+
+void test_echo_size(struct BecoContext *ctx, size_t size) {
+  struct BecoMap *map = NULL;
+  struct BecoRequest req = {0};
+  struct BecoObject *payload = NULL;
+  char *str = NULL;
+
+  str = malloc(size + 1);
+  memset(str, 'x', size);
+  str[size] = '\0';
+
+  map = echo_map();
+  BecoMapPut(map, "payload", STR(str));
+
+  echo_round_trip(ctx, map, &req);
+
+  payload = BecoMapGet(BecoObjectGetMap(req.data), "payload");
+  assert(payload != NULL);
+  assert(BecoMapGetInterned(BecoObjectGetMap(req.data), BecoIntern(ctx, "payload")) == payload);
+  assert(strcmp(BecoObjectGetStr(payload), str) == 0);
+
+  free(str);
+  BecoMapFree(map);
+  BecoRequestDestroy(&req);
+}
+
+// strings of a request which is still alive survive the next read
+void test_keep_request(struct BecoContext *ctx) {
+  struct BecoMap *map = NULL;
+  struct BecoRequest first = {0};
+  struct BecoRequest second = {0};
+
+  map = echo_map();
+  BecoMapPut(map, "payload", STR("first \"one\""));
+  echo_round_trip(ctx, map, &first);
+  BecoMapFree(map);
+
+  map = echo_map();
+  BecoMapPut(map, "payload", STR("second"));
+  echo_round_trip(ctx, map, &second);
+  BecoMapFree(map);
+
+  assert(strcmp(first.cmd, "echo") == 0);
+  assert(strcmp(BecoObjectGetStr(BecoMapGet(BecoObjectGetMap(first.data), "payload")), "first \"one\"") == 0);
+  assert(strcmp(BecoObjectGetStr(BecoMapGet(BecoObjectGetMap(second.data), "payload")), "second") == 0);
+  BecoRequestDestroy(&second);
+  BecoRequestDestroy(&first);
+}
+
+// short strings stay inside the object, lengths survive embedded NULs both ways
+void test_strings(struct BecoContext *ctx) {
+  struct BecoObject *val = NULL;
+  struct BecoMap *map = NULL;
+  struct BecoMap *received = NULL;
+  struct BecoRequest req = {0};
+  const char *long_str = "a string well past the inline limit";
+  char raw[700];
+  char *json = NULL;
+  size_t json_len = 0;
+
+  map = echo_map();
+  val = BecoObjectNew();
+  assert(BecoObjectSetStr(val, "a\0b", 3) == BECO_ERR_OK);
+  assert(val->flags & BECO_OBJECT_INLINE);
+  assert(BecoObjectGetStrLen(val) == 3);
+  BecoMapPut(map, "payload", val);
+  val = BecoObjectNew();
+  assert(BecoObjectSetStr(val, "short", 5) == BECO_ERR_OK);
+  assert(BecoObjectSetStr(val, long_str, strlen(long_str)) == BECO_ERR_OK);
+  assert(!(val->flags & BECO_OBJECT_INLINE));
+  BecoMapPut(map, "long", val);
+  echo_round_trip(ctx, map, &req);
+
+  received = BecoObjectGetMap(req.data);
+  val = BecoMapGet(received, "payload");
+  assert(BecoObjectGetStrLen(val) == 3 && memcmp(BecoObjectGetStr(val), "a\0b", 3) == 0);
+  val = BecoMapGet(received, "long");
+  assert(BecoObjectGetStrLen(val) == strlen(long_str) && strcmp(BecoObjectGetStr(val), long_str) == 0);
+  assert(BecoObjectGetStrLen(BecoMapGet(received, "command")) == 4);
+
+  BecoMapFree(map);
+  BecoRequestDestroy(&req);
+
+  // a new value may come out of the old one, a container is released
+  val = BecoObjectNew();
+  assert(BecoObjectSetStr(val, long_str, strlen(long_str)) == BECO_ERR_OK);
+  assert(BecoObjectSetStr(val, BecoObjectGetStr(val) + 20, 5) == BECO_ERR_OK);
+  assert(BecoObjectGetStrLen(val) == 5 && strcmp(BecoObjectGetStr(val), "he in") == 0);
+  assert(BecoObjectSetStr(val, BecoObjectGetStr(val) + 1, 3) == BECO_ERR_OK);
+  assert(strcmp(BecoObjectGetStr(val), "e i") == 0);
+  BecoObjectFree(val);
+  val = BecoObjectNew();
+  val->type = BECO_VALUE_TYPE_MAP;
+  val->via.map = BecoMapNew();
+  BecoMapPut(val->via.map, "key", STR("released with the object"));
+  assert(BecoObjectSetStr(val, "short", 5) == BECO_ERR_OK);
+  assert(strcmp(BecoObjectGetStr(val), "short") == 0);
+  BecoObjectFree(val);
+
+  // escapes written out, including across the slices of a long string
+  assert(sizeof(raw) > 0x1000 / 6 + 8);
+  memset(raw, 'a', sizeof(raw));
+  memcpy(raw, "\x01\x1f\"\\\n", 5);
+  memcpy(raw + 0x1000 / 6 - 2, "\"\\\x7f\t", 4);
+  val = BecoObjectNew();
+  assert(BecoObjectSetStr(val, raw, sizeof(raw)) == BECO_ERR_OK);
+  assert(BecoObjectDumpJson(val, &json, &json_len) == BECO_ERR_OK);
+  assert(json_len == sizeof(raw) + 2 + 5 + 5 + 1 + 1 + 1 + 1 + 1 + 1);
+  assert(memcmp(json, "\"\\u0001\\u001f\\\"\\\\\\naaa", 22) == 0);
+  assert(memcmp(json + 1 + 0x1000 / 6 - 2 + 13, "\\\"\\\\\x7f\\taaa", 10) == 0);
+  assert(json[json_len - 2] == 'a' && json[json_len - 1] == '"');
+  free(json);
+
+  map = echo_map();
+  BecoMapPut(map, "payload", val);
+  echo_round_trip(ctx, map, &req);
+  val = BecoMapGet(BecoObjectGetMap(req.data), "payload");
+  assert(BecoObjectGetStrLen(val) == sizeof(raw) && memcmp(BecoObjectGetStr(val), raw, sizeof(raw)) == 0);
+  BecoMapFree(map);
+  BecoRequestDestroy(&req);
+}
+
+// keys of received requests come from the key table of the context
+void test_intern(struct BecoContext *ctx) {
+  struct BecoStats before, after;
+  const char *key = NULL;
+  int i;
+
+  assert(BecoGetStats(ctx, &before) == BECO_ERR_OK);
+  for (i = 0; i < 4; ++i) {
+    test_echo_size(ctx, 16);
+  }
+  assert(BecoGetStats(ctx, &after) == BECO_ERR_OK);
+  // command and payload of every response
+  assert(after.intern_hits >= before.intern_hits + 8);
+  assert(after.intern_keys >= 2);
+
+  key = BecoIntern(ctx, "payload");
+  assert(key != NULL && key == BecoIntern(ctx, "payload"));
+  assert(BecoIntern(ctx, "a key far too long to be worth interning, longer than sixty four bytes") == NULL);
+}
+
+// past the size where maps start indexing, keys keep their order and a repeated key its place
+void test_large_map(struct BecoContext *ctx) {
+  struct BecoObject *val = NULL;
+  struct BecoMap *map = NULL;
+  struct BecoMap *payload = NULL;
+  struct BecoRequest req = {0};
+  char key[16];
+  char *sent = NULL, *received = NULL;
+  size_t sent_len = 0, received_len = 0;
+  int i;
+
+  payload = BecoMapNew();
+  for (i = 0; i < 100; ++i) {
+    sprintf(key, "k%d", (i * 37) % 100);
+    val = BecoObjectNew();
+    val->type = BECO_VALUE_TYPE_INTEGER;
+    val->via.i64 = i;
+    BecoMapPut(payload, key, val);
+  }
+  BecoMapPut(payload, "k0", STR("again"));
+  assert(strcmp(BecoObjectGetStr(BecoMapGet(payload, "k0")), "again") == 0);
+  assert(BecoMapGet(payload, "k37")->via.i64 == 1);
+  assert(!BecoMapContainsKey(payload, "k100"));
+
+  map = echo_map();
+  val = BecoObjectNew();
+  val->type = BECO_VALUE_TYPE_MAP;
+  val->via.map = payload;
+  BecoMapPut(map, "payload", val);
+  echo_round_trip(ctx, map, &req);
+
+  assert(BecoObjectDumpJson(val, &sent, &sent_len) == BECO_ERR_OK);
+  assert(strncmp(sent, "{\"k0\":\"again\",\"k37\":1,\"k74\":2,", 30) == 0);
+  val = BecoMapGet(BecoObjectGetMap(req.data), "payload");
+  assert(BecoMapGet(BecoObjectGetMap(val), "k74")->via.i64 == 2);
+  assert(BecoObjectDumpJson(val, &received, &received_len) == BECO_ERR_OK);
+  assert(sent_len == received_len && memcmp(sent, received, sent_len) == 0);
+
+  free(sent);
+  free(received);
+  BecoMapFree(map);
+  BecoRequestDestroy(&req);
+}
+
+void test_growable_array(struct BecoContext *ctx) {
+  struct BecoObject *val = NULL;
+  struct BecoObject items[3];
+  struct BecoMap *map = NULL;
+  struct BecoArray *payload = NULL;
+  struct BecoRequest req = {0};
+  char *sent = NULL, *received = NULL;
+  size_t sent_len = 0, received_len = 0;
+  int i;
+
+  payload = BecoArrayNew(0);
+  assert(BecoArrayReserve(payload, 4) == BECO_ERR_OK);
+  for (i = 0; i < 100; ++i) {
+    val = BecoArrayPush(payload);
+    val->type = BECO_VALUE_TYPE_INTEGER;
+    val->via.i64 = i;
+  }
+  assert(payload->cap >= 100);
+  val = BecoArrayPop(payload);
+  assert(val->via.i64 == 99);
+  BecoObjectFree(val);
+  BecoArrayAdd(payload, 0, STR("first"));
+  BecoArrayAdd(payload, BecoArrayLen(payload), STR("last"));
+
+  memset(items, 0, sizeof(items));
+  for (i = 0; i < 3; ++i) {
+    BecoObjectSetStr(&items[i], "bulk", 4);
+  }
+  assert(BecoArrayAppend(payload, items, 3) == BECO_ERR_OK);
+  assert(BecoArrayLen(payload) == 103);
+  assert(BecoArrayGet(payload, 1)->via.i64 == 1);
+
+  map = echo_map();
+  val = BecoObjectNew();
+  val->type = BECO_VALUE_TYPE_ARRAY;
+  val->via.array = payload;
+  BecoMapPut(map, "payload", val);
+  echo_round_trip(ctx, map, &req);
+
+  assert(BecoObjectDumpJson(val, &sent, &sent_len) == BECO_ERR_OK);
+  assert(strncmp(sent, "[\"first\",1,2,", 13) == 0);
+  assert(strcmp(sent + sent_len - 31, "98,\"last\",\"bulk\",\"bulk\",\"bulk\"]") == 0);
+  val = BecoMapGet(BecoObjectGetMap(req.data), "payload");
+  assert(BecoArrayLen(BecoObjectGetArray(val)) == 103);
+  assert(BecoObjectDumpJson(val, &received, &received_len) == BECO_ERR_OK);
+  assert(sent_len == received_len && memcmp(sent, received, sent_len) == 0);
+
+  free(sent);
+  free(received);
+  BecoMapFree(map);
+  BecoRequestDestroy(&req);
+}
+
+struct BecoObject *complex_entry(int i) {
+  struct BecoObject *obj = NULL;
+  struct BecoObject *val = NULL;
+  struct BecoMap *map = NULL;
+  struct BecoArray *arr = NULL;
+
+  map = BecoMapNew();
+  BecoMapPut(map, "name", STR("h\xc3\xa9 \"q\" \\ / \n\t\x01 \xf0\x9f\x98\x80"));
+
+  val = BecoObjectNew();
+  val->type = BECO_VALUE_TYPE_INTEGER;
+  val->via.i64 = -12345 - i;
+  BecoMapPut(map, "n", val);
+
+  val = BecoObjectNew();
+  val->type = BECO_VALUE_TYPE_POSITIVE_INTEGER;
+  val->via.u64 = UINT64_MAX - (uint64_t) i;
+  BecoMapPut(map, "u", val);
+
+  val = BecoObjectNew();
+  val->type = BECO_VALUE_TYPE_DOUBLE;
+  val->via.f64 = 1.5e-7 * i;
+  BecoMapPut(map, "f", val);
+
+  val = BecoObjectNew();
+  val->type = BECO_VALUE_TYPE_BOOL;
+  val->via.bool_ = i % 2 == 0;
+  BecoMapPut(map, "b", val);
+
+  BecoMapPut(map, "z", BecoObjectNew());
+
+  val = BecoObjectNew();
+  val->type = BECO_VALUE_TYPE_MAP;
+  val->via.map = BecoMapNew();
+  BecoMapPut(map, "m", val);
+
+  arr = BecoArrayNew(2);
+  val = BecoObjectNew();
+  val->type = BECO_VALUE_TYPE_ARRAY;
+  val->via.array = BecoArrayNew(0);
+  BecoArrayAdd(arr, 0, val);
+  BecoArrayAdd(arr, 1, STR(""));
+  val = BecoObjectNew();
+  val->type = BECO_VALUE_TYPE_ARRAY;
+  val->via.array = arr;
+  BecoMapPut(map, "a", val);
+
+  obj = BecoObjectNew();
+  obj->type = BECO_VALUE_TYPE_MAP;
+  obj->via.map = map;
+  return obj;
+}
+
+// state shared with a request keeps what was sent while the state itself changes
+void test_shared(struct BecoContext *ctx) {
+  struct BecoObject *val = NULL;
+  struct BecoObject *tabs = NULL;
+  struct BecoObject *list = NULL;
+  struct BecoMap *state = NULL;
+  struct BecoMap *payload = NULL;
+  struct BecoMap *map = NULL;
+  struct BecoRequest req = {0};
+  char *received = NULL;
+  size_t received_len = 0;
+  int i;
+
+  tabs = BecoObjectNew();
+  tabs->type = BECO_VALUE_TYPE_MAP;
+  tabs->via.map = BecoMapNew();
+  BecoMapPut(tabs->via.map, "t1", STR("first tab"));
+  list = BecoObjectNew();
+  list->type = BECO_VALUE_TYPE_ARRAY;
+  list->via.array = BecoArrayNew(0);
+  for (i = 0; i < 3; ++i) {
+    val = BecoArrayPush(list->via.array);
+    val->type = BECO_VALUE_TYPE_INTEGER;
+    val->via.i64 = i;
+  }
+  state = BecoMapNew();
+  BecoMapPut(state, "tabs", tabs);
+  BecoMapPut(state, "list", list);
+
+  payload = BecoMapNew();
+  val = BecoObjectDup(tabs, false);
+  assert(BecoObjectGetMap(val) == BecoObjectGetMap(tabs));
+  BecoMapPut(payload, "tabs", val);
+  BecoMapPut(payload, "list", BecoObjectDup(list, false));
+
+  // changed after the request was built
+  assert(BecoObjectGetMutMap(tabs) != BecoObjectGetMap(val));
+  BecoMapPut(BecoObjectGetMutMap(tabs), "t2", STR("second tab"));
+  assert(BecoObjectGetMutMap(tabs) == BecoObjectGetMap(tabs));
+  val = BecoArrayPush(BecoObjectGetMutArray(list));
+  val->type = BECO_VALUE_TYPE_INTEGER;
+  val->via.i64 = 3;
+
+  map = echo_map();
+  val = BecoObjectNew();
+  val->type = BECO_VALUE_TYPE_MAP;
+  val->via.map = payload;
+  BecoMapPut(map, "payload", val);
+  echo_round_trip(ctx, map, &req);
+  BecoMapFree(map);
+
+  val = BecoMapGet(BecoObjectGetMap(req.data), "payload");
+  assert(BecoObjectDumpJson(val, &received, &received_len) == BECO_ERR_OK);
+  assert(strcmp(received, "{\"tabs\":{\"t1\":\"first tab\"},\"list\":[0,1,2]}") == 0);
+  assert(strcmp(BecoObjectGetStr(BecoMapGet(BecoObjectGetMap(tabs), "t2")), "second tab") == 0);
+  assert(BecoArrayLen(BecoObjectGetArray(list)) == 4);
+
+  free(received);
+  BecoMapFree(state);
+  BecoRequestDestroy(&req);
+}
+
+struct Pos {
+  int64_t x;
+  uint64_t y;
+};
+
+struct Tab {
+  int id;
+  const char *url;
+  bool active;
+  double zoom;
+  struct Pos pos;
+};
+
+struct BecoField pos_fields[] = {
+    BECO_FIELD(struct Pos, x, BECO_FIELD_INT64),
+    BECO_FIELD(struct Pos, y, BECO_FIELD_UINT64),
+};
+struct BecoStruct pos_struct = BECO_STRUCT(pos_fields);
+
+struct BecoField tab_fields[] = {
+    BECO_FIELD(struct Tab, id, BECO_FIELD_INT),
+    BECO_FIELD(struct Tab, url, BECO_FIELD_STR),
+    BECO_FIELD(struct Tab, active, BECO_FIELD_BOOL),
+    BECO_FIELD(struct Tab, zoom, BECO_FIELD_DOUBLE),
+    BECO_FIELD_NESTED(struct Tab, pos, &pos_struct),
+};
+struct BecoStruct tab_struct = BECO_STRUCT(tab_fields);
+
+// keys out of order and unknown ones on the way in, declaration order on the way out
+void test_struct(struct BecoContext *ctx, bool lazy) {
+  const char *expected = "{\"id\":42,\"url\":\"https://example.com/a/long/path\",\"active\":true,"
+                         "\"zoom\":1.5,\"pos\":{\"x\":-3,\"y\":7}}";
+  struct BecoObject obj;
+  struct BecoObject *val = NULL;
+  struct BecoMap *map = NULL;
+  struct BecoMap *payload = NULL;
+  struct BecoMap *pos = NULL;
+  struct BecoRequest req = {0};
+  struct Tab tab;
+  char *out = NULL;
+  size_t out_len = 0;
+
+  pos = BecoMapNew();
+  val = BecoObjectNew();
+  val->type = BECO_VALUE_TYPE_POSITIVE_INTEGER;
+  val->via.u64 = 7;
+  BecoMapPut(pos, "y", val);
+  val = BecoObjectNew();
+  val->type = BECO_VALUE_TYPE_INTEGER;
+  val->via.i64 = -3;
+  BecoMapPut(pos, "x", val);
+
+  payload = BecoMapNew();
+  val = BecoObjectNew();
+  val->type = BECO_VALUE_TYPE_MAP;
+  val->via.map = pos;
+  BecoMapPut(payload, "pos", val);
+  val = BecoObjectNew();
+  val->type = BECO_VALUE_TYPE_DOUBLE;
+  val->via.f64 = 1.5;
+  BecoMapPut(payload, "zoom", val);
+  BecoMapPut(payload, "unknown", STR("skipped"));
+  BecoMapPut(payload, "url", STR("https://example.com/a/long/path"));
+  val = BecoObjectNew();
+  val->type = BECO_VALUE_TYPE_INTEGER;
+  val->via.i64 = 41;
+  BecoMapPut(payload, "id", val);
+  val = BecoObjectNew();
+  val->type = BECO_VALUE_TYPE_BOOL;
+  val->via.bool_ = true;
+  BecoMapPut(payload, "active", val);
+
+  map = BecoMapNew();
+  BecoMapPut(map, "command", STR("tab"));
+  val = BecoObjectNew();
+  val->type = BECO_VALUE_TYPE_MAP;
+  val->via.map = payload;
+  BecoMapPut(map, "payload", val);
+  obj.type = BECO_VALUE_TYPE_MAP;
+  obj.via.map = map;
+
+  assert(BecoSetLazyView(ctx, lazy) == BECO_ERR_OK);
+  assert(BecoWrite(ctx, &obj) == BECO_ERR_OK);
+  assert(BecoRead(ctx, &req) == BECO_ERR_OK);
+
+  memset(&tab, 0, sizeof(tab));
+  assert(BecoStructDecode(&tab_struct, req.data, &tab) == BECO_ERR_OK);
+  assert(tab.id == 42 && tab.active && tab.zoom == 1.5);
+  assert(strcmp(tab.url, "https://example.com/a/long/path") == 0);
+  assert(tab.pos.x == -3 && tab.pos.y == 7);
+  val = BecoMapGet(BecoObjectGetMap(req.data), "url");
+  assert(BecoStructDecode(&pos_struct, val, &tab.pos) == BECO_ERR_INVALID_JSON);
+
+  assert(BecoStructDumpJson(&tab_struct, &tab, &out, &out_len) == BECO_ERR_OK);
+  assert(out_len == strlen(expected) && strcmp(out, expected) == 0);
+
+  free(out);
+  BecoMapFree(map);
+  BecoRequestDestroy(&req);
+  assert(BecoSetLazyView(ctx, false) == BECO_ERR_OK);
+}
+
+// a packed copy of a request value outlives the request and is released in one call
+void test_deep_copy(struct BecoContext *ctx) {
+  struct BecoObject *val = NULL;
+  struct BecoObject *copy = NULL, *dup = NULL;
+  struct BecoMap *map = NULL;
+  struct BecoMap *payload = NULL;
+  struct BecoArray *arr = NULL;
+  struct BecoRequest req = {0};
+  char key[16];
+  char *sent = NULL, *copied = NULL;
+  size_t sent_len = 0, copied_len = 0;
+  int i;
+
+  payload = BecoMapNew();
+  for (i = 0; i < 40; ++i) {
+    sprintf(key, "key-%d", i);
+    BecoMapPut(payload, key, i % 2 == 0 ? STR("a string too long to be kept inline") : STR("short"));
+  }
+  arr = BecoArrayNew(4);
+  for (i = 0; i < 4; ++i) {
+    BecoArrayAdd(arr, (size_t) i, complex_entry(i));
+  }
+  val = BecoObjectNew();
+  val->type = BECO_VALUE_TYPE_ARRAY;
+  val->via.array = arr;
+  BecoMapPut(payload, "list", val);
+
+  map = echo_map();
+  val = BecoObjectNew();
+  val->type = BECO_VALUE_TYPE_MAP;
+  val->via.map = payload;
+  BecoMapPut(map, "payload", val);
+  echo_round_trip(ctx, map, &req);
+  copy = BecoObjectPack(BecoMapGet(BecoObjectGetMap(req.data), "payload"));
+  BecoRequestDestroy(&req);
+
+  assert(copy != NULL && BecoObjectGetType(copy) == BECO_VALUE_TYPE_MAP);
+  assert(strcmp(BecoObjectGetStr(BecoMapGet(BecoObjectGetMap(copy), "key-38")), "a string too long to be kept inline") == 0);
+  assert(strcmp(BecoObjectGetStr(BecoMapGet(BecoObjectGetMap(copy), "key-39")), "short") == 0);
+  assert(!BecoMapContainsKey(BecoObjectGetMap(copy), "key-40"));
+  arr = BecoObjectGetArray(BecoMapGet(BecoObjectGetMap(copy), "list"));
+  assert(BecoArrayLen(arr) == 4);
+  assert(BecoMapGet(BecoObjectGetMap(BecoArrayGet(arr, 2)), "n")->via.i64 == -12345 - 2);
+
+  assert(BecoObjectDumpJson(val, &sent, &sent_len) == BECO_ERR_OK);
+  assert(BecoObjectDumpJson(copy, &copied, &copied_len) == BECO_ERR_OK);
+  assert(sent_len == copied_len && memcmp(sent, copied, sent_len) == 0);
+
+  // a heap copy takes over what is put into it
+  dup = BecoObjectDup(copy, true);
+  BecoMapPut(BecoObjectGetMap(dup), "key-40", STR("a string too long to be kept inline"));
+  assert(BecoMapContainsKey(BecoObjectGetMap(dup), "key-40"));
+
+  free(sent);
+  free(copied);
+  BecoObjectFree(copy);
+  BecoObjectFree(dup);
+  BecoMapFree(map);
+}
+
+struct BecoObject *arena_request(struct BecoContext *ctx, struct BecoObject *payload, struct BecoRequest *req) {
+  struct BecoObject obj;
+  struct BecoMap *map = NULL;
+
+  map = BecoMapNew();
+  BecoMapPut(map, "command", STR("arena"));
+  BecoMapPut(map, "payload", payload);
+  obj.type = BECO_VALUE_TYPE_MAP;
+  obj.via.map = map;
+  assert(BecoWrite(ctx, &obj) == BECO_ERR_OK);
+  assert(BecoRead(ctx, req) == BECO_ERR_OK);
+  BecoMapFree(map);
+  return BecoMapGet(BecoObjectGetMap(req->data), "previous");
+}
+
+// the host answers from its request arena and with what it promoted out of the last one
+void test_arena(struct BecoContext *ctx) {
+  struct BecoRequest req = {0};
+  struct BecoObject *previous = NULL;
+  struct BecoObject *expected = NULL;
+  char *sent = NULL, *received = NULL;
+  size_t sent_len = 0, received_len = 0;
+
+  previous = arena_request(ctx, complex_entry(7), &req);
+  assert(BecoObjectGetType(previous) == BECO_VALUE_TYPE_NONE);
+  assert(strcmp(BecoObjectGetStr(BecoMapGet(BecoObjectGetMap(req.data), "from")), "arena") == 0);
+  BecoRequestDestroy(&req);
+
+  BecoRequestInit(&req);
+  previous = arena_request(ctx, STR("second"), &req);
+  expected = complex_entry(7);
+  assert(BecoObjectDumpJson(expected, &sent, &sent_len) == BECO_ERR_OK);
+  BecoObjectFree(expected);
+  assert(BecoObjectDumpJson(previous, &received, &received_len) == BECO_ERR_OK);
+  assert(sent_len == received_len && memcmp(sent, received, sent_len) == 0);
+  free(sent);
+  free(received);
+  BecoRequestDestroy(&req);
+}
+
+// the host parses and answers through the codecs generated from codecs.json
+void test_codecs(struct BecoContext *ctx) {
+  const char *request = "{\"command\":\"window\",\"tilt\":1,\"title\":\"Main \\\"window\\\"\","
+                        "\"tabs\":[{\"url\":\"a\",\"pinned\":true,\"zoom\":1.25},{\"zoom\":0.5,\"url\":\"b\"}],"
+                        "\"bounds\":{\"left\":-4,\"top\":2,\"width\":640,\"height\":480},"
+                        "\"tags\":[\"t1\"],\"id\":7}";
+  const char *expected = "{\"id\":7,\"title\":\"Main \\\"window\\\"\",\"urls\":[\"a\",\"b\",\"t1\"],"
+                         "\"pinned\":[true,false],\"zoom\":1.75,\"area\":307200,\"origin\":{\"x\":-4,\"y\":2}}";
+  struct BecoRequest req = {0};
+  struct BecoBuffer buf = {0};
+  struct TestWindowResponse res;
+  struct TestWindowRequest bad;
+
+  assert(BecoSendJson(ctx, request, strlen(request)) == BECO_ERR_OK);
+  assert(BecoRead(ctx, &req) == BECO_ERR_OK);
+
+  memset(&res, 0, sizeof(res));
+  assert(TestWindowResponseParse(req.data, BecoRequestGetArena(&req), &res) == BECO_ERR_OK);
+  assert(res.id == 7 && strcmp(res.title, "Main \"window\"") == 0);
+  assert(res.urls_count == 3 && strcmp(res.urls[2], "t1") == 0);
+  assert(res.pinned_count == 2 && res.pinned[0] && !res.pinned[1]);
+  assert(res.zoom == 1.75 && res.area == 640 * 480);
+  assert(res.origin.x == -4 && res.origin.y == 2);
+
+  assert(TestWindowResponseDump(&res, &buf) == BECO_ERR_OK);
+  assert(buf.len == strlen(expected) && memcmp(buf.data, expected, buf.len) == 0);
+
+  // "tabs" is required and a string is not an object
+  memset(&bad, 0, sizeof(bad));
+  assert(TestWindowRequestParse(req.data, BecoRequestGetArena(&req), &bad) == BECO_ERR_INVALID_JSON);
+  assert(TestWindowResponseOriginParse(BecoMapGet(BecoObjectGetMap(req.data), "title"), NULL, &res.origin) ==
+      BECO_ERR_INVALID_JSON);
+
+  free(buf.data);
+  BecoRequestDestroy(&req);
+}
+
+// large enough to be parsed while it arrives, on both sides
+void test_echo_complex(struct BecoContext *ctx, int count) {
+  struct BecoObject *payload = NULL;
+  struct BecoMap *map = NULL;
+  struct BecoArray *arr = NULL;
+  struct BecoRequest req = {0};
+  char *sent = NULL, *received = NULL;
+  size_t sent_len = 0, received_len = 0;
+  int i;
+
+  arr = BecoArrayNew((size_t) count);
+  for (i = 0; i < count; ++i) {
+    BecoArrayAdd(arr, (size_t) i, complex_entry(i));
+  }
+  payload = BecoObjectNew();
+  payload->type = BECO_VALUE_TYPE_ARRAY;
+  payload->via.array = arr;
+
+  map = echo_map();
+  BecoMapPut(map, "payload", payload);
+
+  echo_round_trip(ctx, map, &req);
+
+  assert(BecoObjectDumpJson(payload, &sent, &sent_len) == BECO_ERR_OK);
+  assert(BecoObjectDumpJson(BecoMapGet(BecoObjectGetMap(req.data), "payload"), &received, &received_len) == BECO_ERR_OK);
+  assert(sent_len > 256 * 1024);
+  assert(sent_len == received_len);
+  assert(memcmp(sent, received, sent_len) == 0);
+
+  free(sent);
+  free(received);
+  BecoMapFree(map);
+  BecoRequestDestroy(&req);
+}
+
+// values are converted as they are looked up, the rest when the request is serialized
+void test_lazy_view(struct BecoContext *ctx) {
+  struct BecoObject *payload = NULL;
+  struct BecoObject *entry = NULL;
+  struct BecoObject *extra = NULL;
+  struct BecoMap *map = NULL;
+  struct BecoArray *arr = NULL;
+  struct BecoRequest req = {0};
+  char *sent = NULL, *received = NULL;
+  size_t sent_len = 0, received_len = 0;
+  size_t size;
+  int i;
+
+  arr = BecoArrayNew(16);
+  for (i = 0; i < 16; ++i) {
+    BecoArrayAdd(arr, (size_t) i, complex_entry(i));
+  }
+  payload = BecoObjectNew();
+  payload->type = BECO_VALUE_TYPE_ARRAY;
+  payload->via.array = arr;
+
+  map = echo_map();
+  BecoMapPut(map, "payload", payload);
+  assert(BecoSetLazyView(ctx, true) == BECO_ERR_OK);
+  echo_round_trip(ctx, map, &req);
+
+  arr = BecoObjectGetArray(BecoMapGet(BecoObjectGetMap(req.data), "payload"));
+  assert(BecoArrayLen(arr) == 16);
+  entry = BecoArrayGet(arr, 3);
+  assert(BecoObjectGetType(entry) == BECO_VALUE_TYPE_MAP);
+  assert(BecoMapGet(BecoObjectGetMap(entry), "n")->via.i64 == -12345 - 3);
+  assert(!BecoMapContainsKey(BecoObjectGetMap(entry), "missing"));
+
+  extra = BecoObjectNewIn(BecoRequestGetArena(&req));
+  extra->type = BECO_VALUE_TYPE_BOOL;
+  extra->via.bool_ = true;
+  BecoMapPut(BecoObjectGetMap(req.data), "extra", extra);
+
+  // sized from the views before dumping materializes them
+  size = BecoObjectSerializedSize(req.data);
+  assert(BecoObjectDumpJson(payload, &sent, &sent_len) == BECO_ERR_OK);
+  assert(BecoObjectDumpJson(req.data, &received, &received_len) == BECO_ERR_OK);
+  assert(size == received_len);
+  assert(BecoObjectSerializedSize(payload) == sent_len);
+  assert(strncmp(received, "{\"command\":\"echo\",\"payload\":", 28) == 0);
+  assert(received_len == 28 + sent_len + 14);
+  assert(memcmp(received + 28, sent, sent_len) == 0);
+  assert(memcmp(received + 28 + sent_len, ",\"extra\":true}", 14) == 0);
+
+  free(sent);
+  free(received);
+  BecoMapFree(map);
+  BecoRequestDestroy(&req);
+  assert(BecoSetLazyView(ctx, false) == BECO_ERR_OK);
+}
+
+void test_serialized_size(void) {
+  static const int64_t ints[] = {0, 9, 10, -1, -10, INT64_MAX, INT64_MIN};
+  static const double reals[] = {0.0, -0.5, 1.0 / 3, 1e300, 5e-324, 1e16};
+  struct BecoObject obj;
+  struct BecoObject *val = NULL;
+  struct BecoMap *map = NULL;
+  struct BecoArray *arr = NULL;
+  char *out = NULL;
+  size_t out_len = 0;
+  size_t i;
+
+  map = BecoMapNew();
+  arr = BecoArrayNew(16);
+  for (i = 0; i < sizeof(ints) / sizeof(ints[0]); ++i) {
+    val = BecoObjectNew();
+    val->type = BECO_VALUE_TYPE_INTEGER;
+    val->via.i64 = ints[i];
+    BecoArrayAdd(arr, i, val);
+  }
+  for (i = 0; i < sizeof(reals) / sizeof(reals[0]); ++i) {
+    val = BecoObjectNew();
+    val->type = BECO_VALUE_TYPE_DOUBLE;
+    val->via.f64 = reals[i];
+    BecoArrayAdd(arr, BecoArrayLen(arr), val);
+  }
+  val = BecoObjectNew();
+  val->type = BECO_VALUE_TYPE_ARRAY;
+  val->via.array = arr;
+  BecoMapPut(map, "n\"\\\x1f", val);
+  BecoMapPut(map, "s", STR("\b\f\n\r\t\x7f\xc3\xa9"));
+  val = BecoObjectNew();
+  val->type = BECO_VALUE_TYPE_STR;
+  BecoMapPut(map, "null", val);
+  val = BecoObjectNew();
+  val->type = BECO_VALUE_TYPE_MAP;
+  BecoMapPut(map, "empty", val);
+  obj.type = BECO_VALUE_TYPE_MAP;
+  obj.via.map = map;
+
+  assert(BecoObjectDumpJson(&obj, &out, &out_len) == BECO_ERR_OK);
+  assert(BecoObjectSerializedSize(&obj) == out_len);
+  free(out);
+  BecoMapFree(map);
+}
+
+void check_numbers(struct BecoObject *data, const double *reals, const int64_t *ints, size_t count) {
+  struct BecoMap *map = BecoObjectGetMap(data);
+  struct BecoObject *item = NULL;
+  double *got_reals = NULL;
+  int64_t *got_ints = NULL;
+  size_t len = 0;
+
+  got_reals = BecoObjectGetDoubles(BecoMapGet(map, "reals"), &len);
+  assert(got_reals != NULL && len == count);
+  assert(memcmp(got_reals, reals, count * sizeof(*reals)) == 0);
+  got_ints = BecoObjectGetInt64s(BecoMapGet(map, "ints"), &len);
+  assert(got_ints != NULL && len == count);
+  assert(memcmp(got_ints, ints, count * sizeof(*ints)) == 0);
+  assert(BecoObjectGetDoubles(BecoMapGet(map, "ints"), &len) == NULL && len == 0);
+  assert(BecoObjectGetInt64s(BecoMapGet(map, "mixed"), NULL) == NULL);
+  assert(BecoObjectGetDoubles(BecoMapGet(map, "mixed"), NULL) == NULL);
+
+  // objects again through the array functions, and numbers again after that
+  item = BecoArrayGet(BecoObjectGetArray(BecoMapGet(map, "ints")), 1);
+  assert(item->type == BECO_VALUE_TYPE_INTEGER && item->via.i64 == INT64_MIN);
+  item = BecoArrayGet(BecoObjectGetArray(BecoMapGet(map, "ints")), 2);
+  assert(item->type == BECO_VALUE_TYPE_POSITIVE_INTEGER && item->via.u64 == INT64_MAX);
+  got_ints = BecoObjectGetInt64s(BecoMapGet(map, "ints"), &len);
+  assert(got_ints != NULL && len == count);
+  assert(memcmp(got_ints, ints, count * sizeof(*ints)) == 0);
+}
+
+void test_numbers(struct BecoContext *ctx) {
+  struct BecoObject obj;
+  struct BecoObject *val = NULL;
+  struct BecoMap *map = NULL;
+  struct BecoArray *arr = NULL;
+  struct BecoRequest req = {0};
+  struct BecoObject *copy = NULL, *dup = NULL;
+  struct BecoBuffer buf;
+  const double exact[] = {1.5, -0.0, 1e300, 0.1, 100, 1.0 / 3, 3e-7, 1e21, 0.001, NAN};
+  const char *exact_json = "1.5,-0.0,1e300,0.1,100.0,0.3333333333333333,3e-7,1e21,0.001,null";
+  double reals[1000];
+  int64_t ints[1000];
+  double *nums = NULL;
+  char *out = NULL;
+  size_t out_len = 0;
+  size_t i, len = 0;
+
+  for (i = 0; i < 1000; ++i) {
+    reals[i] = (double) i * 0.25 - 100;
+    ints[i] = (int64_t) (i * i) - 5000;
+  }
+  reals[1] = -0.0;
+  reals[2] = 1.0 / 3;
+  reals[3] = -1e300;
+  ints[1] = INT64_MIN;
+  ints[2] = INT64_MAX;
+
+  map = echo_map();
+  // filled in place
+  val = BecoObjectNew();
+  assert(BecoObjectSetDoublesIn(NULL, val, NULL, 1000) == BECO_ERR_OK);
+  nums = BecoObjectGetDoubles(val, &len);
+  assert(nums != NULL && len == 1000 && nums[999] == 0);
+  memcpy(nums, reals, sizeof(reals));
+  BecoMapPut(map, "reals", val);
+  val = BecoObjectNew();
+  assert(BecoObjectSetInt64sIn(NULL, val, ints, 1000) == BECO_ERR_OK);
+  BecoMapPut(map, "ints", val);
+  arr = BecoArrayNew(0);
+  for (i = 0; i < 32; ++i) {
+    val = BecoArrayPush(arr);
+    val->type = i % 2 ? BECO_VALUE_TYPE_DOUBLE : BECO_VALUE_TYPE_POSITIVE_INTEGER;
+    if (i % 2) val->via.f64 = 2.5;
+    else val->via.u64 = i;
+  }
+  val = BecoObjectNew();
+  val->type = BECO_VALUE_TYPE_ARRAY;
+  val->via.array = arr;
+  BecoMapPut(map, "mixed", val);
+  obj.type = BECO_VALUE_TYPE_MAP;
+  obj.via.map = map;
+
+  assert(BecoObjectDumpJson(&obj, &out, &out_len) == BECO_ERR_OK);
+  assert(BecoObjectSerializedSize(&obj) == out_len);
+  assert(strstr(out, "\"reals\":[-100.0,-0.0,0.3333333333333333,-1e300,-99.0,") != NULL);
+  assert(strstr(out, "\"ints\":[-5000,-9223372036854775808,9223372036854775807,-4991,") != NULL);
+  free(out);
+
+  // shortest digits which read back the same, written like yyjson does
+  BecoBufferInit(&buf);
+  for (i = 0; i < sizeof(exact) / sizeof(exact[0]); ++i) {
+    if (i > 0) assert(BecoBufferAppend(&buf, ",", 1) == BECO_ERR_OK);
+    assert(BecoBufferAppendJsonDouble(&buf, exact[i]) == BECO_ERR_OK);
+  }
+  assert(buf.len == strlen(exact_json) && memcmp(buf.data, exact_json, buf.len) == 0);
+  buf.len = 0;
+  assert(BecoBufferAppendJsonInt(&buf, INT64_MIN) == BECO_ERR_OK);
+  assert(BecoBufferAppendJsonInt(&buf, -7) == BECO_ERR_OK);
+  assert(BecoBufferAppendJsonUint(&buf, UINT64_MAX) == BECO_ERR_OK);
+  assert(BecoBufferAppendJsonUint(&buf, 0) == BECO_ERR_OK);
+  assert(buf.len == 43 && memcmp(buf.data, "-9223372036854775808-7184467440737095516150", 43) == 0);
+  BecoBufferDestroy(&buf);
+
+  echo_round_trip(ctx, map, &req);
+  assert(BecoMapGet(BecoObjectGetMap(req.data), "reals")->via.array->num_type == BECO_ARRAY_DOUBLE);
+  assert(BecoMapGet(BecoObjectGetMap(req.data), "mixed")->via.array->num_type == BECO_ARRAY_OBJECTS);
+  check_numbers(req.data, reals, ints, 1000);
+  BecoRequestDestroy(&req);
+
+  // numbers straight from the document, without objects in between
+  assert(BecoSetLazyView(ctx, true) == BECO_ERR_OK);
+  echo_round_trip(ctx, map, &req);
+  check_numbers(req.data, reals, ints, 1000);
+  // copies keep the numbers as they are
+  copy = BecoObjectPromote(req.data);
+  dup = BecoObjectPack(req.data);
+  BecoRequestDestroy(&req);
+  check_numbers(copy, reals, ints, 1000);
+  assert(BecoObjectGetDoubles(BecoMapGet(BecoObjectGetMap(dup), "reals"), NULL) != NULL);
+  BecoObjectFree(copy);
+  BecoObjectFree(dup);
+  assert(BecoSetLazyView(ctx, false) == BECO_ERR_OK);
+
+  // a shared array is copied for writing, the numbers of the other owner stay valid
+  val = BecoMapGet(map, "reals");
+  copy = BecoObjectNew();
+  copy->type = BECO_VALUE_TYPE_ARRAY;
+  copy->via.array = BecoArrayRetain(val->via.array);
+  nums = BecoObjectGetDoubles(val, &len);
+  arr = BecoObjectGetMutArray(copy);
+  assert(arr != NULL && arr != val->via.array && BecoArrayGet(arr, 3)->via.f64 == -1e300);
+  assert(BecoObjectGetDoubles(val, NULL) == nums && nums[3] == -1e300);
+  BecoObjectFree(copy);
+
+  // arrays of objects are converted on request
+  val = BecoMapGet(map, "mixed");
+  for (i = 0; i < 32; ++i) BecoArrayGet(BecoObjectGetArray(val), i)->type = BECO_VALUE_TYPE_DOUBLE;
+  nums = BecoObjectGetDoubles(val, &len);
+  assert(nums != NULL && len == 32 && nums[1] == 2.5);
+  assert(BecoArrayLen(BecoObjectGetArray(val)) == 32);
+
+  BecoMapFree(map);
+}
+
+// one frame through the incremental parser, NULL if it is rejected
+struct BecoObject *parse_value(struct BecoContext *ctx, struct BecoRequest *req, const char *val) {
+  uint32_t len = (uint32_t) strlen(val) + 6;
+  FILE *in = tmpfile();
+
+  fwrite(&len, sizeof(len), 1, in);
+  fprintf(in, "{\"n\":%s}", val);
+  rewind(in);
+  if (ctx->in != stdin) fclose(ctx->in);
+  assert(BecoSetIn(ctx, in) == BECO_ERR_OK);
+  BecoRequestDestroy(req);
+  memset(req, 0, sizeof(*req));
+  if (BecoRead(ctx, req) != BECO_ERR_OK) return NULL;
+  return BecoMapGet(BecoObjectGetMap(req->data), "n");
+}
+
+#ifdef __linux__
+// switching transports keeps the output in order and refuses to drop input
+void test_transport_switch(void) {
+  struct BecoContext *ctx = BecoContextNew();
+  struct BecoRequest req = {0};
+  struct BecoObject obj;
+  FILE *in = tmpfile();
+  FILE *out = tmpfile();
+  const char *json = "{\"n\":1}";
+  uint32_t len = (uint32_t) strlen(json);
+  int i;
+
+  ctx->log = NULL;
+  for (i = 0; i < 2; ++i) {
+    fwrite(&len, sizeof(len), 1, in);
+    fwrite(json, 1, len, in);
+  }
+  fflush(in);
+  rewind(in);
+  assert(BecoSetIn(ctx, in) == BECO_ERR_OK);
+  assert(BecoSetOut(ctx, out) == BECO_ERR_OK);
+  assert(BecoSetTransport(ctx, BECO_TRANSPORT_FD) == BECO_ERR_OK);
+  assert(BecoRead(ctx, &req) == BECO_ERR_OK);
+  BecoRequestDestroy(&req);
+  // the second frame came with the first read
+  assert(BecoSetTransport(ctx, BECO_TRANSPORT_STDIO) == BECO_ERR_GENERIC);
+  BecoRequestInit(&req);
+  assert(BecoRead(ctx, &req) == BECO_ERR_OK);
+
+  assert(BecoSetFlushPolicy(ctx, BECO_FLUSH_IDLE, 0, 0) == BECO_ERR_OK);
+  obj.type = BECO_VALUE_TYPE_MAP;
+  obj.via.map = BecoObjectGetMap(req.data);
+  assert(BecoWrite(ctx, &obj) == BECO_ERR_OK);
+  assert(lseek(fileno(out), 0, SEEK_END) == 0);
+  assert(BecoSetTransport(ctx, BECO_TRANSPORT_STDIO) == BECO_ERR_OK);
+  assert(lseek(fileno(out), 0, SEEK_END) == (off_t) (sizeof(len) + len));
+  BecoRequestDestroy(&req);
+
+  BecoContextFree(ctx);
+}
+#endif
+
+// the same grammar and number types as yyjson, whatever the locale
+void test_parser_strict(void) {
+  static const char *invalid[] = {"01", "+1", ".5", "1.", "-.5", "-", "1e", "1e+", "--1", "1.5.2", "0x1", "1-"};
+  static const char *bad_utf8[] = {"\"\xc0\xaf\"", "\"\xed\xa0\x80\"", "\"\xf4\x90\x80\x80\"", "\"\x80\"", "\"\xc3\""};
+  static const char *comma_locales[] = {"de_DE.UTF-8", "de_DE.utf8", "de_DE", "fr_FR.UTF-8", "fr_FR.utf8", "fr_FR"};
+  struct BecoContext *ctx = BecoContextNew();
+  struct BecoRequest req = {0};
+  struct BecoBuffer buf;
+  struct BecoObject *n = NULL;
+  char digits[200];
+  char *str = NULL;
+  size_t i;
+
+  ctx->log = NULL;
+  assert(BecoSetIncrementalParse(ctx, true, 1) == BECO_ERR_OK);
+  for (i = 0; i < sizeof(comma_locales) / sizeof(comma_locales[0]); ++i) {
+    if (setlocale(LC_NUMERIC, comma_locales[i]) != NULL) break;
+  }
+  if (i == sizeof(comma_locales) / sizeof(comma_locales[0])) {
+    printf("parser_strict: no comma decimal locale installed, numbers checked in the C locale only\n");
+  } else {
+    snprintf(digits, sizeof(digits), "%.1f", 1.5);
+    assert(strcmp(digits, "1,5") == 0);
+  }
+
+  BecoBufferInit(&buf);
+  assert(BecoBufferAppendJsonDouble(&buf, 1.5) == BECO_ERR_OK);
+  assert(buf.len == 3 && memcmp(buf.data, "1.5", 3) == 0);
+  BecoBufferDestroy(&buf);
+
+  n = parse_value(ctx, &req, "0");
+  assert(n != NULL && n->type == BECO_VALUE_TYPE_POSITIVE_INTEGER && n->via.u64 == 0);
+  n = parse_value(ctx, &req, "-0");
+  assert(n != NULL && n->type == BECO_VALUE_TYPE_INTEGER && n->via.i64 == 0);
+  n = parse_value(ctx, &req, "18446744073709551615");
+  assert(n != NULL && n->type == BECO_VALUE_TYPE_POSITIVE_INTEGER && n->via.u64 == UINT64_MAX);
+  n = parse_value(ctx, &req, "18446744073709551616");
+  assert(n != NULL && n->type == BECO_VALUE_TYPE_DOUBLE && n->via.f64 == 18446744073709551616.0);
+  n = parse_value(ctx, &req, "-9223372036854775808");
+  assert(n != NULL && n->type == BECO_VALUE_TYPE_INTEGER && n->via.i64 == INT64_MIN);
+  n = parse_value(ctx, &req, "-9223372036854775809");
+  assert(n != NULL && n->type == BECO_VALUE_TYPE_DOUBLE);
+  n = parse_value(ctx, &req, "1.5");
+  assert(n != NULL && n->type == BECO_VALUE_TYPE_DOUBLE && n->via.f64 == 1.5);
+  assert(BecoObjectDumpJson(n, &str, &i) == BECO_ERR_OK && i == 3 && strcmp(str, "1.5") == 0);
+  free(str);
+  n = parse_value(ctx, &req, "-1.25E-3");
+  assert(n != NULL && n->type == BECO_VALUE_TYPE_DOUBLE && n->via.f64 == -1.25e-3);
+  n = parse_value(ctx, &req, "1e2");
+  assert(n != NULL && n->type == BECO_VALUE_TYPE_DOUBLE && n->via.f64 == 100);
+  memset(digits, '7', sizeof(digits) - 3);
+  memcpy(digits + sizeof(digits) - 3, ".5", 3);
+  n = parse_value(ctx, &req, digits);
+  assert(n != NULL && n->type == BECO_VALUE_TYPE_DOUBLE && n->via.f64 > 7e195);
+
+  for (i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i) {
+    assert(parse_value(ctx, &req, invalid[i]) == NULL);
+  }
+
+  // numeric arrays are packed as yyjson reads them
+  n = parse_value(ctx, &req, "[0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,-15]");
+  assert(n != NULL && n->via.array->num_type == BECO_ARRAY_INT64 && n->via.array->size == 16);
+  assert(BecoObjectGetInt64s(n, NULL)[15] == -15);
+  n = parse_value(ctx, &req, "[0.5,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15]");
+  assert(n != NULL && n->via.array->num_type == BECO_ARRAY_OBJECTS);
+  n = parse_value(ctx, &req, "[0.5,1.5,2.5,3.5,4.5,5.5,6.5,7.5,8.5,9.5,10.5,11.5,12.5,13.5,14.5,15.5]");
+  assert(n != NULL && n->via.array->num_type == BECO_ARRAY_DOUBLE && BecoObjectGetDoubles(n, NULL)[15] == 15.5);
+
+  // strings are valid UTF-8, also where a sequence is split between two reads
+  for (i = 0; i < sizeof(bad_utf8) / sizeof(bad_utf8[0]); ++i) {
+    assert(parse_value(ctx, &req, bad_utf8[i]) == NULL);
+  }
+  str = malloc(0x10010);
+  memset(str, 'a', 0x10010);
+  str[0] = '"';
+  memcpy(str + 0x10000 - 7, "\xe6\x97\xa5", 3);
+  memcpy(str + 0x10010 - 2, "\"", 2);
+  n = parse_value(ctx, &req, str);
+  assert(n != NULL && BecoObjectGetStrLen(n) == 0x10010 - 3);
+  assert(memcmp(BecoObjectGetStr(n) + 0x10000 - 8, "\xe6\x97\xa5", 3) == 0);
+  str[0x10000 - 5] = 'a';
+  assert(parse_value(ctx, &req, str) == NULL);
+  free(str);
+
+  setlocale(LC_NUMERIC, "C");
+  BecoRequestDestroy(&req);
+  // the standard streams stay open
+  ctx->out = NULL;
+  BecoContextFree(ctx);
+}
+
+void test_echo(struct BecoContext *ctx) {
+  test_echo_size(ctx, 16);
+  test_echo_size(ctx, 200 * 1024);
+  test_echo_size(ctx, 16);
+  test_echo_size(ctx, 900 * 1024);
+  test_echo_size(ctx, 64);
+}
+
+void test_burst(struct BecoContext *ctx, int count) {
+  struct BecoObject obj;
+  struct BecoMap *map = NULL;
+  struct BecoRequest req;
+  struct BecoStats before, after;
+  int i;
+
+  map = echo_map();
+  BecoMapPut(map, "payload", STR("burst"));
+
+  obj.type = BECO_VALUE_TYPE_MAP;
+  obj.via.map = map;
+
+  BecoSetFlushPolicy(ctx, BECO_FLUSH_THRESHOLD, 1024, 60000);
+  BecoGetStats(ctx, &before);
+  for (i = 0; i < count; ++i) {
+    assert(BecoWrite(ctx, &obj) == BECO_ERR_OK);
+  }
+  for (i = 0; i < count; ++i) {
+    BecoRequestInit(&req);
+    assert(BecoRead(ctx, &req) == BECO_ERR_OK);
+    assert(strcmp(BecoObjectGetStr(BecoMapGet(BecoObjectGetMap(req.data), "payload")), "burst") == 0);
+    BecoRequestDestroy(&req);
+  }
+  BecoGetStats(ctx, &after);
+
+  // frames come several to a read, and go out once per threshold plus the flush before reading
+  assert(after.frames_read - before.frames_read == (uint64_t) count);
+  assert(after.reads - before.reads < (uint64_t) count);
+  assert(after.max_frames_per_read > 1);
+  assert(after.frames_flushed - before.frames_flushed == (uint64_t) count);
+  assert(after.flushes - before.flushes <= (uint64_t) count * (4 + BecoObjectSerializedSize(&obj)) / 1024 + 1);
+  BecoSetFlushPolicy(ctx, BECO_FLUSH_IMMEDIATE, 0, 0);
+
+  BecoMapFree(map);
+}
+
+void test_event(struct BecoContext *ctx, char *command, const char *event) {
+  struct BecoObject obj;
+  struct BecoMap *map = NULL;
+  struct BecoRequest req = {0};
+
+  map = BecoMapNew();
+  BecoMapPut(map, "command", STR(command));
+
+  obj.type = BECO_VALUE_TYPE_MAP;
+  obj.via.map = map;
+
+  assert(BecoWrite(ctx, &obj) == BECO_ERR_OK);
+  assert(BecoRead(ctx, &req) == BECO_ERR_OK);
+  assert(strcmp(BecoObjectGetStr(BecoMapGet(BecoObjectGetMap(req.data), "event")), event) == 0);
+
+  BecoMapFree(map);
+  BecoRequestDestroy(&req);
+}
+
+// everything sent by the child has been read, the pipes report nothing queued
+void test_pipe(struct BecoContext *ctx) {
+  struct BecoStats stats;
+
+  assert(BecoSetPipeSize(ctx, 256 * 1024) == BECO_ERR_OK);
+  assert(BecoGetStats(ctx, &stats) == BECO_ERR_OK);
+  assert(stats.in_pipe_size >= 256 * 1024);
+  assert(stats.out_pipe_size >= 256 * 1024);
+  assert(stats.in_queued == 0);
+  assert(stats.read_wait_us > 0);
+  test_echo(ctx);
+}
+
+#ifdef __linux__
+void write_raw(int fd, const char *data, size_t len) {
+  ssize_t n;
+
+  while (len > 0) {
+    n = write(fd, data, len);
+    assert(n > 0);
+    data += n;
+    len -= (size_t) n;
+  }
+}
+
+// half of a frame larger than the ring is in, the timer still fires while the rest is missing
+void test_large_stall(struct BecoContext *ctx) {
+  struct BecoObject obj;
+  struct BecoMap *map = NULL;
+  struct BecoRequest req = {0};
+  size_t size = 300 * 1024;
+  char *frame = NULL;
+  uint32_t len;
+
+  frame = malloc(size + 64);
+  len = (uint32_t) sprintf(frame + sizeof(len), "{\"command\":\"echo\",\"payload\":\"");
+  memset(frame + sizeof(len) + len, 'x', size);
+  len += (uint32_t) size;
+  len += (uint32_t) sprintf(frame + sizeof(len) + len, "\"}");
+  memcpy(frame, &len, sizeof(len));
+
+  map = BecoMapNew();
+  BecoMapPut(map, "command", STR("timer"));
+  obj.type = BECO_VALUE_TYPE_MAP;
+  obj.via.map = map;
+  assert(BecoWrite(ctx, &obj) == BECO_ERR_OK);
+  assert(BecoFlush(ctx) == BECO_ERR_OK);
+
+  write_raw(ctx->out_fd, frame, sizeof(len) + len / 2);
+  assert(BecoRead(ctx, &req) == BECO_ERR_OK);
+  assert(strcmp(BecoObjectGetStr(BecoMapGet(BecoObjectGetMap(req.data), "event")), "timer") == 0);
+  BecoRequestDestroy(&req);
+
+  write_raw(ctx->out_fd, frame + sizeof(len) + len / 2, len - len / 2);
+  BecoRequestInit(&req);
+  assert(BecoRead(ctx, &req) == BECO_ERR_OK);
+  assert(strlen(BecoObjectGetStr(BecoMapGet(BecoObjectGetMap(req.data), "payload"))) == size);
+  BecoRequestDestroy(&req);
+
+  free(frame);
+  BecoMapFree(map);
+}
+#endif
+
+char *big_payload(size_t size) {
+  const char *pattern = "h\xc3\xa9llo \"w\xc3\xb6rld\" \\ \xe6\x97\xa5\xe6\x9c\xac \xf0\x9f\x98\x80 ";
+  size_t plen = strlen(pattern);
+  char *str = malloc(size + 1);
+  size_t len = 0;
+
+  while (len + plen <= size) {
+    memcpy(str + len, pattern, plen);
+    len += plen;
+  }
+  str[len] = '\0';
+  return str;
+}
+
+// reassemble like the extension side would
+uint64_t read_chunked(struct BecoContext *ctx, struct BecoBuffer *json) {
+  struct BecoMap *chunk = NULL;
+  struct BecoRequest req;
+  const char *data = NULL;
+  uint64_t seq = 0, total = 1, id = 0;
+
+  BecoBufferInit(json);
+  for (seq = 0; seq < total; ++seq) {
+    BecoRequestInit(&req);
+    assert(BecoRead(ctx, &req) == BECO_ERR_OK);
+    chunk = BecoObjectGetMap(BecoMapGet(BecoObjectGetMap(req.data), "chunk"));
+    assert(chunk != NULL);
+    assert(BecoObjectGetUInt64(BecoMapGet(chunk, "seq")) == seq);
+    if (seq == 0) {
+      id = BecoObjectGetUInt64(BecoMapGet(chunk, "id"));
+      total = BecoObjectGetUInt64(BecoMapGet(chunk, "total"));
+      assert(total > 1);
+    }
+    assert(BecoObjectGetUInt64(BecoMapGet(chunk, "id")) == id);
+    data = BecoObjectGetStr(BecoMapGet(BecoObjectGetMap(req.data), "data"));
+    assert(BecoBufferAppend(json, data, strlen(data)) == BECO_ERR_OK);
+    BecoRequestDestroy(&req);
+  }
+  return total;
+}
+
+void test_chunked(struct BecoContext *ctx, size_t size) {
+  struct BecoObject obj;
+  struct BecoObject *num = NULL;
+  struct BecoMap *map = NULL;
+  struct BecoBuffer json;
+  char *expect = NULL;
+  yyjson_doc *doc = NULL;
+  struct BecoStats before, after;
+  uint64_t total = 0;
+
+  num = BecoObjectNew();
+  num->type = BECO_VALUE_TYPE_POSITIVE_INTEGER;
+  num->via.u64 = size;
+
+  map = BecoMapNew();
+  BecoMapPut(map, "command", STR("big"));
+  BecoMapPut(map, "size", num);
+
+  obj.type = BECO_VALUE_TYPE_MAP;
+  obj.via.map = map;
+
+  assert(BecoGetStats(ctx, &before) == BECO_ERR_OK);
+  assert(BecoWrite(ctx, &obj) == BECO_ERR_OK);
+  total = read_chunked(ctx, &json);
+  assert(BecoGetStats(ctx, &after) == BECO_ERR_OK);
+
+  expect = big_payload(size);
+  doc = yyjson_read(json.data, json.len, YYJSON_READ_NOFLAG);
+  assert(doc != NULL);
+  assert(strcmp(yyjson_get_str(yyjson_obj_get(yyjson_doc_get_root(doc), "payload")), expect) == 0);
+  // one frame per chunk, each of the host's 1 MiB frames at least half full
+  assert(after.frames_read - before.frames_read == total);
+  assert(total > json.len / (1024 * 1024) && total <= json.len / (512 * 1024) + 1);
+
+  yyjson_doc_free(doc);
+  free(expect);
+  BecoBufferDestroy(&json);
+  BecoMapFree(map);
+}
+
+// a frozen reply is the same frame every time, a tree too large for a frame can't be frozen
+void test_frozen(struct BecoContext *ctx) {
+  const char *expected = "{\"caps\":[\"tab\",\"window\"],\"version\":\"1.0\"}";
+  struct BecoObject obj;
+  struct BecoObject *val = NULL;
+  struct BecoMap *map = NULL;
+  struct BecoRequest req = {0};
+  struct BecoFrozen *frozen = NULL;
+  char *out = NULL;
+  size_t out_len = 0;
+  char *big = NULL;
+  const char *json = "{\"k\":1,\"x\":\"y\",\"k\":[1,2,3]}";
+  const char *deduped = "{\"k\":[1,2,3],\"x\":\"y\"}";
+  struct BecoContext *lazy = NULL;
+  FILE *in = NULL;
+  FILE *sink = NULL;
+  char frame[64];
+  uint32_t len;
+  int i;
+
+  map = BecoMapNew();
+  BecoMapPut(map, "command", STR("caps"));
+  obj.type = BECO_VALUE_TYPE_MAP;
+  obj.via.map = map;
+
+  for (i = 0; i < 2; ++i) {
+    assert(BecoWrite(ctx, &obj) == BECO_ERR_OK);
+    assert(BecoRead(ctx, &req) == BECO_ERR_OK);
+    assert(BecoObjectDumpJson(req.data, &out, &out_len) == BECO_ERR_OK);
+    assert(out_len == strlen(expected) && strcmp(out, expected) == 0);
+    free(out);
+    BecoRequestDestroy(&req);
+  }
+
+  big = malloc(0x100001);
+  memset(big, 'x', 0x100000);
+  big[0x100000] = '\0';
+  val = BecoObjectNew();
+  BecoObjectSetStr(val, big, 0x100000);
+  BecoMapPut(map, "big", val);
+  assert(BecoObjectFreeze(&obj, &frozen) == BECO_ERR_OVERFLOW);
+  assert(frozen == NULL);
+
+  free(big);
+  BecoMapFree(map);
+
+  // a lazy map with a repeated key comes out shorter than it was sized
+  lazy = BecoContextNew();
+  lazy->log = NULL;
+  in = tmpfile();
+  sink = tmpfile();
+  len = (uint32_t) strlen(json);
+  fwrite(&len, sizeof(len), 1, in);
+  fwrite(json, 1, len, in);
+  rewind(in);
+  assert(BecoSetIn(lazy, in) == BECO_ERR_OK);
+  assert(BecoSetOut(lazy, sink) == BECO_ERR_OK);
+  assert(BecoSetLazyView(lazy, true) == BECO_ERR_OK);
+  assert(BecoRead(lazy, &req) == BECO_ERR_OK);
+  assert(BecoObjectFreeze(req.data, &frozen) == BECO_ERR_OK);
+  BecoRequestDestroy(&req);
+  assert(BecoSendFrozen(lazy, frozen) == BECO_ERR_OK);
+  assert(BecoFlush(lazy) == BECO_ERR_OK);
+  BecoFrozenFree(frozen);
+  rewind(sink);
+  assert(fread(&len, sizeof(len), 1, sink) == 1 && len == strlen(deduped));
+  assert(fread(frame, 1, sizeof(frame), sink) == len && memcmp(frame, deduped, len) == 0);
+  BecoContextFree(lazy);
+}
+
+// the host answers through the response builder, a long list goes out in chunks
+void test_builder(struct BecoContext *ctx) {
+  const char *small = "{\"command\":\"list\",\"count\":2,\"echo\":\"x\\\"y\"}";
+  const char *large = "{\"command\":\"list\",\"count\":40000,\"echo\":[1,{\"a\":true}]}";
+  const char *expected = "{\"items\":[{\"id\":0,\"name\":\"item 0\"},{\"id\":1,\"name\":\"item 1\"}],"
+                         "\"count\":2,\"echo\":\"x\\\"y\",\"checked\":true,\"ratio\":0.5,"
+                         "\"limits\":[-9223372036854775808,18446744073709551615],\"none\":null}";
+  struct BecoRequest req = {0};
+  struct BecoBuffer json;
+  yyjson_doc *doc = NULL;
+  yyjson_val *root = NULL;
+  yyjson_val *items = NULL;
+  char *out = NULL;
+  size_t out_len = 0;
+
+  assert(BecoSendJson(ctx, small, strlen(small)) == BECO_ERR_OK);
+  assert(BecoRead(ctx, &req) == BECO_ERR_OK);
+  assert(BecoObjectDumpJson(req.data, &out, &out_len) == BECO_ERR_OK);
+  assert(out_len == strlen(expected) && strcmp(out, expected) == 0);
+  free(out);
+  BecoRequestDestroy(&req);
+
+  assert(BecoSendJson(ctx, large, strlen(large)) == BECO_ERR_OK);
+  read_chunked(ctx, &json);
+  doc = yyjson_read(json.data, json.len, YYJSON_READ_NOFLAG);
+  assert(doc != NULL);
+  root = yyjson_doc_get_root(doc);
+  items = yyjson_obj_get(root, "items");
+  assert(yyjson_arr_size(items) == 40000);
+  assert(yyjson_get_uint(yyjson_obj_get(yyjson_arr_get(items, 39999), "id")) == 39999);
+  assert(strcmp(yyjson_get_str(yyjson_obj_get(yyjson_arr_get(items, 39999), "name")), "item 39999") == 0);
+  assert(yyjson_get_bool(yyjson_obj_get(root, "checked")));
+  assert(yyjson_get_bool(yyjson_obj_get(yyjson_arr_get(yyjson_obj_get(root, "echo"), 1), "a")));
+
+  yyjson_doc_free(doc);
+  BecoBufferDestroy(&json);
+}
+
 #ifdef _WIN32
 #define MOCK_TARGET_EXE "test_beco.exe"
 #else
@@ -113,9 +1472,58 @@ int main(int argc, char **argv) {
   assert(err == BECO_ERR_OK);
   driver = BecoMockGetDriver(&mock);
   assert(driver != NULL);
+  driver->log = NULL;
 
   test_hello(driver);
   test_print(driver);
+  test_echo(driver);
+  test_keep_request(driver);
+  test_strings(driver);
+  test_intern(driver);
+  test_large_map(driver);
+  test_growable_array(driver);
+  test_deep_copy(driver);
+  test_shared(driver);
+  test_struct(driver, false);
+  test_struct(driver, true);
+  test_codecs(driver);
+  test_builder(driver);
+  test_frozen(driver);
+  test_arena(driver);
+  test_lazy_view(driver);
+  test_serialized_size();
+  test_parser_strict();
+#ifdef __linux__
+  test_transport_switch();
+#endif
+  test_numbers(driver);
+  test_echo_complex(driver, 3000);
+  test_chunked(driver, 3 * 1024 * 1024);
+
+#ifndef _WIN32
+  assert(BecoSetTransport(driver, BECO_TRANSPORT_FD) == BECO_ERR_OK);
+  test_hello(driver);
+  test_echo(driver);
+  test_burst(driver, 64);
+  test_echo_complex(driver, 3000);
+  test_chunked(driver, 3 * 1024 * 1024);
+#endif
+
+#ifdef __linux__
+  // falls back to the fd transport where io_uring is missing
+  assert(BecoSetTransport(driver, BECO_TRANSPORT_URING) == BECO_ERR_OK);
+  test_hello(driver);
+  test_echo(driver);
+  test_burst(driver, 64);
+  test_echo_complex(driver, 3000);
+  test_chunked(driver, 3 * 1024 * 1024);
+  test_pipe(driver);
+
+  test_event(driver, "timer", "timer");
+  test_event(driver, "wake", "wakeup");
+  test_event(driver, "pipe", "fd");
+  test_large_stall(driver);
+#endif
   close_child(driver);
 
   BecoMockFinish(&mock);